@@ -24,10 +24,18 @@ echo Compiling semantic analyzer...
 gcc -Wall -Wextra -std=c11 -O2 -Iengine -c engine/semantic/semantic.c -o build/semantic.o
 if errorlevel 1 goto error
 
+echo Compiling optimizer...
+gcc -Wall -Wextra -std=c11 -O2 -Iengine -c engine/optimizer/optimizer.c -o build/optimizer.o
+if errorlevel 1 goto error
+
 echo Compiling bytecode...
 gcc -Wall -Wextra -std=c11 -O2 -Iengine -c engine/bytecode/bytecode.c -o build/bytecode.o
 if errorlevel 1 goto error
 
+echo Compiling peephole optimizer...
+gcc -Wall -Wextra -std=c11 -O2 -Iengine -c engine/bytecode/peephole.c -o build/peephole.o
+if errorlevel 1 goto error
+
 echo Compiling compiler...
 gcc -Wall -Wextra -std=c11 -O2 -Iengine -c engine/bytecode/compiler.c -o build/compiler.o
 if errorlevel 1 goto error
@@ -36,8 +44,31 @@ echo Compiling VM...
 gcc -Wall -Wextra -std=c11 -O2 -Iengine -c engine/vm/vm.c -o build/vm.o
 if errorlevel 1 goto error
 
+echo Compiling string objects...
+gcc -Wall -Wextra -std=c11 -O2 -Iengine -c engine/vm/riau_string.c -o build/riau_string.o
+if errorlevel 1 goto error
+
+echo Compiling key index...
+gcc -Wall -Wextra -std=c11 -O2 -Iengine -c engine/vm/key_index.c -o build/key_index.o
+if errorlevel 1 goto error
+
+echo Compiling SHAPE...
+gcc -Wall -Wextra -std=c11 -O2 -Iengine -c engine/vm/shape.c -o build/shape.o
+if errorlevel 1 goto error
+
 echo Compiling error reporter...
 gcc -Wall -Wextra -std=c11 -O2 -Iengine -c engine/errors/error_reporter.c -o build/error_reporter.o
+gcc -Wall -Wextra -std=c11 -O2 -Iengine -c engine/bytecode/regcode.c -o build/regcode.o
+gcc -Wall -Wextra -std=c11 -O2 -Iengine -c engine/bytecode/reg_compiler.c -o build/reg_compiler.o
+gcc -Wall -Wextra -std=c11 -O2 -Iengine -c engine/vm/reg_vm.c -o build/reg_vm.o
+gcc -Wall -Wextra -std=c11 -O2 -Iengine -c engine/vm/gc.c -o build/gc.o
+gcc -Wall -Wextra -std=c11 -O2 -Iengine -c engine/runtime/arena.c -o build/arena.o
+gcc -Wall -Wextra -std=c11 -O2 -Iengine -c engine/vm/guard.c -o build/guard.o
+gcc -Wall -Wextra -std=c11 -O2 -Iengine -c engine/stdlib/stdlib.c -o build/stdlib.o
+gcc -Wall -Wextra -std=c11 -O2 -Iengine -c engine/vm/jit.c -o build/jit.o
+gcc -Wall -Wextra -std=c11 -O2 -Iengine -c engine/vm/aot.c -o build/aot.o
+gcc -Wall -Wextra -std=c11 -O2 -Iengine -c engine/bytecode/chunk_cache.c -o build/chunk_cache.o
+gcc -Wall -Wextra -std=c11 -O2 -Iengine -c engine/vm/snapshot.c -o build/snapshot.o
 if errorlevel 1 goto error
 
 echo Compiling CLI...
@@ -46,7 +77,7 @@ if errorlevel 1 goto error
 
 REM Link
 echo Linking...
-gcc -Wall -Wextra -std=c11 -O2 -o bin/riau.exe build/lexer.o build/ast.o build/parser.o build/semantic.o build/bytecode.o build/compiler.o build/vm.o build/error_reporter.o build/main.o -lm
+gcc -Wall -Wextra -std=c11 -O2 -o bin/riau.exe build/lexer.o build/ast.o build/parser.o build/semantic.o build/optimizer.o build/bytecode.o build/compiler.o build/peephole.o build/vm.o build/error_reporter.o build/riau_string.o build/key_index.o build/shape.o build/regcode.o build/reg_compiler.o build/reg_vm.o build/gc.o build/arena.o build/guard.o build/stdlib.o build/jit.o build/aot.o build/chunk_cache.o build/snapshot.o build/main.o -lm
 if errorlevel 1 goto error
 
 echo.
@@ -26,10 +26,18 @@ Write-Host "Compiling semantic analyzer..." -ForegroundColor Yellow
 & $GCC -Wall -Wextra -std=c11 -O2 -Iengine -c engine/semantic/semantic.c -o build/semantic.o
 if ($LASTEXITCODE -ne 0) { Write-Host "Build failed!" -ForegroundColor Red; exit 1 }
 
+Write-Host "Compiling optimizer..." -ForegroundColor Yellow
+& $GCC -Wall -Wextra -std=c11 -O2 -Iengine -c engine/optimizer/optimizer.c -o build/optimizer.o
+if ($LASTEXITCODE -ne 0) { Write-Host "Build failed!" -ForegroundColor Red; exit 1 }
+
 Write-Host "Compiling bytecode..." -ForegroundColor Yellow
 & $GCC -Wall -Wextra -std=c11 -O2 -Iengine -c engine/bytecode/bytecode.c -o build/bytecode.o
 if ($LASTEXITCODE -ne 0) { Write-Host "Build failed!" -ForegroundColor Red; exit 1 }
 
+Write-Host "Compiling peephole optimizer..." -ForegroundColor Yellow
+& $GCC -Wall -Wextra -std=c11 -O2 -Iengine -c engine/bytecode/peephole.c -o build/peephole.o
+if ($LASTEXITCODE -ne 0) { Write-Host "Build failed!" -ForegroundColor Red; exit 1 }
+
 Write-Host "Compiling compiler..." -ForegroundColor Yellow
 & $GCC -Wall -Wextra -std=c11 -O2 -Iengine -c engine/bytecode/compiler.c -o build/compiler.o
 if ($LASTEXITCODE -ne 0) { Write-Host "Build failed!" -ForegroundColor Red; exit 1 }
@@ -38,8 +46,31 @@ Write-Host "Compiling VM..." -ForegroundColor Yellow
 & $GCC -Wall -Wextra -std=c11 -O2 -Iengine -c engine/vm/vm.c -o build/vm.o
 if ($LASTEXITCODE -ne 0) { Write-Host "Build failed!" -ForegroundColor Red; exit 1 }
 
+Write-Host "Compiling string objects..." -ForegroundColor Yellow
+& $GCC -Wall -Wextra -std=c11 -O2 -Iengine -c engine/vm/riau_string.c -o build/riau_string.o
+if ($LASTEXITCODE -ne 0) { Write-Host "Build failed!" -ForegroundColor Red; exit 1 }
+
+Write-Host "Compiling key index..." -ForegroundColor Yellow
+& $GCC -Wall -Wextra -std=c11 -O2 -Iengine -c engine/vm/key_index.c -o build/key_index.o
+if ($LASTEXITCODE -ne 0) { Write-Host "Build failed!" -ForegroundColor Red; exit 1 }
+
+Write-Host "Compiling SHAPE..." -ForegroundColor Yellow
+& $GCC -Wall -Wextra -std=c11 -O2 -Iengine -c engine/vm/shape.c -o build/shape.o
+if ($LASTEXITCODE -ne 0) { Write-Host "Build failed!" -ForegroundColor Red; exit 1 }
+
 Write-Host "Compiling error reporter..." -ForegroundColor Yellow
 & $GCC -Wall -Wextra -std=c11 -O2 -Iengine -c engine/errors/error_reporter.c -o build/error_reporter.o
+& $GCC -Wall -Wextra -std=c11 -O2 -Iengine -c engine/bytecode/regcode.c -o build/regcode.o
+& $GCC -Wall -Wextra -std=c11 -O2 -Iengine -c engine/bytecode/reg_compiler.c -o build/reg_compiler.o
+& $GCC -Wall -Wextra -std=c11 -O2 -Iengine -c engine/vm/reg_vm.c -o build/reg_vm.o
+& $GCC -Wall -Wextra -std=c11 -O2 -Iengine -c engine/vm/gc.c -o build/gc.o
+& $GCC -Wall -Wextra -std=c11 -O2 -Iengine -c engine/runtime/arena.c -o build/arena.o
+& $GCC -Wall -Wextra -std=c11 -O2 -Iengine -c engine/vm/guard.c -o build/guard.o
+& $GCC -Wall -Wextra -std=c11 -O2 -Iengine -c engine/stdlib/stdlib.c -o build/stdlib.o
+& $GCC -Wall -Wextra -std=c11 -O2 -Iengine -c engine/vm/jit.c -o build/jit.o
+& $GCC -Wall -Wextra -std=c11 -O2 -Iengine -c engine/vm/aot.c -o build/aot.o
+& $GCC -Wall -Wextra -std=c11 -O2 -Iengine -c engine/bytecode/chunk_cache.c -o build/chunk_cache.o
+& $GCC -Wall -Wextra -std=c11 -O2 -Iengine -c engine/vm/snapshot.c -o build/snapshot.o
 if ($LASTEXITCODE -ne 0) { Write-Host "Build failed!" -ForegroundColor Red; exit 1 }
 
 Write-Host "Compiling CLI..." -ForegroundColor Yellow
@@ -48,7 +79,7 @@ if ($LASTEXITCODE -ne 0) { Write-Host "Build failed!" -ForegroundColor Red; exit
 
 # Link
 Write-Host "Linking..." -ForegroundColor Yellow
-& $GCC -Wall -Wextra -std=c11 -O2 -o bin/riau.exe build/lexer.o build/ast.o build/parser.o build/semantic.o build/bytecode.o build/compiler.o build/vm.o build/error_reporter.o build/main.o -lm
+& $GCC -Wall -Wextra -std=c11 -O2 -o bin/riau.exe build/lexer.o build/ast.o build/parser.o build/semantic.o build/optimizer.o build/bytecode.o build/compiler.o build/peephole.o build/vm.o build/error_reporter.o build/riau_string.o build/key_index.o build/shape.o build/regcode.o build/reg_compiler.o build/reg_vm.o build/gc.o build/arena.o build/guard.o build/stdlib.o build/jit.o build/aot.o build/chunk_cache.o build/snapshot.o build/main.o -lm
 if ($LASTEXITCODE -ne 0) { Write-Host "Build failed!" -ForegroundColor Red; exit 1 }
 
 Write-Host ""
@@ -3,6 +3,9 @@
 
 set -e
 
+# Extra build options (e.g. RIAU_CFLAGS=-DRIAU_NAN_BOXING) are appended
+CFLAGS="-Wall -Wextra -std=c11 -O2 -Iengine $RIAU_CFLAGS"
+
 echo "Building Riau Programming Language..."
 
 # Create directories
@@ -10,32 +13,52 @@ mkdir -p build bin
 
 # Compile source files
 echo "Compiling lexer..."
-gcc -Wall -Wextra -std=c11 -O2 -Iengine -c engine/lexer/lexer.c -o build/lexer.o
+gcc $CFLAGS -c engine/lexer/lexer.c -o build/lexer.o
 
 echo "Compiling AST..."
-gcc -Wall -Wextra -std=c11 -O2 -Iengine -c engine/ast/ast.c -o build/ast.o
+gcc $CFLAGS -c engine/ast/ast.c -o build/ast.o
 
 echo "Compiling parser..."
-gcc -Wall -Wextra -std=c11 -O2 -Iengine -c engine/parser/parser.c -o build/parser.o
+gcc $CFLAGS -c engine/parser/parser.c -o build/parser.o
 
 echo "Compiling semantic analyzer..."
-gcc -Wall -Wextra -std=c11 -O2 -Iengine -c engine/semantic/semantic.c -o build/semantic.o
+gcc $CFLAGS -c engine/semantic/semantic.c -o build/semantic.o
+
+echo "Compiling optimizer..."
+gcc $CFLAGS -c engine/optimizer/optimizer.c -o build/optimizer.o
 
 echo "Compiling bytecode..."
-gcc -Wall -Wextra -std=c11 -O2 -Iengine -c engine/bytecode/bytecode.c -o build/bytecode.o
+gcc $CFLAGS -c engine/bytecode/bytecode.c -o build/bytecode.o
+
+echo "Compiling peephole optimizer..."
+gcc $CFLAGS -c engine/bytecode/peephole.c -o build/peephole.o
 
 echo "Compiling compiler..."
-gcc -Wall -Wextra -std=c11 -O2 -Iengine -c engine/bytecode/compiler.c -o build/compiler.o
+gcc $CFLAGS -c engine/bytecode/compiler.c -o build/compiler.o
 
 echo "Compiling VM..."
-gcc -Wall -Wextra -std=c11 -O2 -Iengine -c engine/vm/vm.c -o build/vm.o
+gcc $CFLAGS -c engine/vm/vm.c -o build/vm.o
+gcc $CFLAGS -c engine/vm/riau_string.c -o build/riau_string.o
+gcc $CFLAGS -c engine/vm/key_index.c -o build/key_index.o
+gcc $CFLAGS -c engine/vm/shape.c -o build/shape.o
+gcc $CFLAGS -c engine/bytecode/regcode.c -o build/regcode.o
+gcc $CFLAGS -c engine/bytecode/reg_compiler.c -o build/reg_compiler.o
+gcc $CFLAGS -c engine/vm/reg_vm.c -o build/reg_vm.o
+gcc $CFLAGS -c engine/vm/gc.c -o build/gc.o
+gcc $CFLAGS -c engine/runtime/arena.c -o build/arena.o
+gcc $CFLAGS -c engine/vm/guard.c -o build/guard.o
+gcc $CFLAGS -c engine/stdlib/stdlib.c -o build/stdlib.o
+gcc $CFLAGS -c engine/vm/jit.c -o build/jit.o
+gcc $CFLAGS -c engine/vm/aot.c -o build/aot.o
+gcc $CFLAGS -c engine/bytecode/chunk_cache.c -o build/chunk_cache.o
+gcc $CFLAGS -c engine/vm/snapshot.c -o build/snapshot.o
 
 echo "Compiling CLI..."
-gcc -Wall -Wextra -std=c11 -O2 -Iengine -c engine/cli/main.c -o build/main.o
+gcc $CFLAGS -c engine/cli/main.c -o build/main.o
 
 # Link
 echo "Linking..."
-gcc -Wall -Wextra -std=c11 -O2 -o bin/riau build/lexer.o build/ast.o build/parser.o build/semantic.o build/bytecode.o build/compiler.o build/vm.o build/main.o -lm
+gcc $CFLAGS -o bin/riau build/lexer.o build/ast.o build/parser.o build/semantic.o build/optimizer.o build/bytecode.o build/compiler.o build/peephole.o build/vm.o build/riau_string.o build/key_index.o build/shape.o build/regcode.o build/reg_compiler.o build/reg_vm.o build/gc.o build/arena.o build/guard.o build/stdlib.o build/jit.o build/aot.o build/chunk_cache.o build/snapshot.o build/main.o -lm
 
 # Make executable
 chmod +x bin/riau
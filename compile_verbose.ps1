@@ -10,9 +10,25 @@ $files = @(
     @{Name = "ast"; Path = "engine/ast/ast.c" },
     @{Name = "parser"; Path = "engine/parser/parser.c" },
     @{Name = "semantic"; Path = "engine/semantic/semantic.c" },
+    @{Name = "optimizer"; Path = "engine/optimizer/optimizer.c" },
     @{Name = "bytecode"; Path = "engine/bytecode/bytecode.c" },
     @{Name = "compiler"; Path = "engine/bytecode/compiler.c" },
+    @{Name = "peephole"; Path = "engine/bytecode/peephole.c" },
     @{Name = "vm"; Path = "engine/vm/vm.c" },
+    @{Name = "riau_string"; Path = "engine/vm/riau_string.c" },
+    @{Name = "key_index"; Path = "engine/vm/key_index.c" },
+    @{Name = "shape"; Path = "engine/vm/shape.c" },
+    @{Name = "regcode"; Path = "engine/bytecode/regcode.c" },
+    @{Name = "reg_compiler"; Path = "engine/bytecode/reg_compiler.c" },
+    @{Name = "reg_vm"; Path = "engine/vm/reg_vm.c" },
+    @{Name = "gc"; Path = "engine/vm/gc.c" },
+    @{Name = "arena"; Path = "engine/runtime/arena.c" },
+    @{Name = "guard"; Path = "engine/vm/guard.c" },
+    @{Name = "stdlib"; Path = "engine/stdlib/stdlib.c" },
+    @{Name = "jit"; Path = "engine/vm/jit.c" },
+    @{Name = "aot"; Path = "engine/vm/aot.c" },
+    @{Name = "chunk_cache"; Path = "engine/bytecode/chunk_cache.c" },
+    @{Name = "snapshot"; Path = "engine/vm/snapshot.c" },
     @{Name = "main"; Path = "engine/cli/main.c" }
 )
 
@@ -29,7 +45,7 @@ foreach ($file in $files) {
 
 if ($success) {
     Write-Host "`nLinking..." -ForegroundColor Yellow
-    gcc -Wall -Wextra -std=c11 -O2 -o bin/riau.exe build/lexer.o build/ast.o build/parser.o build/semantic.o build/bytecode.o build/compiler.o build/vm.o build/main.o -lm
+    gcc -Wall -Wextra -std=c11 -O2 -o bin/riau.exe build/lexer.o build/ast.o build/parser.o build/semantic.o build/optimizer.o build/bytecode.o build/compiler.o build/peephole.o build/vm.o build/riau_string.o build/key_index.o build/shape.o build/regcode.o build/reg_compiler.o build/reg_vm.o build/gc.o build/arena.o build/guard.o build/stdlib.o build/jit.o build/aot.o build/chunk_cache.o build/snapshot.o build/main.o -lm
     
     if ($LASTEXITCODE -eq 0) {
         Write-Host "`n========================================" -ForegroundColor Green
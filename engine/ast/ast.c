@@ -1,22 +1,12 @@
 #include "ast.h"
+#include "../runtime/arena.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 
-// Helper to allocate and copy strings
-static char* str_dup(const char* str) {
-    if (!str) return NULL;
-    size_t len = strlen(str);
-    char* copy = malloc(len + 1);
-    if (copy) {
-        memcpy(copy, str, len + 1);
-    }
-    return copy;
-}
-
 // AST Node creation
 static ASTNode* ast_create_node(ASTNodeType type, int line, int column) {
-    ASTNode* node = calloc(1, sizeof(ASTNode));
+    ASTNode* node = riau_calloc(1, sizeof(ASTNode));
     node->type = type;
     node->line = line;
     node->column = column;
@@ -31,7 +21,7 @@ ASTNode* ast_create_program(ASTNodeList* statements) {
 
 ASTNode* ast_create_var_decl(char* name, TypeInfo* type_info, ASTNode* initializer, int line, int column) {
     ASTNode* node = ast_create_node(AST_VARIABLE_DECL, line, column);
-    node->data.var_decl.name = str_dup(name);
+    node->data.var_decl.name = riau_strdup(name);
     node->data.var_decl.type_info = type_info;
     node->data.var_decl.initializer = initializer;
     return node;
@@ -39,7 +29,7 @@ ASTNode* ast_create_var_decl(char* name, TypeInfo* type_info, ASTNode* initializ
 
 ASTNode* ast_create_func_decl(char* name, ASTNodeList* parameters, TypeInfo* return_type, ASTNode* body, bool is_arrow, int line, int column) {
     ASTNode* node = ast_create_node(AST_FUNCTION_DECL, line, column);
-    node->data.func_decl.name = str_dup(name);
+    node->data.func_decl.name = riau_strdup(name);
     node->data.func_decl.parameters = parameters;
     node->data.func_decl.return_type = return_type;
     node->data.func_decl.body = body;
@@ -49,14 +39,14 @@ ASTNode* ast_create_func_decl(char* name, ASTNodeList* parameters, TypeInfo* ret
 
 ASTNode* ast_create_entity_decl(char* name, ASTNodeList* fields, int line, int column) {
     ASTNode* node = ast_create_node(AST_ENTITY_DECL, line, column);
-    node->data.entity_decl.name = str_dup(name);
+    node->data.entity_decl.name = riau_strdup(name);
     node->data.entity_decl.fields = fields;
     return node;
 }
 
 ASTNode* ast_create_parameter(char* name, TypeInfo* type_info, int line, int column) {
     ASTNode* node = ast_create_node(AST_PARAMETER, line, column);
-    node->data.parameter.name = str_dup(name);
+    node->data.parameter.name = riau_strdup(name);
     node->data.parameter.type_info = type_info;
     return node;
 }
@@ -77,7 +67,7 @@ ASTNode* ast_create_if_stmt(ASTNode* condition, ASTNode* then_branch, ASTNode* e
 
 ASTNode* ast_create_for_stmt(char* iterator, ASTNode* iterable, ASTNode* body, int line, int column) {
     ASTNode* node = ast_create_node(AST_FOR_STMT, line, column);
-    node->data.for_stmt.iterator = str_dup(iterator);
+    node->data.for_stmt.iterator = riau_strdup(iterator);
     node->data.for_stmt.iterable = iterable;
     node->data.for_stmt.body = body;
     return node;
@@ -92,15 +82,15 @@ ASTNode* ast_create_return_stmt(ASTNode* value, int line, int column) {
 ASTNode* ast_create_try_catch(ASTNode* try_block, char* error_type, char* error_name, ASTNode* catch_block, int line, int column) {
     ASTNode* node = ast_create_node(AST_TRY_CATCH_STMT, line, column);
     node->data.try_catch.try_block = try_block;
-    node->data.try_catch.error_type = str_dup(error_type);
-    node->data.try_catch.error_name = str_dup(error_name);
+    node->data.try_catch.error_type = riau_strdup(error_type);
+    node->data.try_catch.error_name = riau_strdup(error_name);
     node->data.try_catch.catch_block = catch_block;
     return node;
 }
 
 ASTNode* ast_create_use_stmt(char* module_path, int line, int column) {
     ASTNode* node = ast_create_node(AST_USE_STMT, line, column);
-    node->data.use_stmt.module_path = str_dup(module_path);
+    node->data.use_stmt.module_path = riau_strdup(module_path);
     return node;
 }
 
@@ -118,7 +108,7 @@ ASTNode* ast_create_expr_stmt(ASTNode* expression, int line, int column) {
 
 ASTNode* ast_create_binary(char* operator, ASTNode* left, ASTNode* right, int line, int column) {
     ASTNode* node = ast_create_node(AST_BINARY_EXPR, line, column);
-    node->data.binary.operator = str_dup(operator);
+    node->data.binary.operator = riau_strdup(operator);
     node->data.binary.left = left;
     node->data.binary.right = right;
     return node;
@@ -126,7 +116,7 @@ ASTNode* ast_create_binary(char* operator, ASTNode* left, ASTNode* right, int li
 
 ASTNode* ast_create_unary(char* operator, ASTNode* operand, int line, int column) {
     ASTNode* node = ast_create_node(AST_UNARY_EXPR, line, column);
-    node->data.unary.operator = str_dup(operator);
+    node->data.unary.operator = riau_strdup(operator);
     node->data.unary.operand = operand;
     return node;
 }
@@ -141,7 +131,7 @@ ASTNode* ast_create_call(ASTNode* callee, ASTNodeList* arguments, int line, int
 ASTNode* ast_create_member(ASTNode* object, char* property, int line, int column) {
     ASTNode* node = ast_create_node(AST_MEMBER_EXPR, line, column);
     node->data.member.object = object;
-    node->data.member.property = str_dup(property);
+    node->data.member.property = riau_strdup(property);
     return node;
 }
 
@@ -154,7 +144,7 @@ ASTNode* ast_create_index(ASTNode* array, ASTNode* index, int line, int column)
 
 ASTNode* ast_create_identifier(char* name, int line, int column) {
     ASTNode* node = ast_create_node(AST_IDENTIFIER, line, column);
-    node->data.identifier.name = str_dup(name);
+    node->data.identifier.name = riau_strdup(name);
     return node;
 }
 
@@ -166,7 +156,7 @@ ASTNode* ast_create_number(double value, int line, int column) {
 
 ASTNode* ast_create_string(char* value, int line, int column) {
     ASTNode* node = ast_create_node(AST_LITERAL_STRING, line, column);
-    node->data.string.value = str_dup(value);
+    node->data.string.value = riau_strdup(value);
     return node;
 }
 
@@ -194,7 +184,7 @@ ASTNode* ast_create_object(ASTNodeList* pairs, int line, int column) {
 
 // List operations
 ASTNodeList* ast_list_create(ASTNode* node) {
-    ASTNodeList* list = malloc(sizeof(ASTNodeList));
+    ASTNodeList* list = riau_alloc(sizeof(ASTNodeList));
     list->node = node;
     list->next = NULL;
     return list;
@@ -222,10 +212,10 @@ size_t ast_list_length(ASTNodeList* list) {
 
 // Type operations
 TypeInfo* type_create(TypeKind kind, bool is_optional, char* name) {
-    TypeInfo* type = malloc(sizeof(TypeInfo));
+    TypeInfo* type = riau_alloc(sizeof(TypeInfo));
     type->kind = kind;
     type->is_optional = is_optional;
-    type->name = str_dup(name);
+    type->name = riau_strdup(name);
     return type;
 }
 
@@ -233,7 +223,7 @@ TypeInfo* type_parse(const char* type_string) {
     if (!type_string) return type_create(TYPE_UNKNOWN, false, NULL);
     
     bool is_optional = false;
-    char* type_str = str_dup(type_string);
+    char* type_str = riau_strdup(type_string);
     size_t len = strlen(type_str);
     
     if (len > 0 && type_str[len - 1] == '?') {
@@ -249,7 +239,7 @@ TypeInfo* type_parse(const char* type_string) {
     else if (strcmp(type_str, "null") == 0) kind = TYPE_NULL;
     
     TypeInfo* type = type_create(kind, is_optional, type_str);
-    free(type_str);
+    riau_free(type_str);
     return type;
 }
 
@@ -262,22 +252,22 @@ void ast_free(ASTNode* node) {
             ast_list_free(node->data.program.statements);
             break;
         case AST_VARIABLE_DECL:
-            free(node->data.var_decl.name);
+            riau_free(node->data.var_decl.name);
             type_free(node->data.var_decl.type_info);
             ast_free(node->data.var_decl.initializer);
             break;
         case AST_FUNCTION_DECL:
-            free(node->data.func_decl.name);
+            riau_free(node->data.func_decl.name);
             ast_list_free(node->data.func_decl.parameters);
             type_free(node->data.func_decl.return_type);
             ast_free(node->data.func_decl.body);
             break;
         case AST_ENTITY_DECL:
-            free(node->data.entity_decl.name);
+            riau_free(node->data.entity_decl.name);
             ast_list_free(node->data.entity_decl.fields);
             break;
         case AST_PARAMETER:
-            free(node->data.parameter.name);
+            riau_free(node->data.parameter.name);
             type_free(node->data.parameter.type_info);
             break;
         case AST_BLOCK:
@@ -289,7 +279,7 @@ void ast_free(ASTNode* node) {
             ast_free(node->data.if_stmt.else_branch);
             break;
         case AST_FOR_STMT:
-            free(node->data.for_stmt.iterator);
+            riau_free(node->data.for_stmt.iterator);
             ast_free(node->data.for_stmt.iterable);
             ast_free(node->data.for_stmt.body);
             break;
@@ -298,12 +288,12 @@ void ast_free(ASTNode* node) {
             break;
         case AST_TRY_CATCH_STMT:
             ast_free(node->data.try_catch.try_block);
-            free(node->data.try_catch.error_type);
-            free(node->data.try_catch.error_name);
+            riau_free(node->data.try_catch.error_type);
+            riau_free(node->data.try_catch.error_name);
             ast_free(node->data.try_catch.catch_block);
             break;
         case AST_USE_STMT:
-            free(node->data.use_stmt.module_path);
+            riau_free(node->data.use_stmt.module_path);
             break;
         case AST_SPAWN_STMT:
             ast_free(node->data.spawn_stmt.body);
@@ -312,12 +302,12 @@ void ast_free(ASTNode* node) {
             ast_free(node->data.expr_stmt.expression);
             break;
         case AST_BINARY_EXPR:
-            free(node->data.binary.operator);
+            riau_free(node->data.binary.operator);
             ast_free(node->data.binary.left);
             ast_free(node->data.binary.right);
             break;
         case AST_UNARY_EXPR:
-            free(node->data.unary.operator);
+            riau_free(node->data.unary.operator);
             ast_free(node->data.unary.operand);
             break;
         case AST_CALL_EXPR:
@@ -326,17 +316,17 @@ void ast_free(ASTNode* node) {
             break;
         case AST_MEMBER_EXPR:
             ast_free(node->data.member.object);
-            free(node->data.member.property);
+            riau_free(node->data.member.property);
             break;
         case AST_INDEX_EXPR:
             ast_free(node->data.index.array);
             ast_free(node->data.index.index);
             break;
         case AST_IDENTIFIER:
-            free(node->data.identifier.name);
+            riau_free(node->data.identifier.name);
             break;
         case AST_LITERAL_STRING:
-            free(node->data.string.value);
+            riau_free(node->data.string.value);
             break;
         case AST_ARRAY_LITERAL:
             ast_list_free(node->data.array.elements);
@@ -348,22 +338,22 @@ void ast_free(ASTNode* node) {
             break;
     }
     
-    free(node);
+    riau_free(node);
 }
 
 void ast_list_free(ASTNodeList* list) {
     while (list) {
         ASTNodeList* next = list->next;
         ast_free(list->node);
-        free(list);
+        riau_free(list);
         list = next;
     }
 }
 
 void type_free(TypeInfo* type) {
     if (!type) return;
-    free(type->name);
-    free(type);
+    riau_free(type->name);
+    riau_free(type);
 }
 
 // Debugging
@@ -409,7 +399,8 @@ void ast_print(ASTNode* node, int indent) {
             printf(" (%s)", node->data.identifier.name);
             break;
         case AST_LITERAL_NUMBER:
-            printf(" (%g)", node->data.number.value);
+            printf(node->data.number.is_integer ? " (%.0f)" : " (%g)",
+                   node->data.number.value);
             break;
         case AST_LITERAL_STRING:
             printf(" (\"%s\")", node->data.string.value);
@@ -189,6 +189,7 @@ struct ASTNode {
         // Literals
         struct {
             double value;
+            bool is_integer; // No fraction and fits in 32 bits
         } number;
         
         struct {
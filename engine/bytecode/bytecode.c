@@ -1,4 +1,5 @@
 #include "bytecode.h"
+#include "../runtime/arena.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -9,19 +10,51 @@ void chunk_init(Chunk *chunk) {
   chunk->capacity = 0;
   chunk->code = NULL;
   chunk->lines = NULL;
+  chunk->line_count = 0;
+  chunk->line_capacity = 0;
   chunk->constants = NULL;
   chunk->constant_count = 0;
   chunk->constant_capacity = 0;
+  string_table_init(&chunk->strings);
+  chunk->numbers.entries = NULL;
+  chunk->numbers.count = 0;
+  chunk->numbers.capacity = 0;
+  chunk->shared = NULL;
+  chunk->caches = NULL;
+  chunk->cache_count = 0;
+  chunk->cache_capacity = 0;
+  chunk->quicken = NULL;
+  chunk->jit = NULL;
+  chunk->hotness = 0;
 }
 
 void chunk_free(Chunk *chunk) {
-  free(chunk->code);
-  free(chunk->lines);
+  riau_free(chunk->code);
+  riau_free(chunk->lines);
 
   for (size_t i = 0; i < chunk->constant_count; i++) {
+    // Shared strings belong to the table
+    if (chunk->shared && chunk->constants[i].type == CONST_STRING)
+      continue;
     constant_free(&chunk->constants[i]);
   }
-  free(chunk->constants);
+  riau_free(chunk->constants);
+  string_table_free(&chunk->strings);
+  riau_free(chunk->numbers.entries);
+  if (chunk->shared && --chunk->shared->refs == 0) {
+    ConstantTable *table = chunk->shared;
+    for (size_t i = 0; i < table->count; i++) {
+      string_free(table->strings[i]);
+    }
+    riau_free(table->strings);
+    string_table_free(&table->index);
+    riau_free(table);
+  }
+  riau_free(chunk->caches);
+  riau_free(chunk->quicken);
+  if (chunk->jit) {
+    chunk->jit->release(chunk->jit);
+  }
 
   chunk_init(chunk);
 }
@@ -30,27 +63,212 @@ void chunk_write(Chunk *chunk, uint8_t byte, int line) {
   if (chunk->capacity < chunk->count + 1) {
     size_t old_capacity = chunk->capacity;
     chunk->capacity = old_capacity < 8 ? 8 : old_capacity * 2;
-    chunk->code = realloc(chunk->code, chunk->capacity);
-    chunk->lines = realloc(chunk->lines, chunk->capacity * sizeof(int));
+    chunk->code = riau_realloc(chunk->code, chunk->capacity);
+  }
+
+  // A new run starts wherever the line changes
+  if (chunk->line_count == 0 ||
+      chunk->lines[chunk->line_count - 1].line != line) {
+    if (chunk->line_capacity < chunk->line_count + 1) {
+      size_t old_capacity = chunk->line_capacity;
+      chunk->line_capacity = old_capacity < 8 ? 8 : old_capacity * 2;
+      chunk->lines = riau_realloc(chunk->lines,
+                                  chunk->line_capacity * sizeof(LineRun));
+    }
+    chunk->lines[chunk->line_count].offset = (uint32_t)chunk->count;
+    chunk->lines[chunk->line_count].line = line;
+    chunk->line_count++;
   }
 
   chunk->code[chunk->count] = byte;
-  chunk->lines[chunk->count] = line;
   chunk->count++;
 }
 
+// Source line of the code byte at `offset`: the last run starting at or
+// before it
+int chunk_get_line(Chunk *chunk, size_t offset) {
+  size_t low = 0;
+  size_t high = chunk->line_count;
+  while (high - low > 1) {
+    size_t middle = low + (high - low) / 2;
+    if (chunk->lines[middle].offset <= offset) {
+      low = middle;
+    } else {
+      high = middle;
+    }
+  }
+  return chunk->line_count > 0 ? chunk->lines[low].line : 0;
+}
+
+static bool same_number(const Constant *a, const Constant *b) {
+  if (a->type != b->type)
+    return false; // 1 and 1.0 behave differently
+  if (a->type == CONST_INT)
+    return a->as.integer == b->as.integer;
+  // Bit for bit, so 0.0 and -0.0 stay apart
+  return memcmp(&a->as.number, &b->as.number, sizeof(double)) == 0;
+}
+
+static uint32_t number_hash(const Constant *constant) {
+  uint64_t bits;
+  if (constant->type == CONST_INT) {
+    bits = (uint32_t)constant->as.integer;
+  } else {
+    memcpy(&bits, &constant->as.number, sizeof(bits));
+  }
+  bits ^= bits >> 33;
+  bits *= 0xff51afd7ed558ccdULL;
+  bits ^= bits >> 33;
+  return (uint32_t)bits ^ (uint32_t)constant->type;
+}
+
+// Entry for `constant` in the chunk's number table: the one holding an equal
+// constant, or the empty one where it goes
+static uint32_t *find_number(Chunk *chunk, uint32_t *entries, size_t capacity,
+                             const Constant *constant) {
+  size_t index = number_hash(constant) & (capacity - 1);
+  for (;;) {
+    uint32_t entry = entries[index];
+    if (entry == 0 || same_number(&chunk->constants[entry - 1], constant)) {
+      return &entries[index];
+    }
+    index = (index + 1) & (capacity - 1);
+  }
+}
+
+static void grow_numbers(Chunk *chunk) {
+  NumberTable *table = &chunk->numbers;
+  size_t capacity = table->capacity < 8 ? 8 : table->capacity * 2;
+  uint32_t *entries = riau_calloc(capacity, sizeof(uint32_t));
+
+  for (size_t i = 0; i < table->capacity; i++) {
+    uint32_t entry = table->entries[i];
+    if (entry != 0) {
+      *find_number(chunk, entries, capacity, &chunk->constants[entry - 1]) =
+          entry;
+    }
+  }
+
+  riau_free(table->entries);
+  table->entries = entries;
+  table->capacity = capacity;
+}
+
+// The shared copy of `string`, which is freed if the table already has one
+static RiauString *share_string(ConstantTable *table, RiauString *string) {
+  int position;
+  if (string_table_get(&table->index, string->chars, string->length,
+                       string->hash, &position)) {
+    string_free(string);
+    return table->strings[position];
+  }
+
+  if (table->capacity < table->count + 1) {
+    size_t old_capacity = table->capacity;
+    table->capacity = old_capacity < 8 ? 8 : old_capacity * 2;
+    table->strings =
+        riau_realloc(table->strings, table->capacity * sizeof(RiauString *));
+  }
+  table->strings[table->count] = string;
+  string_table_set(&table->index, string, (int)table->count);
+  table->count++;
+  return string;
+}
+
+// Use `table` (a new one if NULL) for the string constants of `chunk`,
+// which has none yet. The table lives until the last of its chunks is
+// freed.
+void chunk_share_constants(Chunk *chunk, ConstantTable *table) {
+  if (!table) {
+    table = riau_calloc(1, sizeof(ConstantTable));
+    string_table_init(&table->index);
+  }
+  table->refs++;
+  chunk->shared = table;
+}
+
 size_t chunk_add_constant(Chunk *chunk, Constant constant) {
+  // String constants are interned per chunk: every occurrence of the same
+  // literal shares one string object and one constant slot
+  if (constant.type == CONST_STRING) {
+    RiauString *string = constant.as.string;
+    int existing;
+    if (string_table_get(&chunk->strings, string->chars, string->length,
+                         string->hash, &existing)) {
+      constant_free(&constant);
+      return (size_t)existing;
+    }
+    if (chunk->shared) {
+      constant.as.string = share_string(chunk->shared, string);
+    }
+    string_table_set(&chunk->strings, constant.as.string,
+                     (int)chunk->constant_count);
+  } else if (constant.type != CONST_FUNCTION) {
+    // Numbers too, by value
+    if (chunk->numbers.count + 1 > chunk->numbers.capacity * 3 / 4) {
+      grow_numbers(chunk);
+    }
+    uint32_t *entry = find_number(chunk, chunk->numbers.entries,
+                                  chunk->numbers.capacity, &constant);
+    if (*entry != 0)
+      return *entry - 1;
+    *entry = (uint32_t)chunk->constant_count + 1;
+    chunk->numbers.count++;
+  }
+
   if (chunk->constant_capacity < chunk->constant_count + 1) {
     size_t old_capacity = chunk->constant_capacity;
     chunk->constant_capacity = old_capacity < 8 ? 8 : old_capacity * 2;
     chunk->constants =
-        realloc(chunk->constants, chunk->constant_capacity * sizeof(Constant));
+        riau_realloc(chunk->constants, chunk->constant_capacity * sizeof(Constant));
   }
 
   chunk->constants[chunk->constant_count] = constant;
   return chunk->constant_count++;
 }
 
+// Reserve an empty inline cache for one property instruction
+size_t chunk_add_cache(Chunk *chunk) {
+  if (chunk->cache_capacity < chunk->cache_count + 1) {
+    size_t old_capacity = chunk->cache_capacity;
+    chunk->cache_capacity = old_capacity < 8 ? 8 : old_capacity * 2;
+    chunk->caches =
+        riau_realloc(chunk->caches, chunk->cache_capacity * sizeof(PropertyCache));
+  }
+
+  memset(&chunk->caches[chunk->cache_count], 0, sizeof(PropertyCache));
+  return chunk->cache_count++;
+}
+
+void chunk_list_collect(ChunkList *list, Chunk *chunk,
+                        RiauFunction *function) {
+  if (list->capacity < list->count + 1) {
+    list->capacity = list->capacity < 8 ? 8 : list->capacity * 2;
+    list->chunks = riau_realloc(list->chunks, list->capacity * sizeof(Chunk *));
+    list->functions = riau_realloc(list->functions,
+                                   list->capacity * sizeof(RiauFunction *));
+  }
+  list->chunks[list->count] = chunk;
+  list->functions[list->count] = function;
+  list->count++;
+
+  for (size_t i = 0; i < chunk->constant_count; i++) {
+    Constant *constant = &chunk->constants[i];
+    if (constant->type == CONST_FUNCTION) {
+      chunk_list_collect(list, constant->as.function->chunk,
+                         constant->as.function);
+    }
+  }
+}
+
+size_t chunk_list_index(ChunkList *list, Chunk *chunk) {
+  for (size_t i = 0; i < list->count; i++) {
+    if (list->chunks[i] == chunk)
+      return i;
+  }
+  return 0;
+}
+
 Constant constant_number(double value) {
   Constant c;
   c.type = CONST_NUMBER;
@@ -58,21 +276,53 @@ Constant constant_number(double value) {
   return c;
 }
 
+Constant constant_int(int32_t value) {
+  Constant c;
+  c.type = CONST_INT;
+  c.as.integer = value;
+  return c;
+}
+
 Constant constant_string(const char *str) {
   Constant c;
   c.type = CONST_STRING;
-  c.as.string = malloc(strlen(str) + 1);
-  strcpy(c.as.string, str);
+  c.as.string = string_new_unmanaged(str, strlen(str));
+  c.as.string->is_constant = true;
   return c;
 }
 
+Constant constant_function(RiauFunction *function) {
+  Constant c;
+  c.type = CONST_FUNCTION;
+  c.as.function = function;
+  return c;
+}
+
+RiauFunction *function_new_unmanaged(const char *name, int arity) {
+  RiauFunction *function = riau_calloc(1, sizeof(RiauFunction));
+  function->gc.kind = GC_FUNCTION;
+  function->gc.flags = GC_UNMANAGED;
+  function->gc.size = sizeof(RiauFunction);
+  function->chunk = riau_alloc(sizeof(Chunk));
+  chunk_init(function->chunk);
+  function->arity = arity;
+  function->name = riau_strdup(name);
+  return function;
+}
+
 void constant_free(Constant *constant) {
   if (constant->type == CONST_STRING) {
-    free(constant->as.string);
+    string_free(constant->as.string);
+  } else if (constant->type == CONST_FUNCTION) {
+    RiauFunction *function = constant->as.function;
+    chunk_free(function->chunk);
+    riau_free(function->chunk);
+    riau_free(function->name);
+    riau_free(function);
   }
 }
 
-static const char *opcode_name(OpCode op) {
+const char *opcode_name(OpCode op) {
   switch (op) {
   case OP_HALT:
     return "HALT";
@@ -158,31 +408,192 @@ static const char *opcode_name(OpCode op) {
     return "THROW";
   case OP_CHECK_NULL:
     return "CHECK_NULL";
+  case OP_ENV:
+    return "ENV";
+  case OP_INPUT:
+    return "INPUT";
   case OP_PRINT:
     return "PRINT";
+  case OP_BIT_AND:
+    return "BIT_AND";
+  case OP_BIT_OR:
+    return "BIT_OR";
+  case OP_BIT_XOR:
+    return "BIT_XOR";
+  case OP_BIT_NOT:
+    return "BIT_NOT";
+  case OP_SHIFT_LEFT:
+    return "SHIFT_LEFT";
+  case OP_SHIFT_RIGHT:
+    return "SHIFT_RIGHT";
+  case OP_ADD_NUM_NUM:
+    return "ADD_NUM_NUM";
+  case OP_ADD_STR_STR:
+    return "ADD_STR_STR";
+  case OP_SUB_NUM_NUM:
+    return "SUB_NUM_NUM";
+  case OP_MUL_NUM_NUM:
+    return "MUL_NUM_NUM";
+  case OP_DIV_NUM_NUM:
+    return "DIV_NUM_NUM";
+  case OP_LESS_NUM_NUM:
+    return "LESS_NUM_NUM";
+  case OP_LESS_EQUAL_NUM_NUM:
+    return "LESS_EQUAL_NUM_NUM";
+  case OP_GREATER_NUM_NUM:
+    return "GREATER_NUM_NUM";
+  case OP_GREATER_EQUAL_NUM_NUM:
+    return "GREATER_EQUAL_NUM_NUM";
+  case OP_ADD_INT_INT:
+    return "ADD_INT_INT";
+  case OP_SUB_INT_INT:
+    return "SUB_INT_INT";
+  case OP_MUL_INT_INT:
+    return "MUL_INT_INT";
+  case OP_LESS_INT_INT:
+    return "LESS_INT_INT";
+  case OP_LESS_EQUAL_INT_INT:
+    return "LESS_EQUAL_INT_INT";
+  case OP_GREATER_INT_INT:
+    return "GREATER_INT_INT";
+  case OP_GREATER_EQUAL_INT_INT:
+    return "GREATER_EQUAL_INT_INT";
+  case OP_PRINT_CONST:
+    return "PRINT_CONST";
+  case OP_PRINT_POP:
+    return "PRINT_POP";
+  case OP_STORE_VAR_POP:
+    return "STORE_VAR_POP";
+  case OP_ADD_VAR_CONST:
+    return "ADD_VAR_CONST";
+  case OP_LOAD_VAR_LONG:
+    return "LOAD_VAR_LONG";
+  case OP_STORE_VAR_LONG:
+    return "STORE_VAR_LONG";
+  case OP_LOAD_LOCAL:
+    return "LOAD_LOCAL";
+  case OP_STORE_LOCAL:
+    return "STORE_LOCAL";
+  case OP_TAIL_CALL:
+    return "TAIL_CALL";
+  case OP_CALL_NATIVE:
+    return "CALL_NATIVE";
+  case OP_PUSH_CONST_LONG:
+    return "PUSH_CONST_LONG";
+  case OP_LOAD_FIELD_LONG:
+    return "LOAD_FIELD_LONG";
+  case OP_STORE_FIELD_LONG:
+    return "STORE_FIELD_LONG";
+  case OP_JUMP_LONG:
+    return "JUMP_LONG";
+  case OP_JUMP_IF_FALSE_LONG:
+    return "JUMP_IF_FALSE_LONG";
+  case OP_JUMP_IF_TRUE_LONG:
+    return "JUMP_IF_TRUE_LONG";
+  case OP_FOR_ITER_LONG:
+    return "FOR_ITER_LONG";
+  case OP_FOR_PREP:
+    return "FOR_PREP";
+  case OP_FOR_ITER:
+    return "FOR_ITER";
   default:
     return "UNKNOWN";
   }
 }
 
+// Size in bytes of an instruction, opcode included
+int opcode_length(OpCode op) {
+  switch (op) {
+  case OP_PUSH_CONST:
+  case OP_LOAD_VAR:
+  case OP_STORE_VAR:
+  case OP_LOAD_GLOBAL:
+  case OP_STORE_GLOBAL:
+  case OP_CALL:
+  case OP_PRINT_CONST:
+  case OP_STORE_VAR_POP:
+  case OP_LOAD_LOCAL:
+  case OP_STORE_LOCAL:
+  case OP_TAIL_CALL:
+    return 2;
+  case OP_JUMP:
+  case OP_JUMP_IF_FALSE:
+  case OP_JUMP_IF_TRUE:
+  case OP_OBJECT_GET:
+  case OP_OBJECT_SET:
+  case OP_ADD_VAR_CONST:
+  case OP_LOAD_VAR_LONG:
+  case OP_STORE_VAR_LONG:
+  case OP_CALL_NATIVE:
+  case OP_PUSH_CONST_LONG:
+  case OP_ARRAY_NEW:
+  case OP_FOR_ITER:
+    return 3;
+  case OP_LOAD_FIELD:
+  case OP_STORE_FIELD:
+    return 4;
+  case OP_LOAD_FIELD_LONG:
+  case OP_STORE_FIELD_LONG:
+  case OP_JUMP_LONG:
+  case OP_JUMP_IF_FALSE_LONG:
+  case OP_JUMP_IF_TRUE_LONG:
+  case OP_FOR_ITER_LONG:
+    return 5;
+  default:
+    return 1;
+  }
+}
+
 static int simple_instruction(const char *name, int offset) {
   printf("%s\n", name);
   return offset + 1;
 }
 
-static int constant_instruction(const char *name, Chunk *chunk, int offset) {
-  uint8_t constant_idx = chunk->code[offset + 1];
-  printf("%-16s %4d '", name, constant_idx);
-
-  Constant *c = &chunk->constants[constant_idx];
+static void print_constant(Constant *c) {
   if (c->type == CONST_NUMBER) {
     printf("%g", c->as.number);
+  } else if (c->type == CONST_INT) {
+    printf("%d", c->as.integer);
   } else if (c->type == CONST_STRING) {
-    printf("%s", c->as.string);
+    printf("%s", c->as.string->chars);
+  } else if (c->type == CONST_FUNCTION) {
+    printf("<fn %s>", c->as.function->name);
   }
+}
+
+static uint16_t read_short_operand(Chunk *chunk, int offset) {
+  return (uint16_t)((chunk->code[offset] << 8) | chunk->code[offset + 1]);
+}
+
+// `wide` instructions have a 16-bit constant index
+static int constant_instruction(const char *name, Chunk *chunk, int offset,
+                                bool wide) {
+  int constant_idx =
+      wide ? read_short_operand(chunk, offset + 1) : chunk->code[offset + 1];
+  printf("%-16s %4d '", name, constant_idx);
+
+  print_constant(&chunk->constants[constant_idx]);
   printf("'\n");
 
-  return offset + 2;
+  return offset + (wide ? 3 : 2);
+}
+
+static int field_instruction(const char *name, Chunk *chunk, int offset,
+                             bool wide) {
+  int constant_idx =
+      wide ? read_short_operand(chunk, offset + 1) : chunk->code[offset + 1];
+  int next = offset + (wide ? 3 : 2);
+  uint16_t cache = read_short_operand(chunk, next);
+  printf("%-16s %4d '%s' ic %d\n", name, constant_idx,
+         chunk->constants[constant_idx].as.string->chars, cache);
+  return next + 2;
+}
+
+static int cache_instruction(const char *name, Chunk *chunk, int offset) {
+  uint16_t cache = (uint16_t)(chunk->code[offset + 1] << 8);
+  cache |= chunk->code[offset + 2];
+  printf("%-16s ic %d\n", name, cache);
+  return offset + 3;
 }
 
 static int byte_instruction(const char *name, Chunk *chunk, int offset) {
@@ -191,37 +602,118 @@ static int byte_instruction(const char *name, Chunk *chunk, int offset) {
   return offset + 2;
 }
 
-static int jump_instruction(const char *name, int sign, Chunk *chunk,
-                            int offset) {
-  uint16_t jump = (uint16_t)(chunk->code[offset + 1] << 8);
-  jump |= chunk->code[offset + 2];
-  printf("%-16s %4d -> %d\n", name, offset, offset + 3 + sign * jump);
+static int short_instruction(const char *name, Chunk *chunk, int offset) {
+  uint16_t slot = (uint16_t)(chunk->code[offset + 1] << 8);
+  slot |= chunk->code[offset + 2];
+  printf("%-16s %4d\n", name, slot);
+  return offset + 3;
+}
+
+static int var_constant_instruction(const char *name, Chunk *chunk,
+                                    int offset) {
+  uint8_t slot = chunk->code[offset + 1];
+  uint8_t constant_idx = chunk->code[offset + 2];
+  printf("%-16s %4d %4d '", name, slot, constant_idx);
+
+  print_constant(&chunk->constants[constant_idx]);
+  printf("'\n");
+
   return offset + 3;
 }
 
+static int native_instruction(const char *name, Chunk *chunk, int offset) {
+  uint8_t native = chunk->code[offset + 1];
+  uint8_t arg_count = chunk->code[offset + 2];
+  printf("%-16s %4d argc %d\n", name, native, arg_count);
+  return offset + 3;
+}
+
+static int jump_instruction(const char *name, Chunk *chunk, int offset) {
+  printf("%-16s %4d -> %zu\n", name, offset,
+         chunk_jump_target(chunk, offset));
+  return offset + opcode_length(chunk->code[offset]);
+}
+
+// Where the jump at `offset` lands. Offsets are unsigned and count from
+// the end of the instruction: 16 bits, or 32 for the *_LONG forms. FOR_ITER
+// jumps back by its offset, every other jump forward.
+size_t chunk_jump_target(Chunk *chunk, size_t offset) {
+  uint8_t *operand = chunk->code + offset + 1;
+  switch (chunk->code[offset]) {
+  case OP_JUMP_LONG:
+  case OP_JUMP_IF_FALSE_LONG:
+  case OP_JUMP_IF_TRUE_LONG: {
+    uint32_t jump = ((uint32_t)operand[0] << 24) |
+                    ((uint32_t)operand[1] << 16) |
+                    ((uint32_t)operand[2] << 8) | operand[3];
+    return offset + 5 + jump;
+  }
+  case OP_FOR_ITER_LONG: {
+    uint32_t jump = ((uint32_t)operand[0] << 24) |
+                    ((uint32_t)operand[1] << 16) |
+                    ((uint32_t)operand[2] << 8) | operand[3];
+    return offset + 5 - jump;
+  }
+  case OP_FOR_ITER:
+    return offset + 3 - (size_t)((operand[0] << 8) | operand[1]);
+  default:
+    return offset + 3 + (size_t)((operand[0] << 8) | operand[1]);
+  }
+}
+
 int chunk_disassemble_instruction(Chunk *chunk, int offset) {
   printf("%04d ", offset);
 
-  if (offset > 0 && chunk->lines[offset] == chunk->lines[offset - 1]) {
+  int line = chunk_get_line(chunk, offset);
+  if (offset > 0 && line == chunk_get_line(chunk, offset - 1)) {
     printf("   | ");
   } else {
-    printf("%4d ", chunk->lines[offset]);
+    printf("%4d ", line);
   }
 
   uint8_t instruction = chunk->code[offset];
   switch (instruction) {
   case OP_PUSH_CONST:
-    return constant_instruction("PUSH_CONST", chunk, offset);
+  case OP_PRINT_CONST:
+    return constant_instruction(opcode_name(instruction), chunk, offset, false);
+  case OP_PUSH_CONST_LONG:
+    return constant_instruction(opcode_name(instruction), chunk, offset, true);
+  case OP_ADD_VAR_CONST:
+    return var_constant_instruction(opcode_name(instruction), chunk, offset);
   case OP_LOAD_VAR:
   case OP_STORE_VAR:
   case OP_LOAD_GLOBAL:
   case OP_STORE_GLOBAL:
   case OP_CALL:
+  case OP_STORE_VAR_POP:
+  case OP_LOAD_LOCAL:
+  case OP_STORE_LOCAL:
+  case OP_TAIL_CALL:
     return byte_instruction(opcode_name(instruction), chunk, offset);
+  case OP_LOAD_VAR_LONG:
+  case OP_STORE_VAR_LONG:
+  case OP_ARRAY_NEW:
+    return short_instruction(opcode_name(instruction), chunk, offset);
+  case OP_CALL_NATIVE:
+    return native_instruction(opcode_name(instruction), chunk, offset);
+  case OP_LOAD_FIELD:
+  case OP_STORE_FIELD:
+    return field_instruction(opcode_name(instruction), chunk, offset, false);
+  case OP_LOAD_FIELD_LONG:
+  case OP_STORE_FIELD_LONG:
+    return field_instruction(opcode_name(instruction), chunk, offset, true);
+  case OP_OBJECT_GET:
+  case OP_OBJECT_SET:
+    return cache_instruction(opcode_name(instruction), chunk, offset);
   case OP_JUMP:
   case OP_JUMP_IF_FALSE:
   case OP_JUMP_IF_TRUE:
-    return jump_instruction(opcode_name(instruction), 1, chunk, offset);
+  case OP_JUMP_LONG:
+  case OP_JUMP_IF_FALSE_LONG:
+  case OP_JUMP_IF_TRUE_LONG:
+  case OP_FOR_ITER:
+  case OP_FOR_ITER_LONG:
+    return jump_instruction(opcode_name(instruction), chunk, offset);
   default:
     return simple_instruction(opcode_name(instruction), offset);
   }
@@ -233,4 +725,60 @@ void chunk_disassemble(Chunk *chunk, const char *name) {
   for (size_t offset = 0; offset < chunk->count;) {
     offset = chunk_disassemble_instruction(chunk, offset);
   }
+
+  for (size_t i = 0; i < chunk->constant_count; i++) {
+    if (chunk->constants[i].type == CONST_FUNCTION) {
+      RiauFunction *function = chunk->constants[i].as.function;
+      chunk_disassemble(function->chunk, function->name);
+    }
+  }
+}
+
+// One line per instruction that went through the quickening machinery,
+// followed by the overall share of executions that ran quickened code
+static void print_quicken_stats(Chunk *chunk, const char *name, FILE *out) {
+  fprintf(out, "== quickening%s%s ==\n", name ? ": " : "", name ? name : "");
+  if (!chunk->quicken) {
+    fprintf(out, "(not executed)\n");
+    return;
+  }
+
+  uint64_t generic = 0;
+  uint64_t hits = 0;
+  for (size_t offset = 0; offset < chunk->count; offset++) {
+    QuickenStats *stats = &chunk->quicken[offset];
+    if (stats->generic == 0 && stats->hits == 0)
+      continue;
+
+    fprintf(out,
+            "%04zu %4d %-22s generic %8u  quickened %8u  rewrites %4u  "
+            "deopts %4u\n",
+            offset, chunk_get_line(chunk, offset),
+            opcode_name(chunk->code[offset]),
+            stats->generic, stats->hits, stats->quickens, stats->deopts);
+    generic += stats->generic;
+    hits += stats->hits;
+  }
+
+  uint64_t total = generic + hits;
+  fprintf(out, "quickened %llu of %llu executions (%.1f%%)\n",
+          (unsigned long long)hits, (unsigned long long)total,
+          total ? 100.0 * (double)hits / (double)total : 0.0);
+}
+
+// The chunk first, then every function declared in it that has run
+static void print_quicken_tree(Chunk *chunk, const char *name, FILE *out) {
+  print_quicken_stats(chunk, name, out);
+  for (size_t i = 0; i < chunk->constant_count; i++) {
+    if (chunk->constants[i].type == CONST_FUNCTION) {
+      RiauFunction *function = chunk->constants[i].as.function;
+      if (function->chunk->quicken) {
+        print_quicken_tree(function->chunk, function->name, out);
+      }
+    }
+  }
+}
+
+void chunk_print_quicken_stats(Chunk *chunk, FILE *out) {
+  print_quicken_tree(chunk, NULL, out);
 }
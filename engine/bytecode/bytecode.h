@@ -1,8 +1,11 @@
 #ifndef RIAU_BYTECODE_H
 #define RIAU_BYTECODE_H
 
+#include "../vm/riau_string.h"
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
 
 // Bytecode instruction set
 typedef enum {
@@ -38,7 +41,7 @@ typedef enum {
   OP_JUMP_IF_TRUE,  // Jump if top of stack is true
   OP_CALL,          // Call function
   OP_RETURN,        // Return from function
-  OP_ARRAY_NEW,     // Create new array
+  OP_ARRAY_NEW,     // Create an array from the top n values (16-bit n)
   OP_ARRAY_GET,     // Get array element
   OP_ARRAY_SET,     // Set array element
   OP_OBJECT_NEW,    // Create new object
@@ -51,44 +54,241 @@ typedef enum {
   OP_ENV,           // Get environment variable
   OP_INPUT,         // Read from stdin
   OP_PRINT,         // Debug print
+  OP_BIT_AND,       // Bitwise AND (32-bit integers)
+  OP_BIT_OR,        // Bitwise OR
+  OP_BIT_XOR,       // Bitwise XOR
+  OP_BIT_NOT,       // Bitwise complement
+  OP_SHIFT_LEFT,    // Left shift
+  OP_SHIFT_RIGHT,   // Arithmetic right shift
+
+  // Quickened forms. The compiler never emits these; the VM rewrites a
+  // generic instruction into one of them once its operand types have been
+  // stable for a while, and back when the type guard fails.
+  OP_ADD_NUM_NUM,
+  OP_ADD_STR_STR,
+  OP_SUB_NUM_NUM,
+  OP_MUL_NUM_NUM,
+  OP_DIV_NUM_NUM,
+  OP_LESS_NUM_NUM,
+  OP_LESS_EQUAL_NUM_NUM,
+  OP_GREATER_NUM_NUM,
+  OP_GREATER_EQUAL_NUM_NUM,
+  OP_ADD_INT_INT,
+  OP_SUB_INT_INT,
+  OP_MUL_INT_INT,
+  OP_LESS_INT_INT,
+  OP_LESS_EQUAL_INT_INT,
+  OP_GREATER_INT_INT,
+  OP_GREATER_EQUAL_INT_INT,
+
+  // Superinstructions. The compiler fuses the most frequent sequences in
+  // expression statements (see tools/pair_stats.sh) into one instruction
+  // with the operands inline.
+  OP_PRINT_CONST,    // PUSH_CONST k; PRINT; POP
+  OP_PRINT_POP,      // PRINT; POP
+  OP_STORE_VAR_POP,  // STORE_VAR s; POP
+  OP_ADD_VAR_CONST,  // LOAD_VAR s; PUSH_CONST k; ADD; STORE_VAR s; POP
+
+  // Variable access with a 16-bit slot, for slots past 255
+  OP_LOAD_VAR_LONG,
+  OP_STORE_VAR_LONG,
+
+  // Function frame slots: parameters first
+  OP_LOAD_LOCAL,
+  OP_STORE_LOCAL,
+
+  OP_TAIL_CALL, // CALL in return position: the callee reuses the frame
+  OP_CALL_NATIVE, // CALL_NATIVE n argc: native table entry n, no frame
+
+  // Wide forms, for operands the short ones cannot hold: a 16-bit constant
+  // index, and a 32-bit jump offset for jumps over more than 64 KB of code
+  OP_PUSH_CONST_LONG,
+  OP_LOAD_FIELD_LONG,
+  OP_STORE_FIELD_LONG,
+  OP_JUMP_LONG,
+  OP_JUMP_IF_FALSE_LONG,
+  OP_JUMP_IF_TRUE_LONG,
+  OP_FOR_ITER_LONG,
+
+  // for x in seq. FOR_PREP checks that seq can be iterated and adds the
+  // loop's position and variable above it; FOR_ITER, at the bottom of the
+  // loop, moves the variable to the next element and jumps back to the
+  // body, or falls through once there are none left. The only backward
+  // jump.
+  OP_FOR_PREP,
+  OP_FOR_ITER,
 } OpCode;
 
+// Constant indexes past 255 need the *_LONG forms; a chunk holds at most
+// CONSTANTS_MAX constants
+#define CONSTANTS_MAX (UINT16_MAX + 1)
+
 // Constant value types
 typedef enum {
   CONST_NUMBER,
+  CONST_INT,
   CONST_STRING,
+  CONST_FUNCTION,
 } ConstantType;
 
+typedef struct RiauFunction RiauFunction;
+
 typedef struct {
   ConstantType type;
   union {
     double number;
-    char *string;
+    int32_t integer;
+    RiauString *string;
+    RiauFunction *function;
   } as;
 } Constant;
 
+// Number constants by value (open addressing). An entry holds a constant
+// index + 1, or 0 when empty.
+typedef struct {
+  uint32_t *entries;
+  size_t count;
+  size_t capacity;
+} NumberTable;
+
+// String constants shared by the chunks of one program
+//
+// Every chunk interns its own string constants, so a literal used many
+// times in it takes one constant slot. Chunks that share a table also share
+// the string objects: a literal used in several functions is stored once,
+// and its uses are the same pointer. The table owns those strings; the
+// chunks refer to them. Each chunk keeps its own constant array, which its
+// operands index.
+typedef struct {
+  RiauString **strings;
+  size_t count;
+  size_t capacity;
+  StringTable index; // String -> position in `strings`
+  int refs;          // Chunks using the table
+} ConstantTable;
+
+// Inline property caches
+//
+// Every property instruction owns one cache in its chunk. An entry
+// remembers the receiver shape seen there and the slot the key lives in;
+// for stores that add a key, `next` is the shape the object moves to. Once
+// all ways are taken the site is megamorphic and does full lookups.
+typedef struct Shape Shape;
+
+#define PROPERTY_CACHE_WAYS 4
+
+typedef struct {
+  Shape *shape;
+  Shape *next;
+  const RiauString *key;
+  uint32_t slot;
+} PropertyCacheEntry;
+
+typedef struct {
+  PropertyCacheEntry entries[PROPERTY_CACHE_WAYS];
+  uint8_t count;
+} PropertyCache;
+
+// Quickening profile of one instruction, indexed by code offset
+typedef struct {
+  uint8_t candidate; // Quickened form the recent executions would allow
+  uint16_t warmup;   // Consecutive generic executions matching `candidate`
+  uint32_t generic;  // Executions of the generic form
+  uint32_t hits;     // Executions of the quickened form
+  uint32_t quickens; // Rewrites to the quickened form
+  uint32_t deopts;   // Guard failures that restored the generic form
+} QuickenStats;
+
+// Native code for a chunk: made by the baseline JIT (vm/jit.h), or compiled
+// ahead of time from emitted C (vm/aot.h). run() continues the chunk from
+// vm->ip and returns false after a runtime error; the bytecode layer only
+// knows how to release it.
+typedef struct JitCode JitCode;
+struct VM;
+
+struct JitCode {
+  bool (*run)(JitCode *code, struct VM *vm);
+  void (*release)(JitCode *code);
+};
+
+// Line table. Consecutive code bytes from the same source line share one
+// run, so it grows with the number of lines rather than with the code; it
+// is only searched to report an error.
+typedef struct {
+  uint32_t offset; // First code byte of the run
+  int line;
+} LineRun;
+
 // Bytecode chunk
 typedef struct {
   uint8_t *code;
   size_t count;
   size_t capacity;
-  int *lines;
+  LineRun *lines;
+  size_t line_count;
+  size_t line_capacity;
   Constant *constants;
   size_t constant_count;
   size_t constant_capacity;
+  StringTable strings;   // Interned string constants -> constant index
+  NumberTable numbers;   // Number constants, deduplicated the same way
+  ConstantTable *shared; // Owns the string constants, if set
+  PropertyCache *caches;
+  size_t cache_count;
+  size_t cache_capacity;
+  QuickenStats *quicken; // Allocated by the VM on first execution
+  JitCode *jit;          // Native code, once the chunk is hot or loaded from C
+  uint32_t hotness;      // Calls and loop back-edges, counted by the JIT
 } Chunk;
 
+// Function
+//
+// Compiled functions are constants of the chunk that declares them: they
+// are unmanaged and own their chunk. Functions made at run time by
+// value_function() are collected like any other object.
+struct RiauFunction {
+  GcHeader gc;
+  Chunk *chunk;
+  int arity;
+  char *name;
+};
+
 // Chunk operations
 void chunk_init(Chunk *chunk);
 void chunk_free(Chunk *chunk);
 void chunk_write(Chunk *chunk, uint8_t byte, int line);
+int chunk_get_line(Chunk *chunk, size_t offset);
 size_t chunk_add_constant(Chunk *chunk, Constant constant);
+void chunk_share_constants(Chunk *chunk, ConstantTable *table);
+size_t chunk_add_cache(Chunk *chunk);
 void chunk_disassemble(Chunk *chunk, const char *name);
+const char *opcode_name(OpCode op);
+int opcode_length(OpCode op);
 int chunk_disassemble_instruction(Chunk *chunk, int offset);
+size_t chunk_jump_target(Chunk *chunk, size_t offset);
+void chunk_print_quicken_stats(Chunk *chunk, FILE *out);
+
+// Every chunk of a script, the script's first, each function after the
+// chunk that declares it. The arrays are riau_alloc()ed.
+typedef struct {
+  Chunk **chunks;
+  RiauFunction **functions; // NULL for the script
+  size_t count;
+  size_t capacity;
+} ChunkList;
+
+// Append `chunk`, the body of `function`, then the chunks of the functions
+// among its constants
+void chunk_list_collect(ChunkList *list, Chunk *chunk, RiauFunction *function);
+// Position of `chunk` in `list`, 0 if it is not there
+size_t chunk_list_index(ChunkList *list, Chunk *chunk);
 
 // Constant operations
 Constant constant_number(double value);
+Constant constant_int(int32_t value);
 Constant constant_string(const char *str);
+Constant constant_function(RiauFunction *function);
+RiauFunction *function_new_unmanaged(const char *name, int arity);
 void constant_free(Constant *constant);
 
 #endif // RIAU_BYTECODE_H
@@ -0,0 +1,491 @@
+// open, fstat, mmap and getpid are POSIX
+#define _DEFAULT_SOURCE
+#define _POSIX_C_SOURCE 200809L
+
+#include "chunk_cache.h"
+#include "../runtime/arena.h"
+#include "../stdlib/stdlib.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define RIAU_CACHE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// File layout, every field in host byte order:
+//
+//   header     Header below, then the chunk count
+//   functions  name and arity of every chunk after the first (the script)
+//   chunks     per chunk: code size, line run count, constant count and
+//              cache count, then the code, the line runs and the constants
+//
+// A constant is its type byte followed by a double, an int32, a string or
+// the index of a function's chunk. Strings are a length and the characters
+// with their NUL. A function's chunk comes after the chunk declaring it.
+
+typedef struct {
+  char magic[8];
+  uint32_t format;
+  uint32_t instruction_set; // Changes whenever an opcode or native does
+  char version[CACHE_VERSION_SIZE];
+  uint64_t source_hash;
+  uint64_t source_length;
+  uint64_t payload_hash; // cache_hash() of everything after the header
+} Header;
+
+// FNV-1a, 64-bit: collisions between versions of one script must not
+// happen in practice
+uint64_t cache_hash(const char *bytes, size_t length) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < length; i++) {
+    hash ^= (uint8_t)bytes[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+// Opcode numbers and operand sizes, and the native table CALL_NATIVE
+// indexes, so a rebuilt interpreter with a different instruction set or
+// different natives never runs an older file
+uint32_t cache_instruction_set(void) {
+  uint32_t hash = 2166136261u;
+  for (int op = 0; op <= UINT8_MAX; op++) {
+    for (const char *c = opcode_name((OpCode)op); *c; c++) {
+      hash = (hash ^ (uint8_t)*c) * 16777619u;
+    }
+    hash = (hash ^ (uint32_t)opcode_length((OpCode)op)) * 16777619u;
+  }
+  for (int native = 0; native < stdlib_native_count; native++) {
+    for (const char *c = stdlib_natives[native].name; *c; c++) {
+      hash = (hash ^ (uint8_t)*c) * 16777619u;
+    }
+    hash = (hash ^ 0) * 16777619u; // Keeps "ab", "c" apart from "a", "bc"
+  }
+  hash = (hash ^ (uint32_t)stdlib_native_count) * 16777619u;
+  return hash;
+}
+
+static void make_header(Header *header, const char *version,
+                        const char *source) {
+  size_t length = strlen(source);
+  memset(header, 0, sizeof(Header));
+  memcpy(header->magic, "RIAUC", 5);
+  header->format = CHUNK_CACHE_FORMAT;
+  header->instruction_set = cache_instruction_set();
+  strncpy(header->version, version, CACHE_VERSION_SIZE - 1);
+  header->source_hash = cache_hash(source, length);
+  header->source_length = length;
+}
+
+char *chunk_cache_path(const char *script, const char *source) {
+  const char *dir = getenv("RIAU_CACHE_DIR");
+  if (dir && *dir) {
+    size_t size = strlen(dir) + sizeof("/0123456789abcdef.riauc");
+    char *path = riau_alloc(size);
+    snprintf(path, size, "%s/%016llx.riauc", dir,
+             (unsigned long long)cache_hash(source, strlen(source)));
+    return path;
+  }
+
+  // index.riau -> index.riauc, anything else gets the whole extension
+  size_t length = strlen(script);
+  bool riau = length >= 5 && strcmp(script + length - 5, ".riau") == 0;
+  const char *suffix = riau ? "c" : ".riauc";
+  size_t size = length + strlen(suffix) + 1;
+  char *path = riau_alloc(size);
+  snprintf(path, size, "%s%s", script, suffix);
+  return path;
+}
+
+// Writing
+
+void cache_put(CacheWriter *buffer, const void *bytes, size_t size) {
+  if (buffer->capacity < buffer->count + size) {
+    size_t capacity = buffer->capacity < 256 ? 256 : buffer->capacity;
+    while (capacity < buffer->count + size) {
+      capacity *= 2;
+    }
+    buffer->data = riau_realloc(buffer->data, capacity);
+    buffer->capacity = capacity;
+  }
+  memcpy(buffer->data + buffer->count, bytes, size);
+  buffer->count += size;
+}
+
+void cache_put_u32(CacheWriter *buffer, uint32_t value) {
+  cache_put(buffer, &value, sizeof(value));
+}
+
+void cache_put_string(CacheWriter *buffer, const char *chars, size_t length) {
+  cache_put_u32(buffer, (uint32_t)length);
+  cache_put(buffer, chars, length + 1);
+}
+
+static void put_chunk(CacheWriter *out, ChunkList *list, Chunk *chunk) {
+  cache_put_u32(out, (uint32_t)chunk->count);
+  cache_put_u32(out, (uint32_t)chunk->line_count);
+  cache_put_u32(out, (uint32_t)chunk->constant_count);
+  cache_put_u32(out, (uint32_t)chunk->cache_count);
+  cache_put(out, chunk->code, chunk->count);
+  cache_put(out, chunk->lines, chunk->line_count * sizeof(LineRun));
+
+  for (size_t i = 0; i < chunk->constant_count; i++) {
+    Constant *constant = &chunk->constants[i];
+    uint8_t type = (uint8_t)constant->type;
+    cache_put(out, &type, 1);
+    switch (constant->type) {
+    case CONST_NUMBER:
+      cache_put(out, &constant->as.number, sizeof(double));
+      break;
+    case CONST_INT:
+      cache_put(out, &constant->as.integer, sizeof(int32_t));
+      break;
+    case CONST_STRING:
+      cache_put_string(out, constant->as.string->chars, constant->as.string->length);
+      break;
+    case CONST_FUNCTION:
+      cache_put_u32(
+          out, (uint32_t)chunk_list_index(list, constant->as.function->chunk));
+      break;
+    }
+  }
+}
+
+bool cache_write_file(const char *path, CacheWriter *buffer) {
+  size_t size = strlen(path) + 32;
+  char *temporary = riau_alloc(size);
+#ifdef RIAU_CACHE_MMAP
+  snprintf(temporary, size, "%s.%ld.tmp", path, (long)getpid());
+#else
+  snprintf(temporary, size, "%s.tmp", path);
+#endif
+
+  FILE *file = fopen(temporary, "wb");
+  bool written = file != NULL;
+  if (file) {
+    written = fwrite(buffer->data, 1, buffer->count, file) == buffer->count;
+    written = fclose(file) == 0 && written;
+  }
+#ifndef RIAU_CACHE_MMAP
+  if (written) {
+    remove(path); // rename() does not replace files everywhere
+  }
+#endif
+  if (written) {
+    written = rename(temporary, path) == 0;
+  }
+  if (!written) {
+    remove(temporary);
+  }
+  riau_free(temporary);
+  return written;
+}
+
+RiauFunction **cache_put_chunks(CacheWriter *out, Chunk *chunk,
+                                uint32_t *count) {
+  ChunkList list = {0};
+  chunk_list_collect(&list, chunk, NULL);
+
+  cache_put_u32(out, (uint32_t)list.count);
+  for (size_t i = 1; i < list.count; i++) {
+    RiauFunction *function = list.functions[i];
+    cache_put_string(out, function->name, strlen(function->name));
+    cache_put_u32(out, (uint32_t)function->arity);
+  }
+  for (size_t i = 0; i < list.count; i++) {
+    put_chunk(out, &list, list.chunks[i]);
+  }
+
+  riau_free(list.chunks);
+  *count = (uint32_t)list.count;
+  return list.functions;
+}
+
+bool chunk_cache_store(const char *path, const char *version,
+                       const char *source, Chunk *chunk) {
+  CacheWriter out = {0};
+  Header header;
+  make_header(&header, version, source);
+  cache_put(&out, &header, sizeof(header));
+  uint32_t count;
+  riau_free(cache_put_chunks(&out, chunk, &count));
+  uint64_t payload = cache_hash((const char *)out.data + sizeof(Header),
+                                out.count - sizeof(Header));
+  memcpy(out.data + offsetof(Header, payload_hash), &payload,
+         sizeof(payload));
+
+  bool written = cache_write_file(path, &out);
+  riau_free(out.data);
+  return written;
+}
+
+// Loading
+
+#ifdef RIAU_CACHE_MMAP
+const uint8_t *cache_map_file(const char *path, size_t *size) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return NULL;
+
+  struct stat info;
+  void *data = MAP_FAILED;
+  if (fstat(fd, &info) == 0 && info.st_size > 0) {
+    data = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  close(fd);
+  if (data == MAP_FAILED)
+    return NULL;
+  *size = (size_t)info.st_size;
+  return data;
+}
+
+void cache_unmap_file(const uint8_t *data, size_t size) {
+  munmap((void *)data, size);
+}
+#else
+// No mmap: read the whole file instead
+const uint8_t *cache_map_file(const char *path, size_t *size) {
+  FILE *file = fopen(path, "rb");
+  if (!file)
+    return NULL;
+
+  uint8_t *data = NULL;
+  long length = -1;
+  if (fseek(file, 0L, SEEK_END) == 0) {
+    length = ftell(file);
+    rewind(file);
+  }
+  if (length > 0) {
+    data = riau_alloc((size_t)length);
+    if (fread(data, 1, (size_t)length, file) != (size_t)length) {
+      riau_free(data);
+      data = NULL;
+    }
+  }
+  fclose(file);
+  *size = (size_t)length;
+  return data;
+}
+
+void cache_unmap_file(const uint8_t *data, size_t size) {
+  (void)size;
+  riau_free((void *)data);
+}
+#endif
+
+const void *cache_get(CacheReader *reader, size_t size) {
+  if (reader->failed || (size_t)(reader->end - reader->at) < size) {
+    reader->failed = true;
+    return NULL;
+  }
+  const void *bytes = reader->at;
+  reader->at += size;
+  return bytes;
+}
+
+uint32_t cache_get_u32(CacheReader *reader) {
+  uint32_t value = 0;
+  const void *bytes = cache_get(reader, sizeof(value));
+  if (bytes) {
+    memcpy(&value, bytes, sizeof(value));
+  }
+  return value;
+}
+
+// The characters, NUL-terminated, in place in the file
+const char *cache_get_string(CacheReader *reader) {
+  uint32_t length = cache_get_u32(reader);
+  if (reader->failed || length == UINT32_MAX)
+    return NULL;
+  const char *chars = cache_get(reader, (size_t)length + 1);
+  if (chars && chars[length] != '\0') {
+    reader->failed = true;
+    return NULL;
+  }
+  return chars;
+}
+
+// Chunks read so far. Each function is claimed by exactly one constant, of
+// a chunk before its own.
+typedef struct {
+  RiauFunction **functions;
+  bool *claimed;
+  uint32_t count;
+} Loader;
+
+static void load_constant(CacheReader *reader, Loader *loader, uint32_t index,
+                          Chunk *chunk) {
+  const uint8_t *type = cache_get(reader, 1);
+  if (!type)
+    return;
+
+  switch (*type) {
+  case CONST_NUMBER: {
+    double number;
+    const void *bytes = cache_get(reader, sizeof(number));
+    if (bytes) {
+      memcpy(&number, bytes, sizeof(number));
+      chunk_add_constant(chunk, constant_number(number));
+    }
+    break;
+  }
+  case CONST_INT: {
+    int32_t integer;
+    const void *bytes = cache_get(reader, sizeof(integer));
+    if (bytes) {
+      memcpy(&integer, bytes, sizeof(integer));
+      chunk_add_constant(chunk, constant_int(integer));
+    }
+    break;
+  }
+  case CONST_STRING: {
+    const char *chars = cache_get_string(reader);
+    if (chars) {
+      chunk_add_constant(chunk, constant_string(chars));
+    }
+    break;
+  }
+  case CONST_FUNCTION: {
+    uint32_t function = cache_get_u32(reader);
+    if (reader->failed || function <= index || function >= loader->count ||
+        loader->claimed[function]) {
+      reader->failed = true;
+      break;
+    }
+    loader->claimed[function] = true;
+    chunk_add_constant(chunk, constant_function(loader->functions[function]));
+    break;
+  }
+  default:
+    reader->failed = true;
+    break;
+  }
+}
+
+static void load_chunk(CacheReader *reader, Loader *loader, uint32_t index,
+                       Chunk *chunk) {
+  uint32_t count = cache_get_u32(reader);
+  uint32_t line_count = cache_get_u32(reader);
+  uint32_t constant_count = cache_get_u32(reader);
+  uint32_t cache_count = cache_get_u32(reader);
+  const uint8_t *code = cache_get(reader, count);
+  const uint8_t *lines = cache_get(reader, (size_t)line_count * sizeof(LineRun));
+  if (reader->failed || count == 0 || line_count == 0 ||
+      constant_count > CONSTANTS_MAX || cache_count > UINT16_MAX + 1) {
+    reader->failed = true;
+    return;
+  }
+
+  chunk->code = riau_alloc(count);
+  memcpy(chunk->code, code, count);
+  chunk->count = chunk->capacity = count;
+  chunk->lines = riau_alloc(line_count * sizeof(LineRun));
+  memcpy(chunk->lines, lines, line_count * sizeof(LineRun));
+  chunk->line_count = chunk->line_capacity = line_count;
+
+  // Constants go back in their original order, so the operands that index
+  // them stay valid. Duplicates would be merged and move the ones after
+  // them, so a cache with any is rejected.
+  for (uint32_t i = 0; i < constant_count && !reader->failed; i++) {
+    load_constant(reader, loader, index, chunk);
+  }
+  if (chunk->constant_count != constant_count) {
+    reader->failed = true;
+  }
+  for (uint32_t i = 0; i < cache_count; i++) {
+    chunk_add_cache(chunk);
+  }
+}
+
+RiauFunction **cache_get_chunks(CacheReader *reader, Chunk *chunk,
+                                uint32_t *count_out) {
+  // Every chunk takes at least 16 bytes
+  uint32_t count = cache_get_u32(reader);
+  if (reader->failed || count == 0 ||
+      count > (size_t)(reader->end - reader->at) / 16) {
+    reader->failed = true;
+    return NULL;
+  }
+
+  Loader loader;
+  loader.functions = riau_calloc(count, sizeof(RiauFunction *));
+  loader.claimed = riau_calloc(count, sizeof(bool));
+  loader.count = count;
+
+  // The chunks share their string constants, as when they were compiled
+  chunk_share_constants(chunk, NULL);
+  for (uint32_t i = 1; i < count && !reader->failed; i++) {
+    const char *name = cache_get_string(reader);
+    uint32_t arity = cache_get_u32(reader);
+    if (!reader->failed) {
+      loader.functions[i] = function_new_unmanaged(name, (int)arity);
+      chunk_share_constants(loader.functions[i]->chunk, chunk->shared);
+    }
+  }
+  for (uint32_t i = 0; i < count && !reader->failed; i++) {
+    load_chunk(reader, &loader, i,
+               i == 0 ? chunk : loader.functions[i]->chunk);
+  }
+  for (uint32_t i = 1; i < count; i++) {
+    if (!loader.claimed[i]) {
+      reader->failed = true;
+    }
+  }
+
+  if (reader->failed) {
+    // The script's constants free the functions they claimed, and each of
+    // those the ones it claimed; that leaves the unclaimed ones
+    chunk_free(chunk);
+    for (uint32_t i = 1; i < count; i++) {
+      if (loader.functions[i] && !loader.claimed[i]) {
+        Constant function = constant_function(loader.functions[i]);
+        constant_free(&function);
+      }
+    }
+    riau_free(loader.functions);
+    riau_free(loader.claimed);
+    return NULL;
+  }
+  riau_free(loader.claimed);
+  *count_out = count;
+  return loader.functions;
+}
+
+static bool load(CacheReader *reader, const char *version, const char *source,
+                 Chunk *chunk) {
+  Header expected;
+  make_header(&expected, version, source);
+  const void *header = cache_get(reader, sizeof(Header));
+  if (!header)
+    return false;
+  // Code and operands are run as they are, so a damaged byte anywhere
+  // after the header is a miss rather than a crash
+  expected.payload_hash = cache_hash((const char *)reader->at,
+                                     (size_t)(reader->end - reader->at));
+  if (memcmp(header, &expected, sizeof(Header)) != 0)
+    return false;
+
+  uint32_t count;
+  RiauFunction **functions = cache_get_chunks(reader, chunk, &count);
+  riau_free(functions);
+  return functions != NULL;
+}
+
+bool chunk_cache_load(const char *path, const char *version,
+                      const char *source, Chunk *chunk) {
+  size_t size;
+  const uint8_t *data = cache_map_file(path, &size);
+  if (!data)
+    return false;
+
+  CacheReader reader = {data, data + size, false};
+  bool loaded = load(&reader, version, source, chunk);
+  cache_unmap_file(data, size);
+  return loaded;
+}
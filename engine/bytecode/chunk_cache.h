@@ -0,0 +1,94 @@
+#ifndef RIAU_CHUNK_CACHE_H
+#define RIAU_CHUNK_CACHE_H
+
+#include "bytecode.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Compiled bytecode cache
+//
+// `riau --cache script.riau` (the default under CGI) saves the compiled
+// script, with the chunks of its functions, to a .riauc file. The next run
+// of the same source maps that file and loads the chunks from it instead of
+// lexing, parsing, analyzing and compiling the script again.
+//
+// A cache file is keyed by a hash of the source text, its length, the
+// interpreter version and its instruction set and natives, and carries a
+// hash of its contents. Any mismatch, or a file that does not parse, is a
+// miss: the script is compiled as usual and the file rewritten. Code, line
+// runs and numbers are copied straight out of the mapping; strings are
+// built from the mapped characters. The loaded chunk owns its memory like
+// a compiled one, so the mapping is gone once loading returns.
+//
+// The file lives next to the script (index.riau -> index.riauc), or in
+// $RIAU_CACHE_DIR, named after the source hash, if that is set.
+
+// Bumped whenever the file layout changes
+#define CHUNK_CACHE_FORMAT 3
+
+// Longest version string a file is keyed by, NUL included
+#define CACHE_VERSION_SIZE 32
+
+// Cache file for `script` with contents `source`. Free with riau_free().
+char *chunk_cache_path(const char *script, const char *source);
+
+// Load the cached compilation of `source` into the empty `chunk`. Returns
+// false, leaving `chunk` empty, if `path` holds no usable entry for it.
+bool chunk_cache_load(const char *path, const char *version,
+                      const char *source, Chunk *chunk);
+
+// Save `chunk`, freshly compiled from `source`, to `path`. The file is
+// replaced atomically, so concurrent runs only ever see a whole file.
+// Returns false if it could not be written.
+bool chunk_cache_store(const char *path, const char *version,
+                       const char *source, Chunk *chunk);
+
+// Building blocks, shared with heap snapshots (vm/snapshot.h)
+
+// Growable output buffer
+typedef struct {
+  uint8_t *data;
+  size_t count;
+  size_t capacity;
+} CacheWriter;
+
+void cache_put(CacheWriter *buffer, const void *bytes, size_t size);
+void cache_put_u32(CacheWriter *buffer, uint32_t value);
+void cache_put_string(CacheWriter *buffer, const char *chars, size_t length);
+
+// Write to a private temporary file and rename it over `path`
+bool cache_write_file(const char *path, CacheWriter *buffer);
+
+// Bounds-checked cursor over a file. Reads past the end, and anything else
+// that does not add up, set `failed`.
+typedef struct {
+  const uint8_t *at;
+  const uint8_t *end;
+  bool failed;
+} CacheReader;
+
+const void *cache_get(CacheReader *reader, size_t size);
+uint32_t cache_get_u32(CacheReader *reader);
+const char *cache_get_string(CacheReader *reader);
+
+// Read-only view of a whole file, NULL if it cannot be read
+const uint8_t *cache_map_file(const char *path, size_t *size);
+void cache_unmap_file(const uint8_t *data, size_t size);
+
+uint64_t cache_hash(const char *bytes, size_t length);
+uint32_t cache_instruction_set(void);
+
+// Write `chunk` and the chunks of its functions. Returns those functions
+// in the order they were written, the script's NULL slot first, and their
+// number in `count`; free the array with riau_free().
+RiauFunction **cache_put_chunks(CacheWriter *out, Chunk *chunk,
+                                uint32_t *count);
+
+// Read what cache_put_chunks() wrote into the empty `chunk`, returning the
+// same function table. On failure `reader->failed` is set, `chunk` is left
+// empty and the result is NULL.
+RiauFunction **cache_get_chunks(CacheReader *reader, Chunk *chunk,
+                                uint32_t *count);
+
+#endif // RIAU_CHUNK_CACHE_H
@@ -1,14 +1,20 @@
 #include "compiler.h"
+#include "peephole.h"
+#include "../runtime/arena.h"
+#include "../stdlib/stdlib.h"
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-#define MAX_VARIABLES 256
+// Slots past 255 use the *_VAR_LONG instructions with a 16-bit operand
+#define MAX_VARIABLES (UINT16_MAX + 1)
 
-// Simple variable table
-static char *variables[MAX_VARIABLES];
+// Simple variable table. The table itself outlives any one arena, so it
+// stays on malloc.
+static char **variables = NULL;
 static int variable_count = 0;
+static int variable_capacity = 0;
 
 static int find_variable(const char *name) {
   for (int i = 0; i < variable_count; i++) {
@@ -23,10 +29,29 @@ static int add_variable(const char *name) {
   if (variable_count >= MAX_VARIABLES) {
     return -1;
   }
-  variables[variable_count] = strdup(name);
+  if (variable_capacity < variable_count + 1) {
+    int old_capacity = variable_capacity;
+    variable_capacity = old_capacity < 8 ? 8 : old_capacity * 2;
+    variables = realloc(variables, variable_capacity * sizeof(char *));
+  }
+  variables[variable_count] = riau_strdup(name);
   return variable_count++;
 }
 
+// Emit a variable access or constant reference, switching to the long form
+// for slots and constants past 255
+static void emit_variable(Compiler *compiler, OpCode op, OpCode long_op,
+                          int slot, int line) {
+  if (slot <= UINT8_MAX) {
+    chunk_write(compiler->chunk, op, line);
+    chunk_write(compiler->chunk, (uint8_t)slot, line);
+  } else {
+    chunk_write(compiler->chunk, long_op, line);
+    chunk_write(compiler->chunk, (uint8_t)(slot >> 8), line);
+    chunk_write(compiler->chunk, (uint8_t)(slot & 0xff), line);
+  }
+}
+
 static void compiler_error(Compiler *compiler, const char *format, ...) {
   va_list args;
   va_start(args, format);
@@ -38,38 +63,271 @@ static void compiler_error(Compiler *compiler, const char *format, ...) {
 
 void compiler_init(Compiler *compiler, Chunk *chunk) {
   compiler->chunk = chunk;
+  compiler->enclosing = NULL;
+  compiler->function = NULL;
+  compiler->local_count = 0;
+  compiler->scope_depth = 0;
+  compiler->superinstructions = true;
+  compiler->long_jumps = NULL;
+  compiler->long_jump_count = 0;
+  compiler->long_jump_capacity = 0;
   compiler->had_error = false;
   compiler->error_message[0] = '\0';
 
+  // The program's functions share its string constants
+  if (!chunk->shared && chunk->constant_count == 0) {
+    chunk_share_constants(chunk, NULL);
+  }
+
   // Reset variable table
   for (int i = 0; i < variable_count; i++) {
-    free(variables[i]);
+    riau_free(variables[i]);
   }
   variable_count = 0;
 }
 
+int compiler_global_count(void) { return variable_count; }
+
+const char *compiler_global_name(int slot) { return variables[slot]; }
+
+bool compiler_define_global(const char *name) {
+  return add_variable(name) != -1;
+}
+
 // Forward declarations
 static void compile_statement(Compiler *compiler, ASTNode *node);
 static void compile_expression(Compiler *compiler, ASTNode *node);
 
+// Frame slot of the innermost local called `name`, or -1
+static int resolve_local(Compiler *compiler, const char *name) {
+  for (int i = compiler->local_count - 1; i >= 0; i--) {
+    if (strcmp(compiler->locals[i].name, name) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+// Whether `name` is a local of the code a function is nested in. That
+// frame is out of the function's reach, and the name must not fall
+// through to a global of the same name instead.
+static bool is_enclosing_local(Compiler *compiler, const char *name) {
+  for (Compiler *outer = compiler->enclosing; outer; outer = outer->enclosing) {
+    if (resolve_local(outer, name) != -1)
+      return true;
+  }
+  return false;
+}
+
+// Claim the next frame slot for `name`; its value must be on top of the
+// stack. Returns false on an error.
+static bool add_local(Compiler *compiler, const char *name) {
+  for (int i = compiler->local_count - 1; i >= 0; i--) {
+    if (compiler->locals[i].depth < compiler->scope_depth)
+      break;
+    if (strcmp(compiler->locals[i].name, name) == 0) {
+      compiler_error(compiler, "Variable '%s' already defined", name);
+      return false;
+    }
+  }
+  if (compiler->local_count == LOCALS_MAX) {
+    compiler_error(compiler, "Too many local variables");
+    return false;
+  }
+  compiler->locals[compiler->local_count++] =
+      (Local){name, compiler->scope_depth, NULL};
+  return true;
+}
+
+static void begin_scope(Compiler *compiler) { compiler->scope_depth++; }
+
+// Pop the locals of the scope that ends; their slots are reused
+static void end_scope(Compiler *compiler, int line) {
+  compiler->scope_depth--;
+  while (compiler->local_count > 0 &&
+         compiler->locals[compiler->local_count - 1].depth >
+             compiler->scope_depth) {
+    chunk_write(compiler->chunk, OP_POP, line);
+    compiler->local_count--;
+  }
+}
+
+// Number literals without a fraction are ints
+static Constant number_constant(ASTNode *node) {
+  if (node->data.number.is_integer)
+    return constant_int((int32_t)node->data.number.value);
+  return constant_number(node->data.number.value);
+}
+
+// Constant operands are at most 16 bits
+static int add_constant(Compiler *compiler, Constant constant) {
+  size_t index = chunk_add_constant(compiler->chunk, constant);
+  if (index >= CONSTANTS_MAX) {
+    compiler_error(compiler, "Too many constants in one chunk");
+    return 0;
+  }
+  return (int)index;
+}
+
+static int string_constant(Compiler *compiler, const char *str) {
+  return add_constant(compiler, constant_string(str));
+}
+
+// Every property instruction gets its own inline cache
+static void emit_cache(Compiler *compiler, int line) {
+  size_t cache = chunk_add_cache(compiler->chunk);
+  chunk_write(compiler->chunk, (uint8_t)(cache >> 8), line);
+  chunk_write(compiler->chunk, (uint8_t)cache, line);
+}
+
+static void compile_assignment(Compiler *compiler, ASTNode *node) {
+  ASTNode *target = node->data.binary.left;
+  ASTNode *value = node->data.binary.right;
+
+  switch (target->type) {
+  case AST_IDENTIFIER: {
+    int local = resolve_local(compiler, target->data.identifier.name);
+    if (local != -1) {
+      compile_expression(compiler, value);
+      chunk_write(compiler->chunk, OP_STORE_LOCAL, node->line);
+      chunk_write(compiler->chunk, (uint8_t)local, node->line);
+      break;
+    }
+
+    if (is_enclosing_local(compiler, target->data.identifier.name)) {
+      compiler_error(compiler,
+                     "Cannot use local '%s' of an enclosing scope (no "
+                     "closures)",
+                     target->data.identifier.name);
+      return;
+    }
+    int slot = find_variable(target->data.identifier.name);
+    if (slot == -1) {
+      compiler_error(compiler, "Undefined variable '%s'",
+                     target->data.identifier.name);
+      return;
+    }
+    compile_expression(compiler, value);
+    emit_variable(compiler, OP_STORE_VAR, OP_STORE_VAR_LONG, slot,
+                  node->line);
+    break;
+  }
+
+  case AST_MEMBER_EXPR: {
+    compile_expression(compiler, target->data.member.object);
+    emit_variable(compiler, OP_PUSH_CONST, OP_PUSH_CONST_LONG,
+                  string_constant(compiler, target->data.member.property),
+                  node->line);
+    compile_expression(compiler, value);
+    chunk_write(compiler->chunk, OP_OBJECT_SET, node->line);
+    emit_cache(compiler, node->line);
+    break;
+  }
+
+  case AST_INDEX_EXPR: {
+    compile_expression(compiler, target->data.index.array);
+    compile_expression(compiler, target->data.index.index);
+    compile_expression(compiler, value);
+    chunk_write(compiler->chunk, OP_OBJECT_SET, node->line);
+    emit_cache(compiler, node->line);
+    break;
+  }
+
+  default:
+    compiler_error(compiler, "Invalid assignment target");
+    break;
+  }
+}
+
+// Pushes the arguments of a call; returns their count
+static int compile_arguments(Compiler *compiler, ASTNode *node) {
+  ASTNodeList *args = node->data.call.arguments;
+  int arg_count = 0;
+  while (args) {
+    compile_expression(compiler, args->node);
+    arg_count++;
+    args = args->next;
+  }
+  if (arg_count > UINT8_MAX) {
+    compiler_error(compiler, "Too many arguments");
+  }
+  return arg_count;
+}
+
+// tail is set for a call whose result is returned. Returns true if the call
+// was emitted as OP_TAIL_CALL, which needs no OP_RETURN after it.
+static bool compile_call(Compiler *compiler, ASTNode *node, bool tail) {
+  // Check if this is a built-in function
+  if (node->data.call.callee->type == AST_IDENTIFIER) {
+    const char *func_name = node->data.call.callee->data.identifier.name;
+
+    // Handle print() built-in
+    if (strcmp(func_name, "print") == 0) {
+      ASTNodeList *args = node->data.call.arguments;
+      if (!args || !args->node) {
+        compiler_error(compiler, "print() requires at least one argument");
+        return false;
+      }
+      // Compile the argument
+      compile_expression(compiler, args->node);
+      // Emit PRINT opcode
+      chunk_write(compiler->chunk, OP_PRINT, node->line);
+      return false;
+    }
+
+    // Handle env() built-in
+    if (strcmp(func_name, "env") == 0) {
+      ASTNodeList *args = node->data.call.arguments;
+      if (!args || !args->node) {
+        compiler_error(compiler, "env() requires one argument");
+        return false;
+      }
+      // Compile the argument (should be a string)
+      compile_expression(compiler, args->node);
+      // Emit ENV opcode
+      chunk_write(compiler->chunk, OP_ENV, node->line);
+      return false;
+    }
+
+    // A native is called by its table index; only the arguments go on
+    // the stack. Scripts can shadow natives with their own names.
+    int native = stdlib_find_native(func_name);
+    if (native != -1 && resolve_local(compiler, func_name) == -1 &&
+        !is_enclosing_local(compiler, func_name) &&
+        find_variable(func_name) == -1) {
+      int arg_count = compile_arguments(compiler, node);
+      chunk_write(compiler->chunk, OP_CALL_NATIVE, node->line);
+      chunk_write(compiler->chunk, (uint8_t)native, node->line);
+      chunk_write(compiler->chunk, (uint8_t)arg_count, node->line);
+      return false;
+    }
+  }
+
+  // Callee first, then the arguments: they become the callee's first
+  // frame slots in place
+  compile_expression(compiler, node->data.call.callee);
+  int arg_count = compile_arguments(compiler, node);
+  chunk_write(compiler->chunk, tail ? OP_TAIL_CALL : OP_CALL, node->line);
+  chunk_write(compiler->chunk, (uint8_t)arg_count, node->line);
+  return tail;
+}
+
 static void compile_expression(Compiler *compiler, ASTNode *node) {
   if (!node)
     return;
 
   switch (node->type) {
   case AST_LITERAL_NUMBER: {
-    size_t constant = chunk_add_constant(
-        compiler->chunk, constant_number(node->data.number.value));
-    chunk_write(compiler->chunk, OP_PUSH_CONST, node->line);
-    chunk_write(compiler->chunk, (uint8_t)constant, node->line);
+    int constant = add_constant(compiler, number_constant(node));
+    emit_variable(compiler, OP_PUSH_CONST, OP_PUSH_CONST_LONG, constant,
+                  node->line);
     break;
   }
 
   case AST_LITERAL_STRING: {
-    size_t constant = chunk_add_constant(
-        compiler->chunk, constant_string(node->data.string.value));
-    chunk_write(compiler->chunk, OP_PUSH_CONST, node->line);
-    chunk_write(compiler->chunk, (uint8_t)constant, node->line);
+    int constant = string_constant(compiler, node->data.string.value);
+    emit_variable(compiler, OP_PUSH_CONST, OP_PUSH_CONST_LONG, constant,
+                  node->line);
     break;
   }
 
@@ -86,19 +344,37 @@ static void compile_expression(Compiler *compiler, ASTNode *node) {
   }
 
   case AST_IDENTIFIER: {
+    int local = resolve_local(compiler, node->data.identifier.name);
+    if (local != -1) {
+      chunk_write(compiler->chunk, OP_LOAD_LOCAL, node->line);
+      chunk_write(compiler->chunk, (uint8_t)local, node->line);
+      break;
+    }
+
     int slot = find_variable(node->data.identifier.name);
-    if (slot == -1) {
+    if (is_enclosing_local(compiler, node->data.identifier.name)) {
+      compiler_error(compiler,
+                     "Cannot use local '%s' of an enclosing scope (no "
+                     "closures)",
+                     node->data.identifier.name);
+      chunk_write(compiler->chunk, OP_PUSH_NULL, node->line);
+    } else if (slot == -1) {
       compiler_error(compiler, "Undefined variable '%s'",
                      node->data.identifier.name);
       chunk_write(compiler->chunk, OP_PUSH_NULL, node->line);
     } else {
-      chunk_write(compiler->chunk, OP_LOAD_VAR, node->line);
-      chunk_write(compiler->chunk, (uint8_t)slot, node->line);
+      emit_variable(compiler, OP_LOAD_VAR, OP_LOAD_VAR_LONG, slot,
+                    node->line);
     }
     break;
   }
 
   case AST_BINARY_EXPR: {
+    if (strcmp(node->data.binary.operator, "=") == 0) {
+      compile_assignment(compiler, node);
+      break;
+    }
+
     // Compile left and right operands
     compile_expression(compiler, node->data.binary.left);
     compile_expression(compiler, node->data.binary.right);
@@ -131,6 +407,16 @@ static void compile_expression(Compiler *compiler, ASTNode *node) {
       chunk_write(compiler->chunk, OP_AND, node->line);
     } else if (strcmp(op, "||") == 0) {
       chunk_write(compiler->chunk, OP_OR, node->line);
+    } else if (strcmp(op, "&") == 0) {
+      chunk_write(compiler->chunk, OP_BIT_AND, node->line);
+    } else if (strcmp(op, "|") == 0) {
+      chunk_write(compiler->chunk, OP_BIT_OR, node->line);
+    } else if (strcmp(op, "^") == 0) {
+      chunk_write(compiler->chunk, OP_BIT_XOR, node->line);
+    } else if (strcmp(op, "<<") == 0) {
+      chunk_write(compiler->chunk, OP_SHIFT_LEFT, node->line);
+    } else if (strcmp(op, ">>") == 0) {
+      chunk_write(compiler->chunk, OP_SHIFT_RIGHT, node->line);
     }
     break;
   }
@@ -143,76 +429,487 @@ static void compile_expression(Compiler *compiler, ASTNode *node) {
       chunk_write(compiler->chunk, OP_NEGATE, node->line);
     } else if (strcmp(op, "!") == 0) {
       chunk_write(compiler->chunk, OP_NOT, node->line);
+    } else if (strcmp(op, "~") == 0) {
+      chunk_write(compiler->chunk, OP_BIT_NOT, node->line);
+    }
+    break;
+  }
+
+  case AST_CALL_EXPR:
+    compile_call(compiler, node, false);
+    break;
+
+  case AST_OBJECT_LITERAL: {
+    chunk_write(compiler->chunk, OP_OBJECT_NEW, node->line);
+
+    ASTNodeList *pairs = node->data.object.pairs;
+    while (pairs) {
+      ASTNode *pair = pairs->node;
+      compile_expression(compiler, pair->data.binary.right);
+      emit_variable(
+          compiler, OP_STORE_FIELD, OP_STORE_FIELD_LONG,
+          string_constant(compiler, pair->data.binary.left->data.string.value),
+          pair->line);
+      emit_cache(compiler, pair->line);
+      pairs = pairs->next;
+    }
+    break;
+  }
+
+  case AST_ARRAY_LITERAL: {
+    int count = 0;
+    for (ASTNodeList *element = node->data.array.elements; element;
+         element = element->next) {
+      compile_expression(compiler, element->node);
+      count++;
     }
+    if (count > UINT16_MAX) {
+      compiler_error(compiler, "Too many elements in array literal");
+      return;
+    }
+    chunk_write(compiler->chunk, OP_ARRAY_NEW, node->line);
+    chunk_write(compiler->chunk, (uint8_t)(count >> 8), node->line);
+    chunk_write(compiler->chunk, (uint8_t)count, node->line);
+    break;
+  }
+
+  case AST_MEMBER_EXPR: {
+    compile_expression(compiler, node->data.member.object);
+    emit_variable(compiler, OP_LOAD_FIELD, OP_LOAD_FIELD_LONG,
+                  string_constant(compiler, node->data.member.property),
+                  node->line);
+    emit_cache(compiler, node->line);
+    break;
+  }
+
+  case AST_INDEX_EXPR: {
+    compile_expression(compiler, node->data.index.array);
+    compile_expression(compiler, node->data.index.index);
+    chunk_write(compiler->chunk, OP_OBJECT_GET, node->line);
+    emit_cache(compiler, node->line);
+    break;
+  }
+
+  default:
+    compiler_error(compiler, "Unknown expression type");
     break;
   }
+}
 
-  case AST_CALL_EXPR: {
-    // Check if this is a built-in function
-    if (node->data.call.callee->type == AST_IDENTIFIER) {
-      const char *func_name = node->data.call.callee->data.identifier.name;
+static bool is_literal(ASTNode *node) {
+  return node->type == AST_LITERAL_NUMBER || node->type == AST_LITERAL_STRING;
+}
+
+static int literal_constant(Compiler *compiler, ASTNode *node) {
+  if (node->type == AST_LITERAL_NUMBER) {
+    return add_constant(compiler, number_constant(node));
+  }
+  return string_constant(compiler, node->data.string.value);
+}
+
+static bool is_call_to(ASTNode *node, const char *name) {
+  return node->type == AST_CALL_EXPR &&
+         node->data.call.callee->type == AST_IDENTIFIER &&
+         strcmp(node->data.call.callee->data.identifier.name, name) == 0 &&
+         node->data.call.arguments && node->data.call.arguments->node;
+}
+
+static bool is_assignment(ASTNode *node) {
+  return node->type == AST_BINARY_EXPR &&
+         strcmp(node->data.binary.operator, "=") == 0 &&
+         node->data.binary.left->type == AST_IDENTIFIER;
+}
 
-      // Handle print() built-in
-      if (strcmp(func_name, "print") == 0) {
-        ASTNodeList *args = node->data.call.arguments;
-        if (!args || !args->node) {
-          compiler_error(compiler, "print() requires at least one argument");
-          return;
-        }
-        // Compile the argument
-        compile_expression(compiler, args->node);
-        // Emit PRINT opcode
-        chunk_write(compiler->chunk, OP_PRINT, node->line);
-        return;
+// Superinstructions for expression statements. Every fused sequence ends
+// in the statement's POP, so no jump can land inside one. Returns false if
+// the statement has no fused form. The fused forms take a byte constant; past
+// 255 they are spelled out with PUSH_CONST_LONG.
+static bool compile_fused_statement(Compiler *compiler, ASTNode *expr,
+                                    int line) {
+  if (is_call_to(expr, "print")) {
+    ASTNode *arg = expr->data.call.arguments->node;
+    if (is_literal(arg)) {
+      // print("...")
+      int constant = literal_constant(compiler, arg);
+      if (constant <= UINT8_MAX) {
+        chunk_write(compiler->chunk, OP_PRINT_CONST, line);
+        chunk_write(compiler->chunk, (uint8_t)constant, line);
+      } else {
+        emit_variable(compiler, OP_PUSH_CONST, OP_PUSH_CONST_LONG, constant,
+                      line);
+        chunk_write(compiler->chunk, OP_PRINT_POP, line);
       }
+    } else {
+      compile_expression(compiler, arg);
+      chunk_write(compiler->chunk, OP_PRINT_POP, line);
+    }
+    return true;
+  }
+
+  if (!is_assignment(expr))
+    return false;
+
+  const char *name = expr->data.binary.left->data.identifier.name;
+  if (resolve_local(compiler, name) != -1)
+    return false; // The fused forms only name globals
+  if (is_enclosing_local(compiler, name))
+    return false; // Let compile_assignment report it
+  int slot = find_variable(name);
+  if (slot == -1)
+    return false; // Let compile_assignment report it
+  if (slot > UINT8_MAX)
+    return false; // The fused forms only take a byte slot
+
+  // x = x + k
+  ASTNode *value = expr->data.binary.right;
+  if (value->type == AST_BINARY_EXPR &&
+      strcmp(value->data.binary.operator, "+") == 0 &&
+      value->data.binary.left->type == AST_IDENTIFIER &&
+      strcmp(value->data.binary.left->data.identifier.name, name) == 0 &&
+      is_literal(value->data.binary.right)) {
+    int constant = literal_constant(compiler, value->data.binary.right);
+    if (constant <= UINT8_MAX) {
+      chunk_write(compiler->chunk, OP_ADD_VAR_CONST, line);
+      chunk_write(compiler->chunk, (uint8_t)slot, line);
+      chunk_write(compiler->chunk, (uint8_t)constant, line);
+    } else {
+      emit_variable(compiler, OP_LOAD_VAR, OP_LOAD_VAR_LONG, slot, line);
+      emit_variable(compiler, OP_PUSH_CONST, OP_PUSH_CONST_LONG, constant,
+                    line);
+      chunk_write(compiler->chunk, OP_ADD, line);
+      chunk_write(compiler->chunk, OP_STORE_VAR_POP, line);
+      chunk_write(compiler->chunk, (uint8_t)slot, line);
+    }
+    return true;
+  }
+
+  // x = expr
+  compile_expression(compiler, value);
+  chunk_write(compiler->chunk, OP_STORE_VAR_POP, line);
+  chunk_write(compiler->chunk, (uint8_t)slot, line);
+  return true;
+}
+
+// Record a jump whose offset does not fit in 16 bits for widen_jumps()
+static void add_long_jump(Compiler *compiler, size_t operand, size_t target) {
+  if (compiler->long_jump_capacity < compiler->long_jump_count + 1) {
+    int old_capacity = compiler->long_jump_capacity;
+    compiler->long_jump_capacity = old_capacity < 8 ? 8 : old_capacity * 2;
+    compiler->long_jumps =
+        riau_realloc(compiler->long_jumps,
+                     compiler->long_jump_capacity * sizeof(LongJump));
+  }
+  compiler->long_jumps[compiler->long_jump_count++] =
+      (LongJump){operand, target};
+}
+
+// Emit a forward jump with a placeholder offset; returns the operand's
+// position for patch_jump()
+static size_t emit_jump(Compiler *compiler, OpCode op, int line) {
+  chunk_write(compiler->chunk, op, line);
+  chunk_write(compiler->chunk, 0xff, line);
+  chunk_write(compiler->chunk, 0xff, line);
+  return compiler->chunk->count - 2;
+}
+
+// Point a forward jump at the next instruction. A jump over more than 64 KB
+// of code is recorded instead, for widen_jumps() to rewrite.
+static void patch_jump(Compiler *compiler, size_t operand) {
+  size_t jump = compiler->chunk->count - operand - 2;
+  if (jump > UINT16_MAX) {
+    add_long_jump(compiler, operand, compiler->chunk->count);
+    return;
+  }
+  compiler->chunk->code[operand] = (uint8_t)(jump >> 8);
+  compiler->chunk->code[operand + 1] = (uint8_t)jump;
+}
+
+// Emit a FOR_ITER back to `target`
+static void emit_loop(Compiler *compiler, size_t target, int line) {
+  chunk_write(compiler->chunk, OP_FOR_ITER, line);
+  size_t operand = compiler->chunk->count;
+  size_t jump = operand + 2 - target;
+  if (jump > UINT16_MAX) {
+    add_long_jump(compiler, operand, target);
+    jump = 0;
+  }
+  chunk_write(compiler->chunk, (uint8_t)(jump >> 8), line);
+  chunk_write(compiler->chunk, (uint8_t)jump, line);
+}
+
+static bool is_short_jump(uint8_t op) {
+  return op == OP_JUMP || op == OP_JUMP_IF_FALSE || op == OP_JUMP_IF_TRUE ||
+         op == OP_FOR_ITER;
+}
+
+static size_t jump_target(Compiler *compiler, size_t offset) {
+  for (int i = 0; i < compiler->long_jump_count; i++) {
+    if (compiler->long_jumps[i].operand == offset + 1)
+      return compiler->long_jumps[i].target;
+  }
+  return chunk_jump_target(compiler->chunk, offset);
+}
+
+// Once a chunk with a long jump is complete, rewrite every jump in it to the
+// *_LONG form with a 32-bit offset. Widening moves code, so the jumps that
+// fit in 16 bits are widened too rather than re-checked one by one.
+static void widen_jumps(Compiler *compiler) {
+  Chunk *chunk = compiler->chunk;
 
-      // Handle env() built-in
-      if (strcmp(func_name, "env") == 0) {
-        ASTNodeList *args = node->data.call.arguments;
-        if (!args || !args->node) {
-          compiler_error(compiler, "env() requires one argument");
-          return;
-        }
-        // Compile the argument (should be a string)
-        compile_expression(compiler, args->node);
-        // Emit ENV opcode
-        chunk_write(compiler->chunk, OP_ENV, node->line);
-        return;
+  // New offset of each instruction, and of the end of the chunk
+  size_t *moved = riau_alloc((chunk->count + 1) * sizeof(size_t));
+  size_t at = 0;
+  for (size_t offset = 0; offset < chunk->count;
+       offset += opcode_length(chunk->code[offset])) {
+    uint8_t op = chunk->code[offset];
+    moved[offset] = at;
+    at += opcode_length(op) + (is_short_jump(op) ? 2 : 0);
+  }
+  moved[chunk->count] = at;
+
+  Chunk wide;
+  chunk_init(&wide);
+  for (size_t offset = 0; offset < chunk->count;
+       offset += opcode_length(chunk->code[offset])) {
+    uint8_t op = chunk->code[offset];
+    if (!is_short_jump(op)) {
+      for (int i = 0; i < opcode_length(op); i++) {
+        chunk_write(&wide, chunk->code[offset + i],
+                    chunk_get_line(chunk, offset + i));
       }
+      continue;
     }
 
-    // Regular function call (not implemented yet)
-    // Compile arguments
-    ASTNodeList *args = node->data.call.arguments;
-    int arg_count = 0;
-    while (args) {
-      compile_expression(compiler, args->node);
-      arg_count++;
-      args = args->next;
+    int line = chunk_get_line(chunk, offset);
+    size_t target = moved[jump_target(compiler, offset)];
+    uint32_t jump = op == OP_FOR_ITER
+                        ? (uint32_t)(moved[offset] + 5 - target)
+                        : (uint32_t)(target - (moved[offset] + 5));
+    chunk_write(&wide,
+                op == OP_JUMP            ? OP_JUMP_LONG
+                : op == OP_JUMP_IF_FALSE ? OP_JUMP_IF_FALSE_LONG
+                : op == OP_JUMP_IF_TRUE  ? OP_JUMP_IF_TRUE_LONG
+                                         : OP_FOR_ITER_LONG,
+                line);
+    chunk_write(&wide, (uint8_t)(jump >> 24), line);
+    chunk_write(&wide, (uint8_t)(jump >> 16), line);
+    chunk_write(&wide, (uint8_t)(jump >> 8), line);
+    chunk_write(&wide, (uint8_t)jump, line);
+  }
+  riau_free(moved);
+
+  // Constants and caches stay; only the code and its line table move
+  riau_free(chunk->code);
+  riau_free(chunk->lines);
+  chunk->code = wide.code;
+  chunk->count = wide.count;
+  chunk->capacity = wide.capacity;
+  chunk->lines = wide.lines;
+  chunk->line_count = wide.line_count;
+  chunk->line_capacity = wide.line_capacity;
+}
+
+// Called once the chunk's last instruction is written
+static void finish_chunk(Compiler *compiler) {
+  if (compiler->long_jump_count > 0) {
+    widen_jumps(compiler);
+  }
+  riau_free(compiler->long_jumps);
+  compiler->long_jumps = NULL;
+  compiler->long_jump_count = 0;
+  compiler->long_jump_capacity = 0;
+
+  peephole_optimize(compiler->chunk, compiler->superinstructions);
+}
+
+// fn name(params) { body }: compile the body into its own chunk and bind
+// the function to a global, like a let
+static void compile_function(Compiler *compiler, ASTNode *node) {
+  const char *name = node->data.func_decl.name;
+
+  // Bind the name before compiling the body so the body can call itself
+  int slot = find_variable(name);
+  if (slot == -1) {
+    slot = add_variable(name);
+  }
+  if (slot == -1) {
+    compiler_error(compiler, "Too many variables");
+    return;
+  }
+
+  int arity = (int)ast_list_length(node->data.func_decl.parameters);
+  if (arity > LOCALS_MAX) {
+    compiler_error(compiler, "Too many parameters in '%s'", name);
+    return;
+  }
+
+  RiauFunction *function = function_new_unmanaged(name, arity);
+  if (compiler->chunk->shared) {
+    chunk_share_constants(function->chunk, compiler->chunk->shared);
+  }
+  Compiler body;
+  body.chunk = function->chunk;
+  body.enclosing = compiler;
+  body.function = function;
+  body.local_count = 0;
+  body.scope_depth = 1;
+  body.superinstructions = compiler->superinstructions;
+  body.long_jumps = NULL;
+  body.long_jump_count = 0;
+  body.long_jump_capacity = 0;
+  body.had_error = false;
+  body.error_message[0] = '\0';
+
+  for (ASTNodeList *param = node->data.func_decl.parameters; param;
+       param = param->next) {
+    body.locals[body.local_count++] =
+        (Local){param->node->data.parameter.name, 1, NULL};
+  }
+
+  if (node->data.func_decl.is_arrow) {
+    compile_expression(&body, node->data.func_decl.body);
+    chunk_write(body.chunk, OP_RETURN, node->line);
+  } else if (node->data.func_decl.body->type == AST_BLOCK) {
+    // The body shares the parameters' scope, and the return drops its
+    // locals with the frame
+    for (ASTNodeList *stmt = node->data.func_decl.body->data.block.statements;
+         stmt; stmt = stmt->next) {
+      compile_statement(&body, stmt->node);
+    }
+    chunk_write(body.chunk, OP_PUSH_NULL, node->line);
+    chunk_write(body.chunk, OP_RETURN, node->line);
+  } else {
+    compile_statement(&body, node->data.func_decl.body);
+    chunk_write(body.chunk, OP_PUSH_NULL, node->line);
+    chunk_write(body.chunk, OP_RETURN, node->line);
+  }
+  finish_chunk(&body);
+
+  if (body.had_error) {
+    compiler->had_error = true;
+    memcpy(compiler->error_message, body.error_message,
+           sizeof(compiler->error_message));
+  }
+
+  int constant = add_constant(compiler, constant_function(function));
+  emit_variable(compiler, OP_PUSH_CONST, OP_PUSH_CONST_LONG, constant,
+                node->line);
+  emit_variable(compiler, OP_STORE_VAR, OP_STORE_VAR_LONG, slot, node->line);
+  chunk_write(compiler->chunk, OP_POP, node->line);
+}
+
+// Constant array literals are built once, before the loop, into a hidden
+// local when they are what an inner loop iterates over
+static bool is_constant_array(ASTNode *node) {
+  if (node->type != AST_ARRAY_LITERAL)
+    return false;
+  for (ASTNodeList *element = node->data.array.elements; element;
+       element = element->next) {
+    ASTNodeType type = element->node->type;
+    if (type != AST_LITERAL_NUMBER && type != AST_LITERAL_STRING &&
+        type != AST_LITERAL_BOOL && type != AST_LITERAL_NULL)
+      return false;
+  }
+  return true;
+}
+
+// Frame slot already holding the constant array `node`, or -1
+static int resolve_array(Compiler *compiler, ASTNode *node) {
+  for (int i = compiler->local_count - 1; i >= 0; i--) {
+    if (compiler->locals[i].array == node)
+      return i;
+  }
+  return -1;
+}
+
+// Build the constant arrays the loops nested in `node` iterate over. Half
+// the frame slots are left for the loop bodies' own locals; past that the
+// arrays are built where they are used.
+static void hoist_arrays(Compiler *compiler, ASTNode *node) {
+  if (!node)
+    return;
+
+  switch (node->type) {
+  case AST_BLOCK:
+    for (ASTNodeList *stmt = node->data.block.statements; stmt;
+         stmt = stmt->next) {
+      hoist_arrays(compiler, stmt->node);
     }
+    break;
 
-    // Compile callee
-    compile_expression(compiler, node->data.call.callee);
+  case AST_IF_STMT:
+    hoist_arrays(compiler, node->data.if_stmt.then_branch);
+    hoist_arrays(compiler, node->data.if_stmt.else_branch);
+    break;
 
-    // Emit call instruction
-    chunk_write(compiler->chunk, OP_CALL, node->line);
-    chunk_write(compiler->chunk, (uint8_t)arg_count, node->line);
+  case AST_FOR_STMT: {
+    ASTNode *iterable = node->data.for_stmt.iterable;
+    if (is_constant_array(iterable) && resolve_array(compiler, iterable) == -1 &&
+        compiler->local_count < LOCALS_MAX / 2) {
+      compile_expression(compiler, iterable);
+      compiler->locals[compiler->local_count++] =
+          (Local){"(array)", compiler->scope_depth, iterable};
+    }
+    hoist_arrays(compiler, node->data.for_stmt.body);
     break;
   }
 
   default:
-    compiler_error(compiler, "Unknown expression type");
     break;
   }
 }
 
+// for x in iterable { body }, with the test at the bottom:
+//
+//   iterable; FOR_PREP; JUMP test
+//   body: ...
+//   test: FOR_ITER body; POP; POP; POP
+static void compile_for(Compiler *compiler, ASTNode *node) {
+  begin_scope(compiler);
+  hoist_arrays(compiler, node->data.for_stmt.body);
+
+  ASTNode *iterable = node->data.for_stmt.iterable;
+  int array = resolve_array(compiler, iterable);
+  if (array != -1) {
+    chunk_write(compiler->chunk, OP_LOAD_LOCAL, node->line);
+    chunk_write(compiler->chunk, (uint8_t)array, node->line);
+  } else {
+    compile_expression(compiler, iterable);
+  }
+  chunk_write(compiler->chunk, OP_FOR_PREP, node->line);
+
+  // The sequence, the position in it and the loop variable
+  if (compiler->local_count > LOCALS_MAX - 3) {
+    compiler_error(compiler, "Too many local variables");
+    end_scope(compiler, node->line);
+    return;
+  }
+  compiler->locals[compiler->local_count++] =
+      (Local){"(sequence)", compiler->scope_depth, NULL};
+  compiler->locals[compiler->local_count++] =
+      (Local){"(position)", compiler->scope_depth, NULL};
+  compiler->locals[compiler->local_count++] =
+      (Local){node->data.for_stmt.iterator, compiler->scope_depth, NULL};
+
+  size_t test_jump = emit_jump(compiler, OP_JUMP, node->line);
+  size_t body = compiler->chunk->count;
+  compile_statement(compiler, node->data.for_stmt.body);
+  patch_jump(compiler, test_jump);
+  emit_loop(compiler, body, node->line);
+  end_scope(compiler, node->line);
+}
+
 static void compile_statement(Compiler *compiler, ASTNode *node) {
   if (!node)
     return;
 
   switch (node->type) {
   case AST_EXPR_STMT: {
-    compile_expression(compiler, node->data.expr_stmt.expression);
+    ASTNode *expr = node->data.expr_stmt.expression;
+    if (compiler->superinstructions &&
+        compile_fused_statement(compiler, expr, node->line))
+      break;
+    compile_expression(compiler, expr);
     chunk_write(compiler->chunk, OP_POP, node->line);
     break;
   }
@@ -223,20 +920,35 @@ static void compile_statement(Compiler *compiler, ASTNode *node) {
     } else {
       chunk_write(compiler->chunk, OP_PUSH_NULL, node->line);
     }
-    // Add variable and store it
-    int slot = add_variable(node->data.var_decl.name);
+    // In a block or function the value stays where it is, as a local
+    if (compiler->scope_depth > 0) {
+      add_local(compiler, node->data.var_decl.name);
+      break;
+    }
+
+    // The slot may already be bound by declare_native_shadows
+    int slot = find_variable(node->data.var_decl.name);
+    if (slot == -1) {
+      slot = add_variable(node->data.var_decl.name);
+    }
     if (slot == -1) {
       compiler_error(compiler, "Too many variables");
       return;
     }
-    chunk_write(compiler->chunk, OP_STORE_VAR, node->line);
-    chunk_write(compiler->chunk, (uint8_t)slot, node->line);
+    emit_variable(compiler, OP_STORE_VAR, OP_STORE_VAR_LONG, slot,
+                  node->line);
+    chunk_write(compiler->chunk, OP_POP, node->line);
     break;
   }
 
   case AST_RETURN_STMT: {
-    if (node->data.return_stmt.value) {
-      compile_expression(compiler, node->data.return_stmt.value);
+    ASTNode *value = node->data.return_stmt.value;
+    if (compiler->function && value && value->type == AST_CALL_EXPR) {
+      // The callee takes over this call's frame
+      if (compile_call(compiler, value, true))
+        break;
+    } else if (value) {
+      compile_expression(compiler, value);
     } else {
       chunk_write(compiler->chunk, OP_PUSH_NULL, node->line);
     }
@@ -245,25 +957,98 @@ static void compile_statement(Compiler *compiler, ASTNode *node) {
   }
 
   case AST_BLOCK: {
+    begin_scope(compiler);
     ASTNodeList *stmts = node->data.block.statements;
     while (stmts) {
       compile_statement(compiler, stmts->node);
       stmts = stmts->next;
     }
+    end_scope(compiler, node->line);
+    break;
+  }
+
+  case AST_IF_STMT: {
+    compile_expression(compiler, node->data.if_stmt.condition);
+    size_t else_jump = emit_jump(compiler, OP_JUMP_IF_FALSE, node->line);
+    compile_statement(compiler, node->data.if_stmt.then_branch);
+
+    if (node->data.if_stmt.else_branch) {
+      size_t end_jump = emit_jump(compiler, OP_JUMP, node->line);
+      patch_jump(compiler, else_jump);
+      compile_statement(compiler, node->data.if_stmt.else_branch);
+      patch_jump(compiler, end_jump);
+    } else {
+      patch_jump(compiler, else_jump);
+    }
     break;
   }
 
+  case AST_FOR_STMT:
+    compile_for(compiler, node);
+    break;
+
+  case AST_FUNCTION_DECL:
+    compile_function(compiler, node);
+    break;
+
   default:
     // For now, skip unsupported statements
     break;
   }
 }
 
+// Binds the globals a statement declares under a native's name before
+// any code is compiled, so calls to them compile as calls to the global
+// even when they come before the declaration. Every `fn` binds a global,
+// `let` only outside blocks and functions.
+static void declare_native_shadows(Compiler *compiler, ASTNode *node,
+                                   bool top_level) {
+  if (!node)
+    return;
+
+  const char *name = NULL;
+  switch (node->type) {
+  case AST_VARIABLE_DECL:
+    if (top_level)
+      name = node->data.var_decl.name;
+    break;
+  case AST_FUNCTION_DECL:
+    name = node->data.func_decl.name;
+    declare_native_shadows(compiler, node->data.func_decl.body, false);
+    break;
+  case AST_BLOCK:
+    for (ASTNodeList *stmt = node->data.block.statements; stmt;
+         stmt = stmt->next) {
+      declare_native_shadows(compiler, stmt->node, false);
+    }
+    break;
+  case AST_IF_STMT:
+    declare_native_shadows(compiler, node->data.if_stmt.then_branch, false);
+    declare_native_shadows(compiler, node->data.if_stmt.else_branch, false);
+    break;
+  case AST_FOR_STMT:
+    declare_native_shadows(compiler, node->data.for_stmt.body, false);
+    break;
+  default:
+    break;
+  }
+
+  if (name && stdlib_find_native(name) != -1 && find_variable(name) == -1 &&
+      add_variable(name) == -1) {
+    compiler_error(compiler, "Too many variables");
+  }
+}
+
 bool compiler_compile(Compiler *compiler, ASTNode *ast) {
   if (!ast)
     return false;
 
   if (ast->type == AST_PROGRAM) {
+    for (ASTNodeList *stmt = ast->data.program.statements; stmt;
+         stmt = stmt->next) {
+      declare_native_shadows(compiler, stmt->node, true);
+    }
+
     ASTNodeList *stmts = ast->data.program.statements;
     while (stmts) {
       compile_statement(compiler, stmts->node);
@@ -273,6 +1058,7 @@ bool compiler_compile(Compiler *compiler, ASTNode *ast) {
 
   // Add halt instruction at the end
   chunk_write(compiler->chunk, OP_HALT, 0);
+  finish_chunk(compiler);
 
   return !compiler->had_error;
 }
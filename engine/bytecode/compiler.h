@@ -5,16 +5,58 @@
 #include "../bytecode/bytecode.h"
 #include <stdbool.h>
 
-// Compiler state
+// Frame slots are byte operands
+#define LOCALS_MAX 256
+
+// A forward jump too long for its 16-bit offset
+typedef struct {
+  size_t operand; // Position of the placeholder offset
+  size_t target;
+} LongJump;
+
+// A frame slot: a parameter, a variable declared in a block, or a for
+// loop's hidden state
 typedef struct {
+  const char *name;
+  int depth;      // Scope it was declared in
+  ASTNode *array; // Constant array literal built into the slot, or NULL
+} Local;
+
+// Compiler state. A function body is compiled by its own Compiler, which
+// points back at the one compiling the enclosing code.
+//
+// A `let` at top level defines a global; any other is a local. A local's
+// value stays on the stack where its initializer left it, so its slot is
+// its position in the frame, and the slot is free again once its block
+// ends. A for loop keeps its sequence, position and loop variable in three
+// locals of their own.
+typedef struct Compiler Compiler;
+
+struct Compiler {
   Chunk *chunk;
+  Compiler *enclosing;
+  RiauFunction *function;   // NULL at top level
+  Local locals[LOCALS_MAX]; // The frame slots in use
+  int local_count;
+  int scope_depth; // 0 at top level, 1 in a function body
+  bool superinstructions; // Fuse common opcode sequences while emitting
+  LongJump *long_jumps;    // Widened once the chunk is complete
+  int long_jump_count;
+  int long_jump_capacity;
   bool had_error;
   char error_message[512];
-} Compiler;
+};
 
 // Compiler functions
 void compiler_init(Compiler *compiler, Chunk *chunk);
 bool compiler_compile(Compiler *compiler, ASTNode *ast);
 void compiler_print_error(Compiler *compiler);
 
+// Global variables, in slot order. They outlive compiler_compile() until
+// the next compiler_init(); a script compiled on top of a heap snapshot
+// (vm/snapshot.h) defines the snapshot's globals right after that.
+int compiler_global_count(void);
+const char *compiler_global_name(int slot);
+bool compiler_define_global(const char *name);
+
 #endif // RIAU_COMPILER_H
@@ -0,0 +1,461 @@
+#include "peephole.h"
+#include "../runtime/arena.h"
+#include <string.h>
+
+// One decoded instruction. Jumps are held in their short form, with the
+// index of the instruction they land on instead of an offset.
+typedef struct {
+  uint8_t op;
+  uint8_t operands[4];
+  int length;
+  int line;
+  size_t target;
+  int refs; // Jumps landing here
+  bool dead;
+} Instruction;
+
+typedef struct {
+  Instruction *code;
+  size_t count; // code[count] stands for the end of the chunk
+  bool superinstructions;
+} Peephole;
+
+static bool is_jump(uint8_t op) {
+  return op == OP_JUMP || op == OP_JUMP_IF_FALSE || op == OP_JUMP_IF_TRUE ||
+         op == OP_FOR_ITER || op == OP_JUMP_LONG ||
+         op == OP_JUMP_IF_FALSE_LONG || op == OP_JUMP_IF_TRUE_LONG ||
+         op == OP_FOR_ITER_LONG;
+}
+
+static bool is_conditional_jump(uint8_t op) {
+  return op == OP_JUMP_IF_FALSE || op == OP_JUMP_IF_TRUE;
+}
+
+static uint8_t short_jump(uint8_t op) {
+  switch (op) {
+  case OP_JUMP_LONG:
+    return OP_JUMP;
+  case OP_JUMP_IF_FALSE_LONG:
+    return OP_JUMP_IF_FALSE;
+  case OP_JUMP_IF_TRUE_LONG:
+    return OP_JUMP_IF_TRUE;
+  case OP_FOR_ITER_LONG:
+    return OP_FOR_ITER;
+  default:
+    return op;
+  }
+}
+
+static uint8_t long_jump(uint8_t op) {
+  switch (op) {
+  case OP_JUMP:
+    return OP_JUMP_LONG;
+  case OP_JUMP_IF_FALSE:
+    return OP_JUMP_IF_FALSE_LONG;
+  case OP_JUMP_IF_TRUE:
+    return OP_JUMP_IF_TRUE_LONG;
+  default:
+    return OP_FOR_ITER_LONG;
+  }
+}
+
+static size_t next_live(Peephole *p, size_t i) {
+  i++;
+  while (i < p->count && p->code[i].dead) {
+    i++;
+  }
+  return i;
+}
+
+// Where the jump at `i` lands: its target, or the first instruction after
+// it that is still there
+static size_t landing(Peephole *p, size_t i) {
+  size_t target = p->code[i].target;
+  while (target < p->count && p->code[target].dead) {
+    target++;
+  }
+  return target;
+}
+
+// Instruction `i` lands on `target` from now on
+static void retarget(Peephole *p, size_t i, size_t target) {
+  p->code[landing(p, i)].refs--;
+  p->code[i].target = target;
+  p->code[target].refs++;
+}
+
+// Turn instruction `i` into the operand-less `op`
+static void replace(Peephole *p, size_t i, uint8_t op) {
+  if (is_jump(p->code[i].op)) {
+    p->code[landing(p, i)].refs--;
+  }
+  p->code[i].op = op;
+  p->code[i].length = 1;
+}
+
+// Remove instruction `i`; jumps to it land on the one after it
+static void kill(Peephole *p, size_t i) {
+  Instruction *instruction = &p->code[i];
+  if (is_jump(instruction->op)) {
+    p->code[landing(p, i)].refs--;
+  }
+  instruction->dead = true;
+  p->code[next_live(p, i)].refs += instruction->refs;
+  instruction->refs = 0;
+}
+
+// The live instruction after `i`, if it has opcode `op` and no jump lands
+// on it, so the two always run together; NULL otherwise
+static Instruction *followed_by(Peephole *p, size_t i, uint8_t op,
+                                size_t *next) {
+  *next = next_live(p, i);
+  if (*next >= p->count || p->code[*next].op != op ||
+      p->code[*next].refs > 0) {
+    return NULL;
+  }
+  return &p->code[*next];
+}
+
+// Rules. Each looks at the sequence starting at live instruction `i` and
+// returns true if it rewrote it.
+
+// PUSH x; POP: the value is never used
+static bool drop_push_pop(Peephole *p, size_t i) {
+  switch (p->code[i].op) {
+  case OP_PUSH_CONST:
+  case OP_PUSH_CONST_LONG:
+  case OP_PUSH_NULL:
+  case OP_PUSH_TRUE:
+  case OP_PUSH_FALSE:
+  case OP_LOAD_LOCAL:
+    break;
+  default:
+    return false; // LOAD_VAR can fail on a global that is not set yet
+  }
+
+  size_t pop;
+  if (!followed_by(p, i, OP_POP, &pop))
+    return false;
+  kill(p, i);
+  kill(p, pop);
+  return true;
+}
+
+// PUSH_TRUE; JUMP_IF_FALSE L: a jump decided at compile time
+static bool fold_constant_condition(Peephole *p, size_t i) {
+  uint8_t op = p->code[i].op;
+  if (op != OP_PUSH_TRUE && op != OP_PUSH_FALSE && op != OP_PUSH_NULL)
+    return false;
+
+  size_t jump = next_live(p, i);
+  if (jump >= p->count || !is_conditional_jump(p->code[jump].op) ||
+      p->code[jump].refs > 0)
+    return false;
+
+  bool taken = (p->code[jump].op == OP_JUMP_IF_TRUE) == (op == OP_PUSH_TRUE);
+  kill(p, i);
+  if (taken) {
+    p->code[jump].op = OP_JUMP;
+  } else {
+    kill(p, jump);
+  }
+  return true;
+}
+
+// NOT; JUMP_IF_FALSE L -> JUMP_IF_TRUE L
+static bool invert_jump(Peephole *p, size_t i) {
+  if (p->code[i].op != OP_NOT)
+    return false;
+
+  size_t jump = next_live(p, i);
+  if (jump >= p->count || !is_conditional_jump(p->code[jump].op) ||
+      p->code[jump].refs > 0)
+    return false;
+
+  p->code[jump].op = p->code[jump].op == OP_JUMP_IF_FALSE ? OP_JUMP_IF_TRUE
+                                                          : OP_JUMP_IF_FALSE;
+  kill(p, i);
+  return true;
+}
+
+// A jump to the next instruction does nothing but pop its condition; a
+// jump to a jump can go straight to where that one goes; a jump to a
+// return can return. FOR_ITER, the one jump back, is left as it is.
+static bool thread_jump(Peephole *p, size_t i) {
+  uint8_t op = p->code[i].op;
+  if (!is_jump(op) || op == OP_FOR_ITER)
+    return false;
+
+  size_t target = landing(p, i);
+  if (target == next_live(p, i)) {
+    if (op == OP_JUMP) {
+      kill(p, i);
+    } else {
+      replace(p, i, OP_POP);
+    }
+    return true;
+  }
+
+  if (target < p->count && p->code[target].op == OP_JUMP) {
+    // JUMP only goes forward, so this ends
+    retarget(p, i, landing(p, target));
+    return true;
+  }
+
+  if (op == OP_JUMP && target < p->count &&
+      (p->code[target].op == OP_RETURN || p->code[target].op == OP_HALT)) {
+    replace(p, i, p->code[target].op);
+    return true;
+  }
+  return false;
+}
+
+static bool same_operands(Instruction *a, Instruction *b) {
+  return a->length == b->length &&
+         memcmp(a->operands, b->operands, a->length - 1) == 0;
+}
+
+// STORE_VAR s; POP; LOAD_VAR s -> STORE_VAR s, which leaves the stored
+// value on the stack, and STORE_VAR_POP s; LOAD_VAR s likewise
+static bool collapse_store_load(Peephole *p, size_t i) {
+  Instruction *store = &p->code[i];
+  size_t load;
+
+  if (store->op == OP_STORE_VAR_POP) {
+    Instruction *next = followed_by(p, i, OP_LOAD_VAR, &load);
+    if (!next || !same_operands(store, next))
+      return false;
+    store->op = OP_STORE_VAR;
+    kill(p, load);
+    return true;
+  }
+
+  uint8_t load_op;
+  switch (store->op) {
+  case OP_STORE_VAR:
+    load_op = OP_LOAD_VAR;
+    break;
+  case OP_STORE_VAR_LONG:
+    load_op = OP_LOAD_VAR_LONG;
+    break;
+  case OP_STORE_LOCAL:
+    load_op = OP_LOAD_LOCAL;
+    break;
+  default:
+    return false;
+  }
+
+  size_t pop;
+  if (!followed_by(p, i, OP_POP, &pop))
+    return false;
+  Instruction *next = followed_by(p, pop, load_op, &load);
+  if (!next || !same_operands(store, next))
+    return false;
+  kill(p, pop);
+  kill(p, load);
+  return true;
+}
+
+// STORE_VAR s; POP -> STORE_VAR_POP s
+static bool fuse_store_pop(Peephole *p, size_t i) {
+  if (!p->superinstructions || p->code[i].op != OP_STORE_VAR)
+    return false;
+
+  size_t pop;
+  if (!followed_by(p, i, OP_POP, &pop))
+    return false;
+  p->code[i].op = OP_STORE_VAR_POP;
+  kill(p, pop);
+  return true;
+}
+
+// Code after a jump or return that no jump lands on never runs
+static bool drop_unreachable(Peephole *p, size_t i) {
+  uint8_t op = p->code[i].op;
+  if (op != OP_JUMP && op != OP_RETURN && op != OP_HALT && op != OP_TAIL_CALL)
+    return false;
+
+  size_t next = next_live(p, i);
+  if (next >= p->count || p->code[next].refs > 0)
+    return false;
+  kill(p, next);
+  return true;
+}
+
+typedef bool (*Rule)(Peephole *p, size_t i);
+
+static const Rule rules[] = {
+    drop_push_pop,       fold_constant_condition, invert_jump,
+    thread_jump,         collapse_store_load,     fuse_store_pop,
+    drop_unreachable,
+};
+
+#define RULE_COUNT (sizeof(rules) / sizeof(rules[0]))
+
+// Decode `chunk` into p->code. Returns false if a jump does not land on an
+// instruction.
+static bool decode(Peephole *p, Chunk *chunk) {
+  size_t count = 0;
+  for (size_t offset = 0; offset < chunk->count;
+       offset += opcode_length(chunk->code[offset])) {
+    count++;
+  }
+
+  // Instruction index of each code offset
+  size_t *index = riau_alloc((chunk->count + 1) * sizeof(size_t));
+  for (size_t offset = 0; offset <= chunk->count; offset++) {
+    index[offset] = SIZE_MAX;
+  }
+
+  p->code = riau_calloc(count + 1, sizeof(Instruction));
+  p->count = count;
+  size_t i = 0;
+  for (size_t offset = 0; offset < chunk->count;
+       offset += opcode_length(chunk->code[offset]), i++) {
+    uint8_t op = chunk->code[offset];
+    Instruction *instruction = &p->code[i];
+    index[offset] = i;
+    instruction->line = chunk_get_line(chunk, offset);
+    if (is_jump(op)) {
+      instruction->op = short_jump(op);
+      instruction->length = 3;
+      instruction->target = chunk_jump_target(chunk, offset);
+    } else {
+      instruction->op = op;
+      instruction->length = opcode_length(op);
+      memcpy(instruction->operands, chunk->code + offset + 1,
+             instruction->length - 1);
+    }
+  }
+  index[chunk->count] = count;
+
+  bool ok = true;
+  for (i = 0; i < count; i++) {
+    Instruction *instruction = &p->code[i];
+    if (!is_jump(instruction->op))
+      continue;
+    if (instruction->target > chunk->count ||
+        index[instruction->target] == SIZE_MAX) {
+      ok = false;
+      break;
+    }
+    instruction->target = index[instruction->target];
+    p->code[instruction->target].refs++;
+  }
+  riau_free(index);
+  return ok;
+}
+
+// Offset of jump `i` once laid out at `at` with `length` bytes: forward
+// from its end, or back from it for FOR_ITER
+static size_t distance(Peephole *p, size_t *at, size_t i, int length) {
+  size_t end = at[i] + length;
+  size_t target = at[p->code[i].target];
+  return p->code[i].op == OP_FOR_ITER ? end - target : target - end;
+}
+
+// Write the live instructions back to `chunk`. Every jump is short if they
+// all fit in 16 bits and long otherwise, as after widen_jumps() in the
+// compiler.
+static void lay_out(Peephole *p, Chunk *chunk) {
+  // New offset of each instruction; a removed one gets the offset of the
+  // next one still there, where jumps to it now land
+  size_t *at = riau_alloc((p->count + 1) * sizeof(size_t));
+  bool wide = false;
+  for (;;) {
+    size_t offset = 0;
+    for (size_t i = 0; i < p->count; i++) {
+      at[i] = offset;
+      if (!p->code[i].dead) {
+        offset += is_jump(p->code[i].op) && wide ? 5 : p->code[i].length;
+      }
+    }
+    at[p->count] = offset;
+    if (wide)
+      break;
+
+    bool fits = true;
+    for (size_t i = 0; i < p->count && fits; i++) {
+      if (!p->code[i].dead && is_jump(p->code[i].op)) {
+        fits = distance(p, at, i, 3) <= UINT16_MAX;
+      }
+    }
+    if (fits)
+      break;
+    wide = true;
+  }
+
+  Chunk out;
+  chunk_init(&out);
+  for (size_t i = 0; i < p->count; i++) {
+    Instruction *instruction = &p->code[i];
+    if (instruction->dead)
+      continue;
+
+    int line = instruction->line;
+    if (!is_jump(instruction->op)) {
+      chunk_write(&out, instruction->op, line);
+      for (int k = 0; k < instruction->length - 1; k++) {
+        chunk_write(&out, instruction->operands[k], line);
+      }
+    } else if (wide) {
+      uint32_t jump = (uint32_t)distance(p, at, i, 5);
+      chunk_write(&out, long_jump(instruction->op), line);
+      chunk_write(&out, (uint8_t)(jump >> 24), line);
+      chunk_write(&out, (uint8_t)(jump >> 16), line);
+      chunk_write(&out, (uint8_t)(jump >> 8), line);
+      chunk_write(&out, (uint8_t)jump, line);
+    } else {
+      uint16_t jump = (uint16_t)distance(p, at, i, 3);
+      chunk_write(&out, instruction->op, line);
+      chunk_write(&out, (uint8_t)(jump >> 8), line);
+      chunk_write(&out, (uint8_t)jump, line);
+    }
+  }
+  riau_free(at);
+
+  // Constants and caches stay; only the code and its line table move
+  riau_free(chunk->code);
+  riau_free(chunk->lines);
+  chunk->code = out.code;
+  chunk->count = out.count;
+  chunk->capacity = out.capacity;
+  chunk->lines = out.lines;
+  chunk->line_count = out.line_count;
+  chunk->line_capacity = out.line_capacity;
+}
+
+int peephole_optimize(Chunk *chunk, bool superinstructions) {
+  // Quickening and native code refer to code offsets
+  if (chunk->count == 0 || chunk->quicken || chunk->jit)
+    return 0;
+
+  Peephole p;
+  p.superinstructions = superinstructions;
+  if (!decode(&p, chunk)) {
+    riau_free(p.code);
+    return 0;
+  }
+
+  // A rewrite can enable another one before it, so go over the code until
+  // nothing changes
+  int rewrites = 0;
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (size_t i = 0; i < p.count; i++) {
+      for (size_t r = 0; r < RULE_COUNT && !p.code[i].dead; r++) {
+        if (rules[r](&p, i)) {
+          rewrites++;
+          changed = true;
+        }
+      }
+    }
+  }
+
+  if (rewrites > 0) {
+    lay_out(&p, chunk);
+  }
+  riau_free(p.code);
+  return rewrites;
+}
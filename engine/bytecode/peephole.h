@@ -0,0 +1,37 @@
+#ifndef RIAU_PEEPHOLE_H
+#define RIAU_PEEPHOLE_H
+
+#include "bytecode.h"
+#include <stdbool.h>
+
+// Peephole optimizer
+//
+// Rewrites short instruction sequences of a finished chunk into shorter
+// ones with the same effect, using a table of rules:
+//
+//   PUSH x; POP                  -> (nothing)
+//   PUSH_TRUE; JUMP_IF_FALSE L   -> (nothing), and the other constants
+//   NOT; JUMP_IF_FALSE L         -> JUMP_IF_TRUE L, and the other way round
+//   JUMP L ... L: JUMP M         -> JUMP M, for conditional jumps too
+//   JUMP L; L:                   -> (nothing)
+//   JUMP L ... L: RETURN         -> RETURN
+//   STORE_VAR s; POP; LOAD_VAR s -> STORE_VAR s, for locals too
+//   STORE_VAR_POP s; LOAD_VAR s  -> STORE_VAR s
+//   STORE_VAR s; POP             -> STORE_VAR_POP s (superinstructions only)
+//   RETURN; <code no jump reaches> -> RETURN
+//
+// A sequence is only rewritten if no jump lands inside it, and rules run
+// until none applies, since one rewrite can expose another. Then the code
+// is laid out again: jumps get their new offsets, in the short form if they
+// all fit, and each instruction keeps its source line. Constants and
+// inline caches stay where they are.
+//
+// Arithmetic identities like `x + 0` are not rules: the instruction is
+// what checks that x is a number, and removing it would hide the error.
+
+// Optimize `chunk` in place; it must not have run yet. `superinstructions`
+// allows rules that produce fused instructions. Returns the number of
+// rewrites.
+int peephole_optimize(Chunk *chunk, bool superinstructions);
+
+#endif // RIAU_PEEPHOLE_H
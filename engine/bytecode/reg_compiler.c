@@ -0,0 +1,430 @@
+#include "reg_compiler.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+// Passed as `target` when the result may go in any register
+#define ANY_REGISTER -1
+
+static void compiler_error(RegCompiler *compiler, const char *format, ...) {
+  if (compiler->had_error)
+    return; // Keep the first error
+
+  va_list args;
+  va_start(args, format);
+  vsnprintf(compiler->error_message, sizeof(compiler->error_message), format,
+            args);
+  va_end(args);
+  compiler->had_error = true;
+}
+
+void reg_compiler_init(RegCompiler *compiler, RegChunk *chunk) {
+  compiler->chunk = chunk;
+  compiler->variable_count = 0;
+  compiler->next_register = 0;
+  compiler->had_error = false;
+  compiler->error_message[0] = '\0';
+}
+
+static void emit(RegCompiler *compiler, uint32_t instruction, int line) {
+  reg_chunk_write(compiler->chunk, instruction, line);
+}
+
+// Every property instruction gets its own inline cache, in the word after it
+static void emit_cache(RegCompiler *compiler, int line) {
+  emit(compiler, (uint32_t)chunk_add_cache(&compiler->chunk->pool), line);
+}
+
+static int find_variable(RegCompiler *compiler, const char *name) {
+  for (int i = compiler->variable_count - 1; i >= 0; i--) {
+    if (strcmp(compiler->variables[i], name) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+static int alloc_register(RegCompiler *compiler) {
+  if (compiler->next_register >= REG_WINDOW_MAX) {
+    compiler_error(compiler, "Expression needs more than %d registers",
+                   REG_WINDOW_MAX);
+    return 0;
+  }
+
+  int reg = compiler->next_register++;
+  if (compiler->next_register > compiler->chunk->register_count) {
+    compiler->chunk->register_count = compiler->next_register;
+  }
+  return reg;
+}
+
+static int dest_register(RegCompiler *compiler, int target) {
+  return target != ANY_REGISTER ? target : alloc_register(compiler);
+}
+
+// Release the temporaries above `mark` and leave the result of an
+// expression where the caller asked for it. Variables stay in place; a
+// temporary is moved down to `mark` so temporaries stay a stack.
+static int finish(RegCompiler *compiler, int mark, int reg, int target,
+                  int line) {
+  compiler->next_register = mark;
+  if (target == ANY_REGISTER && reg < compiler->variable_count)
+    return reg;
+
+  int dest = dest_register(compiler, target);
+  if (dest != reg) {
+    emit(compiler, REG_ABC(ROP_MOVE, dest, reg, 0), line);
+  }
+  return dest;
+}
+
+static int constant_index(RegCompiler *compiler, Constant constant,
+                          size_t limit) {
+  size_t index = chunk_add_constant(&compiler->chunk->pool, constant);
+  if (index > limit) {
+    compiler_error(compiler, "Too many constants");
+    return 0;
+  }
+  return (int)index;
+}
+
+static int name_constant(RegCompiler *compiler, const char *name) {
+  return constant_index(compiler, constant_string(name), 0xff);
+}
+
+static int compile_expression(RegCompiler *compiler, ASTNode *node, int target);
+
+static int compile_binary_op(RegCompiler *compiler, ASTNode *node,
+                             int target) {
+  const char *op = node->data.binary.operator;
+  RegOp rop;
+  if (strcmp(op, "+") == 0) {
+    rop = ROP_ADD;
+  } else if (strcmp(op, "-") == 0) {
+    rop = ROP_SUB;
+  } else if (strcmp(op, "*") == 0) {
+    rop = ROP_MUL;
+  } else if (strcmp(op, "/") == 0) {
+    rop = ROP_DIV;
+  } else if (strcmp(op, "%") == 0) {
+    rop = ROP_MOD;
+  } else if (strcmp(op, "==") == 0) {
+    rop = ROP_EQUAL;
+  } else if (strcmp(op, "!=") == 0) {
+    rop = ROP_NOT_EQUAL;
+  } else if (strcmp(op, "<") == 0) {
+    rop = ROP_LESS;
+  } else if (strcmp(op, "<=") == 0) {
+    rop = ROP_LESS_EQUAL;
+  } else if (strcmp(op, ">") == 0) {
+    rop = ROP_GREATER;
+  } else if (strcmp(op, ">=") == 0) {
+    rop = ROP_GREATER_EQUAL;
+  } else if (strcmp(op, "&&") == 0) {
+    rop = ROP_AND;
+  } else if (strcmp(op, "||") == 0) {
+    rop = ROP_OR;
+  } else {
+    compiler_error(compiler, "Unknown operator '%s'", op);
+    return 0;
+  }
+
+  // Both operands are read before the destination is written, so the
+  // destination may be one of them
+  int mark = compiler->next_register;
+  int left = compile_expression(compiler, node->data.binary.left, ANY_REGISTER);
+  int right =
+      compile_expression(compiler, node->data.binary.right, ANY_REGISTER);
+  compiler->next_register = mark;
+  int dest = dest_register(compiler, target);
+  emit(compiler, REG_ABC(rop, dest, left, right), node->line);
+  return dest;
+}
+
+static int compile_assignment(RegCompiler *compiler, ASTNode *node,
+                              int target) {
+  ASTNode *left = node->data.binary.left;
+  ASTNode *value = node->data.binary.right;
+  int mark = compiler->next_register;
+
+  switch (left->type) {
+  case AST_IDENTIFIER: {
+    int reg = find_variable(compiler, left->data.identifier.name);
+    if (reg == -1) {
+      compiler_error(compiler, "Undefined variable '%s'",
+                     left->data.identifier.name);
+      return 0;
+    }
+    compile_expression(compiler, value, reg);
+    return finish(compiler, mark, reg, target, node->line);
+  }
+
+  case AST_MEMBER_EXPR: {
+    int object = compile_expression(compiler, left->data.member.object,
+                                    ANY_REGISTER);
+    int key = name_constant(compiler, left->data.member.property);
+    int result = compile_expression(compiler, value, ANY_REGISTER);
+    emit(compiler, REG_ABC(ROP_SET_FIELD, object, key, result), node->line);
+    emit_cache(compiler, node->line);
+    return finish(compiler, mark, result, target, node->line);
+  }
+
+  case AST_INDEX_EXPR: {
+    int object =
+        compile_expression(compiler, left->data.index.array, ANY_REGISTER);
+    int key = compile_expression(compiler, left->data.index.index, ANY_REGISTER);
+    int result = compile_expression(compiler, value, ANY_REGISTER);
+    emit(compiler, REG_ABC(ROP_SET_INDEX, object, key, result), node->line);
+    emit_cache(compiler, node->line);
+    return finish(compiler, mark, result, target, node->line);
+  }
+
+  default:
+    compiler_error(compiler, "Invalid assignment target");
+    return 0;
+  }
+}
+
+static bool is_call_to(ASTNode *node, const char *name) {
+  return node->type == AST_CALL_EXPR &&
+         node->data.call.callee->type == AST_IDENTIFIER &&
+         strcmp(node->data.call.callee->data.identifier.name, name) == 0;
+}
+
+static ASTNode *single_argument(RegCompiler *compiler, ASTNode *node,
+                                const char *name) {
+  ASTNodeList *args = node->data.call.arguments;
+  if (!args || !args->node) {
+    compiler_error(compiler, "%s() requires one argument", name);
+    return NULL;
+  }
+  return args->node;
+}
+
+// print(x) as a statement: no null result to materialize
+static void compile_print(RegCompiler *compiler, ASTNode *node) {
+  ASTNode *arg = single_argument(compiler, node, "print");
+  if (!arg)
+    return;
+
+  int mark = compiler->next_register;
+  int reg = compile_expression(compiler, arg, ANY_REGISTER);
+  emit(compiler, REG_ABC(ROP_PRINT, reg, 0, 0), node->line);
+  compiler->next_register = mark;
+}
+
+static int compile_call(RegCompiler *compiler, ASTNode *node, int target) {
+  if (is_call_to(node, "print")) {
+    compile_print(compiler, node);
+    int dest = dest_register(compiler, target);
+    emit(compiler, REG_ABC(ROP_LOADNULL, dest, 0, 0), node->line);
+    return dest;
+  }
+
+  if (is_call_to(node, "env")) {
+    ASTNode *arg = single_argument(compiler, node, "env");
+    if (!arg)
+      return 0;
+    int mark = compiler->next_register;
+    int name = compile_expression(compiler, arg, ANY_REGISTER);
+    compiler->next_register = mark;
+    int dest = dest_register(compiler, target);
+    emit(compiler, REG_ABC(ROP_ENV, dest, name, 0), node->line);
+    return dest;
+  }
+
+  compiler_error(compiler,
+                 "Function calls are not supported by the register backend");
+  return 0;
+}
+
+static int compile_expression(RegCompiler *compiler, ASTNode *node,
+                              int target) {
+  int mark = compiler->next_register;
+
+  switch (node->type) {
+  case AST_LITERAL_NUMBER:
+  case AST_LITERAL_STRING: {
+    Constant constant;
+    if (node->type == AST_LITERAL_STRING) {
+      constant = constant_string(node->data.string.value);
+    } else if (node->data.number.is_integer) {
+      constant = constant_int((int32_t)node->data.number.value);
+    } else {
+      constant = constant_number(node->data.number.value);
+    }
+    int index = constant_index(compiler, constant, 0xffff);
+    int dest = dest_register(compiler, target);
+    emit(compiler, REG_ABX(ROP_LOADK, dest, index), node->line);
+    return dest;
+  }
+
+  case AST_LITERAL_BOOL: {
+    int dest = dest_register(compiler, target);
+    RegOp op = node->data.boolean.value ? ROP_LOADTRUE : ROP_LOADFALSE;
+    emit(compiler, REG_ABC(op, dest, 0, 0), node->line);
+    return dest;
+  }
+
+  case AST_LITERAL_NULL: {
+    int dest = dest_register(compiler, target);
+    emit(compiler, REG_ABC(ROP_LOADNULL, dest, 0, 0), node->line);
+    return dest;
+  }
+
+  case AST_IDENTIFIER: {
+    // A variable is already in a register: no instruction unless the
+    // caller wants it somewhere else
+    int reg = find_variable(compiler, node->data.identifier.name);
+    if (reg == -1) {
+      compiler_error(compiler, "Undefined variable '%s'",
+                     node->data.identifier.name);
+      return 0;
+    }
+    return finish(compiler, mark, reg, target, node->line);
+  }
+
+  case AST_BINARY_EXPR:
+    if (strcmp(node->data.binary.operator, "=") == 0) {
+      return compile_assignment(compiler, node, target);
+    }
+    return compile_binary_op(compiler, node, target);
+
+  case AST_UNARY_EXPR: {
+    const char *op = node->data.unary.operator;
+    if (strcmp(op, "~") == 0) {
+      compiler_error(compiler, "Unknown operator '%s'", op);
+      return dest_register(compiler, target);
+    }
+    int operand =
+        compile_expression(compiler, node->data.unary.operand, ANY_REGISTER);
+    compiler->next_register = mark;
+    int dest = dest_register(compiler, target);
+    RegOp rop = strcmp(op, "-") == 0 ? ROP_NEGATE : ROP_NOT;
+    emit(compiler, REG_ABC(rop, dest, operand, 0), node->line);
+    return dest;
+  }
+
+  case AST_CALL_EXPR:
+    return compile_call(compiler, node, target);
+
+  case AST_OBJECT_LITERAL: {
+    // Built in a fresh register: the field values may still read the
+    // variable the object is being assigned to
+    int object = alloc_register(compiler);
+    emit(compiler, REG_ABC(ROP_NEW_OBJECT, object, 0, 0), node->line);
+
+    for (ASTNodeList *pairs = node->data.object.pairs; pairs;
+         pairs = pairs->next) {
+      ASTNode *pair = pairs->node;
+      int key = name_constant(compiler, pair->data.binary.left->data.string.value);
+      int value =
+          compile_expression(compiler, pair->data.binary.right, ANY_REGISTER);
+      emit(compiler, REG_ABC(ROP_SET_FIELD, object, key, value), pair->line);
+      emit_cache(compiler, pair->line);
+      compiler->next_register = object + 1;
+    }
+    return finish(compiler, mark, object, target, node->line);
+  }
+
+  case AST_MEMBER_EXPR: {
+    int object =
+        compile_expression(compiler, node->data.member.object, ANY_REGISTER);
+    int key = name_constant(compiler, node->data.member.property);
+    compiler->next_register = mark;
+    int dest = dest_register(compiler, target);
+    emit(compiler, REG_ABC(ROP_GET_FIELD, dest, object, key), node->line);
+    emit_cache(compiler, node->line);
+    return dest;
+  }
+
+  case AST_INDEX_EXPR: {
+    int object =
+        compile_expression(compiler, node->data.index.array, ANY_REGISTER);
+    int key = compile_expression(compiler, node->data.index.index, ANY_REGISTER);
+    compiler->next_register = mark;
+    int dest = dest_register(compiler, target);
+    emit(compiler, REG_ABC(ROP_GET_INDEX, dest, object, key), node->line);
+    emit_cache(compiler, node->line);
+    return dest;
+  }
+
+  default:
+    compiler_error(compiler, "Unknown expression type");
+    return 0;
+  }
+}
+
+static void compile_statement(RegCompiler *compiler, ASTNode *node) {
+  if (!node)
+    return;
+
+  switch (node->type) {
+  case AST_EXPR_STMT: {
+    ASTNode *expr = node->data.expr_stmt.expression;
+    if (is_call_to(expr, "print")) {
+      compile_print(compiler, expr);
+    } else {
+      compile_expression(compiler, expr, ANY_REGISTER);
+    }
+    compiler->next_register = compiler->variable_count;
+    break;
+  }
+
+  case AST_VARIABLE_DECL: {
+    if (compiler->variable_count >= REG_WINDOW_MAX) {
+      compiler_error(compiler, "Too many variables");
+      return;
+    }
+    int reg = compiler->variable_count++;
+    compiler->variables[reg] = node->data.var_decl.name;
+    compiler->next_register = reg;
+    alloc_register(compiler);
+
+    if (node->data.var_decl.initializer) {
+      compile_expression(compiler, node->data.var_decl.initializer, reg);
+    } else {
+      emit(compiler, REG_ABC(ROP_LOADNULL, reg, 0, 0), node->line);
+    }
+    compiler->next_register = compiler->variable_count;
+    break;
+  }
+
+  case AST_RETURN_STMT:
+    compiler_error(compiler, "'return' outside of a function");
+    break;
+
+  case AST_BLOCK: {
+    for (ASTNodeList *stmts = node->data.block.statements; stmts;
+         stmts = stmts->next) {
+      compile_statement(compiler, stmts->node);
+    }
+    break;
+  }
+
+  default:
+    // Same as the stack compiler: unsupported statements are skipped
+    break;
+  }
+}
+
+bool reg_compiler_compile(RegCompiler *compiler, ASTNode *ast) {
+  if (!ast)
+    return false;
+
+  if (ast->type == AST_PROGRAM) {
+    for (ASTNodeList *stmts = ast->data.program.statements; stmts;
+         stmts = stmts->next) {
+      compile_statement(compiler, stmts->node);
+    }
+  }
+
+  emit(compiler, REG_ABC(ROP_HALT, 0, 0, 0), 0);
+  return !compiler->had_error;
+}
+
+void reg_compiler_print_error(RegCompiler *compiler) {
+  if (compiler->had_error) {
+    fprintf(stderr, "Compilation error: %s\n", compiler->error_message);
+  }
+}
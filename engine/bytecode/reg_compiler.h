@@ -0,0 +1,27 @@
+#ifndef RIAU_REG_COMPILER_H
+#define RIAU_REG_COMPILER_H
+
+#include "../ast/ast.h"
+#include "regcode.h"
+#include <stdbool.h>
+
+// Register compiler state
+//
+// Variables own the low registers of the window, in declaration order.
+// Temporaries are allocated above them like a stack and released at the
+// end of each statement.
+typedef struct {
+  RegChunk *chunk;
+  const char *variables[REG_WINDOW_MAX];
+  int variable_count;
+  int next_register;
+  bool had_error;
+  char error_message[512];
+} RegCompiler;
+
+// Register compiler functions
+void reg_compiler_init(RegCompiler *compiler, RegChunk *chunk);
+bool reg_compiler_compile(RegCompiler *compiler, ASTNode *ast);
+void reg_compiler_print_error(RegCompiler *compiler);
+
+#endif // RIAU_REG_COMPILER_H
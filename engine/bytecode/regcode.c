@@ -0,0 +1,189 @@
+#include "regcode.h"
+#include "../runtime/arena.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+void reg_chunk_init(RegChunk *chunk) {
+  chunk->code = NULL;
+  chunk->count = 0;
+  chunk->capacity = 0;
+  chunk->lines = NULL;
+  chunk->register_count = 0;
+  chunk_init(&chunk->pool);
+}
+
+void reg_chunk_free(RegChunk *chunk) {
+  riau_free(chunk->code);
+  riau_free(chunk->lines);
+  chunk_free(&chunk->pool);
+  reg_chunk_init(chunk);
+}
+
+void reg_chunk_write(RegChunk *chunk, uint32_t instruction, int line) {
+  if (chunk->capacity < chunk->count + 1) {
+    size_t old_capacity = chunk->capacity;
+    chunk->capacity = old_capacity < 8 ? 8 : old_capacity * 2;
+    chunk->code = riau_realloc(chunk->code, chunk->capacity * sizeof(uint32_t));
+    chunk->lines = riau_realloc(chunk->lines, chunk->capacity * sizeof(int));
+  }
+
+  chunk->code[chunk->count] = instruction;
+  chunk->lines[chunk->count] = line;
+  chunk->count++;
+}
+
+const char *reg_opcode_name(RegOp op) {
+  switch (op) {
+  case ROP_HALT:
+    return "HALT";
+  case ROP_LOADK:
+    return "LOADK";
+  case ROP_LOADNULL:
+    return "LOADNULL";
+  case ROP_LOADTRUE:
+    return "LOADTRUE";
+  case ROP_LOADFALSE:
+    return "LOADFALSE";
+  case ROP_MOVE:
+    return "MOVE";
+  case ROP_ADD:
+    return "ADD";
+  case ROP_SUB:
+    return "SUB";
+  case ROP_MUL:
+    return "MUL";
+  case ROP_DIV:
+    return "DIV";
+  case ROP_MOD:
+    return "MOD";
+  case ROP_EQUAL:
+    return "EQUAL";
+  case ROP_NOT_EQUAL:
+    return "NOT_EQUAL";
+  case ROP_LESS:
+    return "LESS";
+  case ROP_LESS_EQUAL:
+    return "LESS_EQUAL";
+  case ROP_GREATER:
+    return "GREATER";
+  case ROP_GREATER_EQUAL:
+    return "GREATER_EQUAL";
+  case ROP_AND:
+    return "AND";
+  case ROP_OR:
+    return "OR";
+  case ROP_NEGATE:
+    return "NEGATE";
+  case ROP_NOT:
+    return "NOT";
+  case ROP_NEW_OBJECT:
+    return "NEW_OBJECT";
+  case ROP_GET_FIELD:
+    return "GET_FIELD";
+  case ROP_SET_FIELD:
+    return "SET_FIELD";
+  case ROP_GET_INDEX:
+    return "GET_INDEX";
+  case ROP_SET_INDEX:
+    return "SET_INDEX";
+  case ROP_ENV:
+    return "ENV";
+  case ROP_PRINT:
+    return "PRINT";
+  default:
+    return "UNKNOWN";
+  }
+}
+
+// Size in words of an instruction, cache word included
+int reg_opcode_length(RegOp op) {
+  switch (op) {
+  case ROP_GET_FIELD:
+  case ROP_SET_FIELD:
+  case ROP_GET_INDEX:
+  case ROP_SET_INDEX:
+    return 2;
+  default:
+    return 1;
+  }
+}
+
+static void print_constant(Chunk *pool, int index) {
+  Constant *c = &pool->constants[index];
+  if (c->type == CONST_NUMBER) {
+    printf("'%g'", c->as.number);
+  } else if (c->type == CONST_INT) {
+    printf("'%d'", c->as.integer);
+  } else if (c->type == CONST_STRING) {
+    printf("'%s'", c->as.string->chars);
+  }
+}
+
+int reg_chunk_disassemble_instruction(RegChunk *chunk, int offset) {
+  printf("%04d ", offset);
+
+  if (offset > 0 && chunk->lines[offset] == chunk->lines[offset - 1]) {
+    printf("   | ");
+  } else {
+    printf("%4d ", chunk->lines[offset]);
+  }
+
+  uint32_t instruction = chunk->code[offset];
+  RegOp op = REG_OP(instruction);
+  const char *name = reg_opcode_name(op);
+  int a = REG_A(instruction);
+  int b = REG_B(instruction);
+  int c = REG_C(instruction);
+
+  switch (op) {
+  case ROP_HALT:
+    printf("%s\n", name);
+    break;
+  case ROP_LOADK:
+    printf("%-12s r%-3d ", name, a);
+    print_constant(&chunk->pool, REG_BX(instruction));
+    printf("\n");
+    break;
+  case ROP_LOADNULL:
+  case ROP_LOADTRUE:
+  case ROP_LOADFALSE:
+  case ROP_NEW_OBJECT:
+  case ROP_PRINT:
+    printf("%-12s r%d\n", name, a);
+    break;
+  case ROP_MOVE:
+  case ROP_NEGATE:
+  case ROP_NOT:
+  case ROP_ENV:
+    printf("%-12s r%-3d r%d\n", name, a, b);
+    break;
+  case ROP_GET_FIELD:
+    printf("%-12s r%-3d r%-3d ", name, a, b);
+    print_constant(&chunk->pool, c);
+    printf(" ic %u\n", chunk->code[offset + 1]);
+    break;
+  case ROP_SET_FIELD:
+    printf("%-12s r%-3d ", name, a);
+    print_constant(&chunk->pool, b);
+    printf(" r%d ic %u\n", c, chunk->code[offset + 1]);
+    break;
+  case ROP_GET_INDEX:
+  case ROP_SET_INDEX:
+    printf("%-12s r%-3d r%-3d r%d ic %u\n", name, a, b, c,
+           chunk->code[offset + 1]);
+    break;
+  default:
+    printf("%-12s r%-3d r%-3d r%d\n", name, a, b, c);
+    break;
+  }
+
+  return offset + reg_opcode_length(op);
+}
+
+void reg_chunk_disassemble(RegChunk *chunk, const char *name) {
+  printf("== %s (%d registers) ==\n", name, chunk->register_count);
+
+  for (size_t offset = 0; offset < chunk->count;) {
+    offset = reg_chunk_disassemble_instruction(chunk, offset);
+  }
+}
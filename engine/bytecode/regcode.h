@@ -0,0 +1,85 @@
+#ifndef RIAU_REGCODE_H
+#define RIAU_REGCODE_H
+
+#include "bytecode.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Register bytecode
+//
+// The second backend compiles to fixed-width 32-bit three-address
+// instructions over a frame's register window instead of pushing and
+// popping the VM stack. An instruction is an 8-bit opcode followed by
+// either three 8-bit operands A, B, C or an 8-bit A and a 16-bit Bx:
+//
+//   | op:8 | A:8 | B:8 | C:8 |      | op:8 | A:8 | Bx:16 |
+//
+// Property instructions (+ic) are followed by one extra word holding the
+// index of their inline cache.
+typedef enum {
+  ROP_HALT,           //            Stop execution
+  ROP_LOADK,          // A Bx       R[A] = K[Bx]
+  ROP_LOADNULL,       // A          R[A] = null
+  ROP_LOADTRUE,       // A          R[A] = true
+  ROP_LOADFALSE,      // A          R[A] = false
+  ROP_MOVE,           // A B        R[A] = R[B]
+  ROP_ADD,            // A B C      R[A] = R[B] + R[C]
+  ROP_SUB,            // A B C      R[A] = R[B] - R[C]
+  ROP_MUL,            // A B C      R[A] = R[B] * R[C]
+  ROP_DIV,            // A B C      R[A] = R[B] / R[C]
+  ROP_MOD,            // A B C      R[A] = R[B] % R[C]
+  ROP_EQUAL,          // A B C      R[A] = R[B] == R[C]
+  ROP_NOT_EQUAL,      // A B C      R[A] = R[B] != R[C]
+  ROP_LESS,           // A B C      R[A] = R[B] < R[C]
+  ROP_LESS_EQUAL,     // A B C      R[A] = R[B] <= R[C]
+  ROP_GREATER,        // A B C      R[A] = R[B] > R[C]
+  ROP_GREATER_EQUAL,  // A B C      R[A] = R[B] >= R[C]
+  ROP_AND,            // A B C      R[A] = R[B] && R[C]
+  ROP_OR,             // A B C      R[A] = R[B] || R[C]
+  ROP_NEGATE,         // A B        R[A] = -R[B]
+  ROP_NOT,            // A B        R[A] = !R[B]
+  ROP_NEW_OBJECT,     // A          R[A] = {}
+  ROP_GET_FIELD,      // A B C +ic  R[A] = R[B].K[C]
+  ROP_SET_FIELD,      // A B C +ic  R[A].K[B] = R[C]
+  ROP_GET_INDEX,      // A B C +ic  R[A] = R[B][R[C]]
+  ROP_SET_INDEX,      // A B C +ic  R[A][R[B]] = R[C]
+  ROP_ENV,            // A B        R[A] = env(R[B])
+  ROP_PRINT,          // A          print(R[A])
+} RegOp;
+
+#define REG_OP(i) ((RegOp)((i) >> 24))
+#define REG_A(i) (((i) >> 16) & 0xff)
+#define REG_B(i) (((i) >> 8) & 0xff)
+#define REG_C(i) ((i) & 0xff)
+#define REG_BX(i) ((i) & 0xffff)
+
+#define REG_ABC(op, a, b, c)                                                   \
+  (((uint32_t)(op) << 24) | ((uint32_t)(a) << 16) | ((uint32_t)(b) << 8) |    \
+   (uint32_t)(c))
+#define REG_ABX(op, a, bx)                                                     \
+  (((uint32_t)(op) << 24) | ((uint32_t)(a) << 16) | (uint32_t)(bx))
+
+// Registers per frame window; operands are 8 bits wide
+#define REG_WINDOW_MAX 256
+
+// Register chunk. Constants and inline caches live in `pool`, a regular
+// chunk whose code is left empty, so both backends share one constant and
+// cache implementation.
+typedef struct {
+  uint32_t *code;
+  size_t count;
+  size_t capacity;
+  int *lines;
+  int register_count; // Window size the code needs
+  Chunk pool;
+} RegChunk;
+
+void reg_chunk_init(RegChunk *chunk);
+void reg_chunk_free(RegChunk *chunk);
+void reg_chunk_write(RegChunk *chunk, uint32_t instruction, int line);
+const char *reg_opcode_name(RegOp op);
+int reg_opcode_length(RegOp op);
+int reg_chunk_disassemble_instruction(RegChunk *chunk, int offset);
+void reg_chunk_disassemble(RegChunk *chunk, const char *name);
+
+#endif // RIAU_REGCODE_H
@@ -1,8 +1,17 @@
 #include "../bytecode/bytecode.h"
+#include "../bytecode/chunk_cache.h"
 #include "../bytecode/compiler.h"
+#include "../bytecode/reg_compiler.h"
 #include "../lexer/lexer.h"
+#include "../optimizer/optimizer.h"
 #include "../parser/parser.h"
+#include "../runtime/arena.h"
 #include "../semantic/semantic.h"
+#include "../stdlib/stdlib.h"
+#include "../vm/aot.h"
+#include "../vm/jit.h"
+#include "../vm/reg_vm.h"
+#include "../vm/snapshot.h"
 #include "../vm/vm.h"
 #include <stdio.h>
 #include <stdlib.h>
@@ -10,6 +19,17 @@
 
 #define VERSION "0.1.1"
 
+static bool debug = false; // Report what the optimizer did
+static bool show_stats = false;
+static bool use_registers = false;
+static bool emit_c = false; // Write the compiled script as C instead
+static bool use_cache = false; // Reuse compiled bytecode (chunk_cache.h)
+static bool make_snapshot = false; // Save the heap after running (snapshot.h)
+static const char *image_path = NULL; // Start from a heap snapshot
+#ifdef RIAU_JIT
+static uint32_t jit_threshold = JIT_THRESHOLD;
+#endif
+
 static void print_banner() {
   printf("Riau Programming Language v%s\n", VERSION);
   printf("Type 'exit' to quit\n\n");
@@ -26,7 +46,7 @@ static char *read_file(const char *path) {
   size_t file_size = ftell(file);
   rewind(file);
 
-  char *buffer = malloc(file_size + 1);
+  char *buffer = riau_alloc(file_size + 1);
   if (!buffer) {
     fprintf(stderr, "Not enough memory to read \"%s\"\n", path);
     fclose(file);
@@ -36,7 +56,7 @@ static char *read_file(const char *path) {
   size_t bytes_read = fread(buffer, sizeof(char), file_size, file);
   if (bytes_read < file_size) {
     fprintf(stderr, "Could not read file \"%s\"\n", path);
-    free(buffer);
+    riau_free(buffer);
     fclose(file);
     return NULL;
   }
@@ -46,12 +66,53 @@ static char *read_file(const char *path) {
   return buffer;
 }
 
-static void run_file(const char *path) {
-  char *source = read_file(path);
-  if (!source) {
-    exit(74);
+// Compile and run with the register backend; returns the exit status
+static int run_registers(ASTNode *ast) {
+  RegChunk chunk;
+  reg_chunk_init(&chunk);
+
+  RegCompiler compiler;
+  reg_compiler_init(&compiler, &chunk);
+
+  if (!reg_compiler_compile(&compiler, ast)) {
+    reg_compiler_print_error(&compiler);
+    reg_chunk_free(&chunk);
+    return 65;
+  }
+
+  printf("✓ Compilation successful (registers)\n");
+
+  RegVM vm;
+  reg_vm_init(&vm);
+
+  printf("\n--- Execution Output ---\n");
+  bool result = reg_vm_execute(&vm, &chunk);
+  printf("--- End Output ---\n\n");
+
+  if (!result) {
+    reg_vm_print_error(&vm);
+    reg_vm_free(&vm);
+    reg_chunk_free(&chunk);
+    return 70;
   }
 
+  printf("✓ Execution successful\n");
+
+  if (show_stats) {
+    gc_print_stats(stderr);
+  }
+
+  if (!arena_active) {
+    reg_vm_free(&vm);
+    gc_free_heap();
+    reg_chunk_free(&chunk);
+  }
+  return 0;
+}
+
+// Lex, parse, analyze against the globals of `image`, if any, and optimize;
+// exits on an error
+static ASTNode *parse_file(char *source, Snapshot *image) {
   // Lexer
   Lexer lexer;
   lexer_init(&lexer, source);
@@ -64,47 +125,153 @@ static void run_file(const char *path) {
   if (parser_had_error(&parser)) {
     parser_print_errors(&parser);
     ast_free(ast);
-    free(source);
+    riau_free(source);
     exit(65);
   }
 
-  printf("✓ Parsing successful\n");
+  if (!emit_c) {
+    printf("✓ Parsing successful\n");
+  }
 
   // Semantic analysis
   SemanticAnalyzer analyzer;
   semantic_init(&analyzer);
+  for (int i = 0; image && i < image->name_count; i++) {
+    semantic_define_global(&analyzer, image->names[i]);
+  }
 
   if (!semantic_analyze(&analyzer, ast)) {
     semantic_print_errors(&analyzer);
     semantic_free(&analyzer);
     ast_free(ast);
-    free(source);
+    riau_free(source);
     exit(65);
   }
 
-  printf("✓ Semantic analysis passed\n");
+  if (!emit_c) {
+    printf("✓ Semantic analysis passed\n");
+  }
   semantic_free(&analyzer);
 
-  // Compile to bytecode
+  Optimizer optimizer;
+  optimizer_init(&optimizer);
+  optimizer_run(&optimizer, ast);
+  if (debug && !emit_c) {
+    optimizer_print_report(&optimizer);
+  }
+  return ast;
+}
+
+static void run_file(const char *path) {
+  char *source = read_file(path);
+  if (!source) {
+    exit(74);
+  }
+
+  // A heap snapshot stands in for running its prelude first
+  Snapshot image;
+  Snapshot *prelude = NULL;
+  if (image_path && !make_snapshot) {
+    if (use_registers || emit_c) {
+      fprintf(stderr, "--image only works with the stack VM\n");
+      exit(64);
+    }
+    if (!snapshot_load(image_path, VERSION, &image)) {
+      fprintf(stderr, "Could not load heap snapshot \"%s\"\n", image_path);
+      exit(74);
+    }
+    prelude = &image;
+    printf("✓ Loaded heap snapshot from %s\n", image_path);
+  }
+
+  // Bytecode compiled on top of a snapshot depends on its global slots
+  char version[CACHE_VERSION_SIZE];
+  if (prelude) {
+    snprintf(version, sizeof(version), "%s+%016llx", VERSION,
+             (unsigned long long)snapshot_id(prelude));
+  } else {
+    snprintf(version, sizeof(version), "%s", VERSION);
+  }
+
   Chunk chunk;
   chunk_init(&chunk);
+  ASTNode *ast = NULL;
+  SnapshotWriter snapshot;
+
+  // A cache hit skips the whole front end. A snapshot needs the
+  // compiler's global names, so it always compiles.
+  char *cache_path = NULL;
+  if (use_cache && !use_registers && !emit_c && !make_snapshot) {
+    cache_path = chunk_cache_path(path, source);
+  }
+  if (cache_path && chunk_cache_load(cache_path, version, source, &chunk)) {
+    printf("✓ Loaded compiled bytecode from %s\n", cache_path);
+  } else {
+    ast = parse_file(source, prelude);
+
+    if (use_registers && !emit_c) {
+      int status = run_registers(ast);
+      if (!arena_active) {
+        ast_free(ast);
+        riau_free(source);
+      }
+      if (status != 0) {
+        exit(status);
+      }
+      return;
+    }
 
-  Compiler compiler;
-  compiler_init(&compiler, &chunk);
+    // Compile to bytecode
+    Compiler compiler;
+    compiler_init(&compiler, &chunk);
+    for (int i = 0; prelude && i < prelude->name_count; i++) {
+      compiler_define_global(prelude->names[i]);
+    }
 
-  if (!compiler_compile(&compiler, ast)) {
-    compiler_print_error(&compiler);
-    chunk_free(&chunk);
-    ast_free(ast);
-    free(source);
-    exit(65);
-  }
+    if (!compiler_compile(&compiler, ast)) {
+      compiler_print_error(&compiler);
+      chunk_free(&chunk);
+      ast_free(ast);
+      riau_free(source);
+      exit(65);
+    }
 
-  printf("✓ Compilation successful\n");
+    if (emit_c) {
+      bool written = aot_emit_c(&chunk, path, stdout);
+      chunk_free(&chunk);
+      ast_free(ast);
+      riau_free(source);
+      if (!written) {
+        fprintf(stderr, "Could not write C output\n");
+        exit(74);
+      }
+      return;
+    }
+
+    printf("✓ Compilation successful\n");
+
+    // Before running: quickening rewrites the code in place. A cache that
+    // cannot be written (say, a read-only web root) only costs the next
+    // run a compile.
+    if (cache_path) {
+      chunk_cache_store(cache_path, version, source, &chunk);
+    }
+    if (make_snapshot) {
+      snapshot_begin(&snapshot, VERSION, &chunk);
+    }
+  }
+  riau_free(cache_path);
 
   // Execute bytecode
   VM vm;
   vm_init(&vm);
+  stdlib_register_builtins(&vm);
+#ifdef RIAU_JIT
+  vm.jit_threshold = jit_threshold;
+#endif
+  if (prelude) {
+    snapshot_restore(prelude, &vm);
+  }
 
   printf("\n--- Execution Output ---\n");
   bool result = vm_execute(&vm, &chunk);
@@ -115,16 +282,51 @@ static void run_file(const char *path) {
     vm_free(&vm);
     chunk_free(&chunk);
     ast_free(ast);
-    free(source);
+    riau_free(source);
     exit(70);
   }
 
   printf("✓ Execution successful\n");
 
+  if (make_snapshot) {
+    int name_count = compiler_global_count();
+    const char **names = riau_alloc((name_count + 1) * sizeof(char *));
+    for (int i = 0; i < name_count; i++) {
+      names[i] = compiler_global_name(i);
+    }
+    char *snapshot_file = snapshot_path(path);
+    if (!snapshot_finish(&snapshot, &vm, snapshot_file, names, name_count)) {
+      fprintf(stderr, "Snapshot error: %s\n", snapshot.error_message);
+      exit(70);
+    }
+    printf("✓ Saved heap snapshot to %s\n", snapshot_file);
+    riau_free(snapshot_file);
+    riau_free(names);
+  }
+
+  if (show_stats) {
+    chunk_print_quicken_stats(&chunk, stderr);
+    gc_print_stats(stderr);
+#ifdef RIAU_JIT
+    jit_print_stats(stderr);
+#endif
+    if (arena_active) {
+      fprintf(stderr, "Arena: %zu bytes\n", arena_bytes());
+    }
+  }
+
+  // The arena and the heap go away with the process
+  if (arena_active)
+    return;
+
   vm_free(&vm);
+  gc_free_heap();
   chunk_free(&chunk);
+  if (prelude) {
+    snapshot_free(prelude);
+  }
   ast_free(ast);
-  free(source);
+  riau_free(source);
 }
 
 static void repl() {
@@ -175,7 +377,23 @@ static void print_usage() {
   printf("Options:\n");
   printf("  -h, --help     Show this help message\n");
   printf("  -v, --version  Show version information\n");
-  printf("  -d, --debug    Enable debug output\n");
+  printf("  -d, --debug    Enable debug output (what the optimizer removed)\n");
+  printf("  -s, --stats    Print quickening and GC statistics after running\n");
+  printf("  -r, --registers  Run on the register-based backend\n");
+  printf("  -a, --arena    Allocate from an arena and skip teardown (default "
+         "under CGI)\n");
+  printf("  -c, --cache    Reuse compiled bytecode from script.riauc (default "
+         "under CGI)\n");
+  printf("  --snapshot     Run the script, then save its globals and heap to "
+         "script.riaus\n");
+  printf("  --image FILE  Start from a heap snapshot (default: "
+         "$RIAU_IMAGE)\n");
+  printf("  --emit-c       Write the compiled script to stdout as C (see "
+         "tools/aot_build.sh)\n");
+#ifdef RIAU_JIT
+  printf("  --jit-eager    Compile every chunk to native code on first entry\n");
+  printf("  --no-jit       Run everything on the interpreter\n");
+#endif
   printf("\n");
   printf("If no file is specified, starts REPL mode\n");
 }
@@ -186,6 +404,19 @@ int main(int argc, char *argv[]) {
     return 0;
   }
 
+  // One script per process: allocate from an arena, exit without teardown
+#ifdef RIAU_ARENA
+  arena_enable();
+#endif
+  if (getenv("GATEWAY_INTERFACE")) {
+    arena_enable();
+    use_cache = true;
+  }
+  image_path = getenv("RIAU_IMAGE");
+  if (image_path && !*image_path) {
+    image_path = NULL;
+  }
+
   for (int i = 1; i < argc; i++) {
     if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
       print_usage();
@@ -195,8 +426,42 @@ int main(int argc, char *argv[]) {
       printf("Riau v%s\n", VERSION);
       return 0;
     } else if (strcmp(argv[i], "-d") == 0 || strcmp(argv[i], "--debug") == 0) {
-      // Enable debug mode
+      debug = true;
+      continue;
+    } else if (strcmp(argv[i], "-s") == 0 || strcmp(argv[i], "--stats") == 0) {
+      show_stats = true;
+      continue;
+    } else if (strcmp(argv[i], "-r") == 0 ||
+               strcmp(argv[i], "--registers") == 0) {
+      use_registers = true;
+      continue;
+    } else if (strcmp(argv[i], "-a") == 0 || strcmp(argv[i], "--arena") == 0) {
+      arena_enable();
+      continue;
+    } else if (strcmp(argv[i], "-c") == 0 || strcmp(argv[i], "--cache") == 0) {
+      use_cache = true;
+      continue;
+    } else if (strcmp(argv[i], "--snapshot") == 0) {
+      make_snapshot = true;
+      continue;
+    } else if (strcmp(argv[i], "--image") == 0) {
+      if (i + 1 == argc) {
+        fprintf(stderr, "--image needs a snapshot file\n");
+        return 64;
+      }
+      image_path = argv[++i];
+      continue;
+    } else if (strcmp(argv[i], "--emit-c") == 0) {
+      emit_c = true;
+      continue;
+#ifdef RIAU_JIT
+    } else if (strcmp(argv[i], "--jit-eager") == 0) {
+      jit_threshold = 0;
+      continue;
+    } else if (strcmp(argv[i], "--no-jit") == 0) {
+      jit_threshold = JIT_NEVER;
       continue;
+#endif
     } else {
       run_file(argv[i]);
       return 0;
@@ -1,4 +1,5 @@
 #include "error_reporter.h"
+#include "../runtime/arena.h"
 #include <ctype.h>
 #include <stdarg.h>
 #include <stdio.h>
@@ -71,7 +72,7 @@ char *suggest_similar_name(const char *target, const char **candidates,
   }
 
   if (best_match) {
-    return strdup(best_match);
+    return riau_strdup(best_match);
   }
 
   return NULL;
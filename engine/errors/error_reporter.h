@@ -45,7 +45,8 @@ void error_report_with_snippet(const char *filename, const char *source_code,
                                int line, int column, int length,
                                const char *message);
 
-// Find similar names using Levenshtein distance
+// Find similar names using Levenshtein distance. Free the result with
+// riau_free().
 char *suggest_similar_name(const char *target, const char **candidates,
                            int count);
 
@@ -297,18 +297,22 @@ Token lexer_next_token(Lexer *lexer) {
       return make_token(lexer, TOKEN_ASSIGN);
     }
   case '<':
+    if (match(lexer, '<'))
+      return make_token(lexer, TOKEN_SHIFT_LEFT);
     return make_token(lexer, match(lexer, '=') ? TOKEN_LESS_EQUAL : TOKEN_LESS);
   case '>':
+    if (match(lexer, '>'))
+      return make_token(lexer, TOKEN_SHIFT_RIGHT);
     return make_token(lexer,
                       match(lexer, '=') ? TOKEN_GREATER_EQUAL : TOKEN_GREATER);
   case '&':
-    if (match(lexer, '&'))
-      return make_token(lexer, TOKEN_AND);
-    break;
+    return make_token(lexer, match(lexer, '&') ? TOKEN_AND : TOKEN_AMPERSAND);
   case '|':
-    if (match(lexer, '|'))
-      return make_token(lexer, TOKEN_OR);
-    break;
+    return make_token(lexer, match(lexer, '|') ? TOKEN_OR : TOKEN_PIPE);
+  case '^':
+    return make_token(lexer, TOKEN_CARET);
+  case '~':
+    return make_token(lexer, TOKEN_TILDE);
   case '"':
     return string(lexer);
   }
@@ -384,6 +388,18 @@ const char *token_type_to_string(TokenType type) {
     return "OR";
   case TOKEN_NOT:
     return "NOT";
+  case TOKEN_AMPERSAND:
+    return "AMPERSAND";
+  case TOKEN_PIPE:
+    return "PIPE";
+  case TOKEN_CARET:
+    return "CARET";
+  case TOKEN_TILDE:
+    return "TILDE";
+  case TOKEN_SHIFT_LEFT:
+    return "SHIFT_LEFT";
+  case TOKEN_SHIFT_RIGHT:
+    return "SHIFT_RIGHT";
   case TOKEN_QUESTION:
     return "QUESTION";
   case TOKEN_ARROW:
@@ -44,6 +44,12 @@ typedef enum {
     TOKEN_AND,
     TOKEN_OR,
     TOKEN_NOT,
+    TOKEN_AMPERSAND,
+    TOKEN_PIPE,
+    TOKEN_CARET,
+    TOKEN_TILDE,
+    TOKEN_SHIFT_LEFT,
+    TOKEN_SHIFT_RIGHT,
     TOKEN_QUESTION,
     TOKEN_ARROW,
     
@@ -0,0 +1,515 @@
+#include "optimizer.h"
+#include "../runtime/arena.h"
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+void optimizer_init(Optimizer *optimizer) {
+  optimizer->folded = 0;
+  optimizer->removed = 0;
+}
+
+void optimizer_print_report(Optimizer *optimizer) {
+  printf("✓ Optimized: %d constant expression%s folded, %d node%s removed\n",
+         optimizer->folded, optimizer->folded == 1 ? "" : "s",
+         optimizer->removed, optimizer->removed == 1 ? "" : "s");
+}
+
+// Node counting, for the report
+
+static int count_nodes(ASTNode *node);
+
+static int count_list(ASTNodeList *list) {
+  int count = 0;
+  for (; list; list = list->next) {
+    count += count_nodes(list->node);
+  }
+  return count;
+}
+
+static int count_nodes(ASTNode *node) {
+  if (!node)
+    return 0;
+
+  switch (node->type) {
+  case AST_PROGRAM:
+    return 1 + count_list(node->data.program.statements);
+  case AST_VARIABLE_DECL:
+    return 1 + count_nodes(node->data.var_decl.initializer);
+  case AST_FUNCTION_DECL:
+    return 1 + count_list(node->data.func_decl.parameters) +
+           count_nodes(node->data.func_decl.body);
+  case AST_ENTITY_DECL:
+    return 1 + count_list(node->data.entity_decl.fields);
+  case AST_BLOCK:
+    return 1 + count_list(node->data.block.statements);
+  case AST_IF_STMT:
+    return 1 + count_nodes(node->data.if_stmt.condition) +
+           count_nodes(node->data.if_stmt.then_branch) +
+           count_nodes(node->data.if_stmt.else_branch);
+  case AST_FOR_STMT:
+    return 1 + count_nodes(node->data.for_stmt.iterable) +
+           count_nodes(node->data.for_stmt.body);
+  case AST_RETURN_STMT:
+    return 1 + count_nodes(node->data.return_stmt.value);
+  case AST_TRY_CATCH_STMT:
+    return 1 + count_nodes(node->data.try_catch.try_block) +
+           count_nodes(node->data.try_catch.catch_block);
+  case AST_SPAWN_STMT:
+    return 1 + count_nodes(node->data.spawn_stmt.body);
+  case AST_EXPR_STMT:
+    return 1 + count_nodes(node->data.expr_stmt.expression);
+  case AST_BINARY_EXPR:
+    return 1 + count_nodes(node->data.binary.left) +
+           count_nodes(node->data.binary.right);
+  case AST_UNARY_EXPR:
+    return 1 + count_nodes(node->data.unary.operand);
+  case AST_CALL_EXPR:
+    return 1 + count_nodes(node->data.call.callee) +
+           count_list(node->data.call.arguments);
+  case AST_MEMBER_EXPR:
+    return 1 + count_nodes(node->data.member.object);
+  case AST_INDEX_EXPR:
+    return 1 + count_nodes(node->data.index.array) +
+           count_nodes(node->data.index.index);
+  case AST_ARRAY_LITERAL:
+    return 1 + count_list(node->data.array.elements);
+  case AST_OBJECT_LITERAL:
+    return 1 + count_list(node->data.object.pairs);
+  default:
+    return 1;
+  }
+}
+
+static void drop(Optimizer *optimizer, ASTNode *node) {
+  optimizer->removed += count_nodes(node);
+  ast_free(node);
+}
+
+// Operand folding
+
+// A literal operand, as the value the VM would see
+typedef struct {
+  ASTNodeType type;
+  double number;
+  bool is_int;
+  bool boolean;
+  const char *string;
+} Operand;
+
+static bool is_literal(ASTNode *node) {
+  return node && (node->type == AST_LITERAL_NUMBER ||
+                  node->type == AST_LITERAL_STRING ||
+                  node->type == AST_LITERAL_BOOL ||
+                  node->type == AST_LITERAL_NULL);
+}
+
+static Operand operand_of(ASTNode *node) {
+  Operand operand = {node->type, 0, false, false, NULL};
+  switch (node->type) {
+  case AST_LITERAL_NUMBER:
+    operand.number = node->data.number.value;
+    operand.is_int = node->data.number.is_integer;
+    break;
+  case AST_LITERAL_STRING:
+    operand.string = node->data.string.value;
+    break;
+  case AST_LITERAL_BOOL:
+    operand.boolean = node->data.boolean.value;
+    break;
+  default:
+    break;
+  }
+  return operand;
+}
+
+static bool is_number(const Operand *c) {
+  return c->type == AST_LITERAL_NUMBER;
+}
+
+static bool both_ints(const Operand *a, const Operand *b) {
+  return a->is_int && b->is_int;
+}
+
+static bool truthy(const Operand *c) {
+  if (c->type == AST_LITERAL_NULL)
+    return false;
+  if (c->type == AST_LITERAL_BOOL)
+    return c->boolean;
+  return true;
+}
+
+// Whole doubles in range convert, like the VM's bitwise operands
+static bool to_int32(const Operand *c, int32_t *out) {
+  if (!is_number(c))
+    return false;
+  if (c->is_int || (c->number >= INT32_MIN && c->number <= INT32_MAX &&
+                    c->number == (int32_t)c->number)) {
+    *out = (int32_t)c->number;
+    return true;
+  }
+  return false;
+}
+
+static bool equals(const Operand *a, const Operand *b) {
+  if (is_number(a) && is_number(b))
+    return a->number == b->number;
+  if (a->type != b->type)
+    return false;
+  switch (a->type) {
+  case AST_LITERAL_NULL:
+    return true;
+  case AST_LITERAL_BOOL:
+    return a->boolean == b->boolean;
+  case AST_LITERAL_STRING:
+    return strcmp(a->string, b->string) == 0;
+  default:
+    return false;
+  }
+}
+
+// Turn `node`, whose children have been freed, into a literal
+static void make_number(ASTNode *node, double value, bool is_int) {
+  node->type = AST_LITERAL_NUMBER;
+  node->data.number.value = value;
+  node->data.number.is_integer = is_int;
+}
+
+// Int results widen to a double once they leave 32 bits
+static void make_int_result(ASTNode *node, int64_t value) {
+  if (value >= INT32_MIN && value <= INT32_MAX) {
+    make_number(node, (double)value, true);
+  } else {
+    make_number(node, (double)value, false);
+  }
+}
+
+static void make_bool(ASTNode *node, bool value) {
+  node->type = AST_LITERAL_BOOL;
+  node->data.boolean.value = value;
+}
+
+static void make_string(ASTNode *node, char *value) {
+  node->type = AST_LITERAL_STRING;
+  node->data.string.value = value;
+}
+
+// Result of `a op b` if it is a compile-time constant. Written into
+// `result`, a scratch node; returns false if the VM would fail or the
+// operator is not foldable.
+static bool fold_binary(const char *op, const Operand *a, const Operand *b,
+                        ASTNode *result) {
+  bool numbers = is_number(a) && is_number(b);
+  bool ints = numbers && both_ints(a, b);
+  int64_t x = ints ? (int64_t)a->number : 0;
+  int64_t y = ints ? (int64_t)b->number : 0;
+
+  if (strcmp(op, "+") == 0) {
+    if (ints) {
+      make_int_result(result, x + y);
+    } else if (numbers) {
+      make_number(result, a->number + b->number, false);
+    } else if (a->type == AST_LITERAL_STRING &&
+               b->type == AST_LITERAL_STRING) {
+      size_t left = strlen(a->string);
+      size_t right = strlen(b->string);
+      char *chars = riau_alloc(left + right + 1);
+      memcpy(chars, a->string, left);
+      memcpy(chars + left, b->string, right + 1);
+      make_string(result, chars);
+    } else {
+      return false;
+    }
+  } else if (strcmp(op, "-") == 0 || strcmp(op, "*") == 0) {
+    bool minus = op[0] == '-';
+    if (ints) {
+      make_int_result(result, minus ? x - y : x * y);
+    } else if (numbers) {
+      make_number(result, minus ? a->number - b->number : a->number * b->number,
+                  false);
+    } else {
+      return false;
+    }
+  } else if (strcmp(op, "/") == 0) {
+    if (!numbers || b->number == 0)
+      return false;
+    make_number(result, a->number / b->number, false);
+  } else if (strcmp(op, "%") == 0) {
+    if (!numbers || b->number == 0)
+      return false;
+    if (ints) {
+      make_number(result, y == -1 ? 0 : (double)(x % y), true);
+    } else {
+      make_number(result, fmod(a->number, b->number), false);
+    }
+  } else if (strcmp(op, "==") == 0) {
+    make_bool(result, equals(a, b));
+  } else if (strcmp(op, "!=") == 0) {
+    make_bool(result, !equals(a, b));
+  } else if (strcmp(op, "<") == 0 || strcmp(op, "<=") == 0 ||
+             strcmp(op, ">") == 0 || strcmp(op, ">=") == 0) {
+    if (!numbers)
+      return false;
+    double l = a->number;
+    double r = b->number;
+    bool value = op[0] == '<' ? (op[1] ? l <= r : l < r)
+                              : (op[1] ? l >= r : l > r);
+    make_bool(result, value);
+  } else if (strcmp(op, "&&") == 0) {
+    make_bool(result, truthy(a) && truthy(b));
+  } else if (strcmp(op, "||") == 0) {
+    make_bool(result, truthy(a) || truthy(b));
+  } else {
+    int32_t l, r;
+    if (!to_int32(a, &l) || !to_int32(b, &r))
+      return false;
+    int32_t value;
+    if (strcmp(op, "&") == 0) {
+      value = l & r;
+    } else if (strcmp(op, "|") == 0) {
+      value = l | r;
+    } else if (strcmp(op, "^") == 0) {
+      value = l ^ r;
+    } else if (strcmp(op, "<<") == 0) {
+      value = (int32_t)((uint32_t)l << (r & 31));
+    } else if (strcmp(op, ">>") == 0) {
+      value = l >> (r & 31);
+    } else {
+      return false;
+    }
+    make_number(result, value, true);
+  }
+  return true;
+}
+
+static bool fold_unary(const char *op, const Operand *a, ASTNode *result) {
+  if (strcmp(op, "-") == 0) {
+    if (!is_number(a))
+      return false;
+    if (a->is_int) {
+      make_int_result(result, -(int64_t)a->number);
+    } else {
+      make_number(result, -a->number, false);
+    }
+  } else if (strcmp(op, "!") == 0) {
+    make_bool(result, !truthy(a));
+  } else if (strcmp(op, "~") == 0) {
+    int32_t value;
+    if (!to_int32(a, &value))
+      return false;
+    make_number(result, ~value, true);
+  } else {
+    return false;
+  }
+  return true;
+}
+
+static void optimize_expression(Optimizer *optimizer, ASTNode *node);
+
+static void optimize_list(Optimizer *optimizer, ASTNodeList *list) {
+  for (; list; list = list->next) {
+    optimize_expression(optimizer, list->node);
+  }
+}
+
+static void optimize_expression(Optimizer *optimizer, ASTNode *node) {
+  if (!node)
+    return;
+
+  switch (node->type) {
+  case AST_BINARY_EXPR: {
+    ASTNode *left = node->data.binary.left;
+    ASTNode *right = node->data.binary.right;
+    if (strcmp(node->data.binary.operator, "=") == 0) {
+      // Only the parts of the target that are evaluated
+      if (left->type == AST_MEMBER_EXPR) {
+        optimize_expression(optimizer, left->data.member.object);
+      } else if (left->type == AST_INDEX_EXPR) {
+        optimize_expression(optimizer, left);
+      }
+      optimize_expression(optimizer, right);
+      break;
+    }
+
+    optimize_expression(optimizer, left);
+    optimize_expression(optimizer, right);
+    if (!is_literal(left) || !is_literal(right))
+      break;
+
+    Operand a = operand_of(left);
+    Operand b = operand_of(right);
+    ASTNode result;
+    if (!fold_binary(node->data.binary.operator, &a, &b, &result))
+      break;
+    riau_free(node->data.binary.operator);
+    drop(optimizer, left);
+    drop(optimizer, right);
+    node->type = result.type;
+    node->data = result.data;
+    optimizer->folded++;
+    break;
+  }
+
+  case AST_UNARY_EXPR: {
+    ASTNode *operand = node->data.unary.operand;
+    optimize_expression(optimizer, operand);
+    if (!is_literal(operand))
+      break;
+
+    Operand a = operand_of(operand);
+    ASTNode result;
+    if (!fold_unary(node->data.unary.operator, &a, &result))
+      break;
+    riau_free(node->data.unary.operator);
+    drop(optimizer, operand);
+    node->type = result.type;
+    node->data = result.data;
+    optimizer->folded++;
+    break;
+  }
+
+  case AST_CALL_EXPR:
+    optimize_expression(optimizer, node->data.call.callee);
+    optimize_list(optimizer, node->data.call.arguments);
+    break;
+
+  case AST_MEMBER_EXPR:
+    optimize_expression(optimizer, node->data.member.object);
+    break;
+
+  case AST_INDEX_EXPR:
+    optimize_expression(optimizer, node->data.index.array);
+    optimize_expression(optimizer, node->data.index.index);
+    break;
+
+  case AST_ARRAY_LITERAL:
+    optimize_list(optimizer, node->data.array.elements);
+    break;
+
+  case AST_OBJECT_LITERAL:
+    // Each pair is a ':' node; only its value is an expression
+    for (ASTNodeList *pair = node->data.object.pairs; pair; pair = pair->next) {
+      optimize_expression(optimizer, pair->node->data.binary.right);
+    }
+    break;
+
+  default:
+    break;
+  }
+}
+
+// Dead code elimination
+
+static ASTNode *optimize_statement(Optimizer *optimizer, ASTNode *node);
+
+// Optimize each statement in place, dropping the ones that go away and
+// everything after a return
+static void optimize_statements(Optimizer *optimizer, ASTNodeList **list) {
+  while (*list) {
+    ASTNodeList *entry = *list;
+    entry->node = optimize_statement(optimizer, entry->node);
+    if (!entry->node) {
+      *list = entry->next;
+      riau_free(entry);
+      continue;
+    }
+
+    if (entry->node->type == AST_RETURN_STMT && entry->next) {
+      ASTNodeList *rest = entry->next;
+      entry->next = NULL;
+      for (ASTNodeList *dead = rest; dead; dead = dead->next) {
+        optimizer->removed += count_nodes(dead->node);
+      }
+      ast_list_free(rest);
+    }
+    list = &entry->next;
+  }
+}
+
+// The statement to keep in place of `node`, or NULL to remove it
+static ASTNode *optimize_statement(Optimizer *optimizer, ASTNode *node) {
+  if (!node)
+    return NULL;
+
+  switch (node->type) {
+  case AST_EXPR_STMT: {
+    ASTNode *expression = node->data.expr_stmt.expression;
+    optimize_expression(optimizer, expression);
+    if (is_literal(expression)) {
+      drop(optimizer, node);
+      return NULL;
+    }
+    break;
+  }
+
+  case AST_VARIABLE_DECL:
+    optimize_expression(optimizer, node->data.var_decl.initializer);
+    break;
+
+  case AST_RETURN_STMT:
+    optimize_expression(optimizer, node->data.return_stmt.value);
+    break;
+
+  case AST_FUNCTION_DECL:
+    if (node->data.func_decl.is_arrow) {
+      optimize_expression(optimizer, node->data.func_decl.body);
+    } else {
+      node->data.func_decl.body =
+          optimize_statement(optimizer, node->data.func_decl.body);
+    }
+    break;
+
+  case AST_BLOCK:
+    optimize_statements(optimizer, &node->data.block.statements);
+    break;
+
+  case AST_IF_STMT: {
+    ASTNode *condition = node->data.if_stmt.condition;
+    optimize_expression(optimizer, condition);
+    node->data.if_stmt.then_branch =
+        optimize_statement(optimizer, node->data.if_stmt.then_branch);
+    node->data.if_stmt.else_branch =
+        optimize_statement(optimizer, node->data.if_stmt.else_branch);
+    if (!is_literal(condition))
+      break;
+
+    // Keep only the branch that runs, if any
+    Operand value = operand_of(condition);
+    ASTNode **taken = truthy(&value) ? &node->data.if_stmt.then_branch
+                                     : &node->data.if_stmt.else_branch;
+    ASTNode *branch = *taken;
+    *taken = NULL;
+    drop(optimizer, node);
+    return branch;
+  }
+
+  case AST_FOR_STMT:
+    optimize_expression(optimizer, node->data.for_stmt.iterable);
+    node->data.for_stmt.body =
+        optimize_statement(optimizer, node->data.for_stmt.body);
+    break;
+
+  case AST_TRY_CATCH_STMT:
+    node->data.try_catch.try_block =
+        optimize_statement(optimizer, node->data.try_catch.try_block);
+    node->data.try_catch.catch_block =
+        optimize_statement(optimizer, node->data.try_catch.catch_block);
+    break;
+
+  case AST_SPAWN_STMT:
+    node->data.spawn_stmt.body =
+        optimize_statement(optimizer, node->data.spawn_stmt.body);
+    break;
+
+  default:
+    break;
+  }
+  return node;
+}
+
+void optimizer_run(Optimizer *optimizer, ASTNode *ast) {
+  if (ast && ast->type == AST_PROGRAM) {
+    optimize_statements(optimizer, &ast->data.program.statements);
+  }
+}
@@ -0,0 +1,28 @@
+#ifndef RIAU_OPTIMIZER_H
+#define RIAU_OPTIMIZER_H
+
+#include "../ast/ast.h"
+
+// AST optimizer, run between semantic analysis and compilation
+//
+// Folds operators whose operands are all literals (numbers, strings,
+// booleans, null) into a single literal, computed exactly as the VM would
+// at runtime: ints stay ints until they overflow, `/` always gives a
+// double, `==` on numbers compares them exactly. An operation the VM
+// would reject, like `1 / 0` or `"a" - 1`, is left alone so it still fails
+// when it runs.
+//
+// It then removes code that can never run or has no effect: the branch of
+// an `if` a constant condition rules out, statements after a `return` in
+// the same block, and expression statements that are just a literal.
+
+typedef struct {
+  int folded;  // Operators replaced by their result
+  int removed; // Nodes dropped from the tree, folded operands included
+} Optimizer;
+
+void optimizer_init(Optimizer *optimizer);
+void optimizer_run(Optimizer *optimizer, ASTNode *ast);
+void optimizer_print_report(Optimizer *optimizer);
+
+#endif // RIAU_OPTIMIZER_H
@@ -1,4 +1,6 @@
 #include "parser.h"
+#include "../runtime/arena.h"
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -58,7 +60,7 @@ static void consume(Parser* parser, TokenType type, const char* message) {
 }
 
 static char* token_to_string(Token* token) {
-    char* str = malloc(token->length + 1);
+    char* str = riau_alloc(token->length + 1);
     memcpy(str, token->start, token->length);
     str[token->length] = '\0';
     return str;
@@ -77,8 +79,12 @@ static ASTNode* parse_primary(Parser* parser) {
     if (match(parser, TOKEN_NUMBER)) {
         char* str = token_to_string(&parser->previous);
         double value = atof(str);
-        free(str);
-        return ast_create_number(value, parser->previous.line, parser->previous.column);
+        // Literals without a fraction become integer constants
+        bool is_integer = !strchr(str, '.') && value <= INT32_MAX;
+        riau_free(str);
+        ASTNode* node = ast_create_number(value, parser->previous.line, parser->previous.column);
+        node->data.number.is_integer = is_integer;
+        return node;
     }
     
     if (match(parser, TOKEN_STRING)) {
@@ -86,14 +92,14 @@ static ASTNode* parse_primary(Parser* parser) {
         // Remove quotes
         str[strlen(str) - 1] = '\0';
         ASTNode* node = ast_create_string(str + 1, parser->previous.line, parser->previous.column);
-        free(str);
+        riau_free(str);
         return node;
     }
     
     if (match(parser, TOKEN_IDENTIFIER)) {
         char* name = token_to_string(&parser->previous);
         ASTNode* node = ast_create_identifier(name, parser->previous.line, parser->previous.column);
-        free(name);
+        riau_free(name);
         return node;
     }
     
@@ -115,6 +121,35 @@ static ASTNode* parse_primary(Parser* parser) {
         return ast_create_array(elements, parser->previous.line, parser->previous.column);
     }
     
+    if (match(parser, TOKEN_LBRACE)) {
+        int line = parser->previous.line;
+        int column = parser->previous.column;
+        ASTNodeList* pairs = NULL;
+        if (!check(parser, TOKEN_RBRACE)) {
+            do {
+                // Keys are identifiers or string literals
+                ASTNode* key = NULL;
+                if (match(parser, TOKEN_IDENTIFIER)) {
+                    char* name = token_to_string(&parser->previous);
+                    key = ast_create_string(name, parser->previous.line, parser->previous.column);
+                    riau_free(name);
+                } else if (check(parser, TOKEN_STRING)) {
+                    key = parse_primary(parser);
+                } else {
+                    error_at_current(parser, "Expected property name");
+                    return NULL;
+                }
+                int pair_line = parser->previous.line;
+                int pair_column = parser->previous.column;
+                consume(parser, TOKEN_COLON, "Expected ':' after property name");
+                ASTNode* value = parse_expression(parser);
+                pairs = ast_list_append(pairs, ast_create_binary(":", key, value, pair_line, pair_column));
+            } while (match(parser, TOKEN_COMMA) && !check(parser, TOKEN_RBRACE));
+        }
+        consume(parser, TOKEN_RBRACE, "Expected '}' after object properties");
+        return ast_create_object(pairs, line, column);
+    }
+    
     error(parser, "Expected expression");
     return NULL;
 }
@@ -137,7 +172,7 @@ static ASTNode* parse_call(Parser* parser) {
             consume(parser, TOKEN_IDENTIFIER, "Expected property name after '.'");
             char* property = token_to_string(&parser->previous);
             expr = ast_create_member(expr, property, parser->previous.line, parser->previous.column);
-            free(property);
+            riau_free(property);
         } else if (match(parser, TOKEN_LBRACKET)) {
             ASTNode* index = parse_expression(parser);
             consume(parser, TOKEN_RBRACKET, "Expected ']' after index");
@@ -151,13 +186,14 @@ static ASTNode* parse_call(Parser* parser) {
 }
 
 static ASTNode* parse_unary(Parser* parser) {
-    if (match(parser, TOKEN_NOT) || match(parser, TOKEN_MINUS)) {
+    if (match(parser, TOKEN_NOT) || match(parser, TOKEN_MINUS) ||
+        match(parser, TOKEN_TILDE)) {
         char* op = token_to_string(&parser->previous);
         int line = parser->previous.line;
         int column = parser->previous.column;
         ASTNode* operand = parse_unary(parser);
         ASTNode* node = ast_create_unary(op, operand, line, column);
-        free(op);
+        riau_free(op);
         return node;
     }
     
@@ -173,7 +209,7 @@ static ASTNode* parse_factor(Parser* parser) {
         int column = parser->previous.column;
         ASTNode* right = parse_unary(parser);
         expr = ast_create_binary(op, expr, right, line, column);
-        free(op);
+        riau_free(op);
     }
     
     return expr;
@@ -188,23 +224,38 @@ static ASTNode* parse_term(Parser* parser) {
         int column = parser->previous.column;
         ASTNode* right = parse_factor(parser);
         expr = ast_create_binary(op, expr, right, line, column);
-        free(op);
+        riau_free(op);
     }
     
     return expr;
 }
 
-static ASTNode* parse_comparison(Parser* parser) {
+static ASTNode* parse_shift(Parser* parser) {
     ASTNode* expr = parse_term(parser);
     
+    while (match(parser, TOKEN_SHIFT_LEFT) || match(parser, TOKEN_SHIFT_RIGHT)) {
+        char* op = token_to_string(&parser->previous);
+        int line = parser->previous.line;
+        int column = parser->previous.column;
+        ASTNode* right = parse_term(parser);
+        expr = ast_create_binary(op, expr, right, line, column);
+        riau_free(op);
+    }
+    
+    return expr;
+}
+
+static ASTNode* parse_comparison(Parser* parser) {
+    ASTNode* expr = parse_shift(parser);
+    
     while (match(parser, TOKEN_GREATER) || match(parser, TOKEN_GREATER_EQUAL) ||
            match(parser, TOKEN_LESS) || match(parser, TOKEN_LESS_EQUAL)) {
         char* op = token_to_string(&parser->previous);
         int line = parser->previous.line;
         int column = parser->previous.column;
-        ASTNode* right = parse_term(parser);
+        ASTNode* right = parse_shift(parser);
         expr = ast_create_binary(op, expr, right, line, column);
-        free(op);
+        riau_free(op);
     }
     
     return expr;
@@ -219,22 +270,67 @@ static ASTNode* parse_equality(Parser* parser) {
         int column = parser->previous.column;
         ASTNode* right = parse_comparison(parser);
         expr = ast_create_binary(op, expr, right, line, column);
-        free(op);
+        riau_free(op);
     }
     
     return expr;
 }
 
-static ASTNode* parse_logical_and(Parser* parser) {
+static ASTNode* parse_bit_and(Parser* parser) {
     ASTNode* expr = parse_equality(parser);
     
-    while (match(parser, TOKEN_AND)) {
+    while (match(parser, TOKEN_AMPERSAND)) {
         char* op = token_to_string(&parser->previous);
         int line = parser->previous.line;
         int column = parser->previous.column;
         ASTNode* right = parse_equality(parser);
         expr = ast_create_binary(op, expr, right, line, column);
-        free(op);
+        riau_free(op);
+    }
+    
+    return expr;
+}
+
+static ASTNode* parse_bit_xor(Parser* parser) {
+    ASTNode* expr = parse_bit_and(parser);
+    
+    while (match(parser, TOKEN_CARET)) {
+        char* op = token_to_string(&parser->previous);
+        int line = parser->previous.line;
+        int column = parser->previous.column;
+        ASTNode* right = parse_bit_and(parser);
+        expr = ast_create_binary(op, expr, right, line, column);
+        riau_free(op);
+    }
+    
+    return expr;
+}
+
+static ASTNode* parse_bit_or(Parser* parser) {
+    ASTNode* expr = parse_bit_xor(parser);
+    
+    while (match(parser, TOKEN_PIPE)) {
+        char* op = token_to_string(&parser->previous);
+        int line = parser->previous.line;
+        int column = parser->previous.column;
+        ASTNode* right = parse_bit_xor(parser);
+        expr = ast_create_binary(op, expr, right, line, column);
+        riau_free(op);
+    }
+    
+    return expr;
+}
+
+static ASTNode* parse_logical_and(Parser* parser) {
+    ASTNode* expr = parse_bit_or(parser);
+    
+    while (match(parser, TOKEN_AND)) {
+        char* op = token_to_string(&parser->previous);
+        int line = parser->previous.line;
+        int column = parser->previous.column;
+        ASTNode* right = parse_bit_or(parser);
+        expr = ast_create_binary(op, expr, right, line, column);
+        riau_free(op);
     }
     
     return expr;
@@ -249,14 +345,32 @@ static ASTNode* parse_logical_or(Parser* parser) {
         int column = parser->previous.column;
         ASTNode* right = parse_logical_and(parser);
         expr = ast_create_binary(op, expr, right, line, column);
-        free(op);
+        riau_free(op);
+    }
+    
+    return expr;
+}
+
+static ASTNode* parse_assignment(Parser* parser) {
+    ASTNode* expr = parse_logical_or(parser);
+    
+    if (match(parser, TOKEN_ASSIGN)) {
+        int line = parser->previous.line;
+        int column = parser->previous.column;
+        ASTNode* value = parse_assignment(parser);
+        
+        if (expr && expr->type != AST_IDENTIFIER && expr->type != AST_MEMBER_EXPR &&
+            expr->type != AST_INDEX_EXPR) {
+            error(parser, "Invalid assignment target");
+        }
+        return ast_create_binary("=", expr, value, line, column);
     }
     
     return expr;
 }
 
 static ASTNode* parse_expression(Parser* parser) {
-    return parse_logical_or(parser);
+    return parse_assignment(parser);
 }
 
 static ASTNode* parse_block(Parser* parser) {
@@ -269,6 +383,9 @@ static ASTNode* parse_block(Parser* parser) {
         if (stmt) {
             statements = ast_list_append(statements, stmt);
         }
+        // Leave recovery to parser_parse; a failed statement may not have
+        // consumed any tokens
+        if (parser->panic_mode) break;
     }
     
     consume(parser, TOKEN_RBRACE, "Expected '}' after block");
@@ -306,7 +423,7 @@ static ASTNode* parse_for_statement(Parser* parser) {
     ASTNode* body = parse_block(parser);
     
     ASTNode* node = ast_create_for_stmt(iterator, iterable, body, line, column);
-    free(iterator);
+    riau_free(iterator);
     return node;
 }
 
@@ -343,8 +460,8 @@ static ASTNode* parse_try_catch(Parser* parser) {
     ASTNode* catch_block = parse_block(parser);
     
     ASTNode* node = ast_create_try_catch(try_block, error_type, error_name, catch_block, line, column);
-    free(error_type);
-    free(error_name);
+    riau_free(error_type);
+    riau_free(error_name);
     return node;
 }
 
@@ -359,15 +476,15 @@ static ASTNode* parse_use_statement(Parser* parser) {
     while (match(parser, TOKEN_DOT)) {
         consume(parser, TOKEN_IDENTIFIER, "Expected module component after '.'");
         char* component = token_to_string(&parser->previous);
-        char* new_path = malloc(strlen(module_path) + strlen(component) + 2);
+        char* new_path = riau_alloc(strlen(module_path) + strlen(component) + 2);
         sprintf(new_path, "%s.%s", module_path, component);
-        free(module_path);
-        free(component);
+        riau_free(module_path);
+        riau_free(component);
         module_path = new_path;
     }
     
     ASTNode* node = ast_create_use_stmt(module_path, line, column);
-    free(module_path);
+    riau_free(module_path);
     return node;
 }
 
@@ -391,6 +508,7 @@ static ASTNode* parse_statement(Parser* parser) {
     
     // Expression statement
     ASTNode* expr = parse_expression(parser);
+    if (!expr) return NULL;
     return ast_create_expr_stmt(expr, expr->line, expr->column);
 }
 
@@ -404,7 +522,7 @@ static TypeInfo* parse_type_annotation(Parser* parser) {
     
     TypeInfo* type = type_parse(type_str);
     type->is_optional = is_optional;
-    free(type_str);
+    riau_free(type_str);
     return type;
 }
 
@@ -423,7 +541,7 @@ static ASTNode* parse_var_declaration(Parser* parser) {
     }
     
     ASTNode* node = ast_create_var_decl(name, type_info, initializer, line, column);
-    free(name);
+    riau_free(name);
     return node;
 }
 
@@ -444,7 +562,7 @@ static ASTNode* parse_function_declaration(Parser* parser) {
             TypeInfo* param_type = parse_type_annotation(parser);
             ASTNode* param = ast_create_parameter(param_name, param_type, parser->previous.line, parser->previous.column);
             parameters = ast_list_append(parameters, param);
-            free(param_name);
+            riau_free(param_name);
         } while (match(parser, TOKEN_COMMA));
     }
     
@@ -464,7 +582,7 @@ static ASTNode* parse_function_declaration(Parser* parser) {
     }
     
     ASTNode* node = ast_create_func_decl(name, parameters, return_type, body, is_arrow, line, column);
-    free(name);
+    riau_free(name);
     return node;
 }
 
@@ -491,13 +609,13 @@ static ASTNode* parse_entity_declaration(Parser* parser) {
         
         ASTNode* field = ast_create_var_decl(field_name, field_type, default_value, parser->previous.line, parser->previous.column);
         fields = ast_list_append(fields, field);
-        free(field_name);
+        riau_free(field_name);
     }
     
     consume(parser, TOKEN_RBRACE, "Expected '}' after entity fields");
     
     ASTNode* node = ast_create_entity_decl(name, fields, line, column);
-    free(name);
+    riau_free(name);
     return node;
 }
 
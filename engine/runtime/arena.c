@@ -0,0 +1,99 @@
+#include "arena.h"
+#include <stdint.h>
+#include <string.h>
+
+#define ARENA_ALIGN 16
+#define ALIGN_UP(size) (((size) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+// Every allocation is preceded by its size, so realloc knows how much to
+// copy
+#define ALLOCATION_HEADER ARENA_ALIGN
+
+typedef struct ArenaBlock ArenaBlock;
+
+struct ArenaBlock {
+  ArenaBlock *next;
+  uint8_t *top;
+  uint8_t *end;
+};
+
+#define BLOCK_HEADER ALIGN_UP(sizeof(ArenaBlock))
+
+bool arena_active = false;
+
+static ArenaBlock *blocks = NULL; // Current block first
+static size_t allocated = 0;
+
+void arena_enable(void) { arena_active = true; }
+
+void arena_release(void) {
+  while (blocks) {
+    ArenaBlock *next = blocks->next;
+    free(blocks);
+    blocks = next;
+  }
+  allocated = 0;
+}
+
+size_t arena_bytes(void) { return allocated; }
+
+static void add_block(size_t size) {
+  // Oversized allocations get a block of their own
+  size_t capacity = size > ARENA_BLOCK_SIZE / 4 ? size : ARENA_BLOCK_SIZE;
+  ArenaBlock *block = calloc(1, BLOCK_HEADER + capacity);
+  block->top = (uint8_t *)block + BLOCK_HEADER;
+  block->end = block->top + capacity;
+
+  // Keep filling the current block if the new one is a one-off
+  if (blocks && capacity != ARENA_BLOCK_SIZE) {
+    block->next = blocks->next;
+    blocks->next = block;
+  } else {
+    block->next = blocks;
+    blocks = block;
+  }
+}
+
+static size_t *size_of(void *ptr) {
+  return (size_t *)((uint8_t *)ptr - ALLOCATION_HEADER);
+}
+
+void *arena_alloc(size_t size) {
+  size_t total = ALLOCATION_HEADER + ALIGN_UP(size);
+  if (!blocks || (size_t)(blocks->end - blocks->top) < total) {
+    add_block(total);
+  }
+
+  // add_block() may have put an oversized block behind the current one
+  ArenaBlock *block =
+      (size_t)(blocks->end - blocks->top) >= total ? blocks : blocks->next;
+  uint8_t *ptr = block->top + ALLOCATION_HEADER;
+  block->top += total;
+  allocated += total;
+  *size_of(ptr) = size;
+  return ptr;
+}
+
+void *arena_realloc(void *ptr, size_t size) {
+  if (!ptr)
+    return arena_alloc(size);
+
+  size_t old_size = *size_of(ptr);
+  if (size <= old_size) {
+    return ptr;
+  }
+
+  // The last allocation of the current block grows in place
+  uint8_t *old_end = (uint8_t *)ptr + ALIGN_UP(old_size);
+  if (old_end == blocks->top &&
+      (size_t)(blocks->end - (uint8_t *)ptr) >= ALIGN_UP(size)) {
+    blocks->top = (uint8_t *)ptr + ALIGN_UP(size);
+    allocated += ALIGN_UP(size) - ALIGN_UP(old_size);
+    *size_of(ptr) = size;
+    return ptr;
+  }
+
+  void *copy = arena_alloc(size);
+  memcpy(copy, ptr, old_size);
+  return copy;
+}
@@ -0,0 +1,63 @@
+#ifndef RIAU_ARENA_H
+#define RIAU_ARENA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Arena allocation
+//
+// The front end (AST, parser, semantic analysis), the compiler and chunks
+// allocate through riau_alloc() and friends. Normally these are malloc and
+// free. In arena mode they bump-allocate from large zeroed blocks instead,
+// and riau_free() does nothing: a CGI process runs one script and exits,
+// so everything is released in one shot rather than node by node.
+//
+// Arena mode is turned on with `riau --arena`, automatically under CGI
+// (GATEWAY_INTERFACE is set), or by default in builds with -DRIAU_ARENA.
+// Enable it before anything is allocated. Objects owned by the garbage
+// collector are not affected.
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+extern bool arena_active;
+
+void arena_enable(void);
+void arena_release(void);
+size_t arena_bytes(void);
+
+void *arena_alloc(size_t size);
+void *arena_realloc(void *ptr, size_t size);
+
+static inline void *riau_alloc(size_t size) {
+  return arena_active ? arena_alloc(size) : malloc(size);
+}
+
+// Arena memory is always zeroed
+static inline void *riau_calloc(size_t count, size_t size) {
+  return arena_active ? arena_alloc(count * size) : calloc(count, size);
+}
+
+static inline void *riau_realloc(void *ptr, size_t size) {
+  return arena_active ? arena_realloc(ptr, size) : realloc(ptr, size);
+}
+
+static inline void riau_free(void *ptr) {
+  if (!arena_active) {
+    free(ptr);
+  }
+}
+
+// Copy of a string, from riau_alloc(); NULL stays NULL
+static inline char *riau_strdup(const char *str) {
+  if (!str)
+    return NULL;
+  size_t length = strlen(str);
+  char *copy = riau_alloc(length + 1);
+  if (copy) {
+    memcpy(copy, str, length + 1);
+  }
+  return copy;
+}
+
+#endif // RIAU_ARENA_H
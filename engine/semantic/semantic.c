@@ -1,4 +1,5 @@
 #include "semantic.h"
+#include "../runtime/arena.h"
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -6,17 +7,21 @@
 
 // Symbol table implementation
 void symbol_table_init(SymbolTable *table) {
+  table->symbols = NULL;
   table->count = 0;
+  table->capacity = 0;
   table->scope_depth = 0;
-  memset(table->symbols, 0, sizeof(table->symbols));
 }
 
 void symbol_table_free(SymbolTable *table) {
   for (int i = 0; i < table->count; i++) {
-    free(table->symbols[i].name);
+    riau_free(table->symbols[i].name);
     type_free(table->symbols[i].type);
   }
+  riau_free(table->symbols);
+  table->symbols = NULL;
   table->count = 0;
+  table->capacity = 0;
 }
 
 bool symbol_table_define(SymbolTable *table, const char *name, TypeInfo *type,
@@ -35,8 +40,15 @@ bool symbol_table_define(SymbolTable *table, const char *name, TypeInfo *type,
     }
   }
 
+  if (table->capacity < table->count + 1) {
+    int old_capacity = table->capacity;
+    table->capacity = old_capacity < 8 ? 8 : old_capacity * 2;
+    table->symbols =
+        riau_realloc(table->symbols, table->capacity * sizeof(Symbol));
+  }
+
   Symbol *symbol = &table->symbols[table->count++];
-  symbol->name = strdup(name);
+  symbol->name = riau_strdup(name);
   symbol->type = type;
   symbol->is_initialized = false;
   symbol->is_optional = is_optional;
@@ -63,7 +75,7 @@ void symbol_table_end_scope(SymbolTable *table) {
   while (table->count > 0 &&
          table->symbols[table->count - 1].scope_depth > table->scope_depth) {
     table->count--;
-    free(table->symbols[table->count].name);
+    riau_free(table->symbols[table->count].name);
     type_free(table->symbols[table->count].type);
   }
 }
@@ -83,7 +95,7 @@ static void semantic_error(SemanticAnalyzer *analyzer, int line,
 }
 
 void semantic_init(SemanticAnalyzer *analyzer) {
-  analyzer->symbols = malloc(sizeof(SymbolTable));
+  analyzer->symbols = riau_alloc(sizeof(SymbolTable));
   symbol_table_init(analyzer->symbols);
   analyzer->had_error = false;
   analyzer->error_message[0] = '\0';
@@ -92,7 +104,14 @@ void semantic_init(SemanticAnalyzer *analyzer) {
 void semantic_free(SemanticAnalyzer *analyzer) {
   if (analyzer->symbols) {
     symbol_table_free(analyzer->symbols);
-    free(analyzer->symbols);
+    riau_free(analyzer->symbols);
+  }
+}
+
+void semantic_define_global(SemanticAnalyzer *analyzer, const char *name) {
+  TypeInfo *type = type_create(TYPE_UNKNOWN, false, NULL);
+  if (!symbol_table_define(analyzer->symbols, name, type, false)) {
+    type_free(type);
   }
 }
 
@@ -143,7 +162,13 @@ static TypeInfo *analyze_expression(SemanticAnalyzer *analyzer, ASTNode *node) {
 
     // Type checking for binary operations
     const char *op = node->data.binary.operator;
-    if (strcmp(op, "+") == 0 || strcmp(op, "-") == 0 || strcmp(op, "*") == 0 ||
+    if (strcmp(op, "=") == 0) {
+      type_free(left_type);
+      return right_type;
+    }
+    if (left_type->kind == TYPE_UNKNOWN) {
+      // Property reads and the like are only known at runtime
+    } else if (strcmp(op, "+") == 0 || strcmp(op, "-") == 0 || strcmp(op, "*") == 0 ||
         strcmp(op, "/") == 0) {
       if (left_type->kind != TYPE_INT && left_type->kind != TYPE_FLOAT) {
         semantic_error(analyzer, node->line,
@@ -156,6 +181,24 @@ static TypeInfo *analyze_expression(SemanticAnalyzer *analyzer, ASTNode *node) {
     return type_create(TYPE_INT, false, "int");
   }
 
+  case AST_MEMBER_EXPR:
+    type_free(analyze_expression(analyzer, node->data.member.object));
+    return type_create(TYPE_UNKNOWN, false, NULL);
+
+  case AST_INDEX_EXPR:
+    type_free(analyze_expression(analyzer, node->data.index.array));
+    type_free(analyze_expression(analyzer, node->data.index.index));
+    return type_create(TYPE_UNKNOWN, false, NULL);
+
+  case AST_OBJECT_LITERAL: {
+    ASTNodeList *pairs = node->data.object.pairs;
+    while (pairs) {
+      type_free(analyze_expression(analyzer, pairs->node->data.binary.right));
+      pairs = pairs->next;
+    }
+    return type_create(TYPE_UNKNOWN, false, NULL);
+  }
+
   default:
     return type_create(TYPE_UNKNOWN, false, NULL);
   }
@@ -3,8 +3,10 @@
 
 #include "../ast/ast.h"
 #include <stdbool.h>
+#include <stdint.h>
 
-#define MAX_SYMBOLS 256
+// Matches the compiler's limit on variable slots
+#define MAX_SYMBOLS (UINT16_MAX + 1)
 
 // Symbol table entry
 typedef struct {
@@ -17,8 +19,9 @@ typedef struct {
 
 // Symbol table
 typedef struct {
-  Symbol symbols[MAX_SYMBOLS];
+  Symbol *symbols;
   int count;
+  int capacity;
   int scope_depth;
 } SymbolTable;
 
@@ -35,6 +38,10 @@ void semantic_free(SemanticAnalyzer *analyzer);
 bool semantic_analyze(SemanticAnalyzer *analyzer, ASTNode *ast);
 void semantic_print_errors(SemanticAnalyzer *analyzer);
 
+// Declare a global defined before the script runs (a heap snapshot's, see
+// vm/snapshot.h). Its type is unknown; defining a name twice is harmless.
+void semantic_define_global(SemanticAnalyzer *analyzer, const char *name);
+
 // Symbol table functions
 void symbol_table_init(SymbolTable *table);
 void symbol_table_free(SymbolTable *table);
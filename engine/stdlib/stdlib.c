@@ -5,7 +5,6 @@
 #include <stdlib.h>
 #include <string.h>
 
-
 // Core functions
 Value builtin_print(int arg_count, Value *args) {
   for (int i = 0; i < arg_count; i++) {
@@ -36,7 +35,7 @@ Value builtin_type_of(int arg_count, Value *args) {
   }
 
   const char *type_name;
-  switch (args[0].type) {
+  switch (VALUE_TYPE(args[0])) {
   case VAL_NULL:
     type_name = "null";
     break;
@@ -44,6 +43,7 @@ Value builtin_type_of(int arg_count, Value *args) {
     type_name = "bool";
     break;
   case VAL_NUMBER:
+  case VAL_INT:
     type_name = "number";
     break;
   case VAL_STRING:
@@ -68,16 +68,16 @@ Value builtin_type_of(int arg_count, Value *args) {
 
 Value builtin_len(int arg_count, Value *args) {
   if (arg_count != 1) {
-    return value_number(-1);
+    return value_int(-1);
   }
 
-  if (args[0].type == VAL_STRING) {
-    return value_number((double)strlen(args[0].as.string));
-  } else if (args[0].type == VAL_ARRAY) {
-    return value_number((double)args[0].as.array->count);
+  if (IS_STRING(args[0])) {
+    return value_int((int64_t)AS_STRING(args[0])->length);
+  } else if (IS_ARRAY(args[0])) {
+    return value_int((int64_t)AS_ARRAY(args[0])->count);
   }
 
-  return value_number(-1);
+  return value_int(-1);
 }
 
 // String functions
@@ -88,78 +88,82 @@ Value builtin_str_concat(int arg_count, Value *args) {
 
   size_t total_len = 0;
   for (int i = 0; i < arg_count; i++) {
-    if (args[i].type == VAL_STRING) {
-      total_len += strlen(args[i].as.string);
+    if (IS_STRING(args[i])) {
+      total_len += AS_STRING(args[i])->length;
     }
   }
 
   char *result = malloc(total_len + 1);
-  result[0] = '\0';
+  size_t offset = 0;
 
   for (int i = 0; i < arg_count; i++) {
-    if (args[i].type == VAL_STRING) {
-      strcat(result, args[i].as.string);
+    if (IS_STRING(args[i])) {
+      RiauString *part = AS_STRING(args[i]);
+      memcpy(result + offset, part->chars, part->length);
+      offset += part->length;
     }
   }
 
-  Value v = value_string(result);
+  Value v = STRING_VAL(string_new(result, total_len));
   free(result);
   return v;
 }
 
 Value builtin_str_length(int arg_count, Value *args) {
-  if (arg_count != 1 || args[0].type != VAL_STRING) {
-    return value_number(0);
+  if (arg_count != 1 || !IS_STRING(args[0])) {
+    return value_int(0);
   }
-  return value_number((double)strlen(args[0].as.string));
+  return value_int((int64_t)AS_STRING(args[0])->length);
 }
 
 Value builtin_str_upper(int arg_count, Value *args) {
-  if (arg_count != 1 || args[0].type != VAL_STRING) {
+  if (arg_count != 1 || !IS_STRING(args[0])) {
     return value_string("");
   }
 
-  char *str = strdup(args[0].as.string);
-  for (size_t i = 0; i < strlen(str); i++) {
-    str[i] = toupper(str[i]);
+  RiauString *source = AS_STRING(args[0]);
+  char *str = malloc(source->length + 1);
+  for (size_t i = 0; i < source->length; i++) {
+    str[i] = (char)toupper((unsigned char)source->chars[i]);
   }
 
-  Value v = value_string(str);
+  Value v = STRING_VAL(string_new(str, source->length));
   free(str);
   return v;
 }
 
 Value builtin_str_lower(int arg_count, Value *args) {
-  if (arg_count != 1 || args[0].type != VAL_STRING) {
+  if (arg_count != 1 || !IS_STRING(args[0])) {
     return value_string("");
   }
 
-  char *str = strdup(args[0].as.string);
-  for (size_t i = 0; i < strlen(str); i++) {
-    str[i] = tolower(str[i]);
+  RiauString *source = AS_STRING(args[0]);
+  char *str = malloc(source->length + 1);
+  for (size_t i = 0; i < source->length; i++) {
+    str[i] = (char)tolower((unsigned char)source->chars[i]);
   }
 
-  Value v = value_string(str);
+  Value v = STRING_VAL(string_new(str, source->length));
   free(str);
   return v;
 }
 
 // Array functions
 Value builtin_array_push(int arg_count, Value *args) {
-  if (arg_count != 2 || args[0].type != VAL_ARRAY) {
+  if (arg_count != 2 || !IS_ARRAY(args[0])) {
     return value_null();
   }
 
-  array_push(args[0].as.array, args[1]);
+  array_push(AS_ARRAY(args[0]), args[1]);
   return args[0];
 }
 
 Value builtin_array_pop(int arg_count, Value *args) {
-  if (arg_count != 1 || args[0].type != VAL_ARRAY) {
+  if (arg_count != 1 || !IS_ARRAY(args[0])) {
     return value_null();
   }
 
-  RiauArray *arr = args[0].as.array;
+  RiauArray *arr = AS_ARRAY(args[0]);
   if (arr->count == 0) {
     return value_null();
   }
@@ -170,44 +174,84 @@ Value builtin_array_pop(int arg_count, Value *args) {
 }
 
 Value builtin_array_length(int arg_count, Value *args) {
-  if (arg_count != 1 || args[0].type != VAL_ARRAY) {
-    return value_number(0);
+  if (arg_count != 1 || !IS_ARRAY(args[0])) {
+    return value_int(0);
   }
-  return value_number((double)args[0].as.array->count);
+  return value_int((int64_t)AS_ARRAY(args[0])->count);
 }
 
 // Math functions
 Value builtin_math_abs(int arg_count, Value *args) {
-  if (arg_count != 1 || args[0].type != VAL_NUMBER) {
-    return value_number(0);
+  if (arg_count != 1 || !IS_NUMERIC(args[0])) {
+    return value_int(0);
+  }
+  if (IS_INT(args[0])) {
+    return value_int(llabs((int64_t)AS_INT(args[0])));
   }
-  return value_number(fabs(args[0].as.number));
+  return value_number(fabs(AS_NUMBER(args[0])));
 }
 
 Value builtin_math_floor(int arg_count, Value *args) {
-  if (arg_count != 1 || args[0].type != VAL_NUMBER) {
-    return value_number(0);
+  if (arg_count != 1 || !IS_NUMERIC(args[0])) {
+    return value_int(0);
+  }
+  if (IS_INT(args[0])) {
+    return args[0];
   }
-  return value_number(floor(args[0].as.number));
+  return value_number(floor(AS_NUMBER(args[0])));
 }
 
 Value builtin_math_ceil(int arg_count, Value *args) {
-  if (arg_count != 1 || args[0].type != VAL_NUMBER) {
-    return value_number(0);
+  if (arg_count != 1 || !IS_NUMERIC(args[0])) {
+    return value_int(0);
   }
-  return value_number(ceil(args[0].as.number));
+  if (IS_INT(args[0])) {
+    return args[0];
+  }
+  return value_number(ceil(AS_NUMBER(args[0])));
 }
 
 Value builtin_math_round(int arg_count, Value *args) {
-  if (arg_count != 1 || args[0].type != VAL_NUMBER) {
-    return value_number(0);
+  if (arg_count != 1 || !IS_NUMERIC(args[0])) {
+    return value_int(0);
+  }
+  if (IS_INT(args[0])) {
+    return args[0];
+  }
+  return value_number(round(AS_NUMBER(args[0])));
+}
+
+// Native function table; compiled code refers to entries by index
+const NativeEntry stdlib_natives[] = {
+    {"log", builtin_log},
+    {"type_of", builtin_type_of},
+    {"len", builtin_len},
+    {"str_concat", builtin_str_concat},
+    {"str_length", builtin_str_length},
+    {"str_upper", builtin_str_upper},
+    {"str_lower", builtin_str_lower},
+    {"array_push", builtin_array_push},
+    {"array_pop", builtin_array_pop},
+    {"array_length", builtin_array_length},
+    {"math_abs", builtin_math_abs},
+    {"math_floor", builtin_math_floor},
+    {"math_ceil", builtin_math_ceil},
+    {"math_round", builtin_math_round},
+};
+
+const int stdlib_native_count =
+    (int)(sizeof(stdlib_natives) / sizeof(stdlib_natives[0]));
+
+int stdlib_find_native(const char *name) {
+  for (int i = 0; i < stdlib_native_count; i++) {
+    if (strcmp(stdlib_natives[i].name, name) == 0) {
+      return i;
+    }
   }
-  return value_number(round(args[0].as.number));
+  return -1;
 }
 
-// Register all built-in functions (placeholder for now)
 void stdlib_register_builtins(VM *vm) {
-  // This would register built-in functions in the VM's global scope
-  // For now, this is a placeholder
-  (void)vm; // Suppress unused parameter warning
+  vm->natives = stdlib_natives;
+  vm->native_count = stdlib_native_count;
 }
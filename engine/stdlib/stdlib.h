@@ -3,9 +3,6 @@
 
 #include "../vm/vm.h"
 
-// Built-in function signatures
-typedef Value (*NativeFunction)(int arg_count, Value *args);
-
 // Core functions
 Value builtin_print(int arg_count, Value *args);
 Value builtin_log(int arg_count, Value *args);
@@ -29,7 +26,17 @@ Value builtin_math_floor(int arg_count, Value *args);
 Value builtin_math_ceil(int arg_count, Value *args);
 Value builtin_math_round(int arg_count, Value *args);
 
-// Utility functions
+// Native function table. The compiler resolves a call to a native by name
+// to its index in stdlib_natives, and OP_CALL_NATIVE calls it through the
+// VM's table. print() and env() are not in it: they compile to their own
+// instructions.
+extern const NativeEntry stdlib_natives[];
+extern const int stdlib_native_count;
+
+// Index of a native function, or -1
+int stdlib_find_native(const char *name);
+
+// Make the native functions callable on a VM
 void stdlib_register_builtins(VM *vm);
 
 #endif // RIAU_STDLIB_H
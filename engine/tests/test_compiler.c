@@ -0,0 +1,310 @@
+// Test: Compiler, run end to end on the VM
+#include "../bytecode/compiler.h"
+#include "../lexer/lexer.h"
+#include "../optimizer/optimizer.h"
+#include "../parser/parser.h"
+#include "../stdlib/stdlib.h"
+#include "../vm/vm.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+
+// Compiles `source` into `chunk`; returns false and leaves the message in
+// `compiler` on a compile error
+static bool compile(const char *source, Chunk *chunk, Compiler *compiler) {
+  Lexer lexer;
+  lexer_init(&lexer, source);
+  Parser parser;
+  parser_init(&parser, &lexer);
+  ASTNode *ast = parser_parse(&parser);
+  assert(!parser_had_error(&parser));
+
+  Optimizer optimizer;
+  optimizer_init(&optimizer);
+  optimizer_run(&optimizer, ast);
+
+  chunk_init(chunk);
+  compiler_init(compiler, chunk);
+  bool compiled = compiler_compile(compiler, ast);
+  ast_free(ast);
+  return compiled;
+}
+
+// Runs `source` and returns the value it left in global `name`
+static Value run(const char *source, const char *name) {
+  Chunk chunk;
+  Compiler compiler;
+  assert(compile(source, &chunk, &compiler));
+
+  VM vm;
+  vm_init(&vm);
+  stdlib_register_builtins(&vm);
+  assert(vm_execute(&vm, &chunk));
+
+  Value value = NULL_VAL;
+  for (int slot = 0; slot < compiler_global_count(); slot++) {
+    if (strcmp(compiler_global_name(slot), name) == 0) {
+      value = vm.globals[slot];
+    }
+  }
+  vm_free(&vm);
+  chunk_free(&chunk);
+  return value;
+}
+
+// Compiles `source`, which must fail with `message`
+static void assert_compile_error(const char *source, const char *message) {
+  Chunk chunk;
+  Compiler compiler;
+  assert(!compile(source, &chunk, &compiler));
+  assert(strcmp(compiler.error_message, message) == 0);
+  chunk_free(&chunk);
+}
+
+// Runs `source`, which must stop with the runtime error `message`
+static void assert_runtime_error(const char *source, const char *message) {
+  Chunk chunk;
+  Compiler compiler;
+  assert(compile(source, &chunk, &compiler));
+
+  VM vm;
+  vm_init(&vm);
+  stdlib_register_builtins(&vm);
+  assert(!vm_execute(&vm, &chunk));
+  assert(strcmp(vm.error_message, message) == 0);
+  vm_free(&vm);
+  chunk_free(&chunk);
+}
+
+void test_compiler_scopes() {
+  printf("Testing scopes...\n");
+
+  // A function's local hides the global of the same name
+  Value result = run("let hidden = 100\n"
+                     "fn outer(a) {\n"
+                     "  let hidden = a * 2\n"
+                     "  return hidden + 1\n"
+                     "}\n"
+                     "let result = outer(5)\n",
+                     "result");
+  assert(IS_INT(result) && AS_INT(result) == 11);
+
+  // A block's local ends with the block
+  result = run("let x = 1\n"
+               "let result = 0\n"
+               "if x > 0 {\n"
+               "  let x = 2\n"
+               "  result = x * 10\n"
+               "}\n"
+               "result = result + x\n",
+               "result");
+  assert(IS_INT(result) && AS_INT(result) == 21);
+
+  // A nested function still sees globals
+  result = run("let g = 3\n"
+               "fn outer(a) {\n"
+               "  fn inner(b) {\n"
+               "    return b + g\n"
+               "  }\n"
+               "  return inner(a)\n"
+               "}\n"
+               "let result = outer(4)\n",
+               "result");
+  assert(IS_INT(result) && AS_INT(result) == 7);
+
+  printf("✓ Scopes test passed\n");
+}
+
+void test_compiler_enclosing_locals() {
+  printf("Testing locals of enclosing scopes...\n");
+
+  // There are no closures: a nested function cannot reach the locals of
+  // the code around it, and must not get a global of the same name
+  assert_compile_error(
+      "let hidden = 100\n"
+      "fn outer(a) {\n"
+      "  let hidden = a * 2\n"
+      "  fn inner(b) {\n"
+      "    return b + hidden\n"
+      "  }\n"
+      "  return inner(1)\n"
+      "}\n"
+      "print(outer(5))\n",
+      "Cannot use local 'hidden' of an enclosing scope (no closures)");
+
+  // Parameters, locals of a block at top level, and assignments too
+  assert_compile_error(
+      "fn outer(a) {\n"
+      "  fn inner(b) {\n"
+      "    return a + b\n"
+      "  }\n"
+      "  return inner(1)\n"
+      "}\n",
+      "Cannot use local 'a' of an enclosing scope (no closures)");
+  assert_compile_error(
+      "if true {\n"
+      "  let y = 1\n"
+      "  fn f() {\n"
+      "    y = 2\n"
+      "  }\n"
+      "}\n",
+      "Cannot use local 'y' of an enclosing scope (no closures)");
+
+  // An assignment statement too, even with a global of the same name
+  assert_compile_error(
+      "let x = 1\n"
+      "fn outer() {\n"
+      "  let x = 5\n"
+      "  fn inner() {\n"
+      "    x = 10\n"
+      "  }\n"
+      "  inner()\n"
+      "  return x\n"
+      "}\n",
+      "Cannot use local 'x' of an enclosing scope (no closures)");
+  assert_compile_error(
+      "let x = 1\n"
+      "fn outer() {\n"
+      "  let x = 5\n"
+      "  fn inner() {\n"
+      "    x = x + 1\n"
+      "  }\n"
+      "  inner()\n"
+      "  return x\n"
+      "}\n",
+      "Cannot use local 'x' of an enclosing scope (no closures)");
+
+  // A local named like a native is not the native either
+  assert_compile_error(
+      "fn outer(len) {\n"
+      "  fn inner(s) {\n"
+      "    return len(s)\n"
+      "  }\n"
+      "  return inner(\"abc\")\n"
+      "}\n",
+      "Cannot use local 'len' of an enclosing scope (no closures)");
+
+  printf("✓ Enclosing locals test passed\n");
+}
+
+void test_compiler_native_shadowing() {
+  printf("Testing natives shadowed by declarations...\n");
+
+  // A declaration shadows a native at every call site, even the ones
+  // compiled before it
+  Value result = run("fn go() {\n"
+                     "  return len(\"abc\")\n"
+                     "}\n"
+                     "fn len(x) {\n"
+                     "  return 99\n"
+                     "}\n"
+                     "let result = go()\n",
+                     "result");
+  assert(IS_INT(result) && AS_INT(result) == 99);
+
+  result = run("fn go() {\n"
+               "  return len(\"abc\")\n"
+               "}\n"
+               "fn answer(x) {\n"
+               "  return 42\n"
+               "}\n"
+               "let len = answer\n"
+               "let result = go()\n",
+               "result");
+  assert(IS_INT(result) && AS_INT(result) == 42);
+
+  // Without a declaration the native is called
+  result = run("let result = len(\"abc\")\n", "result");
+  assert(IS_INT(result) && AS_INT(result) == 3);
+
+  printf("✓ Native shadowing test passed\n");
+}
+
+void test_compiler_array_indexes() {
+  printf("Testing array indexes...\n");
+
+  // Whole doubles index like integers; past either end reads null
+  Value result = run("let a = [10, 20, 30]\n"
+                     "let result = a[2.0] + a[1]\n",
+                     "result");
+  assert(IS_INT(result) && AS_INT(result) == 50);
+  result = run("let a = [10]\n"
+               "let result = a[4294967296.0 * 4294967296.0 * 4294967296.0]\n",
+               "result");
+  assert(IS_NULL(result));
+  result = run("let a = [10]\nlet result = a[-1]\n", "result");
+  assert(IS_NULL(result));
+
+  // Index count appends
+  result = run("let a = [10]\n"
+               "a[1] = 20\n"
+               "a[2.0] = 30\n"
+               "let result = len(a) * 100 + a[2]\n",
+               "result");
+  assert(IS_INT(result) && AS_INT(result) == 330);
+
+  assert_runtime_error("let a = [1]\nlet b = a[0.5]\n",
+                       "Array index must be an integer");
+  // 2^96 to the 11th overflows to infinity
+  const char *infinity = "let big = 4294967296.0 * 4294967296.0 * 4294967296.0\n"
+                         "let inf = big * big * big * big * big * big * big *"
+                         " big * big * big * big\n"
+                         "let a = [1]\n";
+  char source[256];
+  snprintf(source, sizeof(source), "%sa[inf] = 2\n", infinity);
+  assert_runtime_error(source, "Array index must be an integer");
+  snprintf(source, sizeof(source), "%slet b = a[inf - inf]\n", infinity);
+  assert_runtime_error(source, "Array index must be an integer");
+  assert_runtime_error("let a = [1]\na[100000000] = 2\n",
+                       "Array index out of range");
+  assert_runtime_error("let a = [1]\n"
+                       "a[4294967296.0 * 4294967296.0 * 4294967296.0] = 2\n",
+                       "Array index out of range");
+  assert_runtime_error("let a = [1]\na[-1] = 2\n",
+                       "Array index out of range");
+
+  printf("✓ Array indexes test passed\n");
+}
+
+void test_compiler_number_equality() {
+  printf("Testing number equality...\n");
+
+  // Numbers are equal only when they are the same double, whether the
+  // VM compares them or the optimizer folds the comparison
+  Value result = run("let a = 0.1\n"
+                     "let result = a + 0.2 == 0.3\n",
+                     "result");
+  assert(IS_BOOL(result) && !AS_BOOL(result));
+  result = run("let result = 0.1 + 0.2 == 0.3\n", "result");
+  assert(IS_BOOL(result) && !AS_BOOL(result));
+  result = run("let one = 1\n"
+               "let result = one == 1.00000000001\n",
+               "result");
+  assert(IS_BOOL(result) && !AS_BOOL(result));
+  result = run("let result = 1 == 1.00000000001\n", "result");
+  assert(IS_BOOL(result) && !AS_BOOL(result));
+
+  // An int and a double of the same value are equal
+  result = run("let one = 1\n"
+               "let result = one == 1.0\n",
+               "result");
+  assert(IS_BOOL(result) && AS_BOOL(result));
+  result = run("let result = 2 != 2.0\n", "result");
+  assert(IS_BOOL(result) && !AS_BOOL(result));
+
+  printf("✓ Number equality test passed\n");
+}
+
+int main() {
+  printf("=== Riau Compiler Tests ===\n\n");
+
+  test_compiler_scopes();
+  test_compiler_enclosing_locals();
+  test_compiler_native_shadowing();
+  test_compiler_array_indexes();
+  test_compiler_number_equality();
+
+  printf("\n=== All compiler tests passed! ===\n");
+  return 0;
+}
@@ -74,7 +74,7 @@ void test_lexer_literals() {
 void test_lexer_operators() {
   printf("Testing lexer operators...\n");
 
-  const char *source = "+ - * / == != < > <= >= && ||";
+  const char *source = "+ - * / == != < > <= >= && || & | ^ ~ << >>";
   Lexer lexer;
   lexer_init(&lexer, source);
 
@@ -116,6 +116,24 @@ void test_lexer_operators() {
   token = lexer_next_token(&lexer);
   assert(token.type == TOKEN_OR);
 
+  token = lexer_next_token(&lexer);
+  assert(token.type == TOKEN_AMPERSAND);
+
+  token = lexer_next_token(&lexer);
+  assert(token.type == TOKEN_PIPE);
+
+  token = lexer_next_token(&lexer);
+  assert(token.type == TOKEN_CARET);
+
+  token = lexer_next_token(&lexer);
+  assert(token.type == TOKEN_TILDE);
+
+  token = lexer_next_token(&lexer);
+  assert(token.type == TOKEN_SHIFT_LEFT);
+
+  token = lexer_next_token(&lexer);
+  assert(token.type == TOKEN_SHIFT_RIGHT);
+
   printf("✓ Operator tests passed\n");
 }
 
@@ -1,8 +1,10 @@
 // Test: Parser functionality
 #include "../lexer/lexer.h"
+#include "../optimizer/optimizer.h"
 #include "../parser/parser.h"
 #include <assert.h>
 #include <stdio.h>
+#include <string.h>
 
 
 void test_parser_variable_decl() {
@@ -85,6 +87,56 @@ void test_parser_if_statement() {
   printf("✓ If statement test passed\n");
 }
 
+void test_parser_optimizer() {
+  printf("Testing constant folding and dead code elimination...\n");
+
+  const char *source = "let x = 2 + 3 * 4\n"
+                       "let s = \"ab\" + \"cd\"\n"
+                       "let z = 1 / 0\n"
+                       "if false { print(1) }\n"
+                       "fn f() { return 1\n print(2) }";
+  Lexer lexer;
+  lexer_init(&lexer, source);
+
+  Parser parser;
+  parser_init(&parser, &lexer);
+
+  ASTNode *ast = parser_parse(&parser);
+  assert(ast != NULL);
+  assert(!parser_had_error(&parser));
+
+  Optimizer optimizer;
+  optimizer_init(&optimizer);
+  optimizer_run(&optimizer, ast);
+
+  // The `if` is gone; the rest remain
+  ASTNodeList *statements = ast->data.program.statements;
+  assert(ast_list_length(statements) == 4);
+
+  ASTNode *x = statements->node->data.var_decl.initializer;
+  assert(x->type == AST_LITERAL_NUMBER);
+  assert(x->data.number.value == 14);
+  assert(x->data.number.is_integer);
+
+  ASTNode *s = statements->next->node->data.var_decl.initializer;
+  assert(s->type == AST_LITERAL_STRING);
+  assert(strcmp(s->data.string.value, "abcd") == 0);
+
+  // Division by zero must still fail at runtime
+  ASTNode *z = statements->next->next->node->data.var_decl.initializer;
+  assert(z->type == AST_BINARY_EXPR);
+
+  // Nothing after the return survives
+  ASTNode *f = statements->next->next->next->node;
+  assert(ast_list_length(f->data.func_decl.body->data.block.statements) == 1);
+
+  assert(optimizer.folded == 3);
+  assert(optimizer.removed > 0);
+
+  ast_free(ast);
+  printf("✓ Optimizer test passed\n");
+}
+
 int main() {
   printf("=== Riau Parser Tests ===\n\n");
 
@@ -92,6 +144,7 @@ int main() {
   test_parser_function_decl();
   test_parser_expressions();
   test_parser_if_statement();
+  test_parser_optimizer();
 
   printf("\n=== All parser tests passed! ===\n");
   return 0;
@@ -0,0 +1,241 @@
+// Test: Peephole optimizer
+#include "../bytecode/peephole.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+
+static void write_code(Chunk *chunk, const uint8_t *code, size_t count,
+                       int line) {
+  for (size_t i = 0; i < count; i++) {
+    chunk_write(chunk, code[i], line);
+  }
+}
+
+static void assert_code(Chunk *chunk, const uint8_t *code, size_t count) {
+  assert(chunk->count == count);
+  assert(memcmp(chunk->code, code, count) == 0);
+}
+
+void test_peephole_jumps() {
+  printf("Testing jump rules...\n");
+
+  Chunk chunk;
+  chunk_init(&chunk);
+  size_t one = chunk_add_constant(&chunk, constant_int(1));
+
+  // if !a { print(1) }; return 1, with a dead PUSH_NULL; POP and a jump
+  // over unreachable code
+  const uint8_t line1[] = {OP_LOAD_LOCAL, 0, OP_NOT, OP_JUMP_IF_FALSE, 0, 4};
+  const uint8_t line2[] = {OP_PRINT_CONST, (uint8_t)one, OP_PUSH_NULL, OP_POP};
+  const uint8_t line3[] = {OP_JUMP, 0, 1, OP_PUSH_TRUE};
+  const uint8_t line4[] = {OP_PUSH_CONST, (uint8_t)one, OP_RETURN};
+  write_code(&chunk, line1, sizeof(line1), 1);
+  write_code(&chunk, line2, sizeof(line2), 2);
+  write_code(&chunk, line3, sizeof(line3), 3);
+  write_code(&chunk, line4, sizeof(line4), 4);
+  assert(chunk_jump_target(&chunk, 3) == 10);
+  assert(chunk_jump_target(&chunk, 10) == 14);
+
+  // NOT; JUMP_IF_FALSE is inverted, PUSH_NULL; POP and PUSH_TRUE go; the
+  // conditional jump then skips the jump, which now goes to the next
+  // instruction and goes too
+  assert(peephole_optimize(&chunk, true) == 5);
+
+  const uint8_t expected[] = {
+      OP_LOAD_LOCAL, 0,
+      OP_JUMP_IF_TRUE, 0, 2, // -> 7
+      OP_PRINT_CONST, (uint8_t)one,
+      OP_PUSH_CONST, (uint8_t)one,
+      OP_RETURN,
+  };
+  assert_code(&chunk, expected, sizeof(expected));
+  assert(chunk_jump_target(&chunk, 2) == 7);
+
+  // Every instruction kept its line
+  assert(chunk_get_line(&chunk, 2) == 1);
+  assert(chunk_get_line(&chunk, 5) == 2);
+  assert(chunk_get_line(&chunk, 7) == 4);
+  assert(chunk_get_line(&chunk, 9) == 4);
+
+  chunk_free(&chunk);
+  printf("✓ Jump rules test passed\n");
+}
+
+void test_peephole_threading() {
+  printf("Testing jump threading...\n");
+
+  Chunk chunk;
+  chunk_init(&chunk);
+  size_t one = chunk_add_constant(&chunk, constant_int(1));
+
+  // A long conditional jump to a long jump to the end
+  const uint8_t code[] = {
+      OP_LOAD_VAR, 0,
+      OP_JUMP_IF_FALSE_LONG, 0, 0, 0, 3, // -> 10
+      OP_PRINT_CONST, (uint8_t)one,
+      OP_HALT,
+      OP_JUMP_LONG, 0, 0, 0, 2, // -> 17
+      OP_PRINT_CONST, (uint8_t)one,
+      OP_HALT,
+  };
+  write_code(&chunk, code, sizeof(code), 1);
+  assert(chunk_jump_target(&chunk, 2) == 10);
+  assert(chunk_jump_target(&chunk, 10) == 17);
+
+  // The conditional jump goes straight to the end, which leaves the jump
+  // and what follows it unreachable; the jumps that are left fit in 16 bits
+  assert(peephole_optimize(&chunk, true) == 3);
+
+  const uint8_t expected[] = {
+      OP_LOAD_VAR, 0,
+      OP_JUMP_IF_FALSE, 0, 3, // -> 8
+      OP_PRINT_CONST, (uint8_t)one,
+      OP_HALT,
+      OP_HALT,
+  };
+  assert_code(&chunk, expected, sizeof(expected));
+  assert(chunk_jump_target(&chunk, 2) == 8);
+
+  chunk_free(&chunk);
+  printf("✓ Jump threading test passed\n");
+}
+
+void test_peephole_stores() {
+  printf("Testing store rules...\n");
+
+  Chunk chunk;
+  chunk_init(&chunk);
+  size_t one = chunk_add_constant(&chunk, constant_int(1));
+
+  // fn a ...; b = a; print(b)
+  const uint8_t code[] = {
+      OP_PUSH_CONST, (uint8_t)one,
+      OP_STORE_VAR, 0,
+      OP_POP,
+      OP_LOAD_VAR, 0,
+      OP_STORE_VAR_POP, 1,
+      OP_LOAD_VAR, 1,
+      OP_PRINT_POP,
+      OP_HALT,
+  };
+  write_code(&chunk, code, sizeof(code), 1);
+
+  // The stored values stay on the stack instead of being loaded again
+  assert(peephole_optimize(&chunk, true) == 2);
+
+  const uint8_t expected[] = {
+      OP_PUSH_CONST, (uint8_t)one,
+      OP_STORE_VAR, 0,
+      OP_STORE_VAR, 1,
+      OP_PRINT_POP,
+      OP_HALT,
+  };
+  assert_code(&chunk, expected, sizeof(expected));
+
+  chunk_free(&chunk);
+  printf("✓ Store rules test passed\n");
+}
+
+void test_peephole_jump_targets() {
+  printf("Testing sequences with a jump into them...\n");
+
+  Chunk chunk;
+  chunk_init(&chunk);
+  size_t one = chunk_add_constant(&chunk, constant_int(1));
+
+  // if c { x = 1 }; print(x): the load is where the if ends, so it cannot
+  // be merged with the store before it
+  const uint8_t code[] = {
+      OP_LOAD_VAR, 1,
+      OP_JUMP_IF_FALSE, 0, 5, // -> 10
+      OP_PUSH_CONST, (uint8_t)one,
+      OP_STORE_VAR, 0,
+      OP_POP,
+      OP_LOAD_VAR, 0,
+      OP_PRINT_POP,
+      OP_HALT,
+  };
+  write_code(&chunk, code, sizeof(code), 1);
+  assert(chunk_jump_target(&chunk, 2) == 10);
+
+  assert(peephole_optimize(&chunk, false) == 0);
+  assert_code(&chunk, code, sizeof(code));
+
+  // With superinstructions the store and its pop fuse; the jump follows
+  assert(peephole_optimize(&chunk, true) == 1);
+  const uint8_t fused[] = {
+      OP_LOAD_VAR, 1,
+      OP_JUMP_IF_FALSE, 0, 4, // -> 9
+      OP_PUSH_CONST, (uint8_t)one,
+      OP_STORE_VAR_POP, 0,
+      OP_LOAD_VAR, 0,
+      OP_PRINT_POP,
+      OP_HALT,
+  };
+  assert_code(&chunk, fused, sizeof(fused));
+  assert(chunk_jump_target(&chunk, 2) == 9);
+
+  chunk_free(&chunk);
+  printf("✓ Jump target test passed\n");
+}
+
+void test_peephole_loops() {
+  printf("Testing loops...\n");
+
+  Chunk chunk;
+  chunk_init(&chunk);
+
+  // for x in a { print(x) } with a dead PUSH_NULL; POP in the body: the
+  // loop's jump back gets shorter
+  const uint8_t code[] = {
+      OP_LOAD_VAR, 0,
+      OP_FOR_PREP,
+      OP_JUMP, 0, 5, // -> 11
+      OP_LOAD_LOCAL, 2,
+      OP_PUSH_NULL,
+      OP_POP,
+      OP_PRINT_POP,
+      OP_FOR_ITER, 0, 8, // -> 6
+      OP_POP,
+      OP_POP,
+      OP_POP,
+      OP_HALT,
+  };
+  write_code(&chunk, code, sizeof(code), 1);
+  assert(chunk_jump_target(&chunk, 3) == 11);
+  assert(chunk_jump_target(&chunk, 11) == 6);
+
+  assert(peephole_optimize(&chunk, true) == 1);
+
+  const uint8_t expected[] = {
+      OP_LOAD_VAR, 0,
+      OP_FOR_PREP,
+      OP_JUMP, 0, 3, // -> 9
+      OP_LOAD_LOCAL, 2,
+      OP_PRINT_POP,
+      OP_FOR_ITER, 0, 6, // -> 6
+      OP_POP,
+      OP_POP,
+      OP_POP,
+      OP_HALT,
+  };
+  assert_code(&chunk, expected, sizeof(expected));
+  assert(chunk_jump_target(&chunk, 9) == 6);
+
+  chunk_free(&chunk);
+  printf("✓ Loop test passed\n");
+}
+
+int main() {
+  printf("=== Riau Peephole Optimizer Tests ===\n\n");
+
+  test_peephole_jumps();
+  test_peephole_threading();
+  test_peephole_stores();
+  test_peephole_jump_targets();
+  test_peephole_loops();
+
+  printf("\n=== All peephole optimizer tests passed! ===\n");
+  return 0;
+}
@@ -1,8 +1,16 @@
 // Test: VM functionality
 #include "../bytecode/bytecode.h"
+#include "../bytecode/chunk_cache.h"
+#include "../bytecode/regcode.h"
+#include "../runtime/arena.h"
+#include "../stdlib/stdlib.h"
+#include "../vm/aot.h"
+#include "../vm/reg_vm.h"
+#include "../vm/snapshot.h"
 #include "../vm/vm.h"
 #include <assert.h>
 #include <stdio.h>
+#include <string.h>
 
 
 void test_vm_arithmetic() {
@@ -116,12 +124,1407 @@ void test_vm_strings() {
   printf("✓ VM string test passed\n");
 }
 
+void test_vm_values() {
+  printf("Testing VM value representation...\n");
+
+#ifdef RIAU_NAN_BOXING
+  assert(sizeof(Value) == 8);
+#endif
+
+  Value n = value_number(-2.5);
+  assert(IS_NUMBER(n) && AS_NUMBER(n) == -2.5);
+  assert(VALUE_TYPE(n) == VAL_NUMBER);
+
+  Value i = value_int(-7);
+  assert(IS_INT(i) && !IS_NUMBER(i) && AS_INT(i) == -7);
+  assert(VALUE_TYPE(i) == VAL_INT && IS_NUMERIC(i));
+  assert(AS_DOUBLE(i) == -7.0);
+  assert(value_equals(i, value_number(-7)));
+  assert(!value_equals(i, value_int(7)));
+  // Past 32 bits the value is a double
+  Value big = value_int((int64_t)INT32_MAX + 1);
+  assert(IS_NUMBER(big) && AS_NUMBER(big) == 2147483648.0);
+
+  Value t = value_bool(true);
+  Value f = value_bool(false);
+  assert(IS_BOOL(t) && AS_BOOL(t));
+  assert(IS_BOOL(f) && !AS_BOOL(f));
+  assert(!IS_BOOL(value_null()) && IS_NULL(value_null()));
+
+  Value s = value_string("riau");
+  assert(IS_STRING(s) && !IS_NUMBER(s));
+  assert(VALUE_TYPE(s) == VAL_STRING);
+  assert(value_equals(s, s));
+
+  Value a = value_array();
+  array_push(AS_ARRAY(a), value_number(1));
+  assert(IS_ARRAY(a) && AS_ARRAY(a)->count == 1);
+  assert(AS_NUMBER(array_get(AS_ARRAY(a), 0)) == 1);
+
+  Value o = value_object();
+  object_set(AS_OBJECT(o), "name", value_bool(true));
+  assert(IS_OBJECT(o) && object_has(AS_OBJECT(o), "name"));
+  assert(VALUE_TYPE(o) == VAL_OBJECT);
+
+  printf("✓ VM value test passed\n");
+}
+
+void test_vm_string_interning() {
+  printf("Testing VM string interning...\n");
+
+  Chunk chunk;
+  chunk_init(&chunk);
+
+  size_t first = chunk_add_constant(&chunk, constant_string("</div>"));
+  size_t second = chunk_add_constant(&chunk, constant_string("</div>"));
+  size_t other = chunk_add_constant(&chunk, constant_string("<div>"));
+  assert(first == second);
+  assert(first != other);
+  assert(chunk.constants[first].as.string->length == 6);
+
+  Value a = value_string("ab");
+  Value b = value_string("ab");
+  Value c = value_string("ac");
+  assert(AS_STRING(a) != AS_STRING(b));
+  assert(value_equals(a, b));
+  assert(!value_equals(a, c));
+
+  chunk_free(&chunk);
+
+  printf("✓ VM string interning test passed\n");
+}
+
+void test_vm_constant_dedup() {
+  printf("Testing VM constant deduplication...\n");
+
+  Chunk chunk;
+  chunk_init(&chunk);
+
+  // Numbers are merged by type and bits; enough of them to grow the table
+  size_t one = chunk_add_constant(&chunk, constant_int(1));
+  size_t one_double = chunk_add_constant(&chunk, constant_number(1.0));
+  size_t zero = chunk_add_constant(&chunk, constant_number(0.0));
+  size_t negative_zero = chunk_add_constant(&chunk, constant_number(-0.0));
+  assert(one != one_double);
+  assert(zero != negative_zero);
+  for (int i = 0; i < 100; i++) {
+    size_t first = chunk_add_constant(&chunk, constant_int(i * 7));
+    size_t second = chunk_add_constant(&chunk, constant_int(i * 7));
+    assert(first == second);
+    assert(chunk.constants[first].as.integer == i * 7);
+  }
+  assert(chunk_add_constant(&chunk, constant_int(1)) == one);
+  assert(chunk_add_constant(&chunk, constant_number(1.0)) == one_double);
+  assert(chunk_add_constant(&chunk, constant_number(-0.0)) == negative_zero);
+  chunk_free(&chunk);
+
+  // Chunks sharing a table share their string objects, but keep their own
+  // constant slots
+  Chunk script;
+  Chunk body;
+  chunk_init(&script);
+  chunk_init(&body);
+  chunk_share_constants(&script, NULL);
+  chunk_share_constants(&body, script.shared);
+  assert(script.shared->refs == 2);
+
+  chunk_add_constant(&body, constant_int(3));
+  size_t in_script = chunk_add_constant(&script, constant_string("name"));
+  size_t in_body = chunk_add_constant(&body, constant_string("name"));
+  assert(in_script == 0 && in_body == 1);
+  assert(script.constants[in_script].as.string ==
+         body.constants[in_body].as.string);
+  assert(script.shared->count == 1);
+
+  // The strings outlive the first chunk freed
+  chunk_free(&script);
+  assert(body.shared->refs == 1);
+  assert(body.constants[in_body].as.string->length == 4);
+  chunk_free(&body);
+
+  printf("✓ VM constant deduplication test passed\n");
+}
+
+void test_vm_object_index() {
+  printf("Testing VM object hash index...\n");
+
+  Value o = value_object();
+  RiauObject *obj = AS_OBJECT(o);
+  char key[16];
+
+  for (int i = 0; i < 100; i++) {
+    snprintf(key, sizeof(key), "key%d", i);
+    object_set(obj, key, value_number(i));
+  }
+  assert(obj->shape->size == 100);
+  assert(key_index_is_built(&obj->shape->index));
+
+  for (int i = 0; i < 100; i++) {
+    snprintf(key, sizeof(key), "key%d", i);
+    assert(AS_NUMBER(object_get(obj, key)) == i);
+  }
+  assert(!object_has(obj, "missing"));
+
+  // Overwrite keeps the entry in place
+  object_set(obj, "key5", value_number(500));
+  assert(AS_NUMBER(object_get(obj, "key5")) == 500);
+  assert(obj->shape->size == 100);
+
+  // Delete every even key; odd keys keep insertion order
+  for (int i = 0; i < 100; i += 2) {
+    snprintf(key, sizeof(key), "key%d", i);
+    assert(object_delete(obj, key));
+  }
+  assert(obj->shape->size == 50);
+  assert(!object_has(obj, "key0"));
+  assert(!object_delete(obj, "key0"));
+
+  int expected = 1;
+  for (uint32_t i = 0; i < obj->shape->slot_count; i++) {
+    if (!obj->shape->keys[i])
+      continue;
+    snprintf(key, sizeof(key), "key%d", expected);
+    assert(strcmp(obj->shape->keys[i]->chars, key) == 0);
+    expected += 2;
+  }
+  assert(expected == 101);
+
+  // Re-adding a deleted key appends it at the end
+  object_set(obj, "key0", value_number(0));
+  assert(AS_NUMBER(object_get(obj, "key0")) == 0);
+  Shape *shape = obj->shape;
+  assert(strcmp(shape->keys[shape->slot_count - 1]->chars, "key0") == 0);
+
+  printf("✓ VM object hash index test passed\n");
+}
+
+static void emit_field(Chunk *chunk, OpCode op, const char *name) {
+  size_t constant = chunk_add_constant(chunk, constant_string(name));
+  size_t cache = chunk_add_cache(chunk);
+  chunk_write(chunk, op, 1);
+  chunk_write(chunk, (uint8_t)constant, 1);
+  chunk_write(chunk, (uint8_t)(cache >> 8), 1);
+  chunk_write(chunk, (uint8_t)cache, 1);
+}
+
+void test_vm_shapes() {
+  printf("Testing VM shapes and inline caches...\n");
+
+  // Same keys in the same order share a shape
+  Value a = value_object();
+  Value b = value_object();
+  Value c = value_object();
+  object_set(AS_OBJECT(a), "x", value_number(1));
+  object_set(AS_OBJECT(a), "y", value_number(2));
+  object_set(AS_OBJECT(b), "x", value_number(3));
+  object_set(AS_OBJECT(b), "y", value_number(4));
+  object_set(AS_OBJECT(c), "y", value_number(5));
+  object_set(AS_OBJECT(c), "x", value_number(6));
+  assert(AS_OBJECT(a)->shape == AS_OBJECT(b)->shape);
+  assert(AS_OBJECT(a)->shape != AS_OBJECT(c)->shape);
+  assert(AS_NUMBER(object_get(AS_OBJECT(c), "x")) == 6);
+
+  // Deleting moves only that object to a dictionary shape
+  assert(object_delete(AS_OBJECT(b), "x"));
+  assert(AS_OBJECT(b)->shape->is_dictionary);
+  assert(!AS_OBJECT(a)->shape->is_dictionary);
+  assert(AS_NUMBER(object_get(AS_OBJECT(b), "y")) == 4);
+
+  // { x: 1, y: 2 }.y, run twice over the same chunk
+  Chunk chunk;
+  chunk_init(&chunk);
+  size_t one = chunk_add_constant(&chunk, constant_number(1));
+  size_t two = chunk_add_constant(&chunk, constant_number(2));
+  chunk_write(&chunk, OP_OBJECT_NEW, 1);
+  chunk_write(&chunk, OP_PUSH_CONST, 1);
+  chunk_write(&chunk, (uint8_t)one, 1);
+  emit_field(&chunk, OP_STORE_FIELD, "x");
+  chunk_write(&chunk, OP_PUSH_CONST, 1);
+  chunk_write(&chunk, (uint8_t)two, 1);
+  emit_field(&chunk, OP_STORE_FIELD, "y");
+  emit_field(&chunk, OP_LOAD_FIELD, "y");
+  chunk_write(&chunk, OP_HALT, 1);
+
+  for (int run = 0; run < 2; run++) {
+    VM vm;
+    vm_init(&vm);
+    assert(vm_execute(&vm, &chunk));
+    assert(AS_NUMBER(vm.stack_top[-1]) == 2);
+    vm_free(&vm);
+  }
+
+  // Each site saw one shape: the second run hit the caches
+  assert(chunk.cache_count == 3);
+  for (size_t i = 0; i < chunk.cache_count; i++) {
+    assert(chunk.caches[i].count == 1);
+  }
+  assert(chunk.caches[0].entries[0].next == chunk.caches[1].entries[0].shape);
+  assert(chunk.caches[2].entries[0].slot == 1);
+
+  chunk_free(&chunk);
+
+  printf("✓ VM shapes test passed\n");
+}
+
+// Runs `a + a` with global 0 bound to `a`
+static Value run_add(Chunk *chunk, Value a) {
+  VM vm;
+  vm_init(&vm);
+  vm.globals[0] = a;
+  vm.global_count = 1;
+  assert(vm_execute(&vm, chunk));
+
+  Value result = vm.stack_top[-1];
+  vm_free(&vm);
+  return result;
+}
+
+void test_vm_quickening() {
+  printf("Testing VM adaptive quickening...\n");
+
+  Chunk chunk;
+  chunk_init(&chunk);
+  chunk_write(&chunk, OP_LOAD_VAR, 1);
+  chunk_write(&chunk, 0, 1);
+  chunk_write(&chunk, OP_LOAD_VAR, 1);
+  chunk_write(&chunk, 0, 1);
+  chunk_write(&chunk, OP_ADD, 1);
+  chunk_write(&chunk, OP_HALT, 1);
+  const int add = 4;
+
+#ifdef RIAU_NO_QUICKEN
+  // Quickening is off: the instruction stays generic
+  for (int i = 0; i < 2 * QUICKEN_THRESHOLD; i++) {
+    Value result = run_add(&chunk, value_number(i));
+    assert(AS_NUMBER(result) == 2 * i);
+    assert(chunk.code[add] == OP_ADD);
+  }
+#else
+  // Warm up with numbers
+  for (int i = 0; i < QUICKEN_THRESHOLD; i++) {
+    assert(chunk.code[add] == OP_ADD);
+    Value result = run_add(&chunk, value_number(i));
+    assert(AS_NUMBER(result) == 2 * i);
+  }
+  assert(chunk.code[add] == OP_ADD_NUM_NUM);
+
+  Value result = run_add(&chunk, value_number(21));
+  assert(AS_NUMBER(result) == 42);
+  assert(chunk.quicken[add].hits == 1);
+
+  // A string fails the guard: back to the generic form, same result
+  result = run_add(&chunk, value_string("ab"));
+  assert(strcmp(AS_CSTRING(result), "abab") == 0);
+  assert(chunk.code[add] == OP_ADD);
+  assert(chunk.quicken[add].deopts == 1);
+
+  // ...which can then quicken for strings
+  for (int i = 0; i < QUICKEN_THRESHOLD; i++) {
+    run_add(&chunk, value_string("c"));
+  }
+  assert(chunk.code[add] == OP_ADD_STR_STR);
+  result = run_add(&chunk, value_string("xy"));
+  assert(strcmp(AS_CSTRING(result), "xyxy") == 0);
+
+  // Ints quicken to the int form, which moves to a double on overflow
+  chunk.code[add] = OP_ADD;
+  chunk.quicken[add].deopts = 0;
+  for (int i = 0; i < QUICKEN_THRESHOLD; i++) {
+    result = run_add(&chunk, value_int(i));
+    assert(IS_INT(result) && AS_INT(result) == 2 * i);
+  }
+  assert(chunk.code[add] == OP_ADD_INT_INT);
+  result = run_add(&chunk, value_int(INT32_MAX));
+  assert(IS_NUMBER(result) && AS_NUMBER(result) == 2.0 * INT32_MAX);
+
+  // A double fails the int guard, and is handled by the number form
+  result = run_add(&chunk, value_number(0.25));
+  assert(AS_NUMBER(result) == 0.5);
+  assert(chunk.code[add] == OP_ADD);
+#endif
+
+  chunk_free(&chunk);
+
+  printf("✓ VM quickening test passed\n");
+}
+
+void test_vm_superinstructions() {
+  printf("Testing VM superinstructions...\n");
+
+  Chunk chunk;
+  chunk_init(&chunk);
+  size_t ten = chunk_add_constant(&chunk, constant_number(10));
+  size_t five = chunk_add_constant(&chunk, constant_number(5));
+  size_t hi = chunk_add_constant(&chunk, constant_string("hi"));
+
+  // let x = 10; x = x + 5; x = x + 5; let s = "hi"; s = s + "hi"
+  chunk_write(&chunk, OP_PUSH_CONST, 1);
+  chunk_write(&chunk, (uint8_t)ten, 1);
+  chunk_write(&chunk, OP_STORE_VAR_POP, 1);
+  chunk_write(&chunk, 0, 1);
+  for (int i = 0; i < 2; i++) {
+    chunk_write(&chunk, OP_ADD_VAR_CONST, 2);
+    chunk_write(&chunk, 0, 2);
+    chunk_write(&chunk, (uint8_t)five, 2);
+  }
+  chunk_write(&chunk, OP_PUSH_CONST, 3);
+  chunk_write(&chunk, (uint8_t)hi, 3);
+  chunk_write(&chunk, OP_STORE_VAR_POP, 3);
+  chunk_write(&chunk, 1, 3);
+  chunk_write(&chunk, OP_ADD_VAR_CONST, 4);
+  chunk_write(&chunk, 1, 4);
+  chunk_write(&chunk, (uint8_t)hi, 4);
+
+  // print("hi"); print(x)
+  chunk_write(&chunk, OP_PRINT_CONST, 5);
+  chunk_write(&chunk, (uint8_t)hi, 5);
+  chunk_write(&chunk, OP_LOAD_VAR, 6);
+  chunk_write(&chunk, 0, 6);
+  chunk_write(&chunk, OP_PRINT_POP, 6);
+  chunk_write(&chunk, OP_HALT, 6);
+
+  size_t instructions = 0;
+  for (size_t offset = 0; offset < chunk.count; instructions++) {
+    offset += opcode_length(chunk.code[offset]);
+  }
+  assert(instructions == 11);
+
+  VM vm;
+  vm_init(&vm);
+  assert(vm_execute(&vm, &chunk));
+
+  // Every statement left the stack balanced
+  assert(vm.stack_top == vm.stack);
+  assert(AS_NUMBER(vm.globals[0]) == 20);
+  assert(strcmp(AS_CSTRING(vm.globals[1]), "hihi") == 0);
+
+  vm_free(&vm);
+  chunk_free(&chunk);
+
+  printf("✓ VM superinstructions test passed\n");
+}
+
+void test_reg_vm() {
+  printf("Testing register VM...\n");
+
+  RegChunk chunk;
+  reg_chunk_init(&chunk);
+  size_t ten = chunk_add_constant(&chunk.pool, constant_number(10));
+  size_t four = chunk_add_constant(&chunk.pool, constant_number(4));
+  size_t x = chunk_add_constant(&chunk.pool, constant_string("x"));
+
+  // r0 = 10; r1 = 4; r2 = r0 * r1 - r1; r0 = r0 < r2
+  reg_chunk_write(&chunk, REG_ABX(ROP_LOADK, 0, ten), 1);
+  reg_chunk_write(&chunk, REG_ABX(ROP_LOADK, 1, four), 1);
+  reg_chunk_write(&chunk, REG_ABC(ROP_MUL, 2, 0, 1), 2);
+  reg_chunk_write(&chunk, REG_ABC(ROP_SUB, 2, 2, 1), 2);
+  reg_chunk_write(&chunk, REG_ABC(ROP_LESS, 0, 0, 2), 3);
+
+  // r3 = {}; r3.x = r2; r1 = r3.x
+  reg_chunk_write(&chunk, REG_ABC(ROP_NEW_OBJECT, 3, 0, 0), 4);
+  reg_chunk_write(&chunk, REG_ABC(ROP_SET_FIELD, 3, x, 2), 4);
+  reg_chunk_write(&chunk, (uint32_t)chunk_add_cache(&chunk.pool), 4);
+  reg_chunk_write(&chunk, REG_ABC(ROP_GET_FIELD, 1, 3, x), 5);
+  reg_chunk_write(&chunk, (uint32_t)chunk_add_cache(&chunk.pool), 5);
+
+  // r3 = r3.x: the receiver is released only after the read
+  reg_chunk_write(&chunk, REG_ABC(ROP_GET_FIELD, 3, 3, x), 6);
+  reg_chunk_write(&chunk, (uint32_t)chunk_add_cache(&chunk.pool), 6);
+  reg_chunk_write(&chunk, REG_ABC(ROP_HALT, 0, 0, 0), 6);
+  chunk.register_count = 4;
+
+  assert(REG_OP(chunk.code[2]) == ROP_MUL);
+  assert(REG_A(chunk.code[2]) == 2 && REG_B(chunk.code[2]) == 0);
+  assert(REG_C(chunk.code[2]) == 1 && REG_BX(chunk.code[1]) == four);
+
+  RegVM vm;
+  reg_vm_init(&vm);
+  assert(reg_vm_execute(&vm, &chunk));
+  assert(IS_BOOL(vm.registers[0]) && AS_BOOL(vm.registers[0]));
+  assert(AS_NUMBER(vm.registers[1]) == 36);
+  assert(AS_NUMBER(vm.registers[2]) == 36);
+  assert(AS_NUMBER(vm.registers[3]) == 36);
+  reg_vm_free(&vm);
+
+  // Type errors are reported, not crashed on
+  reg_chunk_free(&chunk);
+  reg_chunk_init(&chunk);
+  size_t text = chunk_add_constant(&chunk.pool, constant_string("a"));
+  reg_chunk_write(&chunk, REG_ABX(ROP_LOADK, 0, text), 1);
+  reg_chunk_write(&chunk, REG_ABC(ROP_MUL, 1, 0, 0), 1);
+  reg_chunk_write(&chunk, REG_ABC(ROP_HALT, 0, 0, 0), 1);
+  chunk.register_count = 2;
+
+  reg_vm_init(&vm);
+  assert(!reg_vm_execute(&vm, &chunk));
+  assert(strcmp(vm.error_message, "Operands must be numbers") == 0);
+  reg_vm_free(&vm);
+  reg_chunk_free(&chunk);
+
+  printf("✓ Register VM test passed\n");
+}
+
+void test_vm_gc() {
+  printf("Testing VM garbage collector...\n");
+
+  VM vm;
+  vm_init(&vm);
+
+  // Reachable nursery objects are promoted, the roots follow them
+  Value array = value_array();
+  array_push(AS_ARRAY(array), value_string("kept"));
+  value_object();
+  assert(gc_is_young(AS_GC(array)));
+  vm.globals[0] = array;
+  vm.global_count = 1;
+  gc_collect();
+  array = vm.globals[0];
+  assert(IS_ARRAY(array) && !gc_is_young(AS_GC(array)));
+  assert(strcmp(AS_CSTRING(array_get(AS_ARRAY(array), 0)), "kept") == 0);
+
+  // Storing a young object into an old one goes through the barrier
+  array_push(AS_ARRAY(array), value_string("young"));
+  assert(AS_GC(array)->flags & GC_REMEMBERED);
+  gc_collect();
+  Value young = array_get(AS_ARRAY(vm.globals[0]), 1);
+  assert(!gc_is_young(AS_GC(young)));
+  assert(strcmp(AS_CSTRING(young), "young") == 0);
+
+  // Unreachable old objects are swept
+  size_t freed = gc_stats()->freed_bytes;
+  vm.global_count = 0;
+  gc_collect();
+  assert(gc_stats()->freed_bytes > freed);
+  assert(gc_phase() == GC_IDLE);
+  vm_free(&vm);
+
+  // Garbage allocated while running is reclaimed at safepoints: each new
+  // object replaces the last in global 0
+  Chunk chunk;
+  chunk_init(&chunk);
+  for (int i = 0; i < 20000; i++) {
+    chunk_write(&chunk, OP_OBJECT_NEW, 1);
+    chunk_write(&chunk, OP_STORE_VAR_POP, 1);
+    chunk_write(&chunk, 0, 1);
+  }
+  chunk_write(&chunk, OP_HALT, 1);
+
+  size_t minor = gc_stats()->minor_collections;
+  vm_init(&vm);
+  assert(vm_execute(&vm, &chunk));
+  assert(IS_OBJECT(vm.globals[0]));
+  assert(gc_stats()->minor_collections > minor);
+  assert(gc_stats()->old_bytes < GC_NURSERY_SIZE);
+  vm_free(&vm);
+  chunk_free(&chunk);
+
+  printf("✓ VM garbage collector test passed\n");
+}
+
+void test_vm_stacks() {
+  printf("Testing VM stack and globals limits...\n");
+
+  // Globals past slot 255 use the long forms
+  Chunk chunk;
+  chunk_init(&chunk);
+  size_t seven = chunk_add_constant(&chunk, constant_number(7));
+  chunk_write(&chunk, OP_PUSH_CONST, 1);
+  chunk_write(&chunk, (uint8_t)seven, 1);
+  chunk_write(&chunk, OP_STORE_VAR_LONG, 1);
+  chunk_write(&chunk, 1000 >> 8, 1);
+  chunk_write(&chunk, 1000 & 0xff, 1);
+  chunk_write(&chunk, OP_LOAD_VAR_LONG, 1);
+  chunk_write(&chunk, 1000 >> 8, 1);
+  chunk_write(&chunk, 1000 & 0xff, 1);
+  chunk_write(&chunk, OP_HALT, 1);
+
+  VM vm;
+  vm_init(&vm);
+  assert(vm_execute(&vm, &chunk));
+  assert(vm.global_count == 1001);
+  assert(IS_NULL(vm.globals[999]));
+  assert(AS_NUMBER(vm.globals[1000]) == 7);
+  assert(AS_NUMBER(vm.stack_top[-1]) == 7);
+  chunk_free(&chunk);
+
+  // Pushing past STACK_MAX is an error, not a crash
+  chunk_init(&chunk);
+  for (int i = 0; i <= STACK_MAX; i++) {
+    chunk_write(&chunk, OP_PUSH_NULL, 1);
+  }
+  chunk_write(&chunk, OP_HALT, 1);
+  assert(!vm_execute(&vm, &chunk));
+  assert(strcmp(vm.error_message, "Stack overflow") == 0);
+  assert(vm.stack_top == vm.stack);
+  chunk_free(&chunk);
+
+  // The VM is still usable afterwards
+  chunk_init(&chunk);
+  chunk_write(&chunk, OP_PUSH_TRUE, 1);
+  chunk_write(&chunk, OP_HALT, 1);
+  vm.had_error = false;
+  assert(vm_execute(&vm, &chunk));
+  assert(IS_BOOL(vm.stack_top[-1]));
+  vm_free(&vm);
+  chunk_free(&chunk);
+
+  printf("✓ VM stack and globals test passed\n");
+}
+
+void test_vm_calls() {
+  printf("Testing VM calls...\n");
+
+  // fn add(a, b) => a + b
+  RiauFunction *add = function_new_unmanaged("add", 2);
+  chunk_write(add->chunk, OP_LOAD_LOCAL, 1);
+  chunk_write(add->chunk, 0, 1);
+  chunk_write(add->chunk, OP_LOAD_LOCAL, 1);
+  chunk_write(add->chunk, 1, 1);
+  chunk_write(add->chunk, OP_ADD, 1);
+  chunk_write(add->chunk, OP_RETURN, 1);
+
+  // add(2, 3), then add(2) on the same callee
+  Chunk chunk;
+  chunk_init(&chunk);
+  size_t function = chunk_add_constant(&chunk, constant_function(add));
+  size_t two = chunk_add_constant(&chunk, constant_number(2));
+  size_t three = chunk_add_constant(&chunk, constant_number(3));
+  chunk_write(&chunk, OP_PUSH_CONST, 2);
+  chunk_write(&chunk, (uint8_t)function, 2);
+  chunk_write(&chunk, OP_PUSH_CONST, 2);
+  chunk_write(&chunk, (uint8_t)two, 2);
+  chunk_write(&chunk, OP_PUSH_CONST, 2);
+  chunk_write(&chunk, (uint8_t)three, 2);
+  chunk_write(&chunk, OP_CALL, 2);
+  chunk_write(&chunk, 2, 2);
+  chunk_write(&chunk, OP_HALT, 2);
+
+  VM vm;
+  vm_init(&vm);
+  assert(vm_execute(&vm, &chunk));
+  // The result took the callee's place; the arguments are gone
+  assert(vm.stack_top == vm.stack + 1);
+  assert(AS_NUMBER(vm.stack[0]) == 5);
+  assert(vm.frame_count == 0);
+
+  chunk.count -= 5; // Drop "PUSH_CONST three; CALL 2; HALT"
+  chunk_write(&chunk, OP_CALL, 3);
+  chunk_write(&chunk, 1, 3);
+  chunk_write(&chunk, OP_HALT, 3);
+  vm.had_error = false;
+  assert(!vm_execute(&vm, &chunk));
+  assert(strcmp(vm.error_message, "add() expects 2 arguments but got 1") ==
+         0);
+  vm_free(&vm);
+  chunk_free(&chunk);
+
+  // if false { push 1 } else { push 2 }
+  chunk_init(&chunk);
+  size_t one = chunk_add_constant(&chunk, constant_number(1));
+  two = chunk_add_constant(&chunk, constant_number(2));
+  chunk_write(&chunk, OP_PUSH_FALSE, 1);
+  chunk_write(&chunk, OP_JUMP_IF_FALSE, 1);
+  chunk_write(&chunk, 0, 1);
+  chunk_write(&chunk, 5, 1);
+  chunk_write(&chunk, OP_PUSH_CONST, 1);
+  chunk_write(&chunk, (uint8_t)one, 1);
+  chunk_write(&chunk, OP_JUMP, 1);
+  chunk_write(&chunk, 0, 1);
+  chunk_write(&chunk, 2, 1);
+  chunk_write(&chunk, OP_PUSH_CONST, 1);
+  chunk_write(&chunk, (uint8_t)two, 1);
+  chunk_write(&chunk, OP_HALT, 1);
+
+  vm_init(&vm);
+  assert(vm_execute(&vm, &chunk));
+  assert(vm.stack_top == vm.stack + 1);
+  assert(AS_NUMBER(vm.stack[0]) == 2);
+  vm_free(&vm);
+  chunk_free(&chunk);
+
+  printf("✓ VM calls test passed\n");
+}
+
+void test_vm_tail_calls() {
+  printf("Testing VM tail calls...\n");
+
+  // fn down(n) { if n <= 0 { return n } return down(n - 1) }, with down
+  // in global 0
+  RiauFunction *down = function_new_unmanaged("down", 1);
+  Chunk *body = down->chunk;
+  size_t zero = chunk_add_constant(body, constant_number(0));
+  size_t one = chunk_add_constant(body, constant_number(1));
+  uint8_t code[] = {
+      OP_LOAD_LOCAL, 0,                     // n
+      OP_PUSH_CONST, (uint8_t)zero,         // 0
+      OP_LESS_EQUAL,
+      OP_JUMP_IF_FALSE, 0, 3,
+      OP_LOAD_LOCAL, 0,                     // return n
+      OP_RETURN,
+      OP_LOAD_VAR, 0,                       // down
+      OP_LOAD_LOCAL, 0,                     // n
+      OP_PUSH_CONST, (uint8_t)one,          // 1
+      OP_SUB,
+      OP_TAIL_CALL, 1,                      // return down(n - 1)
+  };
+  for (size_t i = 0; i < sizeof(code); i++) {
+    chunk_write(body, code[i], 1);
+  }
+
+  // down(FRAMES_MAX * 2) needs one frame, not FRAMES_MAX * 2
+  Chunk chunk;
+  chunk_init(&chunk);
+  size_t function = chunk_add_constant(&chunk, constant_function(down));
+  size_t depth = chunk_add_constant(&chunk, constant_number(FRAMES_MAX * 2));
+  uint8_t script[] = {
+      OP_PUSH_CONST, (uint8_t)function,
+      OP_STORE_VAR_POP, 0,              // global 0 = down
+      OP_LOAD_VAR, 0,
+      OP_PUSH_CONST, (uint8_t)depth,
+      OP_CALL, 1,                       // down(FRAMES_MAX * 2)
+      OP_HALT,
+  };
+  for (size_t i = 0; i < sizeof(script); i++) {
+    chunk_write(&chunk, script[i], 2);
+  }
+
+  VM vm;
+  vm_init(&vm);
+  assert(vm_execute(&vm, &chunk));
+  assert(vm.frame_count == 0);
+  assert(vm.stack_top == vm.stack + 1);
+  assert(AS_NUMBER(vm.stack[0]) == 0);
+  vm_free(&vm);
+  chunk_free(&chunk);
+
+  printf("✓ VM tail calls test passed\n");
+}
+
+// Counts the elements of the sequence on top of the stack with FOR_PREP and
+// FOR_ITER, into the local below it; the loop variable keeps the last one
+static void emit_count_loop(Chunk *chunk, size_t one) {
+  uint8_t code[] = {
+      OP_FOR_PREP,
+      OP_JUMP, 0, 8,                        // -> FOR_ITER
+      OP_LOAD_LOCAL, 0,                     // count = count + 1
+      OP_PUSH_CONST, (uint8_t)one,
+      OP_ADD,
+      OP_STORE_LOCAL, 0,
+      OP_POP,
+      OP_FOR_ITER, 0, 11,                   // -> LOAD_LOCAL
+      OP_HALT,
+  };
+  for (size_t i = 0; i < sizeof(code); i++) {
+    chunk_write(chunk, code[i], 2);
+  }
+  assert(chunk_jump_target(chunk, chunk->count - 4) ==
+         chunk->count - sizeof(code) + 4);
+}
+
+void test_vm_for_loops() {
+  printf("Testing VM for loops...\n");
+
+  // [1, "s"]
+  Chunk chunk;
+  chunk_init(&chunk);
+  size_t zero = chunk_add_constant(&chunk, constant_int(0));
+  size_t one = chunk_add_constant(&chunk, constant_int(1));
+  size_t text = chunk_add_constant(&chunk, constant_string("s"));
+  uint8_t array[] = {
+      OP_PUSH_CONST, (uint8_t)zero,
+      OP_PUSH_CONST, (uint8_t)one,
+      OP_PUSH_CONST, (uint8_t)text,
+      OP_ARRAY_NEW, 0, 2,
+  };
+  for (size_t i = 0; i < sizeof(array); i++) {
+    chunk_write(&chunk, array[i], 1);
+  }
+  emit_count_loop(&chunk, one);
+
+  VM vm;
+  vm_init(&vm);
+  assert(vm_execute(&vm, &chunk));
+  assert(vm.stack_top == vm.stack + 4);
+  assert(AS_INT(vm.stack[0]) == 2);
+  assert(IS_ARRAY(vm.stack[1]) && AS_ARRAY(vm.stack[1])->count == 2);
+  assert(strcmp(AS_STRING(vm.stack[3])->chars, "s") == 0);
+  vm_free(&vm);
+  chunk_free(&chunk);
+
+  // "hé!" has three characters in four bytes
+  chunk_init(&chunk);
+  zero = chunk_add_constant(&chunk, constant_int(0));
+  one = chunk_add_constant(&chunk, constant_int(1));
+  text = chunk_add_constant(&chunk, constant_string("h\xc3\xa9!"));
+  chunk_write(&chunk, OP_PUSH_CONST, 1);
+  chunk_write(&chunk, (uint8_t)zero, 1);
+  chunk_write(&chunk, OP_PUSH_CONST, 1);
+  chunk_write(&chunk, (uint8_t)text, 1);
+  emit_count_loop(&chunk, one);
+
+  vm_init(&vm);
+  assert(vm_execute(&vm, &chunk));
+  assert(AS_INT(vm.stack[0]) == 3);
+  assert(strcmp(AS_STRING(vm.stack[3])->chars, "!") == 0);
+  vm_free(&vm);
+  chunk_free(&chunk);
+
+  // { a: 1, b: 1 } goes over its keys in order
+  chunk_init(&chunk);
+  zero = chunk_add_constant(&chunk, constant_int(0));
+  one = chunk_add_constant(&chunk, constant_int(1));
+  size_t a = chunk_add_constant(&chunk, constant_string("a"));
+  size_t b = chunk_add_constant(&chunk, constant_string("b"));
+  uint8_t object[] = {
+      OP_PUSH_CONST, (uint8_t)zero,
+      OP_OBJECT_NEW,
+      OP_PUSH_CONST, (uint8_t)one,
+      OP_STORE_FIELD, (uint8_t)a, 0, (uint8_t)chunk_add_cache(&chunk),
+      OP_PUSH_CONST, (uint8_t)one,
+      OP_STORE_FIELD, (uint8_t)b, 0, (uint8_t)chunk_add_cache(&chunk),
+  };
+  for (size_t i = 0; i < sizeof(object); i++) {
+    chunk_write(&chunk, object[i], 1);
+  }
+  emit_count_loop(&chunk, one);
+
+  vm_init(&vm);
+  assert(vm_execute(&vm, &chunk));
+  assert(AS_INT(vm.stack[0]) == 2);
+  assert(strcmp(AS_STRING(vm.stack[3])->chars, "b") == 0);
+  vm_free(&vm);
+  chunk_free(&chunk);
+
+  // Anything else cannot be iterated
+  chunk_init(&chunk);
+  zero = chunk_add_constant(&chunk, constant_int(0));
+  one = chunk_add_constant(&chunk, constant_int(1));
+  chunk_write(&chunk, OP_PUSH_CONST, 1);
+  chunk_write(&chunk, (uint8_t)zero, 1);
+  chunk_write(&chunk, OP_PUSH_CONST, 1);
+  chunk_write(&chunk, (uint8_t)one, 1);
+  emit_count_loop(&chunk, one);
+
+  vm_init(&vm);
+  assert(!vm_execute(&vm, &chunk));
+  assert(strcmp(vm.error_message,
+                "Only arrays, strings and objects can be iterated") == 0);
+  vm_free(&vm);
+  chunk_free(&chunk);
+
+  printf("✓ VM for loops test passed\n");
+}
+
+// Runs `a op b` over two constants and returns the result
+static Value run_binary(OpCode op, Constant a, Constant b) {
+  Chunk chunk;
+  chunk_init(&chunk);
+  chunk_write(&chunk, OP_PUSH_CONST, 1);
+  chunk_write(&chunk, (uint8_t)chunk_add_constant(&chunk, a), 1);
+  chunk_write(&chunk, OP_PUSH_CONST, 1);
+  chunk_write(&chunk, (uint8_t)chunk_add_constant(&chunk, b), 1);
+  chunk_write(&chunk, op, 1);
+  chunk_write(&chunk, OP_HALT, 1);
+
+  VM vm;
+  vm_init(&vm);
+  assert(vm_execute(&vm, &chunk));
+  Value result = vm.stack_top[-1];
+  vm_free(&vm);
+  chunk_free(&chunk);
+  return result;
+}
+
+void test_vm_integers() {
+  printf("Testing VM integer arithmetic...\n");
+
+  Value v = run_binary(OP_SUB, constant_int(3), constant_int(10));
+  assert(IS_INT(v) && AS_INT(v) == -7);
+  v = run_binary(OP_MUL, constant_int(65536), constant_int(65536));
+  assert(IS_NUMBER(v) && AS_NUMBER(v) == 4294967296.0);
+  v = run_binary(OP_MOD, constant_int(-7), constant_int(2));
+  assert(IS_INT(v) && AS_INT(v) == -1);
+  v = run_binary(OP_MOD, constant_int(INT32_MIN), constant_int(-1));
+  assert(IS_INT(v) && AS_INT(v) == 0);
+  // Division gives a double; mixed operands give doubles
+  v = run_binary(OP_DIV, constant_int(7), constant_int(2));
+  assert(IS_NUMBER(v) && AS_NUMBER(v) == 3.5);
+  v = run_binary(OP_ADD, constant_int(1), constant_number(0.5));
+  assert(IS_NUMBER(v) && AS_NUMBER(v) == 1.5);
+  v = run_binary(OP_LESS, constant_int(2), constant_number(2.5));
+  assert(IS_BOOL(v) && AS_BOOL(v));
+
+  v = run_binary(OP_BIT_AND, constant_int(12), constant_int(10));
+  assert(IS_INT(v) && AS_INT(v) == 8);
+  v = run_binary(OP_BIT_OR, constant_int(12), constant_int(3));
+  assert(IS_INT(v) && AS_INT(v) == 15);
+  v = run_binary(OP_BIT_XOR, constant_int(12), constant_number(10));
+  assert(IS_INT(v) && AS_INT(v) == 6);
+  v = run_binary(OP_SHIFT_LEFT, constant_int(1), constant_int(31));
+  assert(IS_INT(v) && AS_INT(v) == INT32_MIN);
+  v = run_binary(OP_SHIFT_RIGHT, constant_int(-16), constant_int(2));
+  assert(IS_INT(v) && AS_INT(v) == -4);
+
+  // Bitwise operands must be integers
+  Chunk chunk;
+  chunk_init(&chunk);
+  chunk_write(&chunk, OP_PUSH_CONST, 1);
+  chunk_write(&chunk, (uint8_t)chunk_add_constant(&chunk, constant_number(1.5)),
+              1);
+  chunk_write(&chunk, OP_BIT_NOT, 1);
+  chunk_write(&chunk, OP_HALT, 1);
+  VM vm;
+  vm_init(&vm);
+  assert(!vm_execute(&vm, &chunk));
+  assert(strcmp(vm.error_message, "Operand must be an integer") == 0);
+  vm_free(&vm);
+  chunk_free(&chunk);
+
+  printf("✓ VM integer test passed\n");
+}
+
+void test_vm_natives() {
+  printf("Testing VM native calls...\n");
+
+  int floor_fn = stdlib_find_native("math_floor");
+  int upper_fn = stdlib_find_native("str_upper");
+  assert(floor_fn != -1 && upper_fn != -1);
+  assert(stdlib_find_native("print") == -1);
+  assert(stdlib_find_native("no_such_native") == -1);
+
+  // 1 + math_floor(2.5), then str_upper("riau")
+  Chunk chunk;
+  chunk_init(&chunk);
+  size_t one = chunk_add_constant(&chunk, constant_number(1));
+  size_t half = chunk_add_constant(&chunk, constant_number(2.5));
+  size_t name = chunk_add_constant(&chunk, constant_string("riau"));
+  chunk_write(&chunk, OP_PUSH_CONST, 1);
+  chunk_write(&chunk, (uint8_t)one, 1);
+  chunk_write(&chunk, OP_PUSH_CONST, 1);
+  chunk_write(&chunk, (uint8_t)half, 1);
+  chunk_write(&chunk, OP_CALL_NATIVE, 1);
+  chunk_write(&chunk, (uint8_t)floor_fn, 1);
+  chunk_write(&chunk, 1, 1);
+  chunk_write(&chunk, OP_ADD, 1);
+  chunk_write(&chunk, OP_PUSH_CONST, 2);
+  chunk_write(&chunk, (uint8_t)name, 2);
+  chunk_write(&chunk, OP_CALL_NATIVE, 2);
+  chunk_write(&chunk, (uint8_t)upper_fn, 2);
+  chunk_write(&chunk, 1, 2);
+  chunk_write(&chunk, OP_HALT, 2);
+
+  // Natives have to be registered before they can be called
+  VM vm;
+  vm_init(&vm);
+  assert(!vm_execute(&vm, &chunk));
+  assert(strcmp(vm.error_message, "Native functions are not registered") ==
+         0);
+  vm_free(&vm);
+
+  vm_init(&vm);
+  stdlib_register_builtins(&vm);
+  assert(vm_execute(&vm, &chunk));
+  // Each result replaced its arguments; no frame was pushed
+  assert(vm.stack_top == vm.stack + 2);
+  assert(AS_NUMBER(vm.stack[0]) == 3);
+  assert(strcmp(AS_STRING(vm.stack[1])->chars, "RIAU") == 0);
+  assert(vm.frame_count == 0);
+  vm_free(&vm);
+  chunk_free(&chunk);
+
+  // An index past the table, as in code built for other natives
+  chunk_init(&chunk);
+  chunk_write(&chunk, OP_CALL_NATIVE, 1);
+  chunk_write(&chunk, (uint8_t)stdlib_native_count, 1);
+  chunk_write(&chunk, 0, 1);
+  chunk_write(&chunk, OP_HALT, 1);
+  vm_init(&vm);
+  stdlib_register_builtins(&vm);
+  assert(!vm_execute(&vm, &chunk));
+  char message[32];
+  snprintf(message, sizeof(message), "No native function %d",
+           stdlib_native_count);
+  assert(strcmp(vm.error_message, message) == 0);
+  vm_free(&vm);
+  chunk_free(&chunk);
+
+  printf("✓ VM native calls test passed\n");
+}
+
+void test_vm_emit_c() {
+  printf("Testing C emission...\n");
+
+  // fn twice(x) { return x * 2 }, and a script that branches over a print
+  RiauFunction *twice = function_new_unmanaged("twice", 1);
+  size_t two = chunk_add_constant(twice->chunk, constant_int(2));
+  uint8_t body[] = {
+      OP_LOAD_LOCAL, 0, OP_PUSH_CONST, (uint8_t)two, OP_MUL, OP_RETURN,
+  };
+  for (size_t i = 0; i < sizeof(body); i++) {
+    chunk_write(twice->chunk, body[i], 1);
+  }
+
+  Chunk chunk;
+  chunk_init(&chunk);
+  size_t function = chunk_add_constant(&chunk, constant_function(twice));
+  size_t text = chunk_add_constant(&chunk, constant_string("say \"hi\"\n"));
+  uint8_t script[] = {
+      OP_PUSH_CONST, (uint8_t)function,
+      OP_STORE_VAR_POP, 0,
+      OP_PUSH_TRUE,
+      OP_JUMP_IF_TRUE, 0, 2,
+      OP_PRINT_CONST, (uint8_t)text,
+      OP_HALT,
+  };
+  for (size_t i = 0; i < sizeof(script); i++) {
+    chunk_write(&chunk, script[i], 3);
+  }
+
+  FILE *out = tmpfile();
+  assert(out);
+  assert(aot_emit_c(&chunk, "test.riau", out));
+  static char c[8192];
+  rewind(out);
+  c[fread(c, 1, sizeof(c) - 1, out)] = '\0';
+  fclose(out);
+
+  // Both chunks, with their data and a case per instruction
+  assert(strstr(c, "{CONST_FUNCTION, .function = 1}"));
+  assert(strstr(c, "{CONST_STRING, .string = \"say \\\"hi\\\"\\n\"}"));
+  assert(strstr(c, "static bool run_0(JitCode *native, VM *vm)"));
+  assert(strstr(c, "static bool run_1(JitCode *native, VM *vm)"));
+  assert(strstr(c, "{\"twice\", 1, code_1, 6, lines_1, 1, constants_1, 1, 0, "
+                   "run_1}"));
+
+  // Ints and jumps are plain C, other instructions call their op_* body,
+  // and halt goes back to the interpreter
+  assert(strstr(c, "AOT_INT_ARITHMETIC(vm, code + 5, vm_op_mul, "
+                   "__builtin_mul_overflow);"));
+  assert(strstr(c, "goto L10;"));
+  assert(strstr(c, "case 10: L10: // HALT"));
+  assert(strstr(c, "AOT_STEP(vm, code + 9, vm_op_print_const);"));
+  assert(strstr(c, "AOT_EXIT(vm, code + 10);"));
+  assert(strstr(c, "int main(void) { return aot_main(chunks); }"));
+
+  chunk_free(&chunk);
+
+  printf("✓ C emission test passed\n");
+}
+
+void test_vm_wide_operands() {
+  printf("Testing VM wide operands...\n");
+
+  // 300 constants: the last ones need a 16-bit index
+  Chunk chunk;
+  chunk_init(&chunk);
+  for (int i = 0; i < 300; i++) {
+    chunk_add_constant(&chunk, constant_int(i));
+  }
+  size_t key = chunk_add_constant(&chunk, constant_string("k"));
+  size_t cache = chunk_add_cache(&chunk);
+  assert(key == 300);
+
+  // { k: 299 }.k, then a long jump over a push of 1
+  uint8_t code[] = {
+      OP_OBJECT_NEW,
+      OP_PUSH_CONST_LONG, 0x01, 0x2b,
+      OP_STORE_FIELD_LONG, 0x01, 0x2c, 0x00, (uint8_t)cache,
+      OP_LOAD_FIELD_LONG, 0x01, 0x2c, 0x00, (uint8_t)cache,
+      OP_PUSH_FALSE,
+      OP_JUMP_IF_FALSE_LONG, 0x00, 0x00, 0x00, 0x02,
+      OP_PUSH_CONST, 1,
+      OP_HALT,
+  };
+  for (size_t i = 0; i < sizeof(code); i++) {
+    chunk_write(&chunk, code[i], i < 14 ? 1 : i < 20 ? 2 : 3);
+  }
+  assert(chunk_jump_target(&chunk, 15) == 22);
+
+  // One run per line, whatever the instruction count
+  assert(chunk.line_count == 3);
+  assert(chunk_get_line(&chunk, 0) == 1);
+  assert(chunk_get_line(&chunk, 13) == 1);
+  assert(chunk_get_line(&chunk, 14) == 2);
+  assert(chunk_get_line(&chunk, 22) == 3);
+
+  VM vm;
+  vm_init(&vm);
+  assert(vm_execute(&vm, &chunk));
+  assert(vm.stack_top == vm.stack + 1);
+  assert(AS_INT(vm.stack[0]) == 299);
+  vm_free(&vm);
+  chunk_free(&chunk);
+
+  printf("✓ VM wide operands test passed\n");
+}
+
+void test_vm_chunk_cache() {
+  printf("Testing compiled bytecode cache...\n");
+
+  // fn twice(x) { return x * 2 }; print(twice(21)); "k"
+  const char *source = "source text";
+  RiauFunction *twice = function_new_unmanaged("twice", 1);
+  size_t two = chunk_add_constant(twice->chunk, constant_int(2));
+  uint8_t body[] = {
+      OP_LOAD_LOCAL, 0, OP_PUSH_CONST, (uint8_t)two, OP_MUL, OP_RETURN,
+  };
+  for (size_t i = 0; i < sizeof(body); i++) {
+    chunk_write(twice->chunk, body[i], 1);
+  }
+
+  Chunk chunk;
+  chunk_init(&chunk);
+  size_t function = chunk_add_constant(&chunk, constant_function(twice));
+  size_t half = chunk_add_constant(&chunk, constant_number(10.5));
+  size_t key = chunk_add_constant(&chunk, constant_string("k"));
+  uint8_t script[] = {
+      OP_PUSH_CONST, (uint8_t)function,
+      OP_PUSH_CONST, (uint8_t)half,
+      OP_CALL, 1,
+      OP_PUSH_CONST, (uint8_t)key,
+      OP_HALT,
+  };
+  for (size_t i = 0; i < sizeof(script); i++) {
+    chunk_write(&chunk, script[i], i < 6 ? 2 : 3);
+  }
+  chunk_add_cache(&chunk);
+
+  const char *path = "build/test_vm.riauc";
+  assert(chunk_cache_store(path, "test", source, &chunk));
+
+  // The same chunks come back, and run
+  Chunk loaded;
+  chunk_init(&loaded);
+  assert(chunk_cache_load(path, "test", source, &loaded));
+  assert(loaded.count == chunk.count);
+  assert(memcmp(loaded.code, chunk.code, chunk.count) == 0);
+  assert(loaded.line_count == 2 && chunk_get_line(&loaded, 6) == 3);
+  assert(loaded.constant_count == 3 && loaded.cache_count == 1);
+  assert(loaded.constants[half].as.number == 10.5);
+  assert(strcmp(loaded.constants[key].as.string->chars, "k") == 0);
+  RiauFunction *copy = loaded.constants[function].as.function;
+  assert(strcmp(copy->name, "twice") == 0 && copy->arity == 1);
+  assert(copy->chunk->count == sizeof(body));
+  assert(copy->chunk->constants[two].as.integer == 2);
+
+  VM vm;
+  vm_init(&vm);
+  assert(vm_execute(&vm, &loaded));
+  assert(vm.stack_top == vm.stack + 2);
+  assert(AS_NUMBER(vm.stack[0]) == 21);
+  assert(strcmp(AS_CSTRING(vm.stack[1]), "k") == 0);
+  vm_free(&vm);
+  chunk_free(&loaded);
+
+  // Other source, another version or a damaged file is a miss, and leaves
+  // the chunk empty
+  assert(!chunk_cache_load(path, "test", "other source", &loaded));
+  assert(!chunk_cache_load(path, "other", source, &loaded));
+  static uint8_t bytes[4096];
+  FILE *file = fopen(path, "rb");
+  assert(file);
+  size_t size = fread(bytes, 1, sizeof(bytes), file);
+  fclose(file);
+  file = fopen(path, "wb");
+  assert(file);
+  fwrite(bytes, 1, size - 3, file); // Cut off in the last constant
+  fclose(file);
+  assert(!chunk_cache_load(path, "test", source, &loaded));
+  assert(loaded.count == 0 && loaded.constant_count == 0);
+  bytes[size - 2] ^= 0x40; // Same size, one bit off in twice()'s 2
+  file = fopen(path, "wb");
+  assert(file);
+  fwrite(bytes, 1, size, file);
+  fclose(file);
+  assert(!chunk_cache_load(path, "test", source, &loaded));
+  assert(loaded.count == 0 && loaded.constant_count == 0);
+  remove(path);
+  assert(!chunk_cache_load(path, "test", source, &loaded));
+
+  // Cache files sit next to the script
+  char *cache_path = chunk_cache_path("www/index.riau", source);
+  assert(strcmp(cache_path, "www/index.riauc") == 0);
+  riau_free(cache_path);
+
+  chunk_free(&chunk);
+
+  printf("✓ Compiled bytecode cache test passed\n");
+}
+
+void test_vm_snapshot() {
+  printf("Testing heap snapshots...\n");
+
+  // Prelude: fn twice(x) { return x * 2 }, stored in global 0
+  RiauFunction *twice = function_new_unmanaged("twice", 1);
+  size_t two = chunk_add_constant(twice->chunk, constant_int(2));
+  uint8_t body[] = {
+      OP_LOAD_LOCAL, 0, OP_PUSH_CONST, (uint8_t)two, OP_MUL, OP_RETURN,
+  };
+  for (size_t i = 0; i < sizeof(body); i++) {
+    chunk_write(twice->chunk, body[i], 1);
+  }
+  Chunk prelude;
+  chunk_init(&prelude);
+  size_t function = chunk_add_constant(&prelude, constant_function(twice));
+  uint8_t script[] = {
+      OP_PUSH_CONST, (uint8_t)function, OP_STORE_VAR, 0, OP_POP, OP_HALT,
+  };
+  for (size_t i = 0; i < sizeof(script); i++) {
+    chunk_write(&prelude, script[i], 1);
+  }
+
+  SnapshotWriter writer;
+  snapshot_begin(&writer, "test", &prelude);
+
+  VM vm;
+  vm_init(&vm);
+  assert(vm_execute(&vm, &prelude));
+
+  // A list holding itself, shared with an object
+  Value list = value_array();
+  array_push(AS_ARRAY(list), value_int(1));
+  array_push(AS_ARRAY(list), value_number(2.5));
+  array_push(AS_ARRAY(list), value_string("three"));
+  array_push(AS_ARRAY(list), value_bool(true));
+  array_push(AS_ARRAY(list), value_null());
+  array_push(AS_ARRAY(list), list);
+  Value config = value_object();
+  object_set(AS_OBJECT(config), "name", value_string("riau"));
+  object_set(AS_OBJECT(config), "list", list);
+  vm_define_global(&vm, 1, list);
+  vm_define_global(&vm, 2, config);
+  vm_define_global(&vm, 3, value_int(7));
+
+  const char *names[] = {"twice", "list", "config", "seven", "unset"};
+  const char *path = "build/test_vm.riaus";
+  assert(snapshot_finish(&writer, &vm, path, names, 5));
+  vm_free(&vm);
+
+  // Everything comes back, references and all
+  Snapshot image;
+  assert(snapshot_load(path, "test", &image));
+  assert(image.name_count == 5 && strcmp(image.names[2], "config") == 0);
+  assert(image.object_count == 4); // list, config, "three" and "riau"
+  RiauFunction *loaded = AS_FUNCTION(image.globals[0]);
+  assert(loaded == image.chunk.constants[function].as.function);
+  assert(strcmp(loaded->name, "twice") == 0 && loaded->arity == 1);
+  RiauArray *array = AS_ARRAY(image.globals[1]);
+  assert(array->count == 6 && AS_ARRAY(array->elements[5]) == array);
+  assert(AS_INT(array->elements[0]) == 1);
+  assert(AS_NUMBER(array->elements[1]) == 2.5);
+  assert(strcmp(AS_CSTRING(array->elements[2]), "three") == 0);
+  assert(AS_BOOL(array->elements[3]) && IS_NULL(array->elements[4]));
+  RiauObject *object = AS_OBJECT(image.globals[2]);
+  assert(strcmp(AS_CSTRING(object_get(object, "name")), "riau") == 0);
+  assert(AS_ARRAY(object_get(object, "list")) == array);
+  assert(AS_INT(image.globals[3]) == 7 && IS_NULL(image.globals[4]));
+
+  // A page starts from the restored globals: twice(10.5)
+  Chunk page;
+  chunk_init(&page);
+  size_t half = chunk_add_constant(&page, constant_number(10.5));
+  uint8_t code[] = {
+      OP_LOAD_VAR, 0, OP_PUSH_CONST, (uint8_t)half, OP_CALL, 1, OP_HALT,
+  };
+  for (size_t i = 0; i < sizeof(code); i++) {
+    chunk_write(&page, code[i], 1);
+  }
+  vm_init(&vm);
+  snapshot_restore(&image, &vm);
+  assert(vm.global_count == 5);
+  assert(vm_execute(&vm, &page));
+  assert(vm.stack_top == vm.stack + 1 && AS_NUMBER(vm.stack[0]) == 21);
+  vm_free(&vm);
+  chunk_free(&page);
+  snapshot_free(&image);
+
+  // Another version or a damaged file is a miss
+  assert(!snapshot_load(path, "other", &image));
+  static uint8_t bytes[4096];
+  FILE *file = fopen(path, "rb");
+  assert(file);
+  size_t size = fread(bytes, 1, sizeof(bytes), file);
+  fclose(file);
+  bytes[size - 5] ^= 0x40; // The 7 in globals[3], the last value but null
+  file = fopen(path, "wb");
+  assert(file);
+  fwrite(bytes, 1, size, file);
+  fclose(file);
+  assert(!snapshot_load(path, "test", &image));
+  remove(path);
+  assert(!snapshot_load(path, "test", &image));
+
+  // Functions the prelude does not declare cannot be saved
+  snapshot_begin(&writer, "test", &prelude);
+  vm_init(&vm);
+  vm_define_global(&vm, 0, value_function(NULL, 0, "native"));
+  assert(!snapshot_finish(&writer, &vm, path, names, 1));
+  assert(strstr(writer.error_message, "'native'") != NULL);
+  vm_free(&vm);
+  remove(path);
+
+  char *image_path = snapshot_path("www/prelude.riau");
+  assert(strcmp(image_path, "www/prelude.riaus") == 0);
+  riau_free(image_path);
+
+  chunk_free(&prelude);
+
+  printf("✓ Heap snapshot test passed\n");
+}
+
+#ifdef RIAU_JIT
+void test_vm_jit() {
+  printf("Testing VM JIT...\n");
+
+  // fn sum(n) { if n <= 0 { return 0 } return sum(n - 1) + n }, with sum
+  // in global 0
+  RiauFunction *sum = function_new_unmanaged("sum", 1);
+  Chunk *body = sum->chunk;
+  size_t zero = chunk_add_constant(body, constant_int(0));
+  size_t one = chunk_add_constant(body, constant_int(1));
+  uint8_t code[] = {
+      OP_LOAD_LOCAL, 0,                     // n
+      OP_PUSH_CONST, (uint8_t)zero,         // 0
+      OP_LESS_EQUAL,
+      OP_JUMP_IF_FALSE, 0, 3,
+      OP_PUSH_CONST, (uint8_t)zero,         // return 0
+      OP_RETURN,
+      OP_LOAD_VAR, 0,                       // sum
+      OP_LOAD_LOCAL, 0,                     // n
+      OP_PUSH_CONST, (uint8_t)one,          // 1
+      OP_SUB,
+      OP_CALL, 1,                           // sum(n - 1)
+      OP_LOAD_LOCAL, 0,
+      OP_ADD,                               // + n
+      OP_RETURN,
+  };
+  for (size_t i = 0; i < sizeof(code); i++) {
+    chunk_write(body, code[i], 1);
+  }
+
+  // sum(1000): the first JIT_THRESHOLD calls are interpreted, the rest
+  // run natively, returning through both tiers
+  Chunk chunk;
+  chunk_init(&chunk);
+  size_t function = chunk_add_constant(&chunk, constant_function(sum));
+  size_t n = chunk_add_constant(&chunk, constant_int(1000));
+  uint8_t script[] = {
+      OP_PUSH_CONST, (uint8_t)function,
+      OP_STORE_VAR_POP, 0,              // global 0 = sum
+      OP_LOAD_VAR, 0,
+      OP_PUSH_CONST, (uint8_t)n,
+      OP_CALL, 1,                       // sum(1000)
+      OP_HALT,
+  };
+  for (size_t i = 0; i < sizeof(script); i++) {
+    chunk_write(&chunk, script[i], 2);
+  }
+
+  VM vm;
+  vm_init(&vm);
+  assert(vm_execute(&vm, &chunk));
+  assert(body->jit != NULL);
+  assert(chunk.jit == NULL); // Entered once
+  assert(vm.frame_count == 0);
+  assert(vm.stack_top == vm.stack + 1);
+  assert(IS_INT(vm.stack[0]) && AS_INT(vm.stack[0]) == 500500);
+  vm_free(&vm);
+  chunk_free(&chunk);
+
+  // A loop at top level: the script is entered once, but its back-edges
+  // count, and the loop carries on natively from its head
+  char letters[3 * JIT_THRESHOLD + 1];
+  memset(letters, 'a', sizeof(letters) - 1);
+  letters[sizeof(letters) - 1] = '\0';
+  chunk_init(&chunk);
+  zero = chunk_add_constant(&chunk, constant_int(0));
+  one = chunk_add_constant(&chunk, constant_int(1));
+  size_t word = chunk_add_constant(&chunk, constant_string(letters));
+  chunk_write(&chunk, OP_PUSH_CONST, 1);
+  chunk_write(&chunk, (uint8_t)zero, 1);
+  chunk_write(&chunk, OP_PUSH_CONST, 1);
+  chunk_write(&chunk, (uint8_t)word, 1);
+  emit_count_loop(&chunk, one);
+
+  vm_init(&vm);
+  assert(vm_execute(&vm, &chunk));
+  assert(chunk.jit != NULL);
+  assert(IS_INT(vm.stack[0]) && AS_INT(vm.stack[0]) == 3 * JIT_THRESHOLD);
+  vm_free(&vm);
+  chunk_free(&chunk);
+
+  // Eager: the script itself is compiled. An int overflow leaves the fast
+  // path for the op_* body, which gives a double.
+  chunk_init(&chunk);
+  size_t max = chunk_add_constant(&chunk, constant_int(INT32_MAX));
+  one = chunk_add_constant(&chunk, constant_int(1));
+  chunk_write(&chunk, OP_PUSH_CONST, 1);
+  chunk_write(&chunk, (uint8_t)max, 1);
+  chunk_write(&chunk, OP_PUSH_CONST, 1);
+  chunk_write(&chunk, (uint8_t)one, 1);
+  chunk_write(&chunk, OP_ADD, 1);
+  chunk_write(&chunk, OP_HALT, 1);
+
+  vm_init(&vm);
+  vm.jit_threshold = 0;
+  assert(vm_execute(&vm, &chunk));
+  assert(chunk.jit != NULL);
+  assert(vm.stack_top == vm.stack + 1);
+  assert(IS_NUMBER(vm.stack[0]) && AS_NUMBER(vm.stack[0]) == 2147483648.0);
+  vm_free(&vm);
+  chunk_free(&chunk);
+
+  // Runtime errors in native code stop the script like interpreted ones
+  chunk_init(&chunk);
+  one = chunk_add_constant(&chunk, constant_int(1));
+  size_t text = chunk_add_constant(&chunk, constant_string("s"));
+  chunk_write(&chunk, OP_PUSH_CONST, 1);
+  chunk_write(&chunk, (uint8_t)one, 1);
+  chunk_write(&chunk, OP_PUSH_CONST, 1);
+  chunk_write(&chunk, (uint8_t)text, 1);
+  chunk_write(&chunk, OP_SUB, 1);
+  chunk_write(&chunk, OP_HALT, 1);
+
+  vm_init(&vm);
+  vm.jit_threshold = 0;
+  assert(!vm_execute(&vm, &chunk));
+  assert(chunk.jit != NULL);
+  assert(strcmp(vm.error_message, "Operands must be numbers") == 0);
+  vm_free(&vm);
+  chunk_free(&chunk);
+
+  printf("✓ VM JIT test passed\n");
+}
+#endif
+
 int main() {
   printf("=== Riau VM Tests ===\n\n");
 
   test_vm_arithmetic();
   test_vm_comparison();
   test_vm_strings();
+  test_vm_values();
+  test_vm_string_interning();
+  test_vm_constant_dedup();
+  test_vm_object_index();
+  test_vm_shapes();
+  test_vm_quickening();
+  test_vm_superinstructions();
+  test_reg_vm();
+  test_vm_gc();
+  test_vm_stacks();
+  test_vm_calls();
+  test_vm_tail_calls();
+  test_vm_for_loops();
+  test_vm_natives();
+  test_vm_integers();
+  test_vm_emit_c();
+  test_vm_wide_operands();
+  test_vm_chunk_cache();
+  test_vm_snapshot();
+#ifdef RIAU_JIT
+  test_vm_jit();
+#endif
 
   printf("\n=== All VM tests passed! ===\n");
   return 0;
@@ -0,0 +1,386 @@
+#include "aot.h"
+#include "../runtime/arena.h"
+#include <math.h>
+#include <stdlib.h>
+
+// C emitter
+
+static const char *const op_bodies[256] = {
+#define OP_BODY_NAME(op, function) [op] = "vm_" #function,
+    VM_OP_BODIES(OP_BODY_NAME)
+#undef OP_BODY_NAME
+};
+
+static void emit_string(FILE *out, const char *chars) {
+  fputc('"', out);
+  for (const unsigned char *c = (const unsigned char *)chars; *c; c++) {
+    if (*c == '"' || *c == '\\') {
+      fprintf(out, "\\%c", *c);
+    } else if (*c == '\n') {
+      fputs("\\n", out);
+    } else if (*c < ' ' || *c >= 0x7f || *c == '?') {
+      // Octal escapes are at most three digits, so the next character can
+      // never run into them; '?' would start a trigraph
+      fprintf(out, "\\%03o", *c);
+    } else {
+      fputc(*c, out);
+    }
+  }
+  fputc('"', out);
+}
+
+static void emit_number(FILE *out, double number) {
+  if (isnan(number)) {
+    fputs("NAN", out);
+  } else if (isinf(number)) {
+    fputs(number < 0 ? "-HUGE_VAL" : "HUGE_VAL", out);
+  } else {
+    fprintf(out, "%.17g", number);
+  }
+}
+
+static void emit_data(FILE *out, ChunkList *list, size_t index) {
+  Chunk *chunk = list->chunks[index];
+
+  fprintf(out, "static const uint8_t code_%zu[] = {", index);
+  for (size_t i = 0; i < chunk->count; i++) {
+    fprintf(out, i % 12 == 0 ? "\n    0x%02x," : " 0x%02x,", chunk->code[i]);
+  }
+  fprintf(out, "\n};\n\n");
+
+  fprintf(out, "static const LineRun lines_%zu[] = {", index);
+  for (size_t i = 0; i < chunk->line_count; i++) {
+    fprintf(out, i % 6 == 0 ? "\n    {%u, %d}," : " {%u, %d},",
+            chunk->lines[i].offset, chunk->lines[i].line);
+  }
+  fprintf(out, "\n};\n\n");
+
+  if (chunk->constant_count == 0)
+    return;
+
+  fprintf(out, "static const AotConstant constants_%zu[] = {\n", index);
+  for (size_t i = 0; i < chunk->constant_count; i++) {
+    Constant *constant = &chunk->constants[i];
+    switch (constant->type) {
+    case CONST_NUMBER:
+      fputs("    {CONST_NUMBER, .number = ", out);
+      emit_number(out, constant->as.number);
+      break;
+    case CONST_INT:
+      fprintf(out, "    {CONST_INT, .integer = %d", constant->as.integer);
+      break;
+    case CONST_STRING:
+      fputs("    {CONST_STRING, .string = ", out);
+      emit_string(out, constant->as.string->chars);
+      break;
+    case CONST_FUNCTION:
+      fprintf(out, "    {CONST_FUNCTION, .function = %zu",
+              chunk_list_index(list, constant->as.function->chunk));
+      break;
+    }
+    fputs("},\n", out);
+  }
+  fprintf(out, "};\n\n");
+}
+
+static void emit_push_constant(FILE *out, Constant *constant, uint16_t index) {
+  switch (constant->type) {
+  case CONST_NUMBER:
+    fputs("    AOT_PUSH(vm, NUMBER_VAL(", out);
+    emit_number(out, constant->as.number);
+    fputs("));\n", out);
+    break;
+  case CONST_INT:
+    fprintf(out, "    AOT_PUSH(vm, INT_VAL(%d));\n", constant->as.integer);
+    break;
+  case CONST_STRING:
+    fprintf(out,
+            "    AOT_PUSH(vm, "
+            "STRING_VAL(vm->chunk->constants[%u].as.string));\n",
+            index);
+    break;
+  case CONST_FUNCTION:
+    fprintf(out,
+            "    AOT_PUSH(vm, "
+            "FUNCTION_VAL(vm->chunk->constants[%u].as.function));\n",
+            index);
+    break;
+  }
+}
+
+static void emit_instruction(FILE *out, Chunk *chunk, size_t offset) {
+  uint8_t *ip = chunk->code + offset;
+  uint8_t op = *ip;
+  size_t next = offset + 1;
+
+  switch (op) {
+  case OP_PUSH_CONST:
+    emit_push_constant(out, &chunk->constants[ip[1]], ip[1]);
+    break;
+  case OP_PUSH_CONST_LONG: {
+    uint16_t index = (uint16_t)((ip[1] << 8) | ip[2]);
+    emit_push_constant(out, &chunk->constants[index], index);
+    break;
+  }
+  case OP_PUSH_NULL:
+    fputs("    AOT_PUSH(vm, NULL_VAL);\n", out);
+    break;
+  case OP_PUSH_TRUE:
+    fputs("    AOT_PUSH(vm, BOOL_VAL(true));\n", out);
+    break;
+  case OP_PUSH_FALSE:
+    fputs("    AOT_PUSH(vm, BOOL_VAL(false));\n", out);
+    break;
+  case OP_POP:
+    fputs("    vm->stack_top--;\n", out);
+    break;
+  case OP_LOAD_LOCAL:
+    fprintf(out, "    AOT_PUSH(vm, vm->slots[%u]);\n", ip[1]);
+    break;
+  case OP_STORE_LOCAL:
+    fprintf(out, "    vm->slots[%u] = vm->stack_top[-1];\n", ip[1]);
+    break;
+  case OP_JUMP:
+  case OP_JUMP_LONG:
+    fprintf(out, "    goto L%zu;\n", chunk_jump_target(chunk, offset));
+    break;
+  case OP_JUMP_IF_FALSE:
+  case OP_JUMP_IF_TRUE:
+  case OP_JUMP_IF_FALSE_LONG:
+  case OP_JUMP_IF_TRUE_LONG:
+    fprintf(out,
+            "    {\n"
+            "      Value condition = *--vm->stack_top;\n"
+            "      if (%sAOT_TRUTHY(condition))\n"
+            "        goto L%zu;\n"
+            "    }\n",
+            op == OP_JUMP_IF_FALSE || op == OP_JUMP_IF_FALSE_LONG ? "!" : "",
+            chunk_jump_target(chunk, offset));
+    break;
+  case OP_FOR_ITER:
+  case OP_FOR_ITER_LONG:
+    fprintf(out,
+            "    AOT_STEP(vm, code + %zu, vm_for_next);\n"
+            "    if (AS_BOOL(*--vm->stack_top))\n"
+            "      goto L%zu;\n",
+            next, chunk_jump_target(chunk, offset));
+    break;
+  case OP_ADD:
+  case OP_SUB:
+  case OP_MUL:
+    fprintf(out,
+            "    AOT_INT_ARITHMETIC(vm, code + %zu, %s, "
+            "__builtin_%s_overflow);\n",
+            next, op_bodies[op],
+            op == OP_ADD ? "add" : op == OP_SUB ? "sub" : "mul");
+    break;
+  case OP_LESS:
+  case OP_LESS_EQUAL:
+  case OP_GREATER:
+  case OP_GREATER_EQUAL:
+  case OP_EQUAL:
+  case OP_NOT_EQUAL: {
+    const char *compare = op == OP_LESS            ? "<"
+                          : op == OP_LESS_EQUAL    ? "<="
+                          : op == OP_GREATER       ? ">"
+                          : op == OP_GREATER_EQUAL ? ">="
+                          : op == OP_EQUAL         ? "=="
+                                                   : "!=";
+    fprintf(out, "    AOT_INT_COMPARE(vm, code + %zu, %s, %s);\n", next,
+            op_bodies[op], compare);
+    break;
+  }
+  default:
+    // Calls, returns and halt switch frames, which the interpreter does;
+    // so does anything without a body
+    if (op_bodies[op]) {
+      fprintf(out, "    AOT_STEP(vm, code + %zu, %s);\n", next, op_bodies[op]);
+    } else {
+      fprintf(out, "    AOT_EXIT(vm, code + %zu);\n", offset);
+    }
+    break;
+  }
+}
+
+static void emit_function(FILE *out, ChunkList *list, size_t index) {
+  Chunk *chunk = list->chunks[index];
+
+  // Jump targets get a label
+  bool *targets = riau_calloc(chunk->count + 1, sizeof(bool));
+  for (size_t offset = 0; offset < chunk->count;
+       offset += opcode_length(chunk->code[offset])) {
+    uint8_t op = chunk->code[offset];
+    if (op == OP_JUMP || op == OP_JUMP_IF_FALSE || op == OP_JUMP_IF_TRUE ||
+        op == OP_FOR_ITER || op == OP_JUMP_LONG ||
+        op == OP_JUMP_IF_FALSE_LONG || op == OP_JUMP_IF_TRUE_LONG ||
+        op == OP_FOR_ITER_LONG) {
+      size_t target = chunk_jump_target(chunk, offset);
+      if (target <= chunk->count) {
+        targets[target] = true;
+      }
+    }
+  }
+
+  RiauFunction *function = list->functions[index];
+  fprintf(out, "// %s\n", function ? function->name : "Script");
+  fprintf(out, "static bool run_%zu(JitCode *native, VM *vm) {\n", index);
+  fprintf(out, "  (void)native;\n");
+  fprintf(out, "  uint8_t *code = vm->chunk->code;\n");
+  fprintf(out, "  switch (vm->ip - code) {\n");
+
+  for (size_t offset = 0; offset < chunk->count;
+       offset += opcode_length(chunk->code[offset])) {
+    uint8_t op = chunk->code[offset];
+    fprintf(out, "  case %zu:", offset);
+    if (targets[offset]) {
+      fprintf(out, " L%zu:", offset);
+    }
+    fprintf(out, " // %s", opcode_name(op));
+    for (int i = 1; i < opcode_length(op) && offset + i < chunk->count; i++) {
+      fprintf(out, " %u", chunk->code[offset + i]);
+    }
+    fputc('\n', out);
+    emit_instruction(out, chunk, offset);
+  }
+
+  // A jump to the end of the chunk
+  if (targets[chunk->count]) {
+    fprintf(out, "  L%zu:\n    AOT_EXIT(vm, code + %zu);\n", chunk->count,
+            chunk->count);
+  }
+  fprintf(out, "  }\n  return true;\n}\n\n");
+  riau_free(targets);
+}
+
+bool aot_emit_c(Chunk *chunk, const char *source_path, FILE *out) {
+  // A function's chunk is emitted under its index in the list
+  ChunkList list = {0};
+  chunk_list_collect(&list, chunk, NULL);
+
+  fprintf(out, "// Generated by riau --emit-c from %s\n", source_path);
+  fprintf(out, "// Build: tools/aot_build.sh\n");
+  fprintf(out, "#include \"vm/aot.h\"\n#include <math.h>\n\n");
+  fprintf(out, "// Each case falls through to the next instruction\n");
+  fprintf(out, "#pragma GCC diagnostic ignored \"-Wimplicit-fallthrough\"\n\n");
+
+  for (size_t i = 0; i < list.count; i++) {
+    emit_data(out, &list, i);
+  }
+  for (size_t i = 0; i < list.count; i++) {
+    emit_function(out, &list, i);
+  }
+
+  fprintf(out, "static const AotChunk chunks[] = {\n");
+  for (size_t i = 0; i < list.count; i++) {
+    Chunk *c = list.chunks[i];
+    RiauFunction *function = list.functions[i];
+    fputs("    {", out);
+    if (function) {
+      emit_string(out, function->name);
+      fprintf(out, ", %d", function->arity);
+    } else {
+      fputs("NULL, 0", out);
+    }
+    fprintf(out, ", code_%zu, %zu, lines_%zu, %zu, ", i, c->count, i,
+            c->line_count);
+    if (c->constant_count > 0) {
+      fprintf(out, "constants_%zu, %zu", i, c->constant_count);
+    } else {
+      fputs("NULL, 0", out);
+    }
+    fprintf(out, ", %zu, run_%zu},\n", c->cache_count, i);
+  }
+  fprintf(out, "};\n\n");
+  fprintf(out, "int main(void) { return aot_main(chunks); }\n");
+
+  riau_free(list.chunks);
+  riau_free(list.functions);
+  return !ferror(out);
+}
+
+// Runtime
+
+#ifdef RIAU_AOT
+
+#include "../stdlib/stdlib.h"
+
+static void release(JitCode *code) { riau_free(code); }
+
+static void load_chunk(Chunk *chunk, const AotChunk *chunks, int index) {
+  const AotChunk *source = &chunks[index];
+  size_t run = 0;
+  for (size_t i = 0; i < source->count; i++) {
+    while (run + 1 < source->line_count && source->lines[run + 1].offset <= i) {
+      run++;
+    }
+    chunk_write(chunk, source->code[i], source->lines[run].line);
+  }
+
+  // Constants go back in their original order, so the operands that index
+  // them stay valid
+  for (size_t i = 0; i < source->constant_count; i++) {
+    const AotConstant *constant = &source->constants[i];
+    switch (constant->type) {
+    case CONST_NUMBER:
+      chunk_add_constant(chunk, constant_number(constant->number));
+      break;
+    case CONST_INT:
+      chunk_add_constant(chunk, constant_int(constant->integer));
+      break;
+    case CONST_STRING:
+      chunk_add_constant(chunk, constant_string(constant->string));
+      break;
+    case CONST_FUNCTION: {
+      const AotChunk *body = &chunks[constant->function];
+      RiauFunction *function = function_new_unmanaged(body->name, body->arity);
+      chunk_share_constants(function->chunk, chunk->shared);
+      load_chunk(function->chunk, chunks, constant->function);
+      chunk_add_constant(chunk, constant_function(function));
+      break;
+    }
+    }
+  }
+
+  for (size_t i = 0; i < source->cache_count; i++) {
+    chunk_add_cache(chunk);
+  }
+
+  chunk->jit = riau_alloc(sizeof(JitCode));
+  chunk->jit->run = source->run;
+  chunk->jit->release = release;
+}
+
+int aot_main(const AotChunk *chunks) {
+#ifdef RIAU_ARENA
+  arena_enable();
+#endif
+  if (getenv("GATEWAY_INTERFACE")) {
+    arena_enable();
+  }
+
+  Chunk chunk;
+  chunk_init(&chunk);
+  chunk_share_constants(&chunk, NULL);
+  load_chunk(&chunk, chunks, 0);
+
+  VM vm;
+  vm_init(&vm);
+  stdlib_register_builtins(&vm);
+
+  int status = 0;
+  if (!vm_execute(&vm, &chunk)) {
+    vm_print_error(&vm);
+    status = 70;
+  }
+
+  // The arena and the heap go away with the process
+  if (arena_active)
+    return status;
+
+  vm_free(&vm);
+  gc_free_heap();
+  chunk_free(&chunk);
+  return status;
+}
+
+#endif // RIAU_AOT
@@ -0,0 +1,121 @@
+#ifndef RIAU_AOT_H
+#define RIAU_AOT_H
+
+#include "vm.h"
+#include <stdio.h>
+
+// Ahead-of-time compilation
+//
+// `riau --emit-c script.riau` writes a compiled script out as one C
+// translation unit: the bytecode, line table and constants of every chunk
+// as static data, plus one C function per chunk with a case for each
+// instruction. Stack shuffling, jumps, int arithmetic and int comparisons
+// are plain C; everything else calls the op_* body the interpreter runs
+// (exported as vm_op_* in builds with -DRIAU_AOT).
+//
+// Built against the runtime with -DRIAU_AOT (tools/aot_build.sh), the
+// program loads its chunks from that data, with no lexing, parsing or
+// compiling, and runs them on a VM like the CLI does. Native code runs until
+// the next call, tail call, return or halt, which the interpreter carries
+// out before entering the native code of the chunk it lands in, the same
+// hand-off as the baseline JIT (jit.h).
+
+// Write `chunk`, compiled from `source_path`, as C. Returns false if the
+// output could not be written.
+bool aot_emit_c(Chunk *chunk, const char *source_path, FILE *out);
+
+#ifdef RIAU_AOT
+
+// Runtime side, used by emitted code
+
+typedef struct {
+  ConstantType type;
+  double number;
+  int32_t integer;
+  const char *string;
+  int function; // CONST_FUNCTION: index of its chunk
+} AotConstant;
+
+typedef struct {
+  const char *name; // Function name; NULL for the script
+  int arity;
+  const uint8_t *code;
+  size_t count;
+  const LineRun *lines;
+  size_t line_count;
+  const AotConstant *constants;
+  size_t constant_count;
+  size_t cache_count;
+  bool (*run)(JitCode *code, VM *vm);
+} AotChunk;
+
+// Load chunks[0] (and the functions it declares) and run it. Returns the
+// process exit status.
+int aot_main(const AotChunk *chunks);
+
+#define OP_DECLARE(op, function) bool vm_##function(VM *vm);
+VM_OP_BODIES(OP_DECLARE)
+#undef OP_DECLARE
+
+// Instruction templates. `at` is the address just past the opcode, where an
+// op_* body expects vm->ip.
+
+#ifdef RIAU_GUARD_PAGES
+#define AOT_RESERVE(vm) ((void)0)
+#else
+#define AOT_RESERVE(vm)                                                        \
+  if ((vm)->stack_top == (vm)->stack_limit)                                    \
+  guard_overflow()
+#endif
+
+#define AOT_PUSH(vm, value)                                                    \
+  do {                                                                         \
+    AOT_RESERVE(vm);                                                           \
+    *(vm)->stack_top++ = (value);                                              \
+  } while (0)
+
+#define AOT_STEP(vm, at, body)                                                 \
+  do {                                                                         \
+    (vm)->ip = (at);                                                           \
+    if (!body(vm))                                                             \
+      return false;                                                            \
+  } while (0)
+
+// Hand the instruction at `at` to the interpreter
+#define AOT_EXIT(vm, at)                                                       \
+  do {                                                                         \
+    (vm)->ip = (at);                                                           \
+    return true;                                                               \
+  } while (0)
+
+#define AOT_TRUTHY(v) (IS_BOOL(v) ? AS_BOOL(v) : value_is_truthy(v))
+
+// Two ints: `builtin` is a __builtin_*_overflow; an overflowing result
+// goes to the body, which widens it to a double
+#define AOT_INT_ARITHMETIC(vm, at, body, builtin)                              \
+  do {                                                                         \
+    Value *top_ = (vm)->stack_top;                                             \
+    int32_t result_;                                                           \
+    if (IS_INT(top_[-2]) && IS_INT(top_[-1]) &&                                \
+        !builtin(AS_INT(top_[-2]), AS_INT(top_[-1]), &result_)) {              \
+      top_[-2] = INT_VAL(result_);                                             \
+      (vm)->stack_top = top_ - 1;                                              \
+    } else {                                                                   \
+      AOT_STEP(vm, at, body);                                                  \
+    }                                                                          \
+  } while (0)
+
+#define AOT_INT_COMPARE(vm, at, body, op)                                      \
+  do {                                                                         \
+    Value *top_ = (vm)->stack_top;                                             \
+    if (IS_INT(top_[-2]) && IS_INT(top_[-1])) {                                \
+      top_[-2] = BOOL_VAL(AS_INT(top_[-2]) op AS_INT(top_[-1]));               \
+      (vm)->stack_top = top_ - 1;                                              \
+    } else {                                                                   \
+      AOT_STEP(vm, at, body);                                                  \
+    }                                                                          \
+  } while (0)
+
+#endif // RIAU_AOT
+
+#endif // RIAU_AOT_H
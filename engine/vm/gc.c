@@ -0,0 +1,419 @@
+#include "gc.h"
+#include "vm.h"
+#include "../runtime/arena.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define GC_ALIGN 16
+#define ALIGN_UP(size) (((size) + GC_ALIGN - 1) & ~(size_t)(GC_ALIGN - 1))
+
+typedef struct {
+  GcHeader **items;
+  size_t count;
+  size_t capacity;
+} GcStack;
+
+typedef struct {
+  GcRootScanner scanner;
+  void *context;
+} RootScanner;
+
+// What gc_visit_value() does with the values it is handed
+typedef enum {
+  VISIT_EVACUATE, // Minor collection: copy young objects out
+  VISIT_MARK,     // Major collection: mark old objects
+} VisitMode;
+
+bool gc_requested = false;
+
+// Nursery
+static uint8_t *nursery = NULL;
+static uint8_t *nursery_top = NULL;
+static uint8_t *nursery_end = NULL;
+static bool nursery_full = false;
+
+// Old space. While sweeping, objects not yet swept wait in sweep_list and
+// everything else (survivors, new objects) is in old_objects.
+static GcHeader *old_objects = NULL;
+static GcHeader *sweep_list = NULL;
+
+static GcStack gray;       // Marked objects whose children are not traced
+static GcStack remembered; // Old objects that may point into the nursery
+static GcStack promoted;   // Copied objects whose children are not evacuated
+
+static RootScanner *roots = NULL;
+static size_t root_count = 0;
+static size_t root_capacity = 0;
+
+static GcPhase phase = GC_IDLE;
+static VisitMode visit_mode = VISIT_EVACUATE;
+static size_t threshold = GC_MIN_THRESHOLD;
+static size_t step_debt = 0; // Bytes allocated since the last step
+static GcStats stats;
+
+static void stack_push(GcStack *stack, GcHeader *object) {
+  if (stack->capacity < stack->count + 1) {
+    size_t old_capacity = stack->capacity;
+    stack->capacity = old_capacity < 8 ? 8 : old_capacity * 2;
+    stack->items =
+        realloc(stack->items, stack->capacity * sizeof(GcHeader *));
+  }
+  stack->items[stack->count++] = object;
+}
+
+// Free what an object owns outside the collector's heap
+static void finalize(GcHeader *object) {
+  switch (object->kind) {
+  case GC_ARRAY:
+    free(((RiauArray *)object)->elements);
+    break;
+  case GC_OBJECT:
+    shape_free(((RiauObject *)object)->shape);
+    free(((RiauObject *)object)->slots);
+    break;
+  case GC_FUNCTION:
+    riau_free(((RiauFunction *)object)->name);
+    break;
+  default:
+    break;
+  }
+}
+
+static void mark_object(GcHeader *object) {
+  // Only unmarked old objects; the nursery is left to minor collections
+  if ((object->flags & (GC_OLD | GC_MARKED)) != GC_OLD)
+    return;
+  object->flags |= GC_MARKED;
+  stack_push(&gray, object);
+}
+
+static void enter_old_space(GcHeader *object) {
+  object->flags = GC_OLD;
+  object->next = old_objects;
+  old_objects = object;
+  stats.old_bytes += object->size;
+
+  // Objects that show up while marking are live for this cycle
+  if (phase == GC_MARKING) {
+    mark_object(object);
+  }
+}
+
+void *gc_allocate(GcKind kind, size_t size) {
+  if (!nursery) {
+    nursery = malloc(GC_NURSERY_SIZE);
+    nursery_top = nursery;
+    nursery_end = nursery + GC_NURSERY_SIZE;
+  }
+
+  size = ALIGN_UP(size);
+  GcHeader *object;
+  if (size < GC_LARGE_OBJECT &&
+      (size_t)(nursery_end - nursery_top) >= size) {
+    object = (GcHeader *)nursery_top;
+    nursery_top += size;
+    memset(object, 0, size);
+
+    // Collect once the next small object might not fit
+    if ((size_t)(nursery_end - nursery_top) < GC_LARGE_OBJECT) {
+      nursery_full = true;
+      gc_requested = true;
+    }
+  } else {
+    // Large objects, and small ones between a full nursery and the next
+    // safepoint, go straight to the old space
+    object = calloc(1, size);
+    enter_old_space(object);
+  }
+
+  object->kind = (uint8_t)kind;
+  object->size = (uint32_t)size;
+
+  step_debt += size;
+  if (phase == GC_IDLE ? stats.old_bytes >= threshold
+                       : step_debt >= GC_STEP_BYTES) {
+    gc_requested = true;
+  }
+  return object;
+}
+
+// Roots
+void gc_add_root_scanner(GcRootScanner scanner, void *context) {
+  for (size_t i = 0; i < root_count; i++) {
+    if (roots[i].scanner == scanner && roots[i].context == context)
+      return;
+  }
+
+  if (root_capacity < root_count + 1) {
+    size_t old_capacity = root_capacity;
+    root_capacity = old_capacity < 8 ? 8 : old_capacity * 2;
+    roots = realloc(roots, root_capacity * sizeof(RootScanner));
+  }
+  roots[root_count].scanner = scanner;
+  roots[root_count].context = context;
+  root_count++;
+}
+
+void gc_remove_root_scanner(GcRootScanner scanner, void *context) {
+  for (size_t i = 0; i < root_count; i++) {
+    if (roots[i].scanner == scanner && roots[i].context == context) {
+      roots[i] = roots[--root_count];
+      return;
+    }
+  }
+}
+
+static void scan_roots(VisitMode mode) {
+  visit_mode = mode;
+  for (size_t i = 0; i < root_count; i++) {
+    roots[i].scanner(roots[i].context);
+  }
+}
+
+// Copy a nursery object into the old space, once
+static GcHeader *evacuate(GcHeader *object) {
+  if (object->flags & GC_FORWARDED)
+    return object->next;
+  if (!gc_is_young(object))
+    return object;
+
+  GcHeader *copy = malloc(object->size);
+  memcpy(copy, object, object->size);
+  enter_old_space(copy);
+  stack_push(&promoted, copy);
+  stats.promoted_bytes += object->size;
+
+  object->flags |= GC_FORWARDED;
+  object->next = copy;
+  return copy;
+}
+
+void gc_visit_value(Value *value) {
+  if (!IS_HEAP(*value))
+    return;
+
+  GcHeader *object = AS_GC(*value);
+  if (visit_mode == VISIT_MARK) {
+    mark_object(object);
+    return;
+  }
+
+  GcHeader *moved = evacuate(object);
+  if (moved != object) {
+    *value = HEAP_VAL(*value, moved);
+  }
+}
+
+static void trace_children(GcHeader *object) {
+  switch (object->kind) {
+  case GC_ARRAY: {
+    RiauArray *array = (RiauArray *)object;
+    for (size_t i = 0; i < array->count; i++) {
+      gc_visit_value(&array->elements[i]);
+    }
+    break;
+  }
+  case GC_OBJECT: {
+    RiauObject *obj = (RiauObject *)object;
+    for (uint32_t i = 0; i < obj->shape->slot_count; i++) {
+      if (obj->shape->keys[i]) {
+        gc_visit_value(&obj->slots[i]);
+      }
+    }
+    break;
+  }
+  default:
+    break;
+  }
+}
+
+// Minor collection: evacuate everything in the nursery that is reachable
+// from the roots or the remembered set, then reset the bump pointer
+static void minor_collection(void) {
+  nursery_full = false;
+  if (!nursery || nursery_top == nursery)
+    return;
+
+  scan_roots(VISIT_EVACUATE);
+  for (size_t i = 0; i < remembered.count; i++) {
+    remembered.items[i]->flags &= ~GC_REMEMBERED;
+    trace_children(remembered.items[i]);
+  }
+  remembered.count = 0;
+
+  while (promoted.count > 0) {
+    trace_children(promoted.items[--promoted.count]);
+  }
+
+  for (uint8_t *cursor = nursery; cursor < nursery_top;) {
+    GcHeader *object = (GcHeader *)cursor;
+    if (!(object->flags & GC_FORWARDED)) {
+      finalize(object);
+    }
+    cursor += object->size;
+  }
+  nursery_top = nursery;
+  stats.minor_collections++;
+}
+
+// Major collection: incremental mark, then incremental sweep
+static void begin_mark(void) {
+  phase = GC_MARKING;
+  scan_roots(VISIT_MARK);
+}
+
+// Finish marking atomically: empty the nursery (promoted objects are
+// marked), catch root changes made since marking began, and trace what
+// that found. The write barrier covers every heap store in between.
+static void remark(void) {
+  minor_collection();
+  scan_roots(VISIT_MARK);
+  while (gray.count > 0) {
+    trace_children(gray.items[--gray.count]);
+  }
+
+  phase = GC_SWEEPING;
+  sweep_list = old_objects;
+  old_objects = NULL;
+}
+
+static void mark_step(size_t work) {
+  visit_mode = VISIT_MARK;
+  while (work-- > 0 && gray.count > 0) {
+    trace_children(gray.items[--gray.count]);
+  }
+  if (gray.count == 0) {
+    remark();
+  }
+}
+
+static void sweep_step(size_t work) {
+  while (work-- > 0 && sweep_list) {
+    GcHeader *object = sweep_list;
+    sweep_list = object->next;
+
+    if (object->flags & GC_MARKED) {
+      object->flags &= ~GC_MARKED;
+      object->next = old_objects;
+      old_objects = object;
+    } else {
+      stats.old_bytes -= object->size;
+      stats.freed_bytes += object->size;
+      finalize(object);
+      free(object);
+    }
+  }
+
+  if (!sweep_list) {
+    phase = GC_IDLE;
+    threshold = stats.old_bytes * GC_GROWTH_FACTOR;
+    if (threshold < GC_MIN_THRESHOLD) {
+      threshold = GC_MIN_THRESHOLD;
+    }
+    stats.major_collections++;
+  }
+}
+
+static void step(size_t work) {
+  if (phase == GC_MARKING) {
+    mark_step(work);
+  } else if (phase == GC_SWEEPING) {
+    sweep_step(work);
+  }
+  stats.steps++;
+}
+
+void gc_safepoint(void) {
+  gc_requested = false;
+  clock_t start = clock();
+
+  if (nursery_full) {
+    minor_collection();
+  }
+
+  if (phase == GC_IDLE) {
+    if (stats.old_bytes >= threshold) {
+      begin_mark();
+    }
+    step_debt = 0;
+  } else if (step_debt >= GC_STEP_BYTES) {
+    // Pay for what was allocated since the last step
+    size_t work = step_debt / 1024 * GC_WORK_PER_KB;
+    step(work < GC_STEP_MAX_WORK ? work : GC_STEP_MAX_WORK);
+    step_debt = 0;
+  }
+
+  double pause = (double)(clock() - start) * 1000.0 / CLOCKS_PER_SEC;
+  if (pause > stats.max_pause_ms) {
+    stats.max_pause_ms = pause;
+  }
+}
+
+void gc_collect(void) {
+  minor_collection();
+  if (phase == GC_IDLE) {
+    begin_mark();
+  }
+  while (phase != GC_IDLE) {
+    step(SIZE_MAX);
+  }
+  step_debt = 0;
+}
+
+// Write barrier
+void gc_barrier_slow(GcHeader *owner, GcHeader *child) {
+  if (gc_is_young(child)) {
+    if (!(owner->flags & GC_REMEMBERED)) {
+      owner->flags |= GC_REMEMBERED;
+      stack_push(&remembered, owner);
+    }
+  } else if (phase == GC_MARKING) {
+    mark_object(child);
+  }
+}
+
+GcPhase gc_phase(void) { return phase; }
+
+const GcStats *gc_stats(void) { return &stats; }
+
+void gc_print_stats(FILE *out) {
+  fprintf(out, "GC: %zu minor, %zu major collections, %zu steps\n",
+          stats.minor_collections, stats.major_collections, stats.steps);
+  fprintf(out, "GC: %zu bytes promoted, %zu bytes freed, %zu bytes old\n",
+          stats.promoted_bytes, stats.freed_bytes, stats.old_bytes);
+  fprintf(out, "GC: longest pause %.3f ms\n", stats.max_pause_ms);
+}
+
+static void free_list(GcHeader *object) {
+  while (object) {
+    GcHeader *next = object->next;
+    finalize(object);
+    free(object);
+    object = next;
+  }
+}
+
+void gc_free_heap(void) {
+  for (uint8_t *cursor = nursery; cursor < nursery_top;) {
+    GcHeader *object = (GcHeader *)cursor;
+    if (!(object->flags & GC_FORWARDED)) {
+      finalize(object);
+    }
+    cursor += object->size;
+  }
+  free(nursery);
+  nursery = nursery_top = nursery_end = NULL;
+  nursery_full = false;
+
+  free_list(old_objects);
+  free_list(sweep_list);
+  old_objects = sweep_list = NULL;
+
+  gray.count = remembered.count = promoted.count = 0;
+  phase = GC_IDLE;
+  threshold = GC_MIN_THRESHOLD;
+  step_debt = 0;
+  stats.old_bytes = 0;
+  gc_requested = false;
+}
@@ -0,0 +1,125 @@
+#ifndef RIAU_GC_H
+#define RIAU_GC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Garbage collector
+//
+// Strings, arrays, objects and functions are allocated by the collector
+// and start with a GcHeader. New objects are bump-allocated in a fixed
+// nursery. A minor collection copies the nursery's survivors into the old
+// space and resets it. The old space is collected by an incremental
+// mark-sweep that runs in small steps paced by the allocation rate.
+//
+// Collections only run at safepoints: between instructions, once the VM
+// has pushed the result of an instruction that allocated. At that point
+// every live value is reachable from a registered root (VM stack, globals,
+// registers) or from another heap object, so objects can move. C code
+// must not hold an unrooted Value across vm_execute.
+//
+// Stores of heap values into heap objects go through gc_write_barrier()
+// in vm.h. It records old objects that point into the nursery, and keeps
+// incremental marking correct by shading objects stored into already
+// marked ones.
+
+// Nursery size; a minor collection's pause is bounded by it
+#define GC_NURSERY_SIZE (256 * 1024)
+
+// Objects at least this big skip the nursery
+#define GC_LARGE_OBJECT (GC_NURSERY_SIZE / 16)
+
+// Old-space bytes before the first major collection, and how far the old
+// space may grow past the live bytes of the last one before the next
+#define GC_MIN_THRESHOLD (1024 * 1024)
+#define GC_GROWTH_FACTOR 2
+
+// Pacing: an incremental step runs every GC_STEP_BYTES allocated and does
+// GC_WORK_PER_KB units of work (objects marked or swept) per KB allocated
+// since the last step, up to GC_STEP_MAX_WORK
+#define GC_STEP_BYTES (64 * 1024)
+#define GC_WORK_PER_KB 64
+#define GC_STEP_MAX_WORK 4096
+
+typedef enum {
+  GC_STRING,
+  GC_ARRAY,
+  GC_OBJECT,
+  GC_FUNCTION,
+} GcKind;
+
+// Header flags
+#define GC_MARKED 0x01     // Reached in the current major cycle
+#define GC_OLD 0x02        // Lives in the old space
+#define GC_REMEMBERED 0x04 // Old object in the remembered set
+#define GC_FORWARDED 0x08  // Nursery copy moved; `next` is the new address
+#define GC_UNMANAGED 0x10  // Owned by its creator (constants, shape keys)
+
+typedef struct GcHeader GcHeader;
+
+struct GcHeader {
+  GcHeader *next; // Old space: next object. Forwarded: the new address.
+  uint32_t size;  // Allocation size, header included
+  uint8_t kind;
+  uint8_t flags;
+};
+
+typedef enum {
+  GC_IDLE,
+  GC_MARKING,
+  GC_SWEEPING,
+} GcPhase;
+
+typedef struct {
+  size_t minor_collections;
+  size_t major_collections;
+  size_t steps;
+  size_t promoted_bytes;
+  size_t freed_bytes;
+  size_t old_bytes; // Currently in the old space
+  double max_pause_ms;
+} GcStats;
+
+// Root scanners report each root with gc_visit_value() (vm.h), which may
+// update it in place
+typedef void (*GcRootScanner)(void *context);
+
+// Allocation. Memory is zeroed past the header.
+void *gc_allocate(GcKind kind, size_t size);
+
+// Set when the collector has work for the next safepoint
+extern bool gc_requested;
+
+// Run pending collection work. Call only at a safepoint.
+void gc_safepoint(void);
+
+#define GC_SAFEPOINT()                                                         \
+  do {                                                                         \
+    if (gc_requested)                                                          \
+      gc_safepoint();                                                          \
+  } while (0)
+
+// Run a full minor + major collection now. Call only at a safepoint.
+void gc_collect(void);
+
+// Roots
+void gc_add_root_scanner(GcRootScanner scanner, void *context);
+void gc_remove_root_scanner(GcRootScanner scanner, void *context);
+
+// Write barrier slow path, see gc_write_barrier()
+void gc_barrier_slow(GcHeader *owner, GcHeader *child);
+
+static inline bool gc_is_young(const GcHeader *header) {
+  return !(header->flags & (GC_OLD | GC_UNMANAGED));
+}
+
+GcPhase gc_phase(void);
+const GcStats *gc_stats(void);
+void gc_print_stats(FILE *out);
+
+// Free every managed object; only for process teardown
+void gc_free_heap(void);
+
+#endif // RIAU_GC_H
@@ -0,0 +1,147 @@
+// sigaction, sigsetjmp and mmap are POSIX, MAP_ANONYMOUS is a common
+// extension
+#define _DEFAULT_SOURCE
+#define _DARWIN_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+
+#include "guard.h"
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifdef RIAU_GUARD_PAGES
+#include <setjmp.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+typedef sigjmp_buf GuardJump;
+#define GUARD_SETJMP(jump) sigsetjmp(jump, 1)
+#define GUARD_LONGJMP(jump) siglongjmp(jump, 1)
+#else
+#include <setjmp.h>
+
+typedef jmp_buf GuardJump;
+#define GUARD_SETJMP(jump) setjmp(jump)
+#define GUARD_LONGJMP(jump) longjmp(jump, 1)
+#endif
+
+static GuardJump *current_jump = NULL;
+
+#ifdef RIAU_GUARD_PAGES
+
+static GuardRegion *regions = NULL;
+static bool handler_installed = false;
+
+static size_t page_size(void) {
+  static size_t size = 0;
+  if (!size) {
+    size = (size_t)sysconf(_SC_PAGESIZE);
+  }
+  return size;
+}
+
+static bool in_guard_page(uintptr_t address) {
+  for (GuardRegion *region = regions; region; region = region->next) {
+    uintptr_t guard = (uintptr_t)region->base + region->mapping - page_size();
+    if (address >= guard && address < guard + page_size())
+      return true;
+  }
+  return false;
+}
+
+static void on_fault(int signal, siginfo_t *info, void *ucontext) {
+  (void)ucontext;
+  if (current_jump && in_guard_page((uintptr_t)info->si_addr)) {
+    GUARD_LONGJMP(*current_jump);
+  }
+
+  // Not ours: fault again with the default action
+  struct sigaction action = {0};
+  action.sa_handler = SIG_DFL;
+  sigemptyset(&action.sa_mask);
+  sigaction(signal, &action, NULL);
+}
+
+static void install_handler(void) {
+  struct sigaction action = {0};
+  action.sa_sigaction = on_fault;
+  action.sa_flags = SA_SIGINFO;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGSEGV, &action, NULL);
+  sigaction(SIGBUS, &action, NULL);
+  handler_installed = true;
+}
+
+void guard_region_init(GuardRegion *region, size_t size) {
+  if (!handler_installed) {
+    install_handler();
+  }
+
+  size_t page = page_size();
+  size = (size + page - 1) / page * page;
+  region->size = size;
+  region->mapping = size + page;
+
+  int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef MAP_NORESERVE
+  flags |= MAP_NORESERVE;
+#endif
+  region->base =
+      mmap(NULL, region->mapping, PROT_READ | PROT_WRITE, flags, -1, 0);
+  if (region->base == MAP_FAILED) {
+    abort();
+  }
+  mprotect((uint8_t *)region->base + size, page, PROT_NONE);
+
+  region->next = regions;
+  regions = region;
+}
+
+void guard_region_free(GuardRegion *region) {
+  for (GuardRegion **link = &regions; *link; link = &(*link)->next) {
+    if (*link == region) {
+      *link = region->next;
+      break;
+    }
+  }
+  munmap(region->base, region->mapping);
+  region->base = NULL;
+}
+
+#else
+
+void guard_region_init(GuardRegion *region, size_t size) {
+  region->base = calloc(1, size);
+  region->size = size;
+  region->mapping = size;
+  region->next = NULL;
+  if (!region->base) {
+    abort();
+  }
+}
+
+void guard_region_free(GuardRegion *region) {
+  free(region->base);
+  region->base = NULL;
+}
+
+#endif // RIAU_GUARD_PAGES
+
+bool guard_call(bool (*body)(void *), void *context, bool *overflow) {
+  GuardJump jump;
+  GuardJump *outer = current_jump;
+  *overflow = false;
+
+  if (GUARD_SETJMP(jump)) {
+    current_jump = outer;
+    *overflow = true;
+    return false;
+  }
+
+  current_jump = &jump;
+  bool result = body(context);
+  current_jump = outer;
+  return result;
+}
+
+void guard_overflow(void) { GUARD_LONGJMP(*current_jump); }
@@ -0,0 +1,42 @@
+#ifndef RIAU_GUARD_H
+#define RIAU_GUARD_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Guarded stack regions
+//
+// A region reserves address space for a whole stack up front and places an
+// inaccessible guard page right after it. The OS only commits pages as the
+// stack actually grows into them, so a large limit costs nothing until it
+// is used, the stack never moves, and pushing needs no bounds check:
+// running off the end faults on the guard page, and the fault is turned
+// into a normal error return from guard_call().
+//
+// Platforms without mmap/sigaction, and builds with -DRIAU_NO_GUARD_PAGES,
+// get a plain zeroed allocation instead; there, the owner checks its bounds
+// and calls guard_overflow() itself.
+#if (defined(__unix__) || defined(__APPLE__)) && !defined(RIAU_NO_GUARD_PAGES)
+#define RIAU_GUARD_PAGES
+#endif
+
+typedef struct GuardRegion GuardRegion;
+
+struct GuardRegion {
+  void *base;
+  size_t size;    // Usable bytes
+  size_t mapping; // Bytes mapped, guard page included
+  GuardRegion *next;
+};
+
+void guard_region_init(GuardRegion *region, size_t size);
+void guard_region_free(GuardRegion *region);
+
+// Run body(context) and return its result. If body overflows a region,
+// unwind back here instead, set *overflow and return false. Calls nest.
+bool guard_call(bool (*body)(void *), void *context, bool *overflow);
+
+// Unwind to the innermost guard_call() as if a guard page had been hit
+void guard_overflow(void);
+
+#endif // RIAU_GUARD_H
@@ -0,0 +1,783 @@
+// mmap and mprotect are POSIX, MAP_ANONYMOUS is a common extension
+#define _DEFAULT_SOURCE
+
+#include "jit.h"
+
+#ifdef RIAU_JIT
+
+#include "../runtime/arena.h"
+#include <stddef.h>
+#include <string.h>
+#include <sys/mman.h>
+
+// Native code of one chunk. The code starts with the prologue; entering
+// it at an instruction means calling it with that instruction's address.
+typedef struct {
+  JitCode base;
+  uint8_t *code;
+  size_t mapping;    // Bytes mapped for the code
+  uint32_t *entries; // Code offset of each instruction, by bytecode offset
+} NativeChunk;
+
+typedef bool (*NativeCode)(VM *vm, uint8_t *start);
+
+#define NO_ENTRY UINT32_MAX
+
+// Values are copied a machine word at a time
+_Static_assert(sizeof(Value) % 8 == 0, "Value must be whole words");
+#define VALUE_WORDS ((int32_t)(sizeof(Value) / 8))
+
+static size_t compiled_chunks = 0;
+static size_t native_bytes = 0;
+
+// Templates
+//
+// Machine code with holes for the operands, copied into the chunk's code
+// and patched. The VM pointer lives in rbx for the whole run; rax, rcx and
+// rdx are scratch. Immediates are 64-bit, displacements and jump targets
+// 32-bit. HOLE marks the bytes a patch overwrites.
+#define HOLE 0x00
+#define HOLE32 HOLE, HOLE, HOLE, HOLE
+#define HOLE64 HOLE32, HOLE32
+
+// push rbx; mov rbx, rdi; jmp rsi
+static const uint8_t PROLOGUE[] = {0x53, 0x48, 0x89, 0xfb, 0xff, 0xe6};
+
+// Run an instruction's op_* body: vm->ip = <ip>; if (!<helper>(vm)) fail
+static const uint8_t STEP[] = {
+    0x48, 0xb8, HOLE64,       // mov rax, <ip>
+    0x48, 0x89, 0x83, HOLE32, // mov [rbx + <offsetof ip>], rax
+    0x48, 0x89, 0xdf,         // mov rdi, rbx
+    0x48, 0xb8, HOLE64,       // mov rax, <helper>
+    0xff, 0xd0,               // call rax
+    0x84, 0xc0,               // test al, al
+    0x0f, 0x84, HOLE32,       // jz <error>
+};
+#define STEP_IP 2
+#define STEP_IP_FIELD 13
+#define STEP_HELPER 22
+#define STEP_ERROR 36
+
+// Pop a condition and branch on it: if (!<pop_truthy>(vm)) goto <target>
+static const uint8_t BRANCH[] = {
+    0x48, 0x89, 0xdf,   // mov rdi, rbx
+    0x48, 0xb8, HOLE64, // mov rax, <pop_truthy>
+    0xff, 0xd0,         // call rax
+    0x84, 0xc0,         // test al, al
+    0x0f, 0x84, HOLE32, // jz <target> (jnz for jump-if-true)
+};
+#define BRANCH_HELPER 5
+#define BRANCH_CONDITION 18
+#define BRANCH_TARGET 19
+#define JNZ 0x85
+
+// jmp <target>
+static const uint8_t JUMP[] = {0xe9, HOLE32};
+#define JUMP_TARGET 1
+
+// Leave for the interpreter: vm->ip = <ip>; return true
+static const uint8_t EXIT[] = {
+    0x48, 0xb8, HOLE64,           // mov rax, <ip>
+    0x48, 0x89, 0x83, HOLE32,     // mov [rbx + <offsetof ip>], rax
+    0xb8, 0x01, 0x00, 0x00, 0x00, // mov eax, 1
+    0x5b,                         // pop rbx
+    0xc3,                         // ret
+};
+#define EXIT_IP 2
+#define EXIT_IP_FIELD 13
+
+// Runtime error: return false
+static const uint8_t ERROR[] = {0x31, 0xc0, 0x5b, 0xc3};
+
+// rcx = vm->stack_top
+static const uint8_t LOAD_TOP[] = {0x48, 0x8b, 0x8b, HOLE32};
+#define LOAD_TOP_FIELD 3
+
+// Stacks without a guard page are bounds checked, like push() does
+#ifndef RIAU_GUARD_PAGES
+// if (rcx >= vm->stack_limit) goto <overflow>
+static const uint8_t CHECK_TOP[] = {
+    0x48, 0x3b, 0x8b, HOLE32, // cmp rcx, [rbx + <offsetof stack_limit>]
+    0x0f, 0x83, HOLE32,       // jae <overflow>
+};
+#define CHECK_TOP_FIELD 3
+#define CHECK_TOP_OVERFLOW 9
+
+// guard_overflow(), which does not return
+static const uint8_t OVERFLOW[] = {
+    0x48, 0xb8, HOLE64, // mov rax, <guard_overflow>
+    0xff, 0xd0,         // call rax
+};
+#define OVERFLOW_HELPER 2
+#endif
+
+// rdx = vm->slots
+static const uint8_t LOAD_SLOTS[] = {0x48, 0x8b, 0x93, HOLE32};
+#define LOAD_SLOTS_FIELD 3
+
+// One word from the window to the stack
+static const uint8_t SLOT_TO_TOP[] = {
+    0x48, 0x8b, 0x82, HOLE32, // mov rax, [rdx + <slot>]
+    0x48, 0x89, 0x81, HOLE32, // mov [rcx + <top>], rax
+};
+#define SLOT_TO_TOP_SLOT 3
+#define SLOT_TO_TOP_TOP 10
+
+// One word from the stack to the window
+static const uint8_t TOP_TO_SLOT[] = {
+    0x48, 0x8b, 0x81, HOLE32, // mov rax, [rcx + <top>]
+    0x48, 0x89, 0x82, HOLE32, // mov [rdx + <slot>], rax
+};
+#define TOP_TO_SLOT_TOP 3
+#define TOP_TO_SLOT_SLOT 10
+
+// One word of a constant to the stack
+static const uint8_t WORD_TO_TOP[] = {
+    0x48, 0xb8, HOLE64,       // mov rax, <word>
+    0x48, 0x89, 0x81, HOLE32, // mov [rcx + <top>], rax
+};
+#define WORD_TO_TOP_WORD 2
+#define WORD_TO_TOP_TOP 13
+
+// vm->stack_top = rcx + <bytes>
+static const uint8_t BUMP_TOP[] = {
+    0x48, 0x83, 0xc1, HOLE,   // add rcx, <bytes>
+    0x48, 0x89, 0x8b, HOLE32, // mov [rbx + <offsetof stack_top>], rcx
+};
+#define BUMP_TOP_BYTES 3
+#define BUMP_TOP_FIELD 7
+
+// vm->stack_top -= <bytes>
+static const uint8_t DROP[] = {0x48, 0x83, 0xab, HOLE32, HOLE};
+#define DROP_FIELD 3
+#define DROP_BYTES 7
+
+// Int and bool fast paths
+//
+// Arithmetic and comparisons on two ints, and branches on a bool, are done
+// inline. Any other operands, and overflow, jump (rel8) to a slow path that
+// runs the op_* body as usual. The guards and result stores depend on the
+// Value layout; the operations themselves work on eax and edx.
+#ifdef RIAU_NAN_BOXING
+
+// rcx = vm->stack_top; eax, edx = the two operands if both are ints
+static const uint8_t INT_OPERANDS[] = {
+    0x48, 0x8b, 0x8b, HOLE32, // mov rcx, [rbx + <offsetof stack_top>]
+    0x48, 0x8b, 0x41, 0xf0,   // mov rax, [rcx - 16]
+    0x48, 0x8b, 0x51, 0xf8,   // mov rdx, [rcx - 8]
+    0x48, 0x89, 0xc6,         // mov rsi, rax
+    0x48, 0xc1, 0xee, 0x20,   // shr rsi, 32
+    0x81, 0xfe, HOLE32,       // cmp esi, <INT_TAG >> 32>
+    0x75, HOLE,               // jne <slow>
+    0x48, 0x89, 0xd6,         // mov rsi, rdx
+    0x48, 0xc1, 0xee, 0x20,   // shr rsi, 32
+    0x81, 0xfe, HOLE32,       // cmp esi, <INT_TAG >> 32>
+    0x75, HOLE,               // jne <slow>
+};
+#define INT_OPERANDS_FIELD 3
+#define INT_OPERANDS_TAG_A 24
+#define INT_OPERANDS_SLOW_A 29
+#define INT_OPERANDS_TAG_B 39
+#define INT_OPERANDS_SLOW_B 44
+
+// The left operand's slot = eax (zero-extended) | <tag>, for ints and bools
+static const uint8_t INT_STORE[] = {
+    0x48, 0xba, HOLE64,     // mov rdx, <INT_TAG>
+    0x48, 0x09, 0xd0,       // or rax, rdx
+    0x48, 0x89, 0x41, 0xf0, // mov [rcx - 16], rax
+};
+#define INT_STORE_TAG 2
+#define BOOL_STORE INT_STORE
+#define BOOL_STORE_TAG INT_STORE_TAG
+
+// Pop the condition into rcx; esi = 0 for false, 1 for true
+static const uint8_t BOOL_CONDITION[] = {
+    0x48, 0x8b, 0x8b, HOLE32, // mov rcx, [rbx + <offsetof stack_top>]
+    0x48, 0x83, 0xe9, HOLE,   // sub rcx, <sizeof Value>
+    0x48, 0x8b, 0x01,         // mov rax, [rcx]
+    0x48, 0xba, HOLE64,       // mov rdx, <false>
+    0x48, 0x89, 0xc6,         // mov rsi, rax
+    0x48, 0x31, 0xd6,         // xor rsi, rdx
+    0x48, 0x83, 0xfe, 0x01,   // cmp rsi, 1
+    0x77, HOLE,               // ja <slow>
+    0x48, 0x89, 0x8b, HOLE32, // mov [rbx + <offsetof stack_top>], rcx
+    0x85, 0xf6,               // test esi, esi
+};
+#define BOOL_CONDITION_FIELD 3
+#define BOOL_CONDITION_BYTES 10
+#define BOOL_CONDITION_FALSE 16
+#define BOOL_CONDITION_SLOW 35
+#define BOOL_CONDITION_POP 39
+
+#else
+
+// The type tag is the first word of a Value, the payload the second
+_Static_assert(offsetof(Value, as) == 8, "Value payload must follow the tag");
+
+// rcx = vm->stack_top; eax, edx = the two operands if both are ints
+static const uint8_t INT_OPERANDS[] = {
+    0x48, 0x8b, 0x8b, HOLE32, // mov rcx, [rbx + <offsetof stack_top>]
+    0x83, 0x79, 0xe0, HOLE,   // cmp dword [rcx - 32], <VAL_INT>
+    0x75, HOLE,               // jne <slow>
+    0x83, 0x79, 0xf0, HOLE,   // cmp dword [rcx - 16], <VAL_INT>
+    0x75, HOLE,               // jne <slow>
+    0x8b, 0x41, 0xe8,         // mov eax, [rcx - 24]
+    0x8b, 0x51, 0xf8,         // mov edx, [rcx - 8]
+};
+#define INT_OPERANDS_FIELD 3
+#define INT_OPERANDS_TAG_A 10
+#define INT_OPERANDS_SLOW_A 12
+#define INT_OPERANDS_TAG_B 16
+#define INT_OPERANDS_SLOW_B 18
+
+// The left operand's payload = eax; its tag is already VAL_INT
+static const uint8_t INT_STORE[] = {
+    0x89, 0x41, 0xe8, // mov [rcx - 24], eax
+};
+
+// The left operand = a bool holding eax
+static const uint8_t BOOL_STORE[] = {
+    0xc7, 0x41, 0xe0, HOLE32, // mov dword [rcx - 32], <VAL_BOOL>
+    0x48, 0x89, 0x41, 0xe8,   // mov [rcx - 24], rax
+};
+#define BOOL_STORE_TAG 3
+
+// Pop the condition into rcx; ZF is set for false
+static const uint8_t BOOL_CONDITION[] = {
+    0x48, 0x8b, 0x8b, HOLE32, // mov rcx, [rbx + <offsetof stack_top>]
+    0x48, 0x83, 0xe9, HOLE,   // sub rcx, <sizeof Value>
+    0x83, 0x39, HOLE,         // cmp dword [rcx], <VAL_BOOL>
+    0x75, HOLE,               // jne <slow>
+    0x48, 0x89, 0x8b, HOLE32, // mov [rbx + <offsetof stack_top>], rcx
+    0x80, 0x79, 0x08, 0x00,   // cmp byte [rcx + 8], 0
+};
+#define BOOL_CONDITION_FIELD 3
+#define BOOL_CONDITION_BYTES 10
+#define BOOL_CONDITION_TAG 13
+#define BOOL_CONDITION_SLOW 15
+#define BOOL_CONDITION_POP 19
+
+#endif
+
+// eax = eax <op> edx, or goto <slow> on overflow
+static const uint8_t INT_ADD[] = {0x01, 0xd0, 0x70, HOLE}; // add; jo
+static const uint8_t INT_SUB[] = {0x29, 0xd0, 0x70, HOLE}; // sub; jo
+static const uint8_t INT_MUL[] = {0x0f, 0xaf, 0xc2, 0x70, HOLE}; // imul; jo
+
+// eax = eax <cc> edx
+static const uint8_t INT_COMPARE[] = {
+    0x39, 0xd0,       // cmp eax, edx
+    0x0f, HOLE, 0xc0, // set<cc> al
+    0x0f, 0xb6, 0xc0, // movzx eax, al
+};
+#define INT_COMPARE_CC 3
+#define SETL 0x9c
+#define SETLE 0x9e
+#define SETG 0x9f
+#define SETGE 0x9d
+#define SETE 0x94
+#define SETNE 0x95
+
+// Drop the right operand, then skip the slow path
+static const uint8_t INT_DONE[] = {
+    0x48, 0x83, 0xe9, HOLE,   // sub rcx, <sizeof Value>
+    0x48, 0x89, 0x8b, HOLE32, // mov [rbx + <offsetof stack_top>], rcx
+    0xeb, HOLE,               // jmp <done>
+};
+#define INT_DONE_BYTES 3
+#define INT_DONE_FIELD 7
+#define INT_DONE_SKIP 12
+
+// Branch on the flags BOOL_CONDITION left, then skip the slow path
+static const uint8_t BOOL_BRANCH[] = {
+    0x0f, 0x84, HOLE32, // jz <target> (jnz for jump-if-true)
+    0xeb, HOLE,         // jmp <done>
+};
+#define BOOL_BRANCH_CONDITION 1
+#define BOOL_BRANCH_TARGET 2
+#define BOOL_BRANCH_SKIP 7
+
+// Code being generated
+
+// Where a rel32 hole should point once everything is laid out
+typedef enum {
+  LABEL_INSTRUCTION, // The instruction at a bytecode offset
+  LABEL_ERROR,
+  LABEL_OVERFLOW,
+} LabelKind;
+
+typedef struct {
+  size_t hole;
+  LabelKind kind;
+  size_t offset;
+} Fixup;
+
+typedef struct {
+  uint8_t *code;
+  size_t count;
+  size_t capacity;
+  Fixup *fixups;
+  size_t fixup_count;
+  size_t fixup_capacity;
+} Emitter;
+
+// Copy a template and return where it starts
+static size_t emit(Emitter *e, const uint8_t *template, size_t size) {
+  if (e->capacity < e->count + size) {
+    while (e->capacity < e->count + size) {
+      e->capacity = e->capacity < 256 ? 256 : e->capacity * 2;
+    }
+    e->code = riau_realloc(e->code, e->capacity);
+  }
+  memcpy(e->code + e->count, template, size);
+  e->count += size;
+  return e->count - size;
+}
+
+static void patch8(Emitter *e, size_t at, uint8_t value) { e->code[at] = value; }
+
+static void patch32(Emitter *e, size_t at, int32_t value) {
+  memcpy(e->code + at, &value, sizeof(value));
+}
+
+static void patch64(Emitter *e, size_t at, uint64_t value) {
+  memcpy(e->code + at, &value, sizeof(value));
+}
+
+static void patch_pointer(Emitter *e, size_t at, const void *pointer) {
+  patch64(e, at, (uint64_t)(uintptr_t)pointer);
+}
+
+static void patch_function(Emitter *e, size_t at, void (*function)(void)) {
+  patch64(e, at, (uint64_t)(uintptr_t)function);
+}
+
+// A rel8 jump within the code of one instruction
+static void patch_rel8(Emitter *e, size_t hole, size_t target) {
+  e->code[hole] = (uint8_t)(int8_t)(target - (hole + 1));
+}
+
+static void patch_label(Emitter *e, size_t hole, LabelKind kind,
+                        size_t offset) {
+  if (e->fixup_count == e->fixup_capacity) {
+    e->fixup_capacity = e->fixup_capacity < 16 ? 16 : e->fixup_capacity * 2;
+    e->fixups = riau_realloc(e->fixups, e->fixup_capacity * sizeof(Fixup));
+  }
+  e->fixups[e->fixup_count++] = (Fixup){hole, kind, offset};
+}
+
+#define FIELD(name) ((int32_t)offsetof(VM, name))
+
+// Instructions
+
+static bool pop_truthy(VM *vm) {
+  vm->stack_top--;
+  return value_is_truthy(*vm->stack_top);
+}
+
+static void emit_step(Emitter *e, uint8_t *ip, JitHelper helper) {
+  size_t at = emit(e, STEP, sizeof(STEP));
+  patch_pointer(e, at + STEP_IP, ip);
+  patch32(e, at + STEP_IP_FIELD, FIELD(ip));
+  patch_function(e, at + STEP_HELPER, (void (*)(void))helper);
+  patch_label(e, at + STEP_ERROR, LABEL_ERROR, 0);
+}
+
+static void emit_exit(Emitter *e, uint8_t *ip) {
+  size_t at = emit(e, EXIT, sizeof(EXIT));
+  patch_pointer(e, at + EXIT_IP, ip);
+  patch32(e, at + EXIT_IP_FIELD, FIELD(ip));
+}
+
+// rcx = vm->stack_top, with room for one more value
+static void emit_reserve(Emitter *e) {
+  size_t at = emit(e, LOAD_TOP, sizeof(LOAD_TOP));
+  patch32(e, at + LOAD_TOP_FIELD, FIELD(stack_top));
+#ifndef RIAU_GUARD_PAGES
+  at = emit(e, CHECK_TOP, sizeof(CHECK_TOP));
+  patch32(e, at + CHECK_TOP_FIELD, FIELD(stack_limit));
+  patch_label(e, at + CHECK_TOP_OVERFLOW, LABEL_OVERFLOW, 0);
+#endif
+}
+
+static void emit_bump(Emitter *e) {
+  size_t at = emit(e, BUMP_TOP, sizeof(BUMP_TOP));
+  patch8(e, at + BUMP_TOP_BYTES, (uint8_t)sizeof(Value));
+  patch32(e, at + BUMP_TOP_FIELD, FIELD(stack_top));
+}
+
+static void emit_push(Emitter *e, Value value) {
+  uint64_t words[VALUE_WORDS];
+  memcpy(words, &value, sizeof(Value));
+
+  emit_reserve(e);
+  for (int32_t i = 0; i < VALUE_WORDS; i++) {
+    size_t at = emit(e, WORD_TO_TOP, sizeof(WORD_TO_TOP));
+    patch64(e, at + WORD_TO_TOP_WORD, words[i]);
+    patch32(e, at + WORD_TO_TOP_TOP, i * 8);
+  }
+  emit_bump(e);
+}
+
+static void emit_load_local(Emitter *e, uint8_t slot) {
+  emit_reserve(e);
+  size_t at = emit(e, LOAD_SLOTS, sizeof(LOAD_SLOTS));
+  patch32(e, at + LOAD_SLOTS_FIELD, FIELD(slots));
+  for (int32_t i = 0; i < VALUE_WORDS; i++) {
+    at = emit(e, SLOT_TO_TOP, sizeof(SLOT_TO_TOP));
+    patch32(e, at + SLOT_TO_TOP_SLOT, slot * (int32_t)sizeof(Value) + i * 8);
+    patch32(e, at + SLOT_TO_TOP_TOP, i * 8);
+  }
+  emit_bump(e);
+}
+
+static void emit_store_local(Emitter *e, uint8_t slot) {
+  size_t at = emit(e, LOAD_TOP, sizeof(LOAD_TOP));
+  patch32(e, at + LOAD_TOP_FIELD, FIELD(stack_top));
+  at = emit(e, LOAD_SLOTS, sizeof(LOAD_SLOTS));
+  patch32(e, at + LOAD_SLOTS_FIELD, FIELD(slots));
+  for (int32_t i = 0; i < VALUE_WORDS; i++) {
+    at = emit(e, TOP_TO_SLOT, sizeof(TOP_TO_SLOT));
+    patch32(e, at + TOP_TO_SLOT_TOP, i * 8 - (int32_t)sizeof(Value));
+    patch32(e, at + TOP_TO_SLOT_SLOT, slot * (int32_t)sizeof(Value) + i * 8);
+  }
+}
+
+static void emit_pop(Emitter *e) {
+  size_t at = emit(e, DROP, sizeof(DROP));
+  patch32(e, at + DROP_FIELD, FIELD(stack_top));
+  patch8(e, at + DROP_BYTES, (uint8_t)sizeof(Value));
+}
+
+static void emit_jump(Emitter *e, size_t target) {
+  size_t at = emit(e, JUMP, sizeof(JUMP));
+  patch_label(e, at + JUMP_TARGET, LABEL_INSTRUCTION, target);
+}
+
+static void emit_branch(Emitter *e, size_t target, bool if_true) {
+  size_t at = emit(e, BOOL_CONDITION, sizeof(BOOL_CONDITION));
+  patch32(e, at + BOOL_CONDITION_FIELD, FIELD(stack_top));
+  patch8(e, at + BOOL_CONDITION_BYTES, (uint8_t)sizeof(Value));
+#ifdef RIAU_NAN_BOXING
+  patch64(e, at + BOOL_CONDITION_FALSE, BOOL_VAL(false));
+#else
+  patch8(e, at + BOOL_CONDITION_TAG, VAL_BOOL);
+#endif
+  patch32(e, at + BOOL_CONDITION_POP, FIELD(stack_top));
+  size_t slow = at + BOOL_CONDITION_SLOW;
+
+  at = emit(e, BOOL_BRANCH, sizeof(BOOL_BRANCH));
+  if (if_true) {
+    patch8(e, at + BOOL_BRANCH_CONDITION, JNZ);
+  }
+  patch_label(e, at + BOOL_BRANCH_TARGET, LABEL_INSTRUCTION, target);
+  size_t skip = at + BOOL_BRANCH_SKIP;
+
+  // Not a bool
+  patch_rel8(e, slow, e->count);
+  at = emit(e, BRANCH, sizeof(BRANCH));
+  patch_function(e, at + BRANCH_HELPER, (void (*)(void))pop_truthy);
+  if (if_true) {
+    patch8(e, at + BRANCH_CONDITION, JNZ);
+  }
+  patch_label(e, at + BRANCH_TARGET, LABEL_INSTRUCTION, target);
+  patch_rel8(e, skip, e->count);
+}
+
+// An int-int fast path: `operation` computes eax from eax and edx, jumping
+// to its last byte's rel8 target on overflow when `overflow_hole`; the
+// result is an int, or a bool for comparisons.
+static void emit_int_op(Emitter *e, uint8_t *ip, JitHelper helper,
+                        const uint8_t *operation, size_t size,
+                        bool overflow_hole, uint8_t cc, bool boolean) {
+  size_t slow[3];
+  int slow_count = 0;
+
+  size_t at = emit(e, INT_OPERANDS, sizeof(INT_OPERANDS));
+  patch32(e, at + INT_OPERANDS_FIELD, FIELD(stack_top));
+#ifdef RIAU_NAN_BOXING
+  patch32(e, at + INT_OPERANDS_TAG_A, (int32_t)(INT_TAG >> 32));
+  patch32(e, at + INT_OPERANDS_TAG_B, (int32_t)(INT_TAG >> 32));
+#else
+  patch8(e, at + INT_OPERANDS_TAG_A, VAL_INT);
+  patch8(e, at + INT_OPERANDS_TAG_B, VAL_INT);
+#endif
+  slow[slow_count++] = at + INT_OPERANDS_SLOW_A;
+  slow[slow_count++] = at + INT_OPERANDS_SLOW_B;
+
+  at = emit(e, operation, size);
+  if (overflow_hole) {
+    slow[slow_count++] = at + size - 1;
+  }
+  if (cc) {
+    patch8(e, at + INT_COMPARE_CC, cc);
+  }
+
+  if (boolean) {
+    at = emit(e, BOOL_STORE, sizeof(BOOL_STORE));
+#ifdef RIAU_NAN_BOXING
+    patch64(e, at + BOOL_STORE_TAG, BOOL_VAL(false));
+#else
+    patch32(e, at + BOOL_STORE_TAG, VAL_BOOL);
+#endif
+  } else {
+    at = emit(e, INT_STORE, sizeof(INT_STORE));
+#ifdef RIAU_NAN_BOXING
+    patch64(e, at + INT_STORE_TAG, INT_TAG);
+#endif
+  }
+
+  at = emit(e, INT_DONE, sizeof(INT_DONE));
+  patch8(e, at + INT_DONE_BYTES, (uint8_t)sizeof(Value));
+  patch32(e, at + INT_DONE_FIELD, FIELD(stack_top));
+  size_t skip = at + INT_DONE_SKIP;
+
+  for (int i = 0; i < slow_count; i++) {
+    patch_rel8(e, slow[i], e->count);
+  }
+  emit_step(e, ip + 1, helper);
+  patch_rel8(e, skip, e->count);
+}
+
+static void emit_arithmetic(Emitter *e, uint8_t *ip, JitHelper helper,
+                            const uint8_t *operation, size_t size) {
+  emit_int_op(e, ip, helper, operation, size, true, 0, false);
+}
+
+static void emit_compare(Emitter *e, uint8_t *ip, JitHelper helper,
+                         uint8_t cc) {
+  emit_int_op(e, ip, helper, INT_COMPARE, sizeof(INT_COMPARE), false, cc,
+              true);
+}
+
+// Quickened instructions are compiled as their generic form: the op_*
+// bodies do their own type dispatch
+static uint8_t generic_opcode(uint8_t op) {
+  switch (op) {
+  case OP_ADD_NUM_NUM:
+  case OP_ADD_STR_STR:
+  case OP_ADD_INT_INT:
+    return OP_ADD;
+  case OP_SUB_NUM_NUM:
+  case OP_SUB_INT_INT:
+    return OP_SUB;
+  case OP_MUL_NUM_NUM:
+  case OP_MUL_INT_INT:
+    return OP_MUL;
+  case OP_DIV_NUM_NUM:
+    return OP_DIV;
+  case OP_LESS_NUM_NUM:
+  case OP_LESS_INT_INT:
+    return OP_LESS;
+  case OP_LESS_EQUAL_NUM_NUM:
+  case OP_LESS_EQUAL_INT_INT:
+    return OP_LESS_EQUAL;
+  case OP_GREATER_NUM_NUM:
+  case OP_GREATER_INT_INT:
+    return OP_GREATER;
+  case OP_GREATER_EQUAL_NUM_NUM:
+  case OP_GREATER_EQUAL_INT_INT:
+    return OP_GREATER_EQUAL;
+  default:
+    return op;
+  }
+}
+
+static void emit_instruction(Emitter *e, Chunk *chunk, size_t offset) {
+  uint8_t *ip = chunk->code + offset;
+  uint8_t op = generic_opcode(*ip);
+
+  switch (op) {
+  case OP_PUSH_CONST:
+    emit_push(e, vm_constant_value(&chunk->constants[ip[1]]));
+    break;
+  case OP_PUSH_CONST_LONG:
+    emit_push(e, vm_constant_value(&chunk->constants[(ip[1] << 8) | ip[2]]));
+    break;
+  case OP_PUSH_NULL:
+    emit_push(e, NULL_VAL);
+    break;
+  case OP_PUSH_TRUE:
+    emit_push(e, BOOL_VAL(true));
+    break;
+  case OP_PUSH_FALSE:
+    emit_push(e, BOOL_VAL(false));
+    break;
+  case OP_POP:
+    emit_pop(e);
+    break;
+  case OP_LOAD_LOCAL:
+    emit_load_local(e, ip[1]);
+    break;
+  case OP_STORE_LOCAL:
+    emit_store_local(e, ip[1]);
+    break;
+  case OP_JUMP:
+  case OP_JUMP_LONG:
+    emit_jump(e, chunk_jump_target(chunk, offset));
+    break;
+  case OP_JUMP_IF_FALSE:
+  case OP_JUMP_IF_TRUE:
+  case OP_JUMP_IF_FALSE_LONG:
+  case OP_JUMP_IF_TRUE_LONG:
+    emit_branch(e, chunk_jump_target(chunk, offset),
+                op == OP_JUMP_IF_TRUE || op == OP_JUMP_IF_TRUE_LONG);
+    break;
+  case OP_FOR_ITER:
+  case OP_FOR_ITER_LONG:
+    emit_step(e, ip + 1, vm_for_next);
+    emit_branch(e, chunk_jump_target(chunk, offset), true);
+    break;
+  case OP_ADD:
+    emit_arithmetic(e, ip, vm_op_function(op), INT_ADD, sizeof(INT_ADD));
+    break;
+  case OP_SUB:
+    emit_arithmetic(e, ip, vm_op_function(op), INT_SUB, sizeof(INT_SUB));
+    break;
+  case OP_MUL:
+    emit_arithmetic(e, ip, vm_op_function(op), INT_MUL, sizeof(INT_MUL));
+    break;
+  case OP_LESS:
+    emit_compare(e, ip, vm_op_function(op), SETL);
+    break;
+  case OP_LESS_EQUAL:
+    emit_compare(e, ip, vm_op_function(op), SETLE);
+    break;
+  case OP_GREATER:
+    emit_compare(e, ip, vm_op_function(op), SETG);
+    break;
+  case OP_GREATER_EQUAL:
+    emit_compare(e, ip, vm_op_function(op), SETGE);
+    break;
+  case OP_EQUAL:
+    emit_compare(e, ip, vm_op_function(op), SETE);
+    break;
+  case OP_NOT_EQUAL:
+    emit_compare(e, ip, vm_op_function(op), SETNE);
+    break;
+  default: {
+    // Calls, returns and halt switch frames, which the interpreter does;
+    // so does anything without a body, unknown opcodes included
+    JitHelper helper = vm_op_function(op);
+    if (helper) {
+      emit_step(e, ip + 1, helper);
+    } else {
+      emit_exit(e, ip);
+    }
+    break;
+  }
+  }
+}
+
+// Compilation
+
+static bool run_native(JitCode *code, VM *vm) {
+  NativeChunk *native = (NativeChunk *)code;
+  uint32_t entry = native->entries[vm->ip - vm->chunk->code];
+  if (entry == NO_ENTRY)
+    return true;
+
+  NativeCode start = (NativeCode)(void *)native->code;
+  return start(vm, native->code + entry);
+}
+
+static void release(JitCode *code) {
+  NativeChunk *native = (NativeChunk *)code;
+  munmap(native->code, native->mapping);
+  riau_free(native->entries);
+  riau_free(native);
+}
+
+static bool resolve_labels(Emitter *e, uint32_t *entries, size_t count,
+                           size_t error, size_t overflow) {
+  for (size_t i = 0; i < e->fixup_count; i++) {
+    Fixup *fixup = &e->fixups[i];
+    size_t target;
+    if (fixup->kind == LABEL_ERROR) {
+      target = error;
+    } else if (fixup->kind == LABEL_OVERFLOW) {
+      target = overflow;
+    } else if (fixup->offset < count && entries[fixup->offset] != NO_ENTRY) {
+      target = entries[fixup->offset];
+    } else {
+      return false; // Jump into the middle of an instruction
+    }
+    patch32(e, fixup->hole, (int32_t)(target - (fixup->hole + 4)));
+  }
+  return true;
+}
+
+static NativeChunk *compile(Chunk *chunk) {
+  Emitter e = {0};
+  uint32_t *entries = riau_alloc(chunk->count * sizeof(uint32_t));
+  for (size_t i = 0; i < chunk->count; i++) {
+    entries[i] = NO_ENTRY;
+  }
+
+  emit(&e, PROLOGUE, sizeof(PROLOGUE));
+  for (size_t offset = 0; offset < chunk->count;
+       offset += opcode_length(chunk->code[offset])) {
+    entries[offset] = (uint32_t)e.count;
+    emit_instruction(&e, chunk, offset);
+  }
+
+  size_t error = emit(&e, ERROR, sizeof(ERROR));
+  size_t overflow = error;
+#ifndef RIAU_GUARD_PAGES
+  overflow = emit(&e, OVERFLOW, sizeof(OVERFLOW));
+  patch_function(&e, overflow + OVERFLOW_HELPER, guard_overflow);
+#endif
+
+  NativeChunk *native = NULL;
+  uint8_t *code = MAP_FAILED;
+  size_t mapping = e.count;
+  if (resolve_labels(&e, entries, chunk->count, error, overflow)) {
+    code = mmap(NULL, mapping, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  }
+  if (code != MAP_FAILED) {
+    memcpy(code, e.code, e.count);
+    if (mprotect(code, mapping, PROT_READ | PROT_EXEC) == 0) {
+      native = riau_alloc(sizeof(NativeChunk));
+      native->base.run = run_native;
+      native->base.release = release;
+      native->code = code;
+      native->mapping = mapping;
+      native->entries = entries;
+      compiled_chunks++;
+      native_bytes += e.count;
+    } else {
+      munmap(code, mapping);
+    }
+  }
+
+  if (!native) {
+    riau_free(entries);
+  }
+  riau_free(e.code);
+  riau_free(e.fixups);
+  return native;
+}
+
+bool jit_enter(VM *vm, bool count) {
+  Chunk *chunk = vm->chunk;
+  if (!chunk->jit) {
+    // A chunk gets one try at compiling, on its threshold-th call
+    if (!count || vm->jit_threshold == JIT_NEVER ||
+        chunk->hotness > vm->jit_threshold ||
+        chunk->hotness++ < vm->jit_threshold)
+      return true;
+    chunk->jit = (JitCode *)compile(chunk);
+    if (!chunk->jit)
+      return true;
+  }
+
+  return chunk->jit->run(chunk->jit, vm);
+}
+
+void jit_print_stats(FILE *out) {
+  fprintf(out, "JIT: %zu chunks compiled, %zu bytes of native code\n",
+          compiled_chunks, native_bytes);
+}
+
+#endif // RIAU_JIT
@@ -0,0 +1,48 @@
+#ifndef RIAU_JIT_H
+#define RIAU_JIT_H
+
+#include "vm.h"
+#include <stdio.h>
+
+// Baseline JIT
+//
+// Once a chunk has been called, or has taken a for loop's back-edge,
+// vm->jit_threshold times in all, its bytecode is translated to x86-64 machine code by copying a precompiled template for
+// each instruction and patching in its operands: slot offsets, constant
+// values, the address of the instruction and of the helper that runs it.
+// Stack shuffling (locals, constants, pop) and jumps become straight-line
+// code, as do int arithmetic, int comparisons and branches on a bool. Every
+// other instruction, and any other operand types, call the same op_* body
+// the interpreter inlines, so both tiers share their semantics.
+//
+// Native code runs until the next call, tail call, return or halt and then
+// exits with vm->ip at that instruction for the interpreter to run. The
+// interpreter enters native code again right after: at the start of a
+// compiled callee, at the head of a hot loop, or where a compiled caller
+// resumes. Every instruction is an entry point, so a chunk can switch tiers
+// anywhere.
+//
+// Only built with -DRIAU_JIT on x86-64 Linux (see vm.h).
+
+#ifdef RIAU_JIT
+
+// Run the current chunk's native code from vm->ip. With `count`, this is a
+// call into the chunk or a loop's back-edge: it counts toward compiling the
+// chunk, and compiles it once it is hot. Returns false after a runtime error; otherwise
+// vm->ip is where the interpreter carries on (unchanged if the chunk has
+// no native code).
+bool jit_enter(VM *vm, bool count);
+
+// Chunks compiled and native code generated so far
+void jit_print_stats(FILE *out);
+
+// Defined in vm.c for the templates: the op_* body of an instruction, or
+// NULL for those the JIT handles itself, and the value a constant pushes
+typedef bool (*JitHelper)(VM *vm);
+
+JitHelper vm_op_function(uint8_t op);
+Value vm_constant_value(Constant *constant);
+
+#endif // RIAU_JIT
+
+#endif // RIAU_JIT_H
@@ -0,0 +1,208 @@
+#include "key_index.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Control byte states. Full buckets hold the low 7 bits of the hash, so the
+// high bit alone tells "free" (empty or deleted) from "full".
+#define CTRL_EMPTY 0x80
+#define CTRL_DELETED 0xFE
+
+// Keep at most 7/8 of the buckets occupied so every probe meets an empty
+// bucket eventually
+#define MAX_LOAD_NUM 7
+#define MAX_LOAD_DEN 8
+
+static uint8_t hash_h2(uint32_t hash) { return (uint8_t)(hash & 0x7F); }
+
+static size_t hash_h1(uint32_t hash) { return (size_t)(hash >> 7); }
+
+static const RiauString *key_at(const void *base, size_t stride,
+                                size_t position) {
+  return *(RiauString *const *)((const char *)base + position * stride);
+}
+
+// Group matching: one bit per bucket in the group
+#if defined(__SSE2__)
+static uint32_t group_match(const uint8_t *group, uint8_t byte) {
+  __m128i ctrl = _mm_loadu_si128((const __m128i *)group);
+  __m128i match = _mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char)byte));
+  return (uint32_t)_mm_movemask_epi8(match);
+}
+
+static uint32_t group_match_free(const uint8_t *group) {
+  __m128i ctrl = _mm_loadu_si128((const __m128i *)group);
+  return (uint32_t)_mm_movemask_epi8(ctrl);
+}
+#else
+static uint32_t group_match(const uint8_t *group, uint8_t byte) {
+  uint32_t mask = 0;
+  for (int i = 0; i < KEY_INDEX_GROUP_SIZE; i++) {
+    if (group[i] == byte) {
+      mask |= 1u << i;
+    }
+  }
+  return mask;
+}
+
+static uint32_t group_match_free(const uint8_t *group) {
+  uint32_t mask = 0;
+  for (int i = 0; i < KEY_INDEX_GROUP_SIZE; i++) {
+    if (group[i] & 0x80) {
+      mask |= 1u << i;
+    }
+  }
+  return mask;
+}
+#endif
+
+static int lowest_bit(uint32_t mask) {
+#if defined(__GNUC__)
+  return __builtin_ctz(mask);
+#else
+  int bit = 0;
+  while (!(mask & 1u)) {
+    mask >>= 1;
+    bit++;
+  }
+  return bit;
+#endif
+}
+
+void key_index_init(KeyIndex *index) {
+  index->ctrl = NULL;
+  index->positions = NULL;
+  index->bucket_count = 0;
+  index->occupied = 0;
+}
+
+void key_index_free(KeyIndex *index) {
+  free(index->ctrl);
+  free(index->positions);
+  key_index_init(index);
+}
+
+bool key_index_is_built(const KeyIndex *index) {
+  return index->bucket_count > 0;
+}
+
+// First free bucket on the probe sequence of `hash`
+static size_t find_free_bucket(const KeyIndex *index, uint32_t hash) {
+  size_t group_mask = index->bucket_count / KEY_INDEX_GROUP_SIZE - 1;
+  size_t group = hash_h1(hash) & group_mask;
+
+  for (size_t step = 1;; step++) {
+    const uint8_t *ctrl = index->ctrl + group * KEY_INDEX_GROUP_SIZE;
+    uint32_t free_mask = group_match_free(ctrl);
+    if (free_mask) {
+      return group * KEY_INDEX_GROUP_SIZE + lowest_bit(free_mask);
+    }
+    group = (group + step) & group_mask;
+  }
+}
+
+void key_index_build(KeyIndex *index, const void *base, size_t stride,
+                     size_t count) {
+  size_t live = 0;
+  for (size_t i = 0; i < count; i++) {
+    if (key_at(base, stride, i)) {
+      live++;
+    }
+  }
+
+  // Leave room to double before the next rebuild
+  size_t bucket_count = KEY_INDEX_GROUP_SIZE;
+  while (bucket_count * MAX_LOAD_NUM < live * 2 * MAX_LOAD_DEN) {
+    bucket_count *= 2;
+  }
+
+  key_index_free(index);
+  index->ctrl = malloc(bucket_count);
+  index->positions = malloc(bucket_count * sizeof(uint32_t));
+  index->bucket_count = bucket_count;
+  memset(index->ctrl, CTRL_EMPTY, bucket_count);
+
+  for (size_t i = 0; i < count; i++) {
+    const RiauString *key = key_at(base, stride, i);
+    if (!key)
+      continue;
+
+    size_t bucket = find_free_bucket(index, key->hash);
+    index->ctrl[bucket] = hash_h2(key->hash);
+    index->positions[bucket] = (uint32_t)i;
+  }
+  index->occupied = live;
+}
+
+long key_index_find(const KeyIndex *index, const void *base, size_t stride,
+                    const char *chars, size_t length, uint32_t hash) {
+  size_t group_mask = index->bucket_count / KEY_INDEX_GROUP_SIZE - 1;
+  size_t group = hash_h1(hash) & group_mask;
+  uint8_t h2 = hash_h2(hash);
+
+  for (size_t step = 1;; step++) {
+    const uint8_t *ctrl = index->ctrl + group * KEY_INDEX_GROUP_SIZE;
+
+    uint32_t match = group_match(ctrl, h2);
+    while (match) {
+      size_t bucket = group * KEY_INDEX_GROUP_SIZE + lowest_bit(match);
+      uint32_t position = index->positions[bucket];
+      const RiauString *key = key_at(base, stride, position);
+      if (key && string_equals_chars(key, chars, length, hash)) {
+        return (long)position;
+      }
+      match &= match - 1;
+    }
+
+    // An empty bucket ends the probe sequence
+    if (group_match(ctrl, CTRL_EMPTY)) {
+      return -1;
+    }
+    group = (group + step) & group_mask;
+  }
+}
+
+void key_index_insert(KeyIndex *index, const void *base, size_t stride,
+                      size_t count, uint32_t hash, uint32_t position) {
+  if ((index->occupied + 1) * MAX_LOAD_DEN >
+      index->bucket_count * MAX_LOAD_NUM) {
+    // The rebuild picks up the new key as well
+    key_index_build(index, base, stride, count);
+    return;
+  }
+
+  size_t bucket = find_free_bucket(index, hash);
+  if (index->ctrl[bucket] == CTRL_EMPTY) {
+    index->occupied++;
+  }
+  index->ctrl[bucket] = hash_h2(hash);
+  index->positions[bucket] = position;
+}
+
+void key_index_remove(KeyIndex *index, uint32_t hash, uint32_t position) {
+  size_t group_mask = index->bucket_count / KEY_INDEX_GROUP_SIZE - 1;
+  size_t group = hash_h1(hash) & group_mask;
+  uint8_t h2 = hash_h2(hash);
+
+  for (size_t step = 1;; step++) {
+    uint8_t *ctrl = index->ctrl + group * KEY_INDEX_GROUP_SIZE;
+
+    uint32_t match = group_match(ctrl, h2);
+    while (match) {
+      size_t bucket = group * KEY_INDEX_GROUP_SIZE + lowest_bit(match);
+      if (index->positions[bucket] == position) {
+        index->ctrl[bucket] = CTRL_DELETED;
+        return;
+      }
+      match &= match - 1;
+    }
+
+    if (group_match(ctrl, CTRL_EMPTY)) {
+      return;
+    }
+    group = (group + step) & group_mask;
+  }
+}
@@ -0,0 +1,48 @@
+#ifndef RIAU_KEY_INDEX_H
+#define RIAU_KEY_INDEX_H
+
+#include "riau_string.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Open-addressing hash index over an insertion-ordered key array
+// (Swiss-table layout). Buckets come in groups of 16 with one control byte
+// each: EMPTY, DELETED (tombstone) or the low 7 bits of the key's hash. A
+// probe loads a whole group of control bytes and compares them at once
+// (SSE2 when available), so most lookups touch one cache line of control
+// bytes and at most one key.
+//
+// The index only stores positions into the owner's key array; keys are read
+// back through `base` + position * `stride`, and positions whose key is NULL
+// are treated as deleted.
+#define KEY_INDEX_GROUP_SIZE 16
+
+typedef struct {
+  uint8_t *ctrl;
+  uint32_t *positions;
+  size_t bucket_count; // 0 until the index is built
+  size_t occupied;     // Full and deleted buckets
+} KeyIndex;
+
+void key_index_init(KeyIndex *index);
+void key_index_free(KeyIndex *index);
+bool key_index_is_built(const KeyIndex *index);
+
+// (Re)build from the first `count` keys, dropping tombstones
+void key_index_build(KeyIndex *index, const void *base, size_t stride,
+                     size_t count);
+
+// Position of the key, or -1
+long key_index_find(const KeyIndex *index, const void *base, size_t stride,
+                    const char *chars, size_t length, uint32_t hash);
+
+// Record a key that is known to be absent. `count` includes the new key so
+// the index can rebuild itself when it runs out of room.
+void key_index_insert(KeyIndex *index, const void *base, size_t stride,
+                      size_t count, uint32_t hash, uint32_t position);
+
+// Turn the bucket holding `position` into a tombstone
+void key_index_remove(KeyIndex *index, uint32_t hash, uint32_t position);
+
+#endif // RIAU_KEY_INDEX_H
@@ -0,0 +1,398 @@
+#include "reg_vm.h"
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static void runtime_error(RegVM *vm, const uint32_t *ip, const char *format,
+                          ...) {
+  va_list args;
+  va_start(args, format);
+  vsnprintf(vm->error_message, sizeof(vm->error_message), format, args);
+  va_end(args);
+
+  vm->had_error = true;
+
+  size_t instruction = ip - vm->chunk->code - 1;
+  fprintf(stderr, "[line %d] in script()\n", vm->chunk->lines[instruction]);
+}
+
+static void scan_roots(void *context) {
+  RegVM *vm = context;
+  for (int i = 0; i < vm->register_count; i++) {
+    gc_visit_value(&vm->registers[i]);
+  }
+}
+
+void reg_vm_init(RegVM *vm) {
+  vm->chunk = NULL;
+  vm->register_count = 0;
+  vm->base = vm->registers;
+  vm->had_error = false;
+  vm->error_message[0] = '\0';
+  gc_add_root_scanner(scan_roots, vm);
+}
+
+void reg_vm_free(RegVM *vm) {
+  gc_remove_root_scanner(scan_roots, vm);
+  vm->register_count = 0;
+}
+
+static Value constant_value(Constant *constant) {
+  if (constant->type == CONST_STRING) {
+    return STRING_VAL(constant->as.string);
+  }
+  if (constant->type == CONST_INT) {
+    return INT_VAL(constant->as.integer);
+  }
+  return NUMBER_VAL(constant->as.number);
+}
+
+bool reg_vm_execute(RegVM *vm, RegChunk *chunk) {
+  vm->chunk = chunk;
+  vm->base = vm->registers;
+  while (vm->register_count < chunk->register_count) {
+    vm->registers[vm->register_count++] = NULL_VAL;
+  }
+
+  const uint32_t *ip = chunk->code;
+  Value *base = vm->base;
+  Constant *constants = chunk->pool.constants;
+  PropertyCache *caches = chunk->pool.caches;
+  uint32_t instruction;
+
+#define RA base[REG_A(instruction)]
+#define RB base[REG_B(instruction)]
+#define RC base[REG_C(instruction)]
+
+#ifdef RIAU_COMPUTED_GOTO
+  static void *dispatch_table[256] = {
+      [ROP_HALT] = &&TARGET_ROP_HALT,
+      [ROP_LOADK] = &&TARGET_ROP_LOADK,
+      [ROP_LOADNULL] = &&TARGET_ROP_LOADNULL,
+      [ROP_LOADTRUE] = &&TARGET_ROP_LOADTRUE,
+      [ROP_LOADFALSE] = &&TARGET_ROP_LOADFALSE,
+      [ROP_MOVE] = &&TARGET_ROP_MOVE,
+      [ROP_ADD] = &&TARGET_ROP_ADD,
+      [ROP_SUB] = &&TARGET_ROP_SUB,
+      [ROP_MUL] = &&TARGET_ROP_MUL,
+      [ROP_DIV] = &&TARGET_ROP_DIV,
+      [ROP_MOD] = &&TARGET_ROP_MOD,
+      [ROP_EQUAL] = &&TARGET_ROP_EQUAL,
+      [ROP_NOT_EQUAL] = &&TARGET_ROP_NOT_EQUAL,
+      [ROP_LESS] = &&TARGET_ROP_LESS,
+      [ROP_LESS_EQUAL] = &&TARGET_ROP_LESS_EQUAL,
+      [ROP_GREATER] = &&TARGET_ROP_GREATER,
+      [ROP_GREATER_EQUAL] = &&TARGET_ROP_GREATER_EQUAL,
+      [ROP_AND] = &&TARGET_ROP_AND,
+      [ROP_OR] = &&TARGET_ROP_OR,
+      [ROP_NEGATE] = &&TARGET_ROP_NEGATE,
+      [ROP_NOT] = &&TARGET_ROP_NOT,
+      [ROP_NEW_OBJECT] = &&TARGET_ROP_NEW_OBJECT,
+      [ROP_GET_FIELD] = &&TARGET_ROP_GET_FIELD,
+      [ROP_SET_FIELD] = &&TARGET_ROP_SET_FIELD,
+      [ROP_GET_INDEX] = &&TARGET_ROP_GET_INDEX,
+      [ROP_SET_INDEX] = &&TARGET_ROP_SET_INDEX,
+      [ROP_ENV] = &&TARGET_ROP_ENV,
+      [ROP_PRINT] = &&TARGET_ROP_PRINT,
+  };
+  static bool dispatch_table_ready = false;
+  if (!dispatch_table_ready) {
+    for (int i = 0; i < 256; i++) {
+      if (!dispatch_table[i]) {
+        dispatch_table[i] = &&TARGET_UNKNOWN;
+      }
+    }
+    dispatch_table_ready = true;
+  }
+
+#define TARGET(op) TARGET_##op:
+#define DISPATCH()                                                             \
+  do {                                                                         \
+    instruction = *ip++;                                                       \
+    goto *dispatch_table[REG_OP(instruction)];                                 \
+  } while (0)
+
+  DISPATCH();
+#else
+#define TARGET(op) case op:
+#define DISPATCH() continue
+
+  for (;;) {
+    instruction = *ip++;
+
+    switch (REG_OP(instruction)) {
+#endif
+
+// R[A] = R[B] op R[C] over numbers; two ints go through int_make in 64
+// bits, anything else through make in doubles
+#define NUMBER_OP(int_make, make, op)                                          \
+  {                                                                            \
+    Value b = RB;                                                              \
+    Value c = RC;                                                              \
+    if (IS_INT(b) && IS_INT(c)) {                                              \
+      RA = int_make((int64_t)AS_INT(b) op AS_INT(c));                          \
+      DISPATCH();                                                              \
+    }                                                                          \
+    if (!IS_NUMERIC(b) || !IS_NUMERIC(c)) {                                    \
+      runtime_error(vm, ip, "Operands must be numbers");                       \
+      return false;                                                            \
+    }                                                                          \
+    RA = make(AS_DOUBLE(b) op AS_DOUBLE(c));                                   \
+    DISPATCH();                                                                \
+  }
+
+    TARGET(ROP_HALT)
+      return !vm->had_error;
+
+    TARGET(ROP_LOADK)
+      RA = constant_value(&constants[REG_BX(instruction)]);
+      DISPATCH();
+
+    TARGET(ROP_LOADNULL)
+      RA = NULL_VAL;
+      DISPATCH();
+
+    TARGET(ROP_LOADTRUE)
+      RA = BOOL_VAL(true);
+      DISPATCH();
+
+    TARGET(ROP_LOADFALSE)
+      RA = BOOL_VAL(false);
+      DISPATCH();
+
+    TARGET(ROP_MOVE)
+      RA = RB;
+      DISPATCH();
+
+    TARGET(ROP_ADD) {
+      Value b = RB;
+      Value c = RC;
+      if (IS_INT(b) && IS_INT(c)) {
+        RA = INT_RESULT((int64_t)AS_INT(b) + AS_INT(c));
+      } else if (IS_NUMERIC(b) && IS_NUMERIC(c)) {
+        RA = NUMBER_VAL(AS_DOUBLE(b) + AS_DOUBLE(c));
+      } else if (IS_STRING(b) && IS_STRING(c)) {
+        RA = STRING_VAL(string_concat(AS_STRING(b), AS_STRING(c)));
+        GC_SAFEPOINT();
+      } else {
+        runtime_error(vm, ip, "Operands must be two numbers or two strings");
+        return false;
+      }
+      DISPATCH();
+    }
+
+    TARGET(ROP_SUB)
+    NUMBER_OP(INT_RESULT, NUMBER_VAL, -)
+
+    TARGET(ROP_MUL)
+    NUMBER_OP(INT_RESULT, NUMBER_VAL, *)
+
+    TARGET(ROP_LESS)
+    NUMBER_OP(BOOL_VAL, BOOL_VAL, <)
+
+    TARGET(ROP_LESS_EQUAL)
+    NUMBER_OP(BOOL_VAL, BOOL_VAL, <=)
+
+    TARGET(ROP_GREATER)
+    NUMBER_OP(BOOL_VAL, BOOL_VAL, >)
+
+    TARGET(ROP_GREATER_EQUAL)
+    NUMBER_OP(BOOL_VAL, BOOL_VAL, >=)
+
+    TARGET(ROP_DIV) {
+      Value b = RB;
+      Value c = RC;
+      if (!IS_NUMERIC(b) || !IS_NUMERIC(c)) {
+        runtime_error(vm, ip, "Operands must be numbers");
+        return false;
+      }
+      if (AS_DOUBLE(c) == 0) {
+        runtime_error(vm, ip, "Division by zero");
+        return false;
+      }
+      RA = NUMBER_VAL(AS_DOUBLE(b) / AS_DOUBLE(c));
+      DISPATCH();
+    }
+
+    TARGET(ROP_MOD) {
+      Value b = RB;
+      Value c = RC;
+      if (!IS_NUMERIC(b) || !IS_NUMERIC(c)) {
+        runtime_error(vm, ip, "Operands must be numbers");
+        return false;
+      }
+      if (AS_DOUBLE(c) == 0) {
+        runtime_error(vm, ip, "Modulo by zero");
+        return false;
+      }
+      if (IS_INT(b) && IS_INT(c)) {
+        // x % -1 is 0; computing it would trap on INT32_MIN
+        RA = INT_VAL(AS_INT(c) == -1 ? 0 : AS_INT(b) % AS_INT(c));
+        DISPATCH();
+      }
+      RA = NUMBER_VAL(fmod(AS_DOUBLE(b), AS_DOUBLE(c)));
+      DISPATCH();
+    }
+
+    TARGET(ROP_EQUAL)
+      RA = BOOL_VAL(value_equals(RB, RC));
+      DISPATCH();
+
+    TARGET(ROP_NOT_EQUAL)
+      RA = BOOL_VAL(!value_equals(RB, RC));
+      DISPATCH();
+
+    TARGET(ROP_AND)
+      RA = BOOL_VAL(value_is_truthy(RB) && value_is_truthy(RC));
+      DISPATCH();
+
+    TARGET(ROP_OR)
+      RA = BOOL_VAL(value_is_truthy(RB) || value_is_truthy(RC));
+      DISPATCH();
+
+    TARGET(ROP_NEGATE) {
+      Value b = RB;
+      if (IS_INT(b)) {
+        RA = INT_RESULT(-(int64_t)AS_INT(b));
+        DISPATCH();
+      }
+      if (!IS_NUMBER(b)) {
+        runtime_error(vm, ip, "Operand must be a number");
+        return false;
+      }
+      RA = NUMBER_VAL(-AS_NUMBER(b));
+      DISPATCH();
+    }
+
+    TARGET(ROP_NOT)
+      RA = BOOL_VAL(!value_is_truthy(RB));
+      DISPATCH();
+
+    TARGET(ROP_NEW_OBJECT)
+      RA = value_object();
+      GC_SAFEPOINT();
+      DISPATCH();
+
+    TARGET(ROP_GET_FIELD) {
+      RiauString *name = constants[REG_C(instruction)].as.string;
+      PropertyCache *cache = &caches[*ip++];
+      Value receiver = RB;
+      if (!IS_OBJECT(receiver)) {
+        runtime_error(vm, ip, "Cannot read property '%s' of a non-object",
+                      name->chars);
+        return false;
+      }
+
+      RA = property_get(AS_OBJECT(receiver), name, cache);
+      DISPATCH();
+    }
+
+    TARGET(ROP_SET_FIELD) {
+      RiauString *name = constants[REG_B(instruction)].as.string;
+      PropertyCache *cache = &caches[*ip++];
+      Value receiver = RA;
+      if (!IS_OBJECT(receiver)) {
+        runtime_error(vm, ip, "Cannot set property '%s' on a non-object",
+                      name->chars);
+        return false;
+      }
+
+      property_set(AS_OBJECT(receiver), name, RC, cache);
+      DISPATCH();
+    }
+
+    TARGET(ROP_GET_INDEX) {
+      PropertyCache *cache = &caches[*ip++];
+      Value target = RB;
+      Value key = RC;
+      Value value;
+
+      if (IS_OBJECT(target) && IS_STRING(key)) {
+        value = property_get(AS_OBJECT(target), AS_STRING(key), cache);
+      } else if (IS_ARRAY(target) && IS_NUMERIC(key)) {
+        size_t index;
+        if (!array_index(key, &index)) {
+          runtime_error(vm, ip, "Array index must be an integer");
+          return false;
+        }
+        value = array_get(AS_ARRAY(target), index);
+      } else {
+        runtime_error(vm, ip, "Only objects and arrays can be indexed");
+        return false;
+      }
+
+      RA = value;
+      DISPATCH();
+    }
+
+    TARGET(ROP_SET_INDEX) {
+      PropertyCache *cache = &caches[*ip++];
+      Value target = RA;
+      Value key = RB;
+      Value value = RC;
+
+      if (IS_OBJECT(target) && IS_STRING(key)) {
+        property_set(AS_OBJECT(target), AS_STRING(key), value, cache);
+      } else if (IS_ARRAY(target) && IS_NUMERIC(key)) {
+        RiauArray *array = AS_ARRAY(target);
+        size_t index;
+        if (!array_index(key, &index)) {
+          runtime_error(vm, ip, "Array index must be an integer");
+          return false;
+        }
+        if (index > array->count) {
+          runtime_error(vm, ip, "Array index out of range");
+          return false;
+        }
+        array_set(array, index, value);
+      } else {
+        runtime_error(vm, ip, "Only objects and arrays can be indexed");
+        return false;
+      }
+      DISPATCH();
+    }
+
+    TARGET(ROP_ENV) {
+      Value name = RB;
+      if (!IS_STRING(name)) {
+        runtime_error(vm, ip, "env() requires a string argument");
+        return false;
+      }
+
+      char *env_value = getenv(AS_CSTRING(name));
+      RA = env_value ? value_string(env_value) : NULL_VAL;
+      GC_SAFEPOINT();
+      DISPATCH();
+    }
+
+    TARGET(ROP_PRINT)
+      value_print(RA);
+      printf("\n");
+      DISPATCH();
+
+#ifdef RIAU_COMPUTED_GOTO
+  TARGET_UNKNOWN:
+#else
+    default:
+#endif
+      runtime_error(vm, ip, "Unknown opcode %d", REG_OP(instruction));
+      return false;
+#ifndef RIAU_COMPUTED_GOTO
+    }
+  }
+#endif
+
+#undef NUMBER_OP
+#undef TARGET
+#undef DISPATCH
+#undef RA
+#undef RB
+#undef RC
+}
+
+void reg_vm_print_error(RegVM *vm) {
+  if (vm->had_error) {
+    fprintf(stderr, "Runtime error: %s\n", vm->error_message);
+  }
+}
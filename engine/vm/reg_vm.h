@@ -0,0 +1,27 @@
+#ifndef RIAU_REG_VM_H
+#define RIAU_REG_VM_H
+
+#include "../bytecode/regcode.h"
+#include "vm.h"
+#include <stdbool.h>
+
+// Register VM
+//
+// Runs RegChunk code. Each frame addresses its registers relative to
+// `base`, a window into the register file; the top-level script's window
+// starts at the bottom. The register file is a garbage collector root.
+typedef struct {
+  RegChunk *chunk;
+  Value registers[REG_WINDOW_MAX];
+  int register_count; // Registers holding a value
+  Value *base;
+  bool had_error;
+  char error_message[512];
+} RegVM;
+
+void reg_vm_init(RegVM *vm);
+void reg_vm_free(RegVM *vm);
+bool reg_vm_execute(RegVM *vm, RegChunk *chunk);
+void reg_vm_print_error(RegVM *vm);
+
+#endif // RIAU_REG_VM_H
@@ -0,0 +1,140 @@
+#include "riau_string.h"
+#include "../runtime/arena.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define TABLE_MAX_LOAD 0.75
+
+// FNV-1a
+uint32_t string_hash(const char *chars, size_t length) {
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < length; i++) {
+    hash ^= (uint8_t)chars[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+static RiauString *string_allocate(size_t length) {
+  RiauString *string = gc_allocate(GC_STRING, sizeof(RiauString) + length + 1);
+  string->length = length;
+  return string;
+}
+
+RiauString *string_new(const char *chars, size_t length) {
+  RiauString *string = string_allocate(length);
+  memcpy(string->chars, chars, length);
+  string->hash = string_hash(string->chars, length);
+  return string;
+}
+
+RiauString *string_new_unmanaged(const char *chars, size_t length) {
+  size_t size = sizeof(RiauString) + length + 1;
+  RiauString *string = riau_calloc(1, size);
+  string->gc.kind = GC_STRING;
+  string->gc.flags = GC_UNMANAGED;
+  string->gc.size = (uint32_t)size;
+  string->length = length;
+  memcpy(string->chars, chars, length);
+  string->hash = string_hash(string->chars, length);
+  return string;
+}
+
+RiauString *string_from_cstr(const char *chars) {
+  return string_new(chars, strlen(chars));
+}
+
+RiauString *string_concat(const RiauString *a, const RiauString *b) {
+  RiauString *string = string_allocate(a->length + b->length);
+  memcpy(string->chars, a->chars, a->length);
+  memcpy(string->chars + a->length, b->chars, b->length);
+  string->hash = string_hash(string->chars, string->length);
+  return string;
+}
+
+bool string_equals(const RiauString *a, const RiauString *b) {
+  if (a == b)
+    return true;
+  return string_equals_chars(a, b->chars, b->length, b->hash);
+}
+
+bool string_equals_chars(const RiauString *a, const char *chars,
+                         size_t length, uint32_t hash) {
+  return a->hash == hash && a->length == length &&
+         memcmp(a->chars, chars, length) == 0;
+}
+
+// Unmanaged strings only
+void string_free(RiauString *string) { riau_free(string); }
+
+// String table operations
+void string_table_init(StringTable *table) {
+  table->entries = NULL;
+  table->count = 0;
+  table->capacity = 0;
+}
+
+void string_table_free(StringTable *table) {
+  riau_free(table->entries);
+  string_table_init(table);
+}
+
+static StringEntry *find_entry(StringEntry *entries, size_t capacity,
+                               const char *chars, size_t length,
+                               uint32_t hash) {
+  size_t index = hash & (capacity - 1);
+  for (;;) {
+    StringEntry *entry = &entries[index];
+    if (!entry->key ||
+        string_equals_chars(entry->key, chars, length, hash)) {
+      return entry;
+    }
+    index = (index + 1) & (capacity - 1);
+  }
+}
+
+static void adjust_capacity(StringTable *table, size_t capacity) {
+  StringEntry *entries = riau_calloc(capacity, sizeof(StringEntry));
+
+  for (size_t i = 0; i < table->capacity; i++) {
+    RiauString *key = table->entries[i].key;
+    if (!key)
+      continue;
+
+    StringEntry *dest =
+        find_entry(entries, capacity, key->chars, key->length, key->hash);
+    *dest = table->entries[i];
+  }
+
+  riau_free(table->entries);
+  table->entries = entries;
+  table->capacity = capacity;
+}
+
+bool string_table_get(StringTable *table, const char *chars, size_t length,
+                      uint32_t hash, int *value) {
+  if (table->count == 0)
+    return false;
+
+  StringEntry *entry =
+      find_entry(table->entries, table->capacity, chars, length, hash);
+  if (!entry->key)
+    return false;
+
+  *value = entry->value;
+  return true;
+}
+
+void string_table_set(StringTable *table, RiauString *key, int value) {
+  if (table->count + 1 > table->capacity * TABLE_MAX_LOAD) {
+    adjust_capacity(table, table->capacity < 8 ? 8 : table->capacity * 2);
+  }
+
+  StringEntry *entry = find_entry(table->entries, table->capacity, key->chars,
+                                  key->length, key->hash);
+  if (!entry->key) {
+    table->count++;
+  }
+  entry->key = key;
+  entry->value = value;
+}
@@ -0,0 +1,55 @@
+#ifndef RIAU_STRING_H
+#define RIAU_STRING_H
+
+#include "gc.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Immutable string object. Length and hash are computed once at creation,
+// so length queries, hashing and most inequality checks never touch the
+// characters again.
+//
+// Strings are normally allocated by the garbage collector. Constants and
+// shape keys are unmanaged instead: their owner frees them with
+// string_free().
+typedef struct RiauString {
+  GcHeader gc;
+  bool is_constant; // Interned in a chunk's or program's constant pool
+  uint32_t hash;
+  size_t length;
+  char chars[];
+} RiauString;
+
+// String table (open addressing) mapping strings to an integer, used to
+// intern constant strings per chunk
+typedef struct {
+  RiauString *key;
+  int value;
+} StringEntry;
+
+typedef struct {
+  StringEntry *entries;
+  size_t count;
+  size_t capacity;
+} StringTable;
+
+// String operations
+uint32_t string_hash(const char *chars, size_t length);
+RiauString *string_new(const char *chars, size_t length);
+RiauString *string_new_unmanaged(const char *chars, size_t length);
+RiauString *string_from_cstr(const char *chars);
+RiauString *string_concat(const RiauString *a, const RiauString *b);
+bool string_equals(const RiauString *a, const RiauString *b);
+bool string_equals_chars(const RiauString *a, const char *chars,
+                         size_t length, uint32_t hash);
+void string_free(RiauString *string);
+
+// String table operations
+void string_table_init(StringTable *table);
+void string_table_free(StringTable *table);
+bool string_table_get(StringTable *table, const char *chars, size_t length,
+                      uint32_t hash, int *value);
+void string_table_set(StringTable *table, RiauString *key, int value);
+
+#endif // RIAU_STRING_H
@@ -0,0 +1,183 @@
+#include "shape.h"
+#include <stdlib.h>
+#include <string.h>
+
+static Shape *root_shape = NULL;
+
+static Shape *shape_new(Shape *parent, bool is_dictionary) {
+  Shape *shape = calloc(1, sizeof(Shape));
+  shape->parent = parent;
+  shape->is_dictionary = is_dictionary;
+  key_index_init(&shape->index);
+  return shape;
+}
+
+static void reindex(Shape *shape) {
+  if (shape->slot_count > SHAPE_INDEX_THRESHOLD) {
+    key_index_build(&shape->index, shape->keys, sizeof(RiauString *),
+                    shape->slot_count);
+  } else {
+    key_index_free(&shape->index);
+  }
+}
+
+static uint32_t append_key(Shape *shape, RiauString *key) {
+  if (shape->key_capacity < shape->slot_count + 1) {
+    uint32_t old_capacity = shape->key_capacity;
+    shape->key_capacity = old_capacity < 8 ? 8 : old_capacity * 2;
+    shape->keys =
+        realloc(shape->keys, shape->key_capacity * sizeof(RiauString *));
+  }
+
+  uint32_t slot = shape->slot_count++;
+  shape->keys[slot] = key;
+  shape->size++;
+
+  if (key_index_is_built(&shape->index)) {
+    key_index_insert(&shape->index, shape->keys, sizeof(RiauString *),
+                     shape->slot_count, key->hash, slot);
+  } else if (shape->slot_count > SHAPE_INDEX_THRESHOLD) {
+    reindex(shape);
+  }
+  return slot;
+}
+
+static void copy_keys(Shape *dest, const Shape *src) {
+  dest->key_capacity = src->slot_count < 8 ? 8 : src->slot_count;
+  dest->keys = malloc(dest->key_capacity * sizeof(RiauString *));
+  if (src->slot_count > 0) {
+    memcpy(dest->keys, src->keys, src->slot_count * sizeof(RiauString *));
+  }
+  dest->slot_count = src->slot_count;
+  dest->size = src->size;
+}
+
+// Shared shapes
+Shape *shape_root(void) {
+  if (!root_shape) {
+    root_shape = shape_new(NULL, false);
+  }
+  return root_shape;
+}
+
+Shape *shape_add_key(Shape *shape, const char *chars, size_t length,
+                     uint32_t hash) {
+  for (size_t i = 0; i < shape->transition_count; i++) {
+    Shape *child = shape->transitions[i];
+    RiauString *added = child->keys[child->slot_count - 1];
+    if (string_equals_chars(added, chars, length, hash)) {
+      return child;
+    }
+  }
+
+  // Every shape shares its ancestors' key strings and owns the one it adds
+  Shape *child = shape_new(shape, false);
+  copy_keys(child, shape);
+  append_key(child, string_new_unmanaged(chars, length));
+
+  if (shape->transition_capacity < shape->transition_count + 1) {
+    size_t old_capacity = shape->transition_capacity;
+    shape->transition_capacity = old_capacity < 2 ? 2 : old_capacity * 2;
+    shape->transitions = realloc(
+        shape->transitions, shape->transition_capacity * sizeof(Shape *));
+  }
+  shape->transitions[shape->transition_count++] = child;
+  return child;
+}
+
+static void shape_tree_free_from(Shape *shape) {
+  for (size_t i = 0; i < shape->transition_count; i++) {
+    shape_tree_free_from(shape->transitions[i]);
+  }
+  if (shape->parent) {
+    string_free(shape->keys[shape->slot_count - 1]);
+  }
+  free(shape->transitions);
+  free(shape->keys);
+  key_index_free(&shape->index);
+  free(shape);
+}
+
+void shape_tree_free(void) {
+  if (root_shape) {
+    shape_tree_free_from(root_shape);
+    root_shape = NULL;
+  }
+}
+
+// Lookup
+long shape_find_slot(const Shape *shape, const char *chars, size_t length,
+                     uint32_t hash) {
+  if (key_index_is_built(&shape->index)) {
+    return key_index_find(&shape->index, shape->keys, sizeof(RiauString *),
+                          chars, length, hash);
+  }
+
+  for (uint32_t i = 0; i < shape->slot_count; i++) {
+    RiauString *key = shape->keys[i];
+    if (key && string_equals_chars(key, chars, length, hash)) {
+      return (long)i;
+    }
+  }
+  return -1;
+}
+
+// Dictionary shapes own all of their key strings
+Shape *shape_to_dictionary(const Shape *shape) {
+  Shape *dictionary = shape_new(NULL, true);
+  copy_keys(dictionary, shape);
+  for (uint32_t i = 0; i < dictionary->slot_count; i++) {
+    RiauString *key = dictionary->keys[i];
+    if (key) {
+      dictionary->keys[i] = string_new_unmanaged(key->chars, key->length);
+    }
+  }
+  reindex(dictionary);
+  return dictionary;
+}
+
+uint32_t shape_dictionary_add(Shape *shape, const char *chars, size_t length,
+                              uint32_t hash) {
+  (void)hash;
+  return append_key(shape, string_new_unmanaged(chars, length));
+}
+
+void shape_dictionary_delete(Shape *shape, uint32_t slot) {
+  RiauString *key = shape->keys[slot];
+  if (key_index_is_built(&shape->index)) {
+    key_index_remove(&shape->index, key->hash, slot);
+  }
+  string_free(key);
+  shape->keys[slot] = NULL;
+  shape->size--;
+}
+
+// Drop deleted slots. new_slots receives the new position of every old
+// slot (or UINT32_MAX for deleted ones).
+void shape_dictionary_compact(Shape *shape, uint32_t *new_slots) {
+  uint32_t live = 0;
+  for (uint32_t i = 0; i < shape->slot_count; i++) {
+    if (shape->keys[i]) {
+      new_slots[i] = live;
+      shape->keys[live++] = shape->keys[i];
+    } else {
+      new_slots[i] = UINT32_MAX;
+    }
+  }
+  shape->slot_count = live;
+  reindex(shape);
+}
+
+void shape_free(Shape *shape) {
+  if (!shape || !shape->is_dictionary)
+    return;
+
+  for (uint32_t i = 0; i < shape->slot_count; i++) {
+    if (shape->keys[i]) {
+      string_free(shape->keys[i]);
+    }
+  }
+  free(shape->keys);
+  key_index_free(&shape->index);
+  free(shape);
+}
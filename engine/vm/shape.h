@@ -0,0 +1,60 @@
+#ifndef RIAU_SHAPE_H
+#define RIAU_SHAPE_H
+
+#include "key_index.h"
+#include "riau_string.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Hidden classes. A shape describes the key layout of an object: which
+// keys it has and the slot each key's value lives in. Objects built by
+// adding the same keys in the same order end up sharing one shape, found
+// by following transitions from the empty root shape. Shapes in the
+// transition tree are shared and never freed while the process runs.
+//
+// An object whose keys get deleted, or that grows past SHAPE_MAX_SLOTS,
+// switches to a dictionary shape: a private, mutable shape owned by that
+// object alone.
+#define SHAPE_MAX_SLOTS 64
+
+// Shapes with more keys than this get a hash index; smaller ones are
+// searched linearly
+#define SHAPE_INDEX_THRESHOLD 8
+
+typedef struct Shape Shape;
+
+struct Shape {
+  Shape *parent;
+  RiauString **keys;   // Key of each slot; NULL marks a deleted slot
+  uint32_t slot_count; // Slots in use, including deleted ones
+  uint32_t key_capacity;
+  uint32_t size;       // Live keys
+  KeyIndex index;      // Built once slot_count passes SHAPE_INDEX_THRESHOLD
+  bool is_dictionary;
+
+  // Transition tree (shared shapes only)
+  Shape **transitions;
+  size_t transition_count;
+  size_t transition_capacity;
+};
+
+// Shared shapes
+Shape *shape_root(void);
+Shape *shape_add_key(Shape *shape, const char *chars, size_t length,
+                     uint32_t hash);
+void shape_tree_free(void);
+
+// Lookup
+long shape_find_slot(const Shape *shape, const char *chars, size_t length,
+                     uint32_t hash);
+
+// Dictionary shapes
+Shape *shape_to_dictionary(const Shape *shape);
+uint32_t shape_dictionary_add(Shape *shape, const char *chars, size_t length,
+                              uint32_t hash);
+void shape_dictionary_delete(Shape *shape, uint32_t slot);
+void shape_dictionary_compact(Shape *shape, uint32_t *new_slots);
+void shape_free(Shape *shape);
+
+#endif // RIAU_SHAPE_H
@@ -0,0 +1,483 @@
+#include "snapshot.h"
+#include "../runtime/arena.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// File layout, every field in host byte order:
+//
+//   header   Header below
+//   chunks   the compiled prelude, as cache_put_chunks() writes it
+//   names    global count, then each global's name
+//   objects  object count, then per object its GcKind byte and a string,
+//            or the byte size and contents of an array or object
+//   globals  one value per name
+//
+// A value is its ValueType byte followed by a bool byte, a double, an
+// int32, the index of a string, array or object, or the chunk index of a
+// function. An array is its length and elements; an object its key count,
+// then each key (a string) and value in slot order.
+
+typedef struct {
+  char magic[8];
+  uint32_t format;
+  uint32_t instruction_set;
+  char version[CACHE_VERSION_SIZE];
+  uint64_t payload_hash; // cache_hash() of everything after the header
+} Header;
+
+static void make_header(Header *header, const char *version) {
+  memset(header, 0, sizeof(Header));
+  memcpy(header->magic, "RIAUS", 5);
+  header->format = SNAPSHOT_FORMAT;
+  header->instruction_set = cache_instruction_set();
+  strncpy(header->version, version, CACHE_VERSION_SIZE - 1);
+}
+
+char *snapshot_path(const char *script) {
+  // prelude.riau -> prelude.riaus, anything else gets the whole extension
+  size_t length = strlen(script);
+  bool riau = length >= 5 && strcmp(script + length - 5, ".riau") == 0;
+  const char *suffix = riau ? "s" : ".riaus";
+  size_t size = length + strlen(suffix) + 1;
+  char *path = riau_alloc(size);
+  snprintf(path, size, "%s%s", script, suffix);
+  return path;
+}
+
+// Writing
+
+void snapshot_begin(SnapshotWriter *writer, const char *version,
+                    Chunk *chunk) {
+  memset(&writer->out, 0, sizeof(CacheWriter));
+  Header header;
+  make_header(&header, version);
+  cache_put(&writer->out, &header, sizeof(header));
+  writer->functions =
+      cache_put_chunks(&writer->out, chunk, &writer->function_count);
+  writer->error_message[0] = '\0';
+}
+
+// Heap objects found so far, numbered in the order they were found, with
+// an open-addressing index from address to number
+typedef struct {
+  GcHeader **objects;
+  uint32_t count;
+  uint32_t capacity;
+  GcHeader **keys;
+  uint32_t *numbers;
+  uint32_t index_capacity; // Power of two
+} ObjectTable;
+
+static uint32_t object_slot(ObjectTable *table, GcHeader *object) {
+  uint64_t hash = (uint64_t)((uintptr_t)object >> 4) * 0x9e3779b97f4a7c15ULL;
+  uint32_t slot = (uint32_t)(hash >> 32) & (table->index_capacity - 1);
+  while (table->keys[slot] && table->keys[slot] != object) {
+    slot = (slot + 1) & (table->index_capacity - 1);
+  }
+  return slot;
+}
+
+static void grow_index(ObjectTable *table) {
+  uint32_t capacity = table->index_capacity < 64 ? 64 : table->index_capacity;
+  while (capacity < (table->count + 1) * 2) {
+    capacity *= 2;
+  }
+  riau_free(table->keys);
+  riau_free(table->numbers);
+  table->keys = riau_calloc(capacity, sizeof(GcHeader *));
+  table->numbers = riau_alloc(capacity * sizeof(uint32_t));
+  table->index_capacity = capacity;
+  for (uint32_t i = 0; i < table->count; i++) {
+    uint32_t slot = object_slot(table, table->objects[i]);
+    table->keys[slot] = table->objects[i];
+    table->numbers[slot] = i;
+  }
+}
+
+static uint32_t object_number(ObjectTable *table, GcHeader *object) {
+  if (table->index_capacity < (table->count + 1) * 2) {
+    grow_index(table);
+  }
+  uint32_t slot = object_slot(table, object);
+  if (table->keys[slot])
+    return table->numbers[slot];
+
+  if (table->capacity < table->count + 1) {
+    table->capacity = table->capacity < 64 ? 64 : table->capacity * 2;
+    table->objects =
+        riau_realloc(table->objects, table->capacity * sizeof(GcHeader *));
+  }
+  table->keys[slot] = object;
+  table->numbers[slot] = table->count;
+  table->objects[table->count] = object;
+  return table->count++;
+}
+
+static bool put_value(SnapshotWriter *writer, ObjectTable *table,
+                      CacheWriter *out, Value value) {
+  uint8_t type = (uint8_t)VALUE_TYPE(value);
+  cache_put(out, &type, 1);
+  switch (VALUE_TYPE(value)) {
+  case VAL_NULL:
+    break;
+  case VAL_BOOL: {
+    uint8_t boolean = AS_BOOL(value);
+    cache_put(out, &boolean, 1);
+    break;
+  }
+  case VAL_NUMBER: {
+    double number = AS_NUMBER(value);
+    cache_put(out, &number, sizeof(number));
+    break;
+  }
+  case VAL_INT: {
+    int32_t integer = AS_INT(value);
+    cache_put(out, &integer, sizeof(integer));
+    break;
+  }
+  case VAL_STRING:
+  case VAL_ARRAY:
+  case VAL_OBJECT:
+    cache_put_u32(out, object_number(table, AS_GC(value)));
+    break;
+  case VAL_FUNCTION: {
+    RiauFunction *function = AS_FUNCTION(value);
+    for (uint32_t i = 1; i < writer->function_count; i++) {
+      if (writer->functions[i] == function) {
+        cache_put_u32(out, i);
+        return true;
+      }
+    }
+    snprintf(writer->error_message, sizeof(writer->error_message),
+             "Cannot save function '%s': it is not declared by the prelude",
+             function->name ? function->name : "<anonymous>");
+    return false;
+  }
+  }
+  return true;
+}
+
+static bool put_object(SnapshotWriter *writer, ObjectTable *table,
+                       CacheWriter *out, GcHeader *object) {
+  uint8_t kind = object->kind;
+  cache_put(out, &kind, 1);
+  if (kind == GC_STRING) {
+    RiauString *string = (RiauString *)object;
+    cache_put_string(out, string->chars, string->length);
+    return true;
+  }
+
+  // Arrays and objects: the byte size goes in once the contents are out
+  size_t size_at = out->count;
+  cache_put_u32(out, 0);
+  bool saved = true;
+  if (kind == GC_ARRAY) {
+    RiauArray *array = (RiauArray *)object;
+    cache_put_u32(out, (uint32_t)array->count);
+    for (size_t i = 0; i < array->count && saved; i++) {
+      saved = put_value(writer, table, out, array->elements[i]);
+    }
+  } else {
+    RiauObject *instance = (RiauObject *)object;
+    Shape *shape = instance->shape;
+    cache_put_u32(out, shape->size);
+    for (uint32_t slot = 0; slot < shape->slot_count && saved; slot++) {
+      RiauString *key = shape->keys[slot];
+      if (key) {
+        cache_put_string(out, key->chars, key->length);
+        saved = put_value(writer, table, out, instance->slots[slot]);
+      }
+    }
+  }
+  uint32_t size = (uint32_t)(out->count - size_at - sizeof(uint32_t));
+  memcpy(out->data + size_at, &size, sizeof(size));
+  return saved;
+}
+
+bool snapshot_finish(SnapshotWriter *writer, VM *vm, const char *path,
+                     const char *const *names, int name_count) {
+  CacheWriter *out = &writer->out;
+  cache_put_u32(out, (uint32_t)name_count);
+  for (int i = 0; i < name_count; i++) {
+    cache_put_string(out, names[i], strlen(names[i]));
+  }
+
+  // Globals number the objects they hold; each object then numbers the
+  // ones it holds, so the table grows while it is walked
+  ObjectTable table = {0};
+  CacheWriter globals = {0};
+  CacheWriter objects = {0};
+  bool saved = true;
+  for (int i = 0; i < name_count && saved; i++) {
+    Value value = i < vm->global_count ? vm->globals[i] : NULL_VAL;
+    saved = put_value(writer, &table, &globals, value);
+  }
+  for (uint32_t i = 0; i < table.count && saved; i++) {
+    saved = put_object(writer, &table, &objects, table.objects[i]);
+  }
+
+  if (saved) {
+    cache_put_u32(out, table.count);
+    if (objects.count) {
+      cache_put(out, objects.data, objects.count);
+    }
+    if (globals.count) {
+      cache_put(out, globals.data, globals.count);
+    }
+    uint64_t payload = cache_hash((const char *)out->data + sizeof(Header),
+                                  out->count - sizeof(Header));
+    memcpy(out->data + offsetof(Header, payload_hash), &payload,
+           sizeof(payload));
+    saved = cache_write_file(path, out);
+    if (!saved) {
+      snprintf(writer->error_message, sizeof(writer->error_message),
+               "Could not write \"%s\"", path);
+    }
+  }
+
+  riau_free(table.objects);
+  riau_free(table.keys);
+  riau_free(table.numbers);
+  riau_free(globals.data);
+  riau_free(objects.data);
+  riau_free(out->data);
+  riau_free(writer->functions);
+  return saved;
+}
+
+// Loading
+
+typedef struct {
+  RiauFunction **functions;
+  uint32_t function_count;
+  Value *objects;
+  CacheReader *bodies; // Contents of each array and object
+  uint32_t object_count;
+} Loader;
+
+static Value get_value(CacheReader *reader, Loader *loader) {
+  const uint8_t *type = cache_get(reader, 1);
+  if (!type)
+    return NULL_VAL;
+
+  switch (*type) {
+  case VAL_NULL:
+    return NULL_VAL;
+  case VAL_BOOL: {
+    const uint8_t *boolean = cache_get(reader, 1);
+    if (boolean && *boolean <= 1)
+      return BOOL_VAL(*boolean);
+    break;
+  }
+  case VAL_NUMBER: {
+    double number;
+    const void *bytes = cache_get(reader, sizeof(number));
+    if (bytes) {
+      memcpy(&number, bytes, sizeof(number));
+      return NUMBER_VAL(number);
+    }
+    break;
+  }
+  case VAL_INT: {
+    int32_t integer;
+    const void *bytes = cache_get(reader, sizeof(integer));
+    if (bytes) {
+      memcpy(&integer, bytes, sizeof(integer));
+      return INT_VAL(integer);
+    }
+    break;
+  }
+  case VAL_STRING:
+  case VAL_ARRAY:
+  case VAL_OBJECT: {
+    uint32_t index = cache_get_u32(reader);
+    if (!reader->failed && index < loader->object_count &&
+        VALUE_TYPE(loader->objects[index]) == *type)
+      return loader->objects[index];
+    break;
+  }
+  case VAL_FUNCTION: {
+    uint32_t index = cache_get_u32(reader);
+    if (!reader->failed && index > 0 && index < loader->function_count)
+      return FUNCTION_VAL(loader->functions[index]);
+    break;
+  }
+  }
+  reader->failed = true;
+  return NULL_VAL;
+}
+
+// Allocate every object, filling in strings; arrays and objects get their
+// contents once all of them exist
+static void create_objects(CacheReader *reader, Loader *loader) {
+  for (uint32_t i = 0; i < loader->object_count && !reader->failed; i++) {
+    const uint8_t *kind = cache_get(reader, 1);
+    if (!kind)
+      break;
+
+    if (*kind == GC_STRING) {
+      const char *chars = cache_get_string(reader);
+      if (chars) {
+        // The characters and their NUL end right where the reader is
+        size_t length = (size_t)((const char *)reader->at - chars) - 1;
+        loader->objects[i] = STRING_VAL(string_new(chars, length));
+      }
+    } else if (*kind == GC_ARRAY || *kind == GC_OBJECT) {
+      uint32_t size = cache_get_u32(reader);
+      const uint8_t *body = cache_get(reader, size);
+      if (body) {
+        loader->bodies[i] = (CacheReader){body, body + size, false};
+        loader->objects[i] = *kind == GC_ARRAY ? value_array() : value_object();
+      }
+    } else {
+      reader->failed = true;
+    }
+  }
+}
+
+static bool fill_object(Loader *loader, uint32_t index) {
+  CacheReader *body = &loader->bodies[index];
+  Value object = loader->objects[index];
+  uint32_t count = cache_get_u32(body);
+  // Every element or key/value pair takes at least one byte
+  if (count > (size_t)(body->end - body->at))
+    return false;
+
+  for (uint32_t i = 0; i < count && !body->failed; i++) {
+    if (IS_ARRAY(object)) {
+      Value element = get_value(body, loader);
+      if (!body->failed) {
+        array_push(AS_ARRAY(object), element);
+      }
+    } else {
+      const char *key = cache_get_string(body);
+      Value value = get_value(body, loader);
+      if (!body->failed) {
+        object_set(AS_OBJECT(object), key, value);
+      }
+    }
+  }
+  return !body->failed && body->at == body->end;
+}
+
+static bool load(CacheReader *reader, const char *version,
+                 Snapshot *snapshot) {
+  Header expected;
+  make_header(&expected, version);
+  const void *header = cache_get(reader, sizeof(Header));
+  if (!header)
+    return false;
+  // The prelude's code runs as it is, so a damaged byte anywhere after the
+  // header is a miss rather than a crash
+  expected.payload_hash = cache_hash((const char *)reader->at,
+                                     (size_t)(reader->end - reader->at));
+  if (memcmp(header, &expected, sizeof(Header)) != 0)
+    return false;
+
+  Loader loader = {0};
+  loader.functions =
+      cache_get_chunks(reader, &snapshot->chunk, &loader.function_count);
+  if (!loader.functions)
+    return false;
+
+  // Every name takes at least 5 bytes, every object and value at least 1
+  uint32_t name_count = cache_get_u32(reader);
+  if (reader->failed || name_count > GLOBALS_MAX ||
+      name_count > (size_t)(reader->end - reader->at) / 5) {
+    reader->failed = true;
+    name_count = 0;
+  }
+  snapshot->names = riau_calloc(name_count ? name_count : 1, sizeof(char *));
+  for (uint32_t i = 0; i < name_count && !reader->failed; i++) {
+    const char *name = cache_get_string(reader);
+    if (name) {
+      size_t size = strlen(name) + 1;
+      snapshot->names[i] = riau_alloc(size);
+      memcpy(snapshot->names[i], name, size);
+      snapshot->name_count = (int)i + 1;
+    }
+  }
+
+  loader.object_count = cache_get_u32(reader);
+  if (reader->failed ||
+      loader.object_count > (size_t)(reader->end - reader->at)) {
+    reader->failed = true;
+    loader.object_count = 0;
+  }
+  loader.objects = riau_calloc(loader.object_count + 1, sizeof(Value));
+  loader.bodies = riau_calloc(loader.object_count + 1, sizeof(CacheReader));
+  create_objects(reader, &loader);
+
+  snapshot->globals = riau_alloc((name_count + 1) * sizeof(Value));
+  for (uint32_t i = 0; i < name_count && !reader->failed; i++) {
+    snapshot->globals[i] = get_value(reader, &loader);
+  }
+  for (uint32_t i = 0; i < loader.object_count && !reader->failed; i++) {
+    if (loader.bodies[i].at && !fill_object(&loader, i)) {
+      reader->failed = true;
+    }
+  }
+  if (reader->at != reader->end) {
+    reader->failed = true;
+  }
+  snapshot->object_count = loader.object_count;
+
+  // The functions belong to the prelude's constants; the objects built so
+  // far to the collector
+  riau_free(loader.functions);
+  riau_free(loader.objects);
+  riau_free(loader.bodies);
+  return !reader->failed;
+}
+
+bool snapshot_load(const char *path, const char *version, Snapshot *snapshot) {
+  chunk_init(&snapshot->chunk);
+  snapshot->names = NULL;
+  snapshot->name_count = 0;
+  snapshot->globals = NULL;
+  snapshot->object_count = 0;
+
+  size_t size;
+  const uint8_t *data = cache_map_file(path, &size);
+  if (!data)
+    return false;
+
+  CacheReader reader = {data, data + size, false};
+  bool loaded = load(&reader, version, snapshot);
+  cache_unmap_file(data, size);
+  if (!loaded) {
+    snapshot_free(snapshot);
+  }
+  return loaded;
+}
+
+uint64_t snapshot_id(const Snapshot *snapshot) {
+  uint64_t id = 0;
+  for (int i = 0; i < snapshot->name_count; i++) {
+    const char *name = snapshot->names[i];
+    id = (id ^ cache_hash(name, strlen(name) + 1)) * 1099511628211ULL;
+  }
+  return id;
+}
+
+void snapshot_restore(Snapshot *snapshot, VM *vm) {
+  for (int i = 0; i < snapshot->name_count; i++) {
+    vm_define_global(vm, (uint16_t)i, snapshot->globals[i]);
+  }
+  riau_free(snapshot->globals);
+  snapshot->globals = NULL;
+}
+
+void snapshot_free(Snapshot *snapshot) {
+  chunk_free(&snapshot->chunk);
+  for (int i = 0; i < snapshot->name_count; i++) {
+    riau_free(snapshot->names[i]);
+  }
+  riau_free(snapshot->names);
+  riau_free(snapshot->globals);
+  snapshot->names = NULL;
+  snapshot->name_count = 0;
+  snapshot->globals = NULL;
+}
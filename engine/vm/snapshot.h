@@ -0,0 +1,82 @@
+#ifndef RIAU_SNAPSHOT_H
+#define RIAU_SNAPSHOT_H
+
+#include "../bytecode/chunk_cache.h"
+#include "vm.h"
+
+// Heap snapshots
+//
+// `riau --snapshot prelude.riau` runs a prelude once and saves what it
+// leaves behind to prelude.riaus: the compiled prelude with the chunks of
+// its functions, the names of its globals, their values and every string,
+// array and object those reach. `riau --image prelude.riaus page.riau`
+// (or $RIAU_IMAGE) then starts page.riau from that state instead of
+// running the prelude again: the page sees the prelude's globals, already
+// set, in the same slots.
+//
+// The image is relocatable: heap values refer to each other by their index
+// in the image, and functions by the index of their chunk, so shared
+// references and cycles come back as they were. Loading maps the file and
+// rebuilds the objects on the collector's heap, which owns their placement;
+// nothing in the mapping is used in place once loading returns.
+//
+// Functions in an image must be ones the prelude declares. An image is
+// keyed by the interpreter version and instruction set, and carries a hash
+// of its contents, like a .riauc file (chunk_cache.h); snapshot_id()
+// changes with the global names, which the page's compiled bytecode
+// depends on.
+
+// Bumped whenever the file layout changes
+#define SNAPSHOT_FORMAT 2
+
+// Image file for `script` (prelude.riau -> prelude.riaus). Free with
+// riau_free().
+char *snapshot_path(const char *script);
+
+// Writing. Begin once the prelude is compiled, before it runs and
+// quickening rewrites its code; finish after it has run.
+typedef struct {
+  CacheWriter out;
+  RiauFunction **functions; // Declared by the prelude, by chunk index
+  uint32_t function_count;
+  char error_message[512];
+} SnapshotWriter;
+
+void snapshot_begin(SnapshotWriter *writer, const char *version,
+                    Chunk *chunk);
+
+// Save the globals `names` (in slot order) of `vm` and what they reach to
+// `path`. Returns false, with the reason in writer->error_message, if a
+// value cannot be saved or the file cannot be written. Frees the writer
+// either way.
+bool snapshot_finish(SnapshotWriter *writer, VM *vm, const char *path,
+                     const char *const *names, int name_count);
+
+// Loading
+typedef struct {
+  Chunk chunk;  // The prelude; owns every function in the image
+  char **names; // Globals in slot order
+  int name_count;
+  Value *globals; // Their values, one per name
+  uint32_t object_count;
+} Snapshot;
+
+// Load the image at `path`. Returns false, leaving nothing to free, if it
+// is missing, built for another interpreter or malformed.
+//
+// The rebuilt values are not rooted until snapshot_restore() stores them
+// in a VM, so nothing may run the collector in between: lexing, parsing and
+// compiling do not.
+bool snapshot_load(const char *path, const char *version, Snapshot *snapshot);
+
+// Identifies the image's global names, for keying bytecode compiled
+// against them
+uint64_t snapshot_id(const Snapshot *snapshot);
+
+// Set `vm`'s globals to the image's values
+void snapshot_restore(Snapshot *snapshot, VM *vm);
+
+// Call after the VM is done; values already restored are the collector's
+void snapshot_free(Snapshot *snapshot);
+
+#endif // RIAU_SNAPSHOT_H
@@ -1,4 +1,7 @@
 #include "vm.h"
+#include "../runtime/arena.h"
+#include "aot.h"
+#include "jit.h"
 #include <math.h>
 #include <stdarg.h>
 #include <stdio.h>
@@ -8,10 +11,17 @@
 // Stack operations
 static void reset_stack(VM *vm) {
   vm->stack_top = vm->stack;
+  vm->slots = vm->stack;
   vm->frame_count = 0;
 }
 
+// No bounds check where the stack ends in a guard page
 static void push(VM *vm, Value value) {
+#ifndef RIAU_GUARD_PAGES
+  if (vm->stack_top == vm->stack_limit) {
+    guard_overflow();
+  }
+#endif
   *vm->stack_top = value;
   vm->stack_top++;
 }
@@ -24,6 +34,10 @@ static Value pop(VM *vm) {
 static Value peek(VM *vm, int distance) { return vm->stack_top[-1 - distance]; }
 
 // Error handling
+
+// Calls listed in a stack trace; the outermost ones are summarized
+#define STACK_TRACE_MAX 16
+
 static void runtime_error(VM *vm, const char *format, ...) {
   va_list args;
   va_start(args, format);
@@ -32,124 +46,108 @@ static void runtime_error(VM *vm, const char *format, ...) {
 
   vm->had_error = true;
 
-  // Print stack trace
+  // Print stack trace, innermost call first
+  uint8_t *ip = vm->ip;
   for (int i = vm->frame_count - 1; i >= 0; i--) {
     CallFrame *frame = &vm->frames[i];
-    RiauFunction *function = frame->function;
-    size_t instruction = frame->ip - function->chunk->code - 1;
-    fprintf(stderr, "[line %d] in %s()\n", function->chunk->lines[instruction],
-            function->name ? function->name : "script");
+    Chunk *chunk = frame->function->chunk;
+    if (i >= vm->frame_count - STACK_TRACE_MAX) {
+      fprintf(stderr, "[line %d] in %s()\n",
+              chunk_get_line(chunk, ip - chunk->code - 1),
+              frame->function->name);
+    } else if (i == vm->frame_count - STACK_TRACE_MAX - 1) {
+      fprintf(stderr, "[... %d more calls]\n", i + 1);
+    }
+    ip = frame->ip;
+  }
+  if (vm->frame_count > 0) {
+    Chunk *script = vm->frames[0].chunk;
+    fprintf(stderr, "[line %d] in script\n",
+            chunk_get_line(script, ip - script->code - 1));
   }
 
   reset_stack(vm);
 }
 
 // Value operations
-Value value_null() {
-  Value v;
-  v.type = VAL_NULL;
-  return v;
-}
+Value value_null() { return NULL_VAL; }
 
-Value value_bool(bool b) {
-  Value v;
-  v.type = VAL_BOOL;
-  v.as.boolean = b;
-  return v;
-}
+Value value_bool(bool b) { return BOOL_VAL(b); }
 
-Value value_number(double n) {
-  Value v;
-  v.type = VAL_NUMBER;
-  v.as.number = n;
-  return v;
-}
+Value value_number(double n) { return NUMBER_VAL(n); }
 
-Value value_string(const char *str) {
-  Value v;
-  v.type = VAL_STRING;
-  v.as.string = malloc(strlen(str) + 1);
-  strcpy(v.as.string, str);
-  return v;
-}
+Value value_int(int64_t n) { return INT_RESULT(n); }
+
+Value value_string(const char *str) { return STRING_VAL(string_from_cstr(str)); }
 
 Value value_array() {
-  Value v;
-  v.type = VAL_ARRAY;
-  v.as.array = malloc(sizeof(RiauArray));
-  v.as.array->elements = NULL;
-  v.as.array->count = 0;
-  v.as.array->capacity = 0;
-  v.as.array->ref_count = 1;
-  return v;
+  RiauArray *array = gc_allocate(GC_ARRAY, sizeof(RiauArray));
+  return ARRAY_VAL(array);
 }
 
 Value value_object() {
-  Value v;
-  v.type = VAL_OBJECT;
-  v.as.object = malloc(sizeof(RiauObject));
-  v.as.object->entries = NULL;
-  v.as.object->count = 0;
-  v.as.object->capacity = 0;
-  v.as.object->ref_count = 1;
-  return v;
+  RiauObject *object = gc_allocate(GC_OBJECT, sizeof(RiauObject));
+  object->shape = shape_root();
+  return OBJECT_VAL(object);
 }
 
 Value value_function(Chunk *chunk, int arity, const char *name) {
-  Value v;
-  v.type = VAL_FUNCTION;
-  v.as.function = malloc(sizeof(RiauFunction));
-  v.as.function->chunk = chunk;
-  v.as.function->arity = arity;
-  v.as.function->name = name ? strdup(name) : NULL;
-  v.as.function->ref_count = 1;
-  return v;
+  RiauFunction *function = gc_allocate(GC_FUNCTION, sizeof(RiauFunction));
+  function->chunk = chunk;
+  function->arity = arity;
+  function->name = riau_strdup(name);
+  return FUNCTION_VAL(function);
 }
 
-bool value_is_null(Value v) { return v.type == VAL_NULL; }
-bool value_is_bool(Value v) { return v.type == VAL_BOOL; }
-bool value_is_number(Value v) { return v.type == VAL_NUMBER; }
-bool value_is_string(Value v) { return v.type == VAL_STRING; }
+bool value_is_null(Value v) { return IS_NULL(v); }
+bool value_is_bool(Value v) { return IS_BOOL(v); }
+bool value_is_number(Value v) { return IS_NUMERIC(v); }
+bool value_is_string(Value v) { return IS_STRING(v); }
 
 bool value_is_truthy(Value v) {
-  if (v.type == VAL_NULL)
+  if (IS_NULL(v))
     return false;
-  if (v.type == VAL_BOOL)
-    return v.as.boolean;
+  if (IS_BOOL(v))
+    return AS_BOOL(v);
   return true;
 }
 
 bool value_equals(Value a, Value b) {
-  if (a.type != b.type)
+  if (IS_INT(a) && IS_INT(b))
+    return AS_INT(a) == AS_INT(b);
+  if (IS_NUMERIC(a) && IS_NUMERIC(b))
+    return AS_DOUBLE(a) == AS_DOUBLE(b); // Exact, as in IEEE 754
+  if (VALUE_TYPE(a) != VALUE_TYPE(b))
     return false;
 
-  switch (a.type) {
+  switch (VALUE_TYPE(a)) {
   case VAL_NULL:
     return true;
   case VAL_BOOL:
-    return a.as.boolean == b.as.boolean;
-  case VAL_NUMBER:
-    return fabs(a.as.number - b.as.number) < 1e-10;
+    return AS_BOOL(a) == AS_BOOL(b);
   case VAL_STRING:
-    return strcmp(a.as.string, b.as.string) == 0;
+    return string_equals(AS_STRING(a), AS_STRING(b));
   default:
     return false;
   }
 }
 
 void value_print(Value v) {
-  switch (v.type) {
+  switch (VALUE_TYPE(v)) {
   case VAL_NULL:
     printf("null");
     break;
   case VAL_BOOL:
-    printf(v.as.boolean ? "true" : "false");
+    printf(AS_BOOL(v) ? "true" : "false");
     break;
   case VAL_NUMBER:
-    printf("%g", v.as.number);
+    printf("%g", AS_NUMBER(v));
+    break;
+  case VAL_INT:
+    printf("%d", AS_INT(v));
     break;
   case VAL_STRING:
-    printf("%s", v.as.string);
+    printf("%s", AS_CSTRING(v));
     break;
   case VAL_ARRAY:
     printf("[Array]");
@@ -159,42 +157,7 @@ void value_print(Value v) {
     break;
   case VAL_FUNCTION:
     printf("[Function %s]",
-           v.as.function->name ? v.as.function->name : "anonymous");
-    break;
-  }
-}
-
-void value_free(Value *v) {
-  switch (v->type) {
-  case VAL_STRING:
-    free(v->as.string);
-    break;
-  case VAL_ARRAY:
-    if (--v->as.array->ref_count == 0) {
-      for (size_t i = 0; i < v->as.array->count; i++) {
-        value_free(&v->as.array->elements[i]);
-      }
-      free(v->as.array->elements);
-      free(v->as.array);
-    }
-    break;
-  case VAL_OBJECT:
-    if (--v->as.object->ref_count == 0) {
-      for (size_t i = 0; i < v->as.object->count; i++) {
-        free(v->as.object->entries[i].key);
-        value_free(&v->as.object->entries[i].value);
-      }
-      free(v->as.object->entries);
-      free(v->as.object);
-    }
-    break;
-  case VAL_FUNCTION:
-    if (--v->as.function->ref_count == 0) {
-      free(v->as.function->name);
-      free(v->as.function);
-    }
-    break;
-  default:
+           AS_FUNCTION(v)->name ? AS_FUNCTION(v)->name : "anonymous");
     break;
   }
 }
@@ -207,6 +170,7 @@ void array_push(RiauArray *arr, Value value) {
     arr->elements = realloc(arr->elements, arr->capacity * sizeof(Value));
   }
   arr->elements[arr->count++] = value;
+  gc_write_barrier(&arr->gc, value);
 }
 
 Value array_get(RiauArray *arr, size_t index) {
@@ -224,70 +188,304 @@ void array_set(RiauArray *arr, size_t index, Value value) {
     }
   }
   arr->elements[index] = value;
+  gc_write_barrier(&arr->gc, value);
+}
+
+bool array_index(Value key, size_t *index) {
+  if (IS_INT(key)) {
+    *index = AS_INT(key) < 0 ? SIZE_MAX : (size_t)AS_INT(key);
+    return true;
+  }
+  double number = AS_NUMBER(key);
+  if (!isfinite(number) || number != floor(number))
+    return false;
+  // SIZE_MAX rounds up to 2^64 as a double, so every smaller value casts
+  *index = number < 0 || number >= (double)SIZE_MAX ? SIZE_MAX
+                                                      : (size_t)number;
+  return true;
 }
 
 // Object operations
-void object_set(RiauObject *obj, const char *key, Value value) {
-  // Simple linear search (could be optimized with hash table)
-  for (size_t i = 0; i < obj->count; i++) {
-    if (strcmp(obj->entries[i].key, key) == 0) {
-      value_free(&obj->entries[i].value);
-      obj->entries[i].value = value;
-      return;
+static void object_reserve(RiauObject *obj, uint32_t slot_count) {
+  if (obj->slot_capacity < slot_count) {
+    uint32_t capacity = obj->slot_capacity < 8 ? 8 : obj->slot_capacity * 2;
+    while (capacity < slot_count) {
+      capacity *= 2;
     }
+    obj->slots = realloc(obj->slots, capacity * sizeof(Value));
+    obj->slot_capacity = capacity;
   }
+}
 
-  // Add new entry
-  if (obj->capacity < obj->count + 1) {
-    size_t old_capacity = obj->capacity;
-    obj->capacity = old_capacity < 8 ? 8 : old_capacity * 2;
-    obj->entries = realloc(obj->entries, obj->capacity * sizeof(ObjectEntry));
+// Add a key known to be absent and return its slot
+static uint32_t object_add_key(RiauObject *obj, const char *key, size_t length,
+                               uint32_t hash) {
+  Shape *shape = obj->shape;
+  uint32_t slot;
+
+  if (shape->is_dictionary) {
+    slot = shape_dictionary_add(shape, key, length, hash);
+  } else if (shape->slot_count >= SHAPE_MAX_SLOTS) {
+    obj->shape = shape_to_dictionary(shape);
+    slot = shape_dictionary_add(obj->shape, key, length, hash);
+  } else {
+    obj->shape = shape_add_key(shape, key, length, hash);
+    slot = obj->shape->slot_count - 1;
   }
 
-  obj->entries[obj->count].key = strdup(key);
-  obj->entries[obj->count].value = value;
-  obj->count++;
+  object_reserve(obj, obj->shape->slot_count);
+  return slot;
 }
 
-Value object_get(RiauObject *obj, const char *key) {
-  for (size_t i = 0; i < obj->count; i++) {
-    if (strcmp(obj->entries[i].key, key) == 0) {
-      return obj->entries[i].value;
+// Drop deleted slots once they make up half of the slot array
+static void object_compact(RiauObject *obj) {
+  Shape *shape = obj->shape;
+  uint32_t old_count = shape->slot_count;
+  uint32_t *new_slots = malloc(old_count * sizeof(uint32_t));
+
+  shape_dictionary_compact(shape, new_slots);
+  for (uint32_t i = 0; i < old_count; i++) {
+    if (new_slots[i] != UINT32_MAX) {
+      obj->slots[new_slots[i]] = obj->slots[i];
     }
   }
-  return value_null();
+  free(new_slots);
+}
+
+void object_set(RiauObject *obj, const char *key, Value value) {
+  size_t length = strlen(key);
+  uint32_t hash = string_hash(key, length);
+
+  long slot = shape_find_slot(obj->shape, key, length, hash);
+  if (slot < 0) {
+    slot = object_add_key(obj, key, length, hash);
+  }
+  obj->slots[slot] = value;
+  gc_write_barrier(&obj->gc, value);
+}
+
+Value object_get(RiauObject *obj, const char *key) {
+  size_t length = strlen(key);
+  long slot = shape_find_slot(obj->shape, key, length, string_hash(key, length));
+  return slot < 0 ? value_null() : obj->slots[slot];
 }
 
 bool object_has(RiauObject *obj, const char *key) {
-  for (size_t i = 0; i < obj->count; i++) {
-    if (strcmp(obj->entries[i].key, key) == 0) {
-      return true;
+  size_t length = strlen(key);
+  return shape_find_slot(obj->shape, key, length, string_hash(key, length)) >=
+         0;
+}
+
+bool object_delete(RiauObject *obj, const char *key) {
+  size_t length = strlen(key);
+  long slot = shape_find_slot(obj->shape, key, length, string_hash(key, length));
+  if (slot < 0) {
+    return false;
+  }
+
+  // Deleting leaves the shared shape tree for a private dictionary shape
+  if (!obj->shape->is_dictionary) {
+    obj->shape = shape_to_dictionary(obj->shape);
+  }
+
+  Shape *shape = obj->shape;
+  shape_dictionary_delete(shape, (uint32_t)slot);
+  obj->slots[slot] = NULL_VAL;
+
+  if (shape->slot_count > SHAPE_INDEX_THRESHOLD &&
+      shape->size * 2 < shape->slot_count) {
+    object_compact(obj);
+  }
+  return true;
+}
+
+// Property access through inline caches. Only shared shapes and constant
+// keys are cached: both live as long as the chunk, so a pointer match is
+// enough to trust an entry.
+static bool property_cacheable(const Shape *shape, const RiauString *key) {
+  return !shape->is_dictionary && key->is_constant;
+}
+
+static void property_cache_add(PropertyCache *cache, Shape *shape, Shape *next,
+                               const RiauString *key, uint32_t slot) {
+  if (cache->count == PROPERTY_CACHE_WAYS)
+    return; // Megamorphic
+
+  PropertyCacheEntry *entry = &cache->entries[cache->count++];
+  entry->shape = shape;
+  entry->next = next;
+  entry->key = key;
+  entry->slot = slot;
+}
+
+Value property_get(RiauObject *obj, const RiauString *key,
+                   PropertyCache *cache) {
+  Shape *shape = obj->shape;
+  for (uint8_t i = 0; i < cache->count; i++) {
+    PropertyCacheEntry *entry = &cache->entries[i];
+    if (entry->shape == shape && entry->key == key) {
+      return obj->slots[entry->slot];
     }
   }
-  return false;
+
+  long slot = shape_find_slot(shape, key->chars, key->length, key->hash);
+  if (slot < 0)
+    return NULL_VAL;
+
+  if (property_cacheable(shape, key)) {
+    property_cache_add(cache, shape, shape, key, (uint32_t)slot);
+  }
+  return obj->slots[slot];
+}
+
+void property_set(RiauObject *obj, const RiauString *key, Value value,
+                  PropertyCache *cache) {
+  Shape *shape = obj->shape;
+  for (uint8_t i = 0; i < cache->count; i++) {
+    PropertyCacheEntry *entry = &cache->entries[i];
+    if (entry->shape == shape && entry->key == key) {
+      if (entry->next != shape) {
+        // Cached transition: adding the key moves the object to `next`
+        object_reserve(obj, entry->next->slot_count);
+        obj->shape = entry->next;
+      }
+      obj->slots[entry->slot] = value;
+      gc_write_barrier(&obj->gc, value);
+      return;
+    }
+  }
+
+  long slot = shape_find_slot(shape, key->chars, key->length, key->hash);
+  if (slot >= 0) {
+    obj->slots[slot] = value;
+    gc_write_barrier(&obj->gc, value);
+    if (property_cacheable(shape, key)) {
+      property_cache_add(cache, shape, shape, key, (uint32_t)slot);
+    }
+    return;
+  }
+
+  uint32_t new_slot = object_add_key(obj, key->chars, key->length, key->hash);
+  obj->slots[new_slot] = value;
+  gc_write_barrier(&obj->gc, value);
+  if (property_cacheable(shape, key) && !obj->shape->is_dictionary) {
+    property_cache_add(cache, shape, obj->shape, key, new_slot);
+  }
 }
 
 // VM operations
+static void scan_roots(void *context) {
+  VM *vm = context;
+  for (Value *slot = vm->stack; slot < vm->stack_top; slot++) {
+    gc_visit_value(slot);
+  }
+  for (int i = 0; i < vm->global_count; i++) {
+    gc_visit_value(&vm->globals[i]);
+  }
+
+  // Callees are on the stack too; this only updates the frames' copies
+  for (int i = 0; i < vm->frame_count; i++) {
+    Value function = FUNCTION_VAL(vm->frames[i].function);
+    gc_visit_value(&function);
+    vm->frames[i].function = AS_FUNCTION(function);
+  }
+}
+
 void vm_init(VM *vm) {
+  guard_region_init(&vm->stack_region, STACK_MAX * sizeof(Value));
+  vm->stack = vm->stack_region.base;
+  vm->stack_limit = vm->stack + STACK_MAX;
+  guard_region_init(&vm->frame_region, FRAMES_MAX * sizeof(CallFrame));
+  vm->frames = vm->frame_region.base;
   reset_stack(vm);
+
   vm->chunk = NULL;
   vm->ip = NULL;
+  vm->globals = malloc(GLOBALS_INITIAL * sizeof(Value));
   vm->global_count = 0;
+  vm->global_capacity = GLOBALS_INITIAL;
+  vm->natives = NULL;
+  vm->native_count = 0;
+#ifdef RIAU_JIT
+  vm->jit_threshold = JIT_THRESHOLD;
+#endif
   vm->had_error = false;
   vm->error_message[0] = '\0';
+  gc_add_root_scanner(scan_roots, vm);
 }
 
+// Values the VM held are left to the collector
 void vm_free(VM *vm) {
-  // Free stack values
-  while (vm->stack_top > vm->stack) {
-    vm->stack_top--;
-    value_free(vm->stack_top);
+  gc_remove_root_scanner(scan_roots, vm);
+  guard_region_free(&vm->stack_region);
+  guard_region_free(&vm->frame_region);
+  vm->stack = vm->stack_top = vm->stack_limit = NULL;
+  vm->frames = NULL;
+  vm->frame_count = 0;
+  free(vm->globals);
+  vm->globals = NULL;
+  vm->global_count = 0;
+  vm->global_capacity = 0;
+}
+
+static void store_global(VM *vm, uint16_t slot, Value value) {
+  if (slot >= vm->global_count) {
+    if (slot >= vm->global_capacity) {
+      int capacity = vm->global_capacity;
+      while (capacity <= slot) {
+        capacity *= 2;
+      }
+      vm->globals = realloc(vm->globals, capacity * sizeof(Value));
+      vm->global_capacity = capacity;
+    }
+    for (int i = vm->global_count; i < slot; i++) {
+      vm->globals[i] = NULL_VAL;
+    }
+    vm->global_count = slot + 1;
   }
+  vm->globals[slot] = value;
+}
 
-  // Free globals
-  for (int i = 0; i < vm->global_count; i++) {
-    value_free(&vm->globals[i]);
+void vm_define_global(VM *vm, uint16_t slot, Value value) {
+  store_global(vm, slot, value);
+}
+
+// The function a call with arg_count arguments is about to run, or NULL
+// after reporting why it cannot be called
+static RiauFunction *callee(VM *vm, int arg_count) {
+  Value value = vm->stack_top[-1 - arg_count];
+  if (!IS_FUNCTION(value)) {
+    runtime_error(vm, "Can only call functions");
+    return NULL;
+  }
+  RiauFunction *function = AS_FUNCTION(value);
+  if (function->arity != arg_count) {
+    runtime_error(vm, "%s() expects %d arguments but got %d", function->name,
+                  function->arity, arg_count);
+    return NULL;
+  }
+  return function;
+}
+
+static void enter_function(VM *vm, RiauFunction *function) {
+  vm->chunk = function->chunk;
+  vm->ip = function->chunk->code;
+  if (!vm->chunk->quicken) {
+    vm->chunk->quicken = riau_calloc(vm->chunk->count, sizeof(QuickenStats));
+  }
+}
+
+static Value constant_value(Constant *constant) {
+  if (constant->type == CONST_STRING) {
+    return STRING_VAL(constant->as.string);
+  }
+  if (constant->type == CONST_FUNCTION) {
+    return FUNCTION_VAL(constant->as.function);
+  }
+  if (constant->type == CONST_INT) {
+    return INT_VAL(constant->as.integer);
   }
+  return NUMBER_VAL(constant->as.number);
 }
 
 static uint8_t read_byte(VM *vm) { return *vm->ip++; }
@@ -297,338 +495,1289 @@ static uint16_t read_short(VM *vm) {
   return (uint16_t)((vm->ip[-2] << 8) | vm->ip[-1]);
 }
 
-static Constant read_constant(VM *vm) {
-  return vm->chunk->constants[read_byte(vm)];
+static uint32_t read_int(VM *vm) {
+  vm->ip += 4;
+  return ((uint32_t)vm->ip[-4] << 24) | ((uint32_t)vm->ip[-3] << 16) |
+         ((uint32_t)vm->ip[-2] << 8) | vm->ip[-1];
 }
 
-bool vm_execute(VM *vm, Chunk *chunk) {
-  vm->chunk = chunk;
-  vm->ip = chunk->code;
+static Constant *read_constant(VM *vm) {
+  return &vm->chunk->constants[read_byte(vm)];
+}
+
+static Constant *read_constant_long(VM *vm) {
+  return &vm->chunk->constants[read_short(vm)];
+}
 
-  for (;;) {
 #ifdef DEBUG_TRACE_EXECUTION
-    printf("          ");
-    for (Value *slot = vm->stack; slot < vm->stack_top; slot++) {
-      printf("[ ");
-      value_print(*slot);
-      printf(" ]");
-    }
-    printf("\n");
-    chunk_disassemble_instruction(vm->chunk, (int)(vm->ip - vm->chunk->code));
+static void trace_execution(VM *vm) {
+  printf("          ");
+  for (Value *slot = vm->stack; slot < vm->stack_top; slot++) {
+    printf("[ ");
+    value_print(*slot);
+    printf(" ]");
+  }
+  printf("\n");
+  chunk_disassemble_instruction(vm->chunk, (int)(vm->ip - vm->chunk->code));
+}
+#define TRACE_EXECUTION(vm) trace_execution(vm)
+#else
+#define TRACE_EXECUTION(vm) ((void)0)
+#endif
+
+// Quickening
+#ifndef RIAU_NO_QUICKEN
+static void quicken(VM *vm, uint8_t *site, uint8_t quickened) {
+  QuickenStats *stats = &vm->chunk->quicken[site - vm->chunk->code];
+  stats->generic++;
+  if (stats->deopts >= QUICKEN_MAX_DEOPTS)
+    return; // Types keep changing here, stay generic
+
+  if (stats->candidate != quickened) {
+    stats->candidate = quickened;
+    stats->warmup = 0;
+  }
+  if (++stats->warmup >= QUICKEN_THRESHOLD) {
+    *site = quickened;
+    stats->quickens++;
+    stats->warmup = 0;
+  }
+}
 #endif
 
-    uint8_t instruction = read_byte(vm);
+static void deoptimize(VM *vm, uint8_t *site, uint8_t generic) {
+  QuickenStats *stats = &vm->chunk->quicken[site - vm->chunk->code];
+  *site = generic;
+  stats->deopts++;
+  stats->candidate = 0;
+  stats->warmup = 0;
+}
 
-    switch (instruction) {
-    case OP_HALT:
-      return !vm->had_error;
+// Used inside handlers of operand-less instructions, where the opcode is
+// the byte just before ip
+#ifdef RIAU_NO_QUICKEN
+#define QUICKEN(quickened) ((void)0)
+#else
+#define QUICKEN(quickened) quicken(vm, vm->ip - 1, (quickened))
+#endif
 
-    case OP_PUSH_CONST: {
-      Constant constant = read_constant(vm);
-      if (constant.type == CONST_NUMBER) {
-        push(vm, value_number(constant.as.number));
-      } else if (constant.type == CONST_STRING) {
-        push(vm, value_string(constant.as.string));
-      }
-      break;
-    }
+#define QUICKENED_HIT() vm->chunk->quicken[vm->ip - 1 - vm->chunk->code].hits++
 
-    case OP_PUSH_NULL:
-      push(vm, value_null());
-      break;
+// Restore the generic instruction and run it again
+#define DEOPTIMIZE(generic)                                                    \
+  {                                                                            \
+    deoptimize(vm, vm->ip - 1, (generic));                                     \
+    vm->ip--;                                                                  \
+    DISPATCH();                                                                \
+  }
 
-    case OP_PUSH_TRUE:
-      push(vm, value_bool(true));
-      break;
+// Quickened number-number operation; the result overwrites the left operand
+// in place. It covers a double with a double or an int: two ints take the
+// *_INT_INT form.
+#define NUM_NUM_OP(generic, make, op)                                          \
+  {                                                                            \
+    Value b = vm->stack_top[-1];                                               \
+    Value a = vm->stack_top[-2];                                               \
+    if (!IS_NUMERIC(a) || !IS_NUMERIC(b) || (IS_INT(a) && IS_INT(b)))          \
+      DEOPTIMIZE(generic);                                                     \
+    vm->stack_top[-2] = make(AS_DOUBLE(a) op AS_DOUBLE(b));                    \
+    vm->stack_top--;                                                           \
+    QUICKENED_HIT();                                                           \
+    DISPATCH();                                                                \
+  }
 
-    case OP_PUSH_FALSE:
-      push(vm, value_bool(false));
-      break;
+// Quickened int-int operation. Arithmetic is done in 64 bits, so make is
+// INT_RESULT, which moves an overflowing result to a double.
+#define INT_INT_OP(generic, make, op)                                          \
+  {                                                                            \
+    Value b = vm->stack_top[-1];                                               \
+    Value a = vm->stack_top[-2];                                               \
+    if (!IS_INT(a) || !IS_INT(b))                                              \
+      DEOPTIMIZE(generic);                                                     \
+    vm->stack_top[-2] = make((int64_t)AS_INT(a) op AS_INT(b));                 \
+    vm->stack_top--;                                                           \
+    QUICKENED_HIT();                                                           \
+    DISPATCH();                                                                \
+  }
+
+// Operand of a bitwise instruction: an int, or a double holding one
+static bool to_int32(Value v, int32_t *out) {
+  if (IS_INT(v)) {
+    *out = AS_INT(v);
+    return true;
+  }
+  if (IS_NUMBER(v) && AS_NUMBER(v) >= INT32_MIN && AS_NUMBER(v) <= INT32_MAX &&
+      AS_NUMBER(v) == (int32_t)AS_NUMBER(v)) {
+    *out = (int32_t)AS_NUMBER(v);
+    return true;
+  }
+  return false;
+}
+
+// Instruction bodies
+//
+// Each op_* function runs one instruction with vm->ip just past its opcode
+// and returns false after a runtime error. run() inlines them; JIT builds
+// also call them from native code (see jit.h), and AOT builds export them
+// as vm_op_* for emitted C (see aot.h).
+
+static inline bool op_add(VM *vm) {
+  Value b = pop(vm);
+  Value a = pop(vm);
+  if (IS_INT(a) && IS_INT(b)) {
+    push(vm, INT_RESULT((int64_t)AS_INT(a) + AS_INT(b)));
+    QUICKEN(OP_ADD_INT_INT);
+  } else if (IS_NUMERIC(a) && IS_NUMERIC(b)) {
+    push(vm, value_number(AS_DOUBLE(a) + AS_DOUBLE(b)));
+    QUICKEN(OP_ADD_NUM_NUM);
+  } else if (IS_STRING(a) && IS_STRING(b)) {
+    push(vm, STRING_VAL(string_concat(AS_STRING(a), AS_STRING(b))));
+    QUICKEN(OP_ADD_STR_STR);
+    GC_SAFEPOINT();
+  } else {
+    runtime_error(vm, "Operands must be two numbers or two strings");
+    return false;
+  }
+  return true;
+}
+
+static inline bool op_sub(VM *vm) {
+  Value b = pop(vm);
+  Value a = pop(vm);
+  if (IS_INT(a) && IS_INT(b)) {
+    push(vm, INT_RESULT((int64_t)AS_INT(a) - AS_INT(b)));
+    QUICKEN(OP_SUB_INT_INT);
+    return true;
+  }
+  if (!IS_NUMERIC(a) || !IS_NUMERIC(b)) {
+    runtime_error(vm, "Operands must be numbers");
+    return false;
+  }
+  push(vm, value_number(AS_DOUBLE(a) - AS_DOUBLE(b)));
+  QUICKEN(OP_SUB_NUM_NUM);
+  return true;
+}
+
+static inline bool op_mul(VM *vm) {
+  Value b = pop(vm);
+  Value a = pop(vm);
+  if (IS_INT(a) && IS_INT(b)) {
+    push(vm, INT_RESULT((int64_t)AS_INT(a) * AS_INT(b)));
+    QUICKEN(OP_MUL_INT_INT);
+    return true;
+  }
+  if (!IS_NUMERIC(a) || !IS_NUMERIC(b)) {
+    runtime_error(vm, "Operands must be numbers");
+    return false;
+  }
+  push(vm, value_number(AS_DOUBLE(a) * AS_DOUBLE(b)));
+  QUICKEN(OP_MUL_NUM_NUM);
+  return true;
+}
+
+static inline bool op_div(VM *vm) {
+  Value b = pop(vm);
+  Value a = pop(vm);
+  if (!IS_NUMERIC(a) || !IS_NUMERIC(b)) {
+    runtime_error(vm, "Operands must be numbers");
+    return false;
+  }
+  if (AS_DOUBLE(b) == 0) {
+    runtime_error(vm, "Division by zero");
+    return false;
+  }
+  // Division always gives a double, even for two ints
+  push(vm, value_number(AS_DOUBLE(a) / AS_DOUBLE(b)));
+  QUICKEN(OP_DIV_NUM_NUM);
+  return true;
+}
+
+static inline bool op_negate(VM *vm) {
+  Value v = pop(vm);
+  if (IS_INT(v)) {
+    push(vm, INT_RESULT(-(int64_t)AS_INT(v)));
+    return true;
+  }
+  if (!IS_NUMBER(v)) {
+    runtime_error(vm, "Operand must be a number");
+    return false;
+  }
+  push(vm, value_number(-AS_NUMBER(v)));
+  return true;
+}
+
+static inline bool op_not(VM *vm) {
+  Value v = pop(vm);
+  push(vm, value_bool(!value_is_truthy(v)));
+  return true;
+}
+
+static inline bool op_equal(VM *vm) {
+  Value b = pop(vm);
+  Value a = pop(vm);
+  push(vm, value_bool(value_equals(a, b)));
+  return true;
+}
+
+static inline bool op_greater(VM *vm) {
+  Value b = pop(vm);
+  Value a = pop(vm);
+  if (IS_INT(a) && IS_INT(b)) {
+    push(vm, value_bool(AS_INT(a) > AS_INT(b)));
+    QUICKEN(OP_GREATER_INT_INT);
+    return true;
+  }
+  if (!IS_NUMERIC(a) || !IS_NUMERIC(b)) {
+    runtime_error(vm, "Operands must be numbers");
+    return false;
+  }
+  push(vm, value_bool(AS_DOUBLE(a) > AS_DOUBLE(b)));
+  QUICKEN(OP_GREATER_NUM_NUM);
+  return true;
+}
 
-    case OP_POP: {
-      Value v = pop(vm);
-      value_free(&v);
-      break;
+static inline bool op_less(VM *vm) {
+  Value b = pop(vm);
+  Value a = pop(vm);
+  if (IS_INT(a) && IS_INT(b)) {
+    push(vm, value_bool(AS_INT(a) < AS_INT(b)));
+    QUICKEN(OP_LESS_INT_INT);
+    return true;
+  }
+  if (!IS_NUMERIC(a) || !IS_NUMERIC(b)) {
+    runtime_error(vm, "Operands must be numbers");
+    return false;
+  }
+  push(vm, value_bool(AS_DOUBLE(a) < AS_DOUBLE(b)));
+  QUICKEN(OP_LESS_NUM_NUM);
+  return true;
+}
+
+static inline bool op_mod(VM *vm) {
+  Value b = pop(vm);
+  Value a = pop(vm);
+  if (!IS_NUMERIC(a) || !IS_NUMERIC(b)) {
+    runtime_error(vm, "Operands must be numbers");
+    return false;
+  }
+  if (AS_DOUBLE(b) == 0) {
+    runtime_error(vm, "Modulo by zero");
+    return false;
+  }
+  if (IS_INT(a) && IS_INT(b)) {
+    // x % -1 is 0; computing it would trap on INT32_MIN
+    int32_t divisor = AS_INT(b);
+    push(vm, INT_VAL(divisor == -1 ? 0 : AS_INT(a) % divisor));
+    return true;
+  }
+  push(vm, value_number(fmod(AS_DOUBLE(a), AS_DOUBLE(b))));
+  return true;
+}
+
+static inline bool op_not_equal(VM *vm) {
+  Value b = pop(vm);
+  Value a = pop(vm);
+  push(vm, value_bool(!value_equals(a, b)));
+  return true;
+}
+
+static inline bool op_less_equal(VM *vm) {
+  Value b = pop(vm);
+  Value a = pop(vm);
+  if (IS_INT(a) && IS_INT(b)) {
+    push(vm, value_bool(AS_INT(a) <= AS_INT(b)));
+    QUICKEN(OP_LESS_EQUAL_INT_INT);
+    return true;
+  }
+  if (!IS_NUMERIC(a) || !IS_NUMERIC(b)) {
+    runtime_error(vm, "Operands must be numbers");
+    return false;
+  }
+  push(vm, value_bool(AS_DOUBLE(a) <= AS_DOUBLE(b)));
+  QUICKEN(OP_LESS_EQUAL_NUM_NUM);
+  return true;
+}
+
+static inline bool op_greater_equal(VM *vm) {
+  Value b = pop(vm);
+  Value a = pop(vm);
+  if (IS_INT(a) && IS_INT(b)) {
+    push(vm, value_bool(AS_INT(a) >= AS_INT(b)));
+    QUICKEN(OP_GREATER_EQUAL_INT_INT);
+    return true;
+  }
+  if (!IS_NUMERIC(a) || !IS_NUMERIC(b)) {
+    runtime_error(vm, "Operands must be numbers");
+    return false;
+  }
+  push(vm, value_bool(AS_DOUBLE(a) >= AS_DOUBLE(b)));
+  QUICKEN(OP_GREATER_EQUAL_NUM_NUM);
+  return true;
+}
+
+static inline bool op_and(VM *vm) {
+  Value b = pop(vm);
+  Value a = pop(vm);
+  push(vm, value_bool(value_is_truthy(a) && value_is_truthy(b)));
+  return true;
+}
+
+static inline bool op_or(VM *vm) {
+  Value b = pop(vm);
+  Value a = pop(vm);
+  push(vm, value_bool(value_is_truthy(a) || value_is_truthy(b)));
+  return true;
+}
+
+static inline bool op_store_var(VM *vm) {
+  store_global(vm, read_byte(vm), peek(vm, 0));
+  return true;
+}
+
+static inline bool op_load_var(VM *vm) {
+  uint8_t slot = read_byte(vm);
+  if (slot >= vm->global_count) {
+    runtime_error(vm, "Undefined variable");
+    return false;
+  }
+  push(vm, vm->globals[slot]);
+  return true;
+}
+
+static inline bool op_store_var_long(VM *vm) {
+  store_global(vm, read_short(vm), peek(vm, 0));
+  return true;
+}
+
+static inline bool op_load_var_long(VM *vm) {
+  uint16_t slot = read_short(vm);
+  if (slot >= vm->global_count) {
+    runtime_error(vm, "Undefined variable");
+    return false;
+  }
+  push(vm, vm->globals[slot]);
+  return true;
+}
+
+static inline bool op_call_native(VM *vm) {
+  // The native reads its arguments where they are on the stack, and
+  // the result takes their place
+  uint8_t native = read_byte(vm);
+  uint8_t arg_count = read_byte(vm);
+  if (!vm->natives) {
+    runtime_error(vm, "Native functions are not registered");
+    return false;
+  }
+  if (native >= vm->native_count) {
+    runtime_error(vm, "No native function %d", native);
+    return false;
+  }
+  Value *args = vm->stack_top - arg_count;
+  Value result = vm->natives[native].function(arg_count, args);
+  vm->stack_top = args;
+  push(vm, result);
+  GC_SAFEPOINT();
+  return true;
+}
+
+static inline bool op_object_new(VM *vm) {
+  push(vm, value_object());
+  GC_SAFEPOINT();
+  return true;
+}
+
+static inline bool op_array_new(VM *vm) {
+  // Array literals: [element1 ... elementN] -> [array]
+  uint16_t count = read_short(vm);
+  Value array = value_array();
+  RiauArray *elements = AS_ARRAY(array);
+  if (count > 0) {
+    elements->elements = malloc(count * sizeof(Value));
+    elements->capacity = count;
+    memcpy(elements->elements, vm->stack_top - count, count * sizeof(Value));
+    elements->count = count;
+    // The array goes straight to the old space when the nursery is full
+    for (uint16_t i = 0; i < count; i++) {
+      gc_write_barrier(&elements->gc, elements->elements[i]);
     }
+  }
+  vm->stack_top -= count;
+  push(vm, array);
+  GC_SAFEPOINT();
+  return true;
+}
 
-    case OP_ADD: {
-      Value b = pop(vm);
-      Value a = pop(vm);
-      if (value_is_number(a) && value_is_number(b)) {
-        push(vm, value_number(a.as.number + b.as.number));
-      } else if (value_is_string(a) && value_is_string(b)) {
-        char *result = malloc(strlen(a.as.string) + strlen(b.as.string) + 1);
-        strcpy(result, a.as.string);
-        strcat(result, b.as.string);
-        push(vm, value_string(result));
-        free(result);
-      } else {
-        runtime_error(vm, "Operands must be two numbers or two strings");
-        return false;
-      }
-      value_free(&a);
-      value_free(&b);
-      break;
+static inline bool op_for_prep(VM *vm) {
+  // [seq] -> [seq position variable]
+  Value seq = peek(vm, 0);
+  if (!IS_ARRAY(seq) && !IS_STRING(seq) && !IS_OBJECT(seq)) {
+    runtime_error(vm, "Only arrays, strings and objects can be iterated");
+    return false;
+  }
+  push(vm, INT_VAL(0));
+  push(vm, NULL_VAL);
+  return true;
+}
+
+// Bytes in the UTF-8 character starting with `lead`
+static size_t utf8_length(uint8_t lead) {
+  if (lead >= 0xf0)
+    return 4;
+  if (lead >= 0xe0)
+    return 3;
+  if (lead >= 0xc0)
+    return 2;
+  return 1;
+}
+
+// FOR_ITER's step, on the state FOR_PREP set up: the next element of an
+// array, character of a string or key of an object goes into the loop
+// variable. Returns false once there are none left. Only a string
+// allocates, for the character; the state lives in its stack slots.
+static bool for_next(VM *vm) {
+  Value *state = vm->stack_top - 3;
+  Value seq = state[0];
+  int32_t position = AS_INT(state[1]);
+
+  if (IS_ARRAY(seq)) {
+    RiauArray *array = AS_ARRAY(seq);
+    if ((size_t)position >= array->count)
+      return false;
+    state[2] = array->elements[position];
+    state[1] = INT_VAL(position + 1);
+    return true;
+  }
+
+  if (IS_STRING(seq)) {
+    RiauString *string = AS_STRING(seq);
+    if ((size_t)position >= string->length)
+      return false;
+    size_t length = utf8_length((uint8_t)string->chars[position]);
+    if (length > string->length - (size_t)position) {
+      length = string->length - (size_t)position;
     }
+    state[1] = INT_VAL(position + (int32_t)length);
+    state[2] = STRING_VAL(string_new(string->chars + position, length));
+    GC_SAFEPOINT();
+    return true;
+  }
 
-    case OP_SUB: {
-      Value b = pop(vm);
-      Value a = pop(vm);
-      if (!value_is_number(a) || !value_is_number(b)) {
-        runtime_error(vm, "Operands must be numbers");
-        return false;
-      }
-      push(vm, value_number(a.as.number - b.as.number));
-      value_free(&a);
-      value_free(&b);
-      break;
+  // An object's keys in slot order, skipping deleted ones
+  Shape *shape = AS_OBJECT(seq)->shape;
+  while ((uint32_t)position < shape->slot_count && !shape->keys[position]) {
+    position++;
+  }
+  if ((uint32_t)position >= shape->slot_count)
+    return false;
+  RiauString *key = shape->keys[position];
+  state[1] = INT_VAL(position + 1);
+  if (shape->is_dictionary) {
+    // A dictionary's keys go away with it, or when deleted
+    state[2] = STRING_VAL(string_new(key->chars, key->length));
+    GC_SAFEPOINT();
+  } else {
+    state[2] = STRING_VAL(key);
+  }
+  return true;
+}
+
+bool vm_for_next(VM *vm) {
+  push(vm, BOOL_VAL(for_next(vm)));
+  return true;
+}
+
+static inline bool load_field(VM *vm, RiauString *name) {
+  PropertyCache *cache = &vm->chunk->caches[read_short(vm)];
+  Value receiver = pop(vm);
+  if (!IS_OBJECT(receiver)) {
+    runtime_error(vm, "Cannot read property '%s' of a non-object",
+                  name->chars);
+    return false;
+  }
+
+  Value value = property_get(AS_OBJECT(receiver), name, cache);
+  push(vm, value);
+  return true;
+}
+
+static inline bool store_field(VM *vm, RiauString *name) {
+  // Object literals: [object value] -> [object]
+  PropertyCache *cache = &vm->chunk->caches[read_short(vm)];
+  Value value = pop(vm);
+  Value receiver = peek(vm, 0);
+  if (!IS_OBJECT(receiver)) {
+    runtime_error(vm, "Cannot set property '%s' on a non-object",
+                  name->chars);
+    return false;
+  }
+
+  property_set(AS_OBJECT(receiver), name, value, cache);
+  return true;
+}
+
+static inline bool op_load_field(VM *vm) {
+  return load_field(vm, read_constant(vm)->as.string);
+}
+
+static inline bool op_load_field_long(VM *vm) {
+  return load_field(vm, read_constant_long(vm)->as.string);
+}
+
+static inline bool op_store_field(VM *vm) {
+  return store_field(vm, read_constant(vm)->as.string);
+}
+
+static inline bool op_store_field_long(VM *vm) {
+  return store_field(vm, read_constant_long(vm)->as.string);
+}
+
+static inline bool op_object_get(VM *vm) {
+  // [target key] -> [value]
+  PropertyCache *cache = &vm->chunk->caches[read_short(vm)];
+  Value key = pop(vm);
+  Value target = pop(vm);
+  Value value;
+
+  if (IS_OBJECT(target) && IS_STRING(key)) {
+    value = property_get(AS_OBJECT(target), AS_STRING(key), cache);
+  } else if (IS_ARRAY(target) && IS_NUMERIC(key)) {
+    size_t index;
+    if (!array_index(key, &index)) {
+      runtime_error(vm, "Array index must be an integer");
+      return false;
     }
+    value = array_get(AS_ARRAY(target), index); // null past the end
+  } else {
+    runtime_error(vm, "Only objects and arrays can be indexed");
+    return false;
+  }
 
-    case OP_MUL: {
-      Value b = pop(vm);
-      Value a = pop(vm);
-      if (!value_is_number(a) || !value_is_number(b)) {
-        runtime_error(vm, "Operands must be numbers");
-        return false;
-      }
-      push(vm, value_number(a.as.number * b.as.number));
-      value_free(&a);
-      value_free(&b);
-      break;
+  push(vm, value);
+  return true;
+}
+
+static inline bool op_object_set(VM *vm) {
+  // [target key value] -> [value]
+  PropertyCache *cache = &vm->chunk->caches[read_short(vm)];
+  Value value = pop(vm);
+  Value key = pop(vm);
+  Value target = pop(vm);
+
+  if (IS_OBJECT(target) && IS_STRING(key)) {
+    property_set(AS_OBJECT(target), AS_STRING(key), value, cache);
+  } else if (IS_ARRAY(target) && IS_NUMERIC(key)) {
+    // Arrays grow one element at a time: index count appends
+    RiauArray *array = AS_ARRAY(target);
+    size_t index;
+    if (!array_index(key, &index)) {
+      runtime_error(vm, "Array index must be an integer");
+      return false;
+    }
+    if (index > array->count) {
+      runtime_error(vm, "Array index out of range");
+      return false;
     }
+    array_set(array, index, value);
+  } else {
+    runtime_error(vm, "Only objects and arrays can be indexed");
+    return false;
+  }
 
-    case OP_DIV: {
-      Value b = pop(vm);
-      Value a = pop(vm);
-      if (!value_is_number(a) || !value_is_number(b)) {
-        runtime_error(vm, "Operands must be numbers");
-        return false;
-      }
-      if (b.as.number == 0) {
-        runtime_error(vm, "Division by zero");
-        return false;
-      }
-      push(vm, value_number(a.as.number / b.as.number));
-      value_free(&a);
-      value_free(&b);
-      break;
+  push(vm, value);
+  return true;
+}
+
+static inline bool op_check_null(VM *vm) {
+  Value v = peek(vm, 0);
+  if (IS_NULL(v)) {
+    runtime_error(vm, "Variable may be null");
+    return false;
+  }
+  return true;
+}
+
+static inline bool op_env(VM *vm) {
+  Value v = pop(vm);
+  if (!IS_STRING(v)) {
+    runtime_error(vm, "env() requires a string argument");
+    return false;
+  }
+
+  char *env_value = getenv(AS_CSTRING(v));
+  if (env_value) {
+    push(vm, value_string(env_value));
+  } else {
+    push(vm, value_null());
+  }
+  GC_SAFEPOINT();
+  return true;
+}
+
+static inline bool op_input(VM *vm) {
+  // Read from stdin (for POST data)
+  char *content_length_str = getenv("CONTENT_LENGTH");
+  size_t content_length = 0;
+
+  if (content_length_str) {
+    content_length = (size_t)atoi(content_length_str);
+  }
+
+  if (content_length > 0 && content_length < 1048576) { // Max 1MB
+    // Read exactly content_length bytes from stdin
+    char *buffer = malloc(content_length + 1);
+    if (buffer) {
+      size_t bytes_read = fread(buffer, 1, content_length, stdin);
+      push(vm, STRING_VAL(string_new(buffer, bytes_read)));
+      free(buffer);
+    } else {
+      push(vm, value_string(""));
     }
+  } else {
+    // No content or too large, return empty string
+    push(vm, value_string(""));
+  }
+  GC_SAFEPOINT();
+  return true;
+}
 
-    case OP_NEGATE: {
-      Value v = pop(vm);
-      if (!value_is_number(v)) {
-        runtime_error(vm, "Operand must be a number");
-        return false;
+static inline bool op_print(VM *vm) {
+  // print() is an expression: its null result is what the enclosing
+  // expression statement pops
+  Value v = pop(vm);
+  value_print(v);
+  printf("\n");
+  push(vm, NULL_VAL);
+  return true;
+}
+
+static inline bool op_print_const(VM *vm) {
+  value_print(constant_value(read_constant(vm)));
+  printf("\n");
+  return true;
+}
+
+static inline bool op_print_pop(VM *vm) {
+  Value v = pop(vm);
+  value_print(v);
+  printf("\n");
+  return true;
+}
+
+static inline bool op_store_var_pop(VM *vm) {
+  uint8_t slot = read_byte(vm);
+  store_global(vm, slot, pop(vm));
+  return true;
+}
+
+static inline bool op_add_var_const(VM *vm) {
+  uint8_t slot = read_byte(vm);
+  Value k = constant_value(read_constant(vm));
+  if (slot >= vm->global_count) {
+    runtime_error(vm, "Undefined variable");
+    return false;
+  }
+
+  Value *var = &vm->globals[slot];
+  if (IS_INT(*var) && IS_INT(k)) {
+    *var = INT_RESULT((int64_t)AS_INT(*var) + AS_INT(k));
+  } else if (IS_NUMERIC(*var) && IS_NUMERIC(k)) {
+    *var = NUMBER_VAL(AS_DOUBLE(*var) + AS_DOUBLE(k));
+  } else if (IS_STRING(*var) && IS_STRING(k)) {
+    *var = STRING_VAL(string_concat(AS_STRING(*var), AS_STRING(k)));
+    GC_SAFEPOINT();
+  } else {
+    runtime_error(vm, "Operands must be two numbers or two strings");
+    return false;
+  }
+  return true;
+}
+
+// Bitwise operation on two 32-bit integers; results wrap
+#define BITWISE_OP(name, expr)                                                 \
+  static inline bool name(VM *vm) {                                            \
+    Value b = pop(vm);                                                         \
+    Value a = pop(vm);                                                         \
+    int32_t x, y;                                                              \
+    if (!to_int32(a, &x) || !to_int32(b, &y)) {                                \
+      runtime_error(vm, "Operands must be integers");                          \
+      return false;                                                            \
+    }                                                                          \
+    push(vm, INT_VAL(expr));                                                   \
+    return true;                                                               \
+  }
+
+BITWISE_OP(op_bit_and, x & y)
+BITWISE_OP(op_bit_or, x | y)
+BITWISE_OP(op_bit_xor, x ^ y)
+
+// Shift counts use their low 5 bits
+BITWISE_OP(op_shift_left, (int32_t)((uint32_t)x << (y & 31)))
+BITWISE_OP(op_shift_right, x >> (y & 31))
+
+static inline bool op_bit_not(VM *vm) {
+  int32_t x;
+  if (!to_int32(pop(vm), &x)) {
+    runtime_error(vm, "Operand must be an integer");
+    return false;
+  }
+  push(vm, INT_VAL(~x));
+  return true;
+}
+
+// Handler of an instruction with an op_* body
+#define RUN_OP(function)                                                       \
+  if (!function(vm))                                                           \
+    return false;                                                              \
+  DISPATCH();
+
+#ifdef RIAU_JIT
+#define OP_FUNCTION(op, function) [op] = function,
+static JitHelper const op_functions[256] = {VM_OP_BODIES(OP_FUNCTION)};
+#undef OP_FUNCTION
+
+JitHelper vm_op_function(uint8_t op) { return op_functions[op]; }
+
+Value vm_constant_value(Constant *constant) { return constant_value(constant); }
+
+// Continue in native code if the chunk has any; see jit_enter()
+#define JIT_ENTER(count)                                                       \
+  if (!jit_enter(vm, (count)))                                                 \
+    return false
+#elif defined(RIAU_AOT)
+// Chunks loaded from emitted C come with their native code
+#define JIT_ENTER(count)                                                       \
+  if (vm->chunk->jit && !vm->chunk->jit->run(vm->chunk->jit, vm))              \
+    return false
+#else
+#define JIT_ENTER(count) ((void)0)
+#endif
+
+#ifdef RIAU_AOT
+#define OP_EXPORT(op, function)                                                \
+  bool vm_##function(VM *vm) { return function(vm); }
+VM_OP_BODIES(OP_EXPORT)
+#undef OP_EXPORT
+#endif
+
+static bool run(void *context) {
+  VM *vm = context;
+  uint8_t instruction;
+
+  JIT_ENTER(true);
+
+#ifdef RIAU_COMPUTED_GOTO
+  // One indirect jump per handler instead of a single shared switch. Slots
+  // for opcodes without a handler are filled with the error target once.
+  static void *dispatch_table[256] = {
+      [OP_HALT] = &&TARGET_OP_HALT,
+      [OP_PUSH_CONST] = &&TARGET_OP_PUSH_CONST,
+      [OP_PUSH_NULL] = &&TARGET_OP_PUSH_NULL,
+      [OP_PUSH_TRUE] = &&TARGET_OP_PUSH_TRUE,
+      [OP_PUSH_FALSE] = &&TARGET_OP_PUSH_FALSE,
+      [OP_POP] = &&TARGET_OP_POP,
+      [OP_LOAD_VAR] = &&TARGET_OP_LOAD_VAR,
+      [OP_STORE_VAR] = &&TARGET_OP_STORE_VAR,
+      [OP_LOAD_FIELD] = &&TARGET_OP_LOAD_FIELD,
+      [OP_STORE_FIELD] = &&TARGET_OP_STORE_FIELD,
+      [OP_ADD] = &&TARGET_OP_ADD,
+      [OP_SUB] = &&TARGET_OP_SUB,
+      [OP_MUL] = &&TARGET_OP_MUL,
+      [OP_DIV] = &&TARGET_OP_DIV,
+      [OP_MOD] = &&TARGET_OP_MOD,
+      [OP_NEGATE] = &&TARGET_OP_NEGATE,
+      [OP_NOT] = &&TARGET_OP_NOT,
+      [OP_EQUAL] = &&TARGET_OP_EQUAL,
+      [OP_NOT_EQUAL] = &&TARGET_OP_NOT_EQUAL,
+      [OP_GREATER] = &&TARGET_OP_GREATER,
+      [OP_GREATER_EQUAL] = &&TARGET_OP_GREATER_EQUAL,
+      [OP_LESS] = &&TARGET_OP_LESS,
+      [OP_LESS_EQUAL] = &&TARGET_OP_LESS_EQUAL,
+      [OP_AND] = &&TARGET_OP_AND,
+      [OP_OR] = &&TARGET_OP_OR,
+      [OP_OBJECT_NEW] = &&TARGET_OP_OBJECT_NEW,
+      [OP_ARRAY_NEW] = &&TARGET_OP_ARRAY_NEW,
+      [OP_OBJECT_GET] = &&TARGET_OP_OBJECT_GET,
+      [OP_OBJECT_SET] = &&TARGET_OP_OBJECT_SET,
+      [OP_CHECK_NULL] = &&TARGET_OP_CHECK_NULL,
+      [OP_ENV] = &&TARGET_OP_ENV,
+      [OP_INPUT] = &&TARGET_OP_INPUT,
+      [OP_PRINT] = &&TARGET_OP_PRINT,
+      [OP_BIT_AND] = &&TARGET_OP_BIT_AND,
+      [OP_BIT_OR] = &&TARGET_OP_BIT_OR,
+      [OP_BIT_XOR] = &&TARGET_OP_BIT_XOR,
+      [OP_BIT_NOT] = &&TARGET_OP_BIT_NOT,
+      [OP_SHIFT_LEFT] = &&TARGET_OP_SHIFT_LEFT,
+      [OP_SHIFT_RIGHT] = &&TARGET_OP_SHIFT_RIGHT,
+      [OP_ADD_NUM_NUM] = &&TARGET_OP_ADD_NUM_NUM,
+      [OP_ADD_STR_STR] = &&TARGET_OP_ADD_STR_STR,
+      [OP_SUB_NUM_NUM] = &&TARGET_OP_SUB_NUM_NUM,
+      [OP_MUL_NUM_NUM] = &&TARGET_OP_MUL_NUM_NUM,
+      [OP_DIV_NUM_NUM] = &&TARGET_OP_DIV_NUM_NUM,
+      [OP_LESS_NUM_NUM] = &&TARGET_OP_LESS_NUM_NUM,
+      [OP_LESS_EQUAL_NUM_NUM] = &&TARGET_OP_LESS_EQUAL_NUM_NUM,
+      [OP_GREATER_NUM_NUM] = &&TARGET_OP_GREATER_NUM_NUM,
+      [OP_GREATER_EQUAL_NUM_NUM] = &&TARGET_OP_GREATER_EQUAL_NUM_NUM,
+      [OP_ADD_INT_INT] = &&TARGET_OP_ADD_INT_INT,
+      [OP_SUB_INT_INT] = &&TARGET_OP_SUB_INT_INT,
+      [OP_MUL_INT_INT] = &&TARGET_OP_MUL_INT_INT,
+      [OP_LESS_INT_INT] = &&TARGET_OP_LESS_INT_INT,
+      [OP_LESS_EQUAL_INT_INT] = &&TARGET_OP_LESS_EQUAL_INT_INT,
+      [OP_GREATER_INT_INT] = &&TARGET_OP_GREATER_INT_INT,
+      [OP_GREATER_EQUAL_INT_INT] = &&TARGET_OP_GREATER_EQUAL_INT_INT,
+      [OP_PRINT_CONST] = &&TARGET_OP_PRINT_CONST,
+      [OP_PRINT_POP] = &&TARGET_OP_PRINT_POP,
+      [OP_STORE_VAR_POP] = &&TARGET_OP_STORE_VAR_POP,
+      [OP_ADD_VAR_CONST] = &&TARGET_OP_ADD_VAR_CONST,
+      [OP_LOAD_VAR_LONG] = &&TARGET_OP_LOAD_VAR_LONG,
+      [OP_STORE_VAR_LONG] = &&TARGET_OP_STORE_VAR_LONG,
+      [OP_LOAD_LOCAL] = &&TARGET_OP_LOAD_LOCAL,
+      [OP_STORE_LOCAL] = &&TARGET_OP_STORE_LOCAL,
+      [OP_JUMP] = &&TARGET_OP_JUMP,
+      [OP_JUMP_IF_FALSE] = &&TARGET_OP_JUMP_IF_FALSE,
+      [OP_JUMP_IF_TRUE] = &&TARGET_OP_JUMP_IF_TRUE,
+      [OP_CALL] = &&TARGET_OP_CALL,
+      [OP_RETURN] = &&TARGET_OP_RETURN,
+      [OP_TAIL_CALL] = &&TARGET_OP_TAIL_CALL,
+      [OP_CALL_NATIVE] = &&TARGET_OP_CALL_NATIVE,
+      [OP_PUSH_CONST_LONG] = &&TARGET_OP_PUSH_CONST_LONG,
+      [OP_LOAD_FIELD_LONG] = &&TARGET_OP_LOAD_FIELD_LONG,
+      [OP_STORE_FIELD_LONG] = &&TARGET_OP_STORE_FIELD_LONG,
+      [OP_JUMP_LONG] = &&TARGET_OP_JUMP_LONG,
+      [OP_JUMP_IF_FALSE_LONG] = &&TARGET_OP_JUMP_IF_FALSE_LONG,
+      [OP_JUMP_IF_TRUE_LONG] = &&TARGET_OP_JUMP_IF_TRUE_LONG,
+      [OP_FOR_ITER_LONG] = &&TARGET_OP_FOR_ITER_LONG,
+      [OP_FOR_PREP] = &&TARGET_OP_FOR_PREP,
+      [OP_FOR_ITER] = &&TARGET_OP_FOR_ITER,
+  };
+  static bool dispatch_table_ready = false;
+  if (!dispatch_table_ready) {
+    for (int i = 0; i < 256; i++) {
+      if (!dispatch_table[i]) {
+        dispatch_table[i] = &&TARGET_UNKNOWN;
       }
-      push(vm, value_number(-v.as.number));
-      value_free(&v);
-      break;
     }
+    dispatch_table_ready = true;
+  }
 
-    case OP_NOT: {
-      Value v = pop(vm);
-      push(vm, value_bool(!value_is_truthy(v)));
-      value_free(&v);
-      break;
-    }
+#define TARGET(op) TARGET_##op:
+#define DISPATCH()                                                             \
+  do {                                                                         \
+    TRACE_EXECUTION(vm);                                                       \
+    instruction = read_byte(vm);                                               \
+    goto *dispatch_table[instruction];                                         \
+  } while (0)
 
-    case OP_EQUAL: {
-      Value b = pop(vm);
-      Value a = pop(vm);
-      push(vm, value_bool(value_equals(a, b)));
-      value_free(&a);
-      value_free(&b);
-      break;
+  DISPATCH();
+#else
+#define TARGET(op) case op:
+#define DISPATCH() continue
+
+  for (;;) {
+    TRACE_EXECUTION(vm);
+    instruction = read_byte(vm);
+
+    switch (instruction) {
+#endif
+
+    TARGET(OP_HALT)
+      return !vm->had_error;
+
+    TARGET(OP_PUSH_CONST) {
+      // String constants are interned in the chunk, so pushing one is a
+      // pointer copy
+      push(vm, constant_value(read_constant(vm)));
+      DISPATCH();
     }
 
-    case OP_GREATER: {
-      Value b = pop(vm);
-      Value a = pop(vm);
-      if (!value_is_number(a) || !value_is_number(b)) {
-        runtime_error(vm, "Operands must be numbers");
-        return false;
-      }
-      push(vm, value_bool(a.as.number > b.as.number));
-      value_free(&a);
-      value_free(&b);
-      break;
+    TARGET(OP_PUSH_CONST_LONG)
+      push(vm, constant_value(read_constant_long(vm)));
+      DISPATCH();
+
+    TARGET(OP_PUSH_NULL)
+      push(vm, value_null());
+      DISPATCH();
+
+    TARGET(OP_PUSH_TRUE)
+      push(vm, value_bool(true));
+      DISPATCH();
+
+    TARGET(OP_PUSH_FALSE)
+      push(vm, value_bool(false));
+      DISPATCH();
+
+    TARGET(OP_POP)
+      vm->stack_top--;
+      DISPATCH();
+
+    TARGET(OP_ADD)
+    RUN_OP(op_add)
+
+    TARGET(OP_SUB)
+    RUN_OP(op_sub)
+
+    TARGET(OP_MUL)
+    RUN_OP(op_mul)
+
+    TARGET(OP_DIV)
+    RUN_OP(op_div)
+
+    TARGET(OP_NEGATE)
+    RUN_OP(op_negate)
+
+    TARGET(OP_NOT)
+    RUN_OP(op_not)
+
+    TARGET(OP_EQUAL)
+    RUN_OP(op_equal)
+
+    TARGET(OP_GREATER)
+    RUN_OP(op_greater)
+
+    TARGET(OP_LESS)
+    RUN_OP(op_less)
+
+    TARGET(OP_MOD)
+    RUN_OP(op_mod)
+
+    TARGET(OP_BIT_AND)
+    RUN_OP(op_bit_and)
+
+    TARGET(OP_BIT_OR)
+    RUN_OP(op_bit_or)
+
+    TARGET(OP_BIT_XOR)
+    RUN_OP(op_bit_xor)
+
+    TARGET(OP_SHIFT_LEFT)
+    RUN_OP(op_shift_left)
+
+    TARGET(OP_SHIFT_RIGHT)
+    RUN_OP(op_shift_right)
+
+    TARGET(OP_BIT_NOT)
+    RUN_OP(op_bit_not)
+
+    TARGET(OP_NOT_EQUAL)
+    RUN_OP(op_not_equal)
+
+    TARGET(OP_LESS_EQUAL)
+    RUN_OP(op_less_equal)
+
+    TARGET(OP_GREATER_EQUAL)
+    RUN_OP(op_greater_equal)
+
+    TARGET(OP_AND)
+    RUN_OP(op_and)
+
+    TARGET(OP_OR)
+    RUN_OP(op_or)
+
+    TARGET(OP_STORE_VAR)
+    RUN_OP(op_store_var)
+
+    TARGET(OP_LOAD_VAR)
+    RUN_OP(op_load_var)
+
+    TARGET(OP_STORE_VAR_LONG)
+    RUN_OP(op_store_var_long)
+
+    TARGET(OP_LOAD_VAR_LONG)
+    RUN_OP(op_load_var_long)
+
+    TARGET(OP_LOAD_LOCAL)
+      push(vm, vm->slots[read_byte(vm)]);
+      DISPATCH();
+
+    TARGET(OP_STORE_LOCAL)
+      vm->slots[read_byte(vm)] = peek(vm, 0);
+      DISPATCH();
+
+    TARGET(OP_JUMP) {
+      uint16_t offset = read_short(vm);
+      vm->ip += offset;
+      DISPATCH();
     }
 
-    case OP_LESS: {
-      Value b = pop(vm);
-      Value a = pop(vm);
-      if (!value_is_number(a) || !value_is_number(b)) {
-        runtime_error(vm, "Operands must be numbers");
-        return false;
+    TARGET(OP_JUMP_IF_FALSE) {
+      uint16_t offset = read_short(vm);
+      if (!value_is_truthy(pop(vm))) {
+        vm->ip += offset;
       }
-      push(vm, value_bool(a.as.number < b.as.number));
-      value_free(&a);
-      value_free(&b);
-      break;
+      DISPATCH();
     }
 
-    case OP_MOD: {
-      Value b = pop(vm);
-      Value a = pop(vm);
-      if (!value_is_number(a) || !value_is_number(b)) {
-        runtime_error(vm, "Operands must be numbers");
-        return false;
+    TARGET(OP_JUMP_IF_TRUE) {
+      uint16_t offset = read_short(vm);
+      if (value_is_truthy(pop(vm))) {
+        vm->ip += offset;
       }
-      if (b.as.number == 0) {
-        runtime_error(vm, "Modulo by zero");
-        return false;
-      }
-      push(vm, value_number(fmod(a.as.number, b.as.number)));
-      value_free(&a);
-      value_free(&b);
-      break;
+      DISPATCH();
     }
 
-    case OP_NOT_EQUAL: {
-      Value b = pop(vm);
-      Value a = pop(vm);
-      push(vm, value_bool(!value_equals(a, b)));
-      value_free(&a);
-      value_free(&b);
-      break;
+    TARGET(OP_JUMP_LONG) {
+      uint32_t offset = read_int(vm);
+      vm->ip += offset;
+      DISPATCH();
     }
 
-    case OP_LESS_EQUAL: {
-      Value b = pop(vm);
-      Value a = pop(vm);
-      if (!value_is_number(a) || !value_is_number(b)) {
-        runtime_error(vm, "Operands must be numbers");
-        return false;
+    TARGET(OP_JUMP_IF_FALSE_LONG) {
+      uint32_t offset = read_int(vm);
+      if (!value_is_truthy(pop(vm))) {
+        vm->ip += offset;
       }
-      push(vm, value_bool(a.as.number <= b.as.number));
-      value_free(&a);
-      value_free(&b);
-      break;
+      DISPATCH();
     }
 
-    case OP_GREATER_EQUAL: {
-      Value b = pop(vm);
-      Value a = pop(vm);
-      if (!value_is_number(a) || !value_is_number(b)) {
-        runtime_error(vm, "Operands must be numbers");
-        return false;
+    TARGET(OP_JUMP_IF_TRUE_LONG) {
+      uint32_t offset = read_int(vm);
+      if (value_is_truthy(pop(vm))) {
+        vm->ip += offset;
       }
-      push(vm, value_bool(a.as.number >= b.as.number));
-      value_free(&a);
-      value_free(&b);
-      break;
+      DISPATCH();
     }
 
-    case OP_AND: {
-      Value b = pop(vm);
-      Value a = pop(vm);
-      push(vm, value_bool(value_is_truthy(a) && value_is_truthy(b)));
-      value_free(&a);
-      value_free(&b);
-      break;
-    }
-
-    case OP_OR: {
-      Value b = pop(vm);
-      Value a = pop(vm);
-      push(vm, value_bool(value_is_truthy(a) || value_is_truthy(b)));
-      value_free(&a);
-      value_free(&b);
-      break;
-    }
+    TARGET(OP_FOR_PREP)
+    RUN_OP(op_for_prep)
 
-    case OP_STORE_VAR: {
-      uint8_t slot = read_byte(vm);
-      if (slot >= GLOBALS_MAX) {
-        runtime_error(vm, "Too many global variables");
-        return false;
+    TARGET(OP_FOR_ITER) {
+      uint16_t offset = read_short(vm);
+      if (for_next(vm)) {
+        vm->ip -= offset;
+        JIT_ENTER(true); // A back-edge counts like a call
       }
-      vm->globals[slot] = peek(vm, 0);
-      if (slot >= vm->global_count) {
-        vm->global_count = slot + 1;
-      }
-      break;
+      DISPATCH();
     }
 
-    case OP_LOAD_VAR: {
-      uint8_t slot = read_byte(vm);
-      if (slot >= vm->global_count) {
-        runtime_error(vm, "Undefined variable");
-        return false;
+    TARGET(OP_FOR_ITER_LONG) {
+      uint32_t offset = read_int(vm);
+      if (for_next(vm)) {
+        vm->ip -= offset;
+        JIT_ENTER(true); // A back-edge counts like a call
       }
-      push(vm, vm->globals[slot]);
-      break;
+      DISPATCH();
     }
 
-    case OP_CHECK_NULL: {
-      Value v = peek(vm, 0);
-      if (value_is_null(v)) {
-        runtime_error(vm, "Variable may be null");
+    TARGET(OP_CALL) {
+      // [callee arg1 ... argN] -> the callee's window starts at arg1
+      uint8_t arg_count = read_byte(vm);
+      RiauFunction *function = callee(vm, arg_count);
+      if (!function)
         return false;
+
+#ifndef RIAU_GUARD_PAGES
+      if (vm->frame_count == FRAMES_MAX) {
+        guard_overflow();
       }
-      break;
+#endif
+      // Fill the frame in before counting it, so a fault on the guard page
+      // leaves the frame stack consistent
+      CallFrame *frame = &vm->frames[vm->frame_count];
+      frame->function = function;
+      frame->ip = vm->ip;
+      frame->chunk = vm->chunk;
+      frame->slots = vm->stack_top - arg_count;
+      vm->frame_count++;
+
+      vm->slots = frame->slots;
+      enter_function(vm, function);
+      JIT_ENTER(true);
+      DISPATCH();
     }
 
-    case OP_ENV: {
-      Value v = pop(vm);
-      if (!value_is_string(v)) {
-        runtime_error(vm, "env() requires a string argument");
-        value_free(&v);
+    TARGET(OP_TAIL_CALL) {
+      uint8_t arg_count = read_byte(vm);
+      RiauFunction *function = callee(vm, arg_count);
+      if (!function)
         return false;
-      }
 
-      char *env_value = getenv(v.as.string);
-      if (env_value) {
-        push(vm, value_string(env_value));
-      } else {
-        push(vm, value_null());
-      }
-      value_free(&v);
-      break;
+      // Slide the callee and its arguments down over the current call's
+      // window. The frame keeps the caller's return address, so the
+      // callee returns straight to it.
+      CallFrame *frame = &vm->frames[vm->frame_count - 1];
+      Value *base = frame->slots - 1;
+      memmove(base, vm->stack_top - arg_count - 1,
+              (arg_count + 1) * sizeof(Value));
+      vm->stack_top = base + arg_count + 1;
+      frame->function = function;
+      enter_function(vm, function);
+      JIT_ENTER(true);
+      DISPATCH();
+    }
+
+    TARGET(OP_CALL_NATIVE)
+    RUN_OP(op_call_native)
+
+    TARGET(OP_RETURN) {
+      if (vm->frame_count == 0)
+        return !vm->had_error; // return at top level ends the script
+
+      // The result replaces the callee; everything above it is dropped
+      Value result = peek(vm, 0);
+      CallFrame *frame = &vm->frames[--vm->frame_count];
+      vm->stack_top = frame->slots;
+      vm->stack_top[-1] = result;
+      vm->ip = frame->ip;
+      vm->chunk = frame->chunk;
+      vm->slots = vm->frame_count > 0 ? vm->frames[vm->frame_count - 1].slots
+                                      : vm->stack;
+      JIT_ENTER(false);
+      DISPATCH();
     }
 
-    case OP_INPUT: {
-      // Read from stdin (for POST data)
-      char *content_length_str = getenv("CONTENT_LENGTH");
-      size_t content_length = 0;
+    TARGET(OP_OBJECT_NEW)
+    RUN_OP(op_object_new)
 
-      if (content_length_str) {
-        content_length = (size_t)atoi(content_length_str);
-      }
+    TARGET(OP_ARRAY_NEW)
+    RUN_OP(op_array_new)
 
-      if (content_length > 0 && content_length < 1048576) { // Max 1MB
-        // Read exactly content_length bytes from stdin
-        char *buffer = malloc(content_length + 1);
-        if (buffer) {
-          size_t bytes_read = fread(buffer, 1, content_length, stdin);
-          buffer[bytes_read] = '\0';
-          push(vm, value_string(buffer));
-          free(buffer);
-        } else {
-          push(vm, value_string(""));
-        }
-      } else {
-        // No content or too large, return empty string
-        push(vm, value_string(""));
-      }
-      break;
+    TARGET(OP_LOAD_FIELD)
+    RUN_OP(op_load_field)
+
+    TARGET(OP_STORE_FIELD)
+    RUN_OP(op_store_field)
+
+    TARGET(OP_LOAD_FIELD_LONG)
+    RUN_OP(op_load_field_long)
+
+    TARGET(OP_STORE_FIELD_LONG)
+    RUN_OP(op_store_field_long)
+
+    TARGET(OP_OBJECT_GET)
+    RUN_OP(op_object_get)
+
+    TARGET(OP_OBJECT_SET)
+    RUN_OP(op_object_set)
+
+    TARGET(OP_CHECK_NULL)
+    RUN_OP(op_check_null)
+
+    TARGET(OP_ENV)
+    RUN_OP(op_env)
+
+    TARGET(OP_INPUT)
+    RUN_OP(op_input)
+
+    TARGET(OP_PRINT)
+    RUN_OP(op_print)
+
+    TARGET(OP_PRINT_CONST)
+    RUN_OP(op_print_const)
+
+    TARGET(OP_PRINT_POP)
+    RUN_OP(op_print_pop)
+
+    TARGET(OP_STORE_VAR_POP)
+    RUN_OP(op_store_var_pop)
+
+    TARGET(OP_ADD_VAR_CONST)
+    RUN_OP(op_add_var_const)
+
+    TARGET(OP_ADD_NUM_NUM)
+    NUM_NUM_OP(OP_ADD, NUMBER_VAL, +)
+
+    TARGET(OP_SUB_NUM_NUM)
+    NUM_NUM_OP(OP_SUB, NUMBER_VAL, -)
+
+    TARGET(OP_MUL_NUM_NUM)
+    NUM_NUM_OP(OP_MUL, NUMBER_VAL, *)
+
+    TARGET(OP_LESS_NUM_NUM)
+    NUM_NUM_OP(OP_LESS, BOOL_VAL, <)
+
+    TARGET(OP_LESS_EQUAL_NUM_NUM)
+    NUM_NUM_OP(OP_LESS_EQUAL, BOOL_VAL, <=)
+
+    TARGET(OP_GREATER_NUM_NUM)
+    NUM_NUM_OP(OP_GREATER, BOOL_VAL, >)
+
+    TARGET(OP_GREATER_EQUAL_NUM_NUM)
+    NUM_NUM_OP(OP_GREATER_EQUAL, BOOL_VAL, >=)
+
+    TARGET(OP_ADD_INT_INT)
+    INT_INT_OP(OP_ADD, INT_RESULT, +)
+
+    TARGET(OP_SUB_INT_INT)
+    INT_INT_OP(OP_SUB, INT_RESULT, -)
+
+    TARGET(OP_MUL_INT_INT)
+    INT_INT_OP(OP_MUL, INT_RESULT, *)
+
+    TARGET(OP_LESS_INT_INT)
+    INT_INT_OP(OP_LESS, BOOL_VAL, <)
+
+    TARGET(OP_LESS_EQUAL_INT_INT)
+    INT_INT_OP(OP_LESS_EQUAL, BOOL_VAL, <=)
+
+    TARGET(OP_GREATER_INT_INT)
+    INT_INT_OP(OP_GREATER, BOOL_VAL, >)
+
+    TARGET(OP_GREATER_EQUAL_INT_INT)
+    INT_INT_OP(OP_GREATER_EQUAL, BOOL_VAL, >=)
+
+    TARGET(OP_DIV_NUM_NUM) {
+      Value b = vm->stack_top[-1];
+      Value a = vm->stack_top[-2];
+      // The generic form reports division by zero
+      if (!IS_NUMERIC(a) || !IS_NUMERIC(b) || AS_DOUBLE(b) == 0)
+        DEOPTIMIZE(OP_DIV);
+      vm->stack_top[-2] = NUMBER_VAL(AS_DOUBLE(a) / AS_DOUBLE(b));
+      vm->stack_top--;
+      QUICKENED_HIT();
+      DISPATCH();
     }
 
-    case OP_PRINT: {
-      Value v = pop(vm);
-      value_print(v);
-      printf("\n");
-      value_free(&v);
-      break;
+    TARGET(OP_ADD_STR_STR) {
+      Value b = vm->stack_top[-1];
+      Value a = vm->stack_top[-2];
+      if (!IS_STRING(a) || !IS_STRING(b))
+        DEOPTIMIZE(OP_ADD);
+      vm->stack_top[-2] = STRING_VAL(string_concat(AS_STRING(a), AS_STRING(b)));
+      vm->stack_top--;
+      QUICKENED_HIT();
+      GC_SAFEPOINT();
+      DISPATCH();
     }
 
+#ifdef RIAU_COMPUTED_GOTO
+  TARGET_UNKNOWN:
+#else
     default:
+#endif
       runtime_error(vm, "Unknown opcode %d", instruction);
       return false;
+#ifndef RIAU_COMPUTED_GOTO
     }
   }
+#endif
+
+#undef TARGET
+#undef DISPATCH
+}
 
-  return !vm->had_error;
+bool vm_execute(VM *vm, Chunk *chunk) {
+  // The script's block locals are slots from the bottom of the stack
+  reset_stack(vm);
+  vm->chunk = chunk;
+  vm->ip = chunk->code;
+  if (!chunk->quicken) {
+    chunk->quicken = riau_calloc(chunk->count, sizeof(QuickenStats));
+  }
+
+  // A push past the end of the stack lands back here
+  bool overflow;
+  bool result = guard_call(run, vm, &overflow);
+  if (overflow) {
+    runtime_error(vm, "Stack overflow");
+  }
+  return result;
+}
+
+const char *vm_dispatch_mode(void) {
+#ifdef RIAU_COMPUTED_GOTO
+  return "computed-goto";
+#else
+  return "switch";
+#endif
 }
 
 void vm_print_error(VM *vm) {
@@ -2,17 +2,54 @@
 #define RIAU_VM_H
 
 #include "../bytecode/bytecode.h"
+#include "gc.h"
+#include "guard.h"
+#include "shape.h"
 #include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
 
-#define STACK_MAX 256
-#define FRAMES_MAX 64
-#define GLOBALS_MAX 256
+// Stack limits. Both stacks are guarded regions (guard.h) reserved at
+// their full size: memory is only committed as they grow, they never move,
+// and pushing past the end is reported as "Stack overflow".
+#define STACK_MAX (1024 * 1024)
+#define FRAMES_MAX (64 * 1024)
+
+// Globals grow on demand; slots are 16-bit operands
+#define GLOBALS_INITIAL 64
+#define GLOBALS_MAX (UINT16_MAX + 1)
+
+// Instruction dispatch: GCC and Clang get computed-goto threaded dispatch,
+// everything else (or a build with -DRIAU_NO_COMPUTED_GOTO) uses the
+// portable switch loop.
+#if defined(__GNUC__) && !defined(RIAU_NO_COMPUTED_GOTO)
+#define RIAU_COMPUTED_GOTO
+#endif
+
+// Adaptive quickening: a generic arithmetic or comparison instruction that
+// sees the same operand types QUICKEN_THRESHOLD times in a row is rewritten
+// to a type-specialized form. A site that fails its type guard
+// QUICKEN_MAX_DEOPTS times stays generic. Build with -DRIAU_NO_QUICKEN to
+// turn it off.
+#define QUICKEN_THRESHOLD 8
+#define QUICKEN_MAX_DEOPTS 4
+
+// Baseline JIT (jit.h): opt in with -DRIAU_JIT. Its templates are x86-64
+// machine code for the System V ABI, so elsewhere the flag is ignored and
+// everything runs on the interpreter. A chunk is compiled on its
+// JIT_THRESHOLD-th call or for loop iteration.
+#if defined(RIAU_JIT) && !(defined(__x86_64__) && defined(__linux__))
+#undef RIAU_JIT
+#endif
+#define JIT_THRESHOLD 100
+#define JIT_NEVER UINT32_MAX // vm->jit_threshold that turns the JIT off
 
 // Runtime value types
 typedef enum {
   VAL_NULL,
   VAL_BOOL,
-  VAL_NUMBER,
+  VAL_NUMBER, // double
+  VAL_INT,    // 32-bit integer; promoted to a double when a result overflows
   VAL_STRING,
   VAL_ARRAY,
   VAL_OBJECT,
@@ -20,84 +57,315 @@ typedef enum {
 } ValueType;
 
 // Forward declarations
-typedef struct Value Value;
 typedef struct RiauArray RiauArray;
 typedef struct RiauObject RiauObject;
 typedef struct RiauFunction RiauFunction;
 
 // Runtime value
+//
+// By default a Value is a type tag plus a union (16 bytes). Building with
+// -DRIAU_NAN_BOXING packs every value into one 64-bit word instead: numbers
+// are stored as plain doubles, everything else (ints included) lives in the
+// payload of a quiet NaN. Always go through the accessor macros below so the VM, stdlib
+// and tests compile in either mode.
+#ifdef RIAU_NAN_BOXING
+
+typedef uint64_t Value;
+
+// Quiet NaN bits shared by every non-number value
+#define QNAN ((uint64_t)0x7ffc000000000000)
+#define SIGN_BIT ((uint64_t)0x8000000000000000)
+
+// Singletons: QNAN with a small tag in the low bits
+#define TAG_NULL 1
+#define TAG_FALSE 2
+#define TAG_TRUE 3
+
+// Ints: QNAN plus bit 48, the integer in the low 32 bits
+#define INT_TAG ((uint64_t)(QNAN | ((uint64_t)1 << 48)))
+
+// Heap pointers: sign bit + QNAN, pointer kind in bits 48-49, address in
+// the low 48 bits
+#define PTR_TAG ((uint64_t)(SIGN_BIT | QNAN))
+#define PTR_KIND_MASK ((uint64_t)3 << 48)
+#define PTR_ADDRESS_MASK ((uint64_t)0x0000ffffffffffff)
+#define PTR_KIND_STRING ((uint64_t)0 << 48)
+#define PTR_KIND_ARRAY ((uint64_t)1 << 48)
+#define PTR_KIND_OBJECT ((uint64_t)2 << 48)
+#define PTR_KIND_FUNCTION ((uint64_t)3 << 48)
+
+static inline Value riau_number_to_value(double number) {
+  Value value;
+  memcpy(&value, &number, sizeof(double));
+  return value;
+}
+
+static inline double riau_value_to_number(Value value) {
+  double number;
+  memcpy(&number, &value, sizeof(Value));
+  return number;
+}
+
+#define PTR_VAL(kind, ptr) (PTR_TAG | (kind) | (uint64_t)(uintptr_t)(ptr))
+#define IS_PTR_KIND(v, kind) (((v) & (PTR_TAG | PTR_KIND_MASK)) == (PTR_TAG | (kind)))
+#define AS_PTR(v) ((void *)(uintptr_t)((v) & PTR_ADDRESS_MASK))
+
+#define NULL_VAL ((Value)(QNAN | TAG_NULL))
+#define BOOL_VAL(b) ((Value)(QNAN | ((b) ? TAG_TRUE : TAG_FALSE)))
+#define NUMBER_VAL(n) riau_number_to_value(n)
+#define INT_VAL(i) ((Value)(INT_TAG | (uint32_t)(int32_t)(i)))
+#define STRING_VAL(s) PTR_VAL(PTR_KIND_STRING, s)
+#define ARRAY_VAL(a) PTR_VAL(PTR_KIND_ARRAY, a)
+#define OBJECT_VAL(o) PTR_VAL(PTR_KIND_OBJECT, o)
+#define FUNCTION_VAL(f) PTR_VAL(PTR_KIND_FUNCTION, f)
+
+#define IS_NULL(v) ((v) == NULL_VAL)
+#define IS_BOOL(v) (((v) | 1) == (QNAN | TAG_TRUE))
+#define IS_NUMBER(v) (((v) & QNAN) != QNAN)
+#define IS_INT(v) (((v) >> 32) == (INT_TAG >> 32))
+#define IS_STRING(v) IS_PTR_KIND(v, PTR_KIND_STRING)
+#define IS_ARRAY(v) IS_PTR_KIND(v, PTR_KIND_ARRAY)
+#define IS_OBJECT(v) IS_PTR_KIND(v, PTR_KIND_OBJECT)
+#define IS_FUNCTION(v) IS_PTR_KIND(v, PTR_KIND_FUNCTION)
+
+#define AS_BOOL(v) ((v) == BOOL_VAL(true))
+#define AS_NUMBER(v) riau_value_to_number(v)
+#define AS_INT(v) ((int32_t)(uint32_t)(v))
+#define AS_STRING(v) ((RiauString *)AS_PTR(v))
+#define AS_ARRAY(v) ((RiauArray *)AS_PTR(v))
+#define AS_OBJECT(v) ((RiauObject *)AS_PTR(v))
+#define AS_FUNCTION(v) ((RiauFunction *)AS_PTR(v))
+
+// Collector access: any heap value, and the same kind of value pointing at
+// another (moved) object
+#define IS_HEAP(v) (((v) & PTR_TAG) == PTR_TAG)
+#define AS_GC(v) ((GcHeader *)AS_PTR(v))
+#define HEAP_VAL(v, gc) (((v) & ~PTR_ADDRESS_MASK) | (uint64_t)(uintptr_t)(gc))
+
+static inline ValueType riau_value_type(Value value) {
+  if (IS_NUMBER(value))
+    return VAL_NUMBER;
+  if (IS_INT(value))
+    return VAL_INT;
+  if (IS_NULL(value))
+    return VAL_NULL;
+  if (IS_BOOL(value))
+    return VAL_BOOL;
+  switch (value & PTR_KIND_MASK) {
+  case PTR_KIND_STRING:
+    return VAL_STRING;
+  case PTR_KIND_ARRAY:
+    return VAL_ARRAY;
+  case PTR_KIND_OBJECT:
+    return VAL_OBJECT;
+  default:
+    return VAL_FUNCTION;
+  }
+}
+
+#define VALUE_TYPE(v) riau_value_type(v)
+
+#else
+
+typedef struct Value Value;
+
 struct Value {
   ValueType type;
   union {
     bool boolean;
     double number;
-    char *string;
+    int32_t integer;
+    RiauString *string;
     RiauArray *array;
     RiauObject *object;
     RiauFunction *function;
+    GcHeader *gc;
   } as;
 };
 
+#define NULL_VAL ((Value){VAL_NULL, {.number = 0}})
+#define BOOL_VAL(b) ((Value){VAL_BOOL, {.boolean = (b)}})
+#define NUMBER_VAL(n) ((Value){VAL_NUMBER, {.number = (n)}})
+#define INT_VAL(i) ((Value){VAL_INT, {.integer = (i)}})
+#define STRING_VAL(s) ((Value){VAL_STRING, {.string = (s)}})
+#define ARRAY_VAL(a) ((Value){VAL_ARRAY, {.array = (a)}})
+#define OBJECT_VAL(o) ((Value){VAL_OBJECT, {.object = (o)}})
+#define FUNCTION_VAL(f) ((Value){VAL_FUNCTION, {.function = (f)}})
+
+#define IS_NULL(v) ((v).type == VAL_NULL)
+#define IS_BOOL(v) ((v).type == VAL_BOOL)
+#define IS_NUMBER(v) ((v).type == VAL_NUMBER)
+#define IS_INT(v) ((v).type == VAL_INT)
+#define IS_STRING(v) ((v).type == VAL_STRING)
+#define IS_ARRAY(v) ((v).type == VAL_ARRAY)
+#define IS_OBJECT(v) ((v).type == VAL_OBJECT)
+#define IS_FUNCTION(v) ((v).type == VAL_FUNCTION)
+
+#define AS_BOOL(v) ((v).as.boolean)
+#define AS_NUMBER(v) ((v).as.number)
+#define AS_INT(v) ((v).as.integer)
+#define AS_STRING(v) ((v).as.string)
+#define AS_ARRAY(v) ((v).as.array)
+#define AS_OBJECT(v) ((v).as.object)
+#define AS_FUNCTION(v) ((v).as.function)
+
+#define IS_HEAP(v) ((v).type >= VAL_STRING)
+#define AS_GC(v) ((v).as.gc)
+#define HEAP_VAL(v, g) ((Value){(v).type, {.gc = (g)}})
+
+#define VALUE_TYPE(v) ((v).type)
+
+#endif // RIAU_NAN_BOXING
+
+#define AS_CSTRING(v) (AS_STRING(v)->chars)
+
+// Either kind of number. IS_NUMBER and AS_NUMBER only cover doubles;
+// AS_DOUBLE widens an int.
+#define IS_NUMERIC(v) (IS_NUMBER(v) || IS_INT(v))
+#define AS_DOUBLE(v) (IS_INT(v) ? (double)AS_INT(v) : AS_NUMBER(v))
+
+// Result of integer arithmetic: an int while it fits in 32 bits, a double
+// once it overflows
+static inline Value riau_int_to_value(int64_t n) {
+  if (n >= INT32_MIN && n <= INT32_MAX)
+    return INT_VAL((int32_t)n);
+  return NUMBER_VAL((double)n);
+}
+
+#define INT_RESULT(n) riau_int_to_value(n)
+
 // Array type
 struct RiauArray {
+  GcHeader gc;
   Value *elements;
   size_t count;
   size_t capacity;
-  int ref_count;
 };
 
-// Object type (hash map)
-typedef struct {
-  char *key;
-  Value value;
-} ObjectEntry;
-
+// Object type
+//
+// The object's shape maps keys to slots; the values live in `slots`,
+// indexed by slot number. Objects built the same way share a shape, which
+// is what the property caches in each chunk key on.
 struct RiauObject {
-  ObjectEntry *entries;
-  size_t count;
-  size_t capacity;
-  int ref_count;
-};
-
-// Function type
-struct RiauFunction {
-  Chunk *chunk;
-  int arity;
-  char *name;
-  int ref_count;
+  GcHeader gc;
+  Shape *shape;
+  Value *slots;
+  uint32_t slot_capacity;
 };
 
 // Call frame
+//
+// A call's window starts at its first argument, right where the caller
+// pushed it, with the callee itself just below: arguments are never
+// copied, and returning resets the stack top to the window.
 typedef struct {
   RiauFunction *function;
-  uint8_t *ip;
+  uint8_t *ip;  // Where the caller resumes
+  Chunk *chunk; // The caller's chunk
   Value *slots;
 } CallFrame;
 
-// Virtual Machine
+// Native function. `args` points at the arguments on the VM stack; they
+// are not copied.
+typedef Value (*NativeFunction)(int arg_count, Value *args);
+
 typedef struct {
+  const char *name;
+  NativeFunction function;
+} NativeEntry;
+
+// Virtual Machine
+typedef struct VM {
   Chunk *chunk;
   uint8_t *ip;
-  Value stack[STACK_MAX];
+  Value *stack;
   Value *stack_top;
-  CallFrame frames[FRAMES_MAX];
+  Value *stack_limit;
+  GuardRegion stack_region;
+  Value *slots; // Window of the innermost call
+  CallFrame *frames;
   int frame_count;
-  Value globals[GLOBALS_MAX];
+  GuardRegion frame_region;
+  Value *globals;
   int global_count;
+  int global_capacity;
+  const NativeEntry *natives; // Set by stdlib_register_builtins()
+  int native_count;
+#ifdef RIAU_JIT
+  uint32_t jit_threshold; // JIT_THRESHOLD; 0 compiles chunks on first entry
+#endif
   bool had_error;
   char error_message[512];
 } VM;
 
+// Instructions whose body is an op_* function in vm.c. run() inlines them;
+// native code (jit.h, aot.h) calls them for whatever it does not translate
+// itself.
+#define VM_OP_BODIES(X)                                                        \
+  X(OP_ADD, op_add)                                                            \
+  X(OP_SUB, op_sub)                                                            \
+  X(OP_MUL, op_mul)                                                            \
+  X(OP_DIV, op_div)                                                            \
+  X(OP_MOD, op_mod)                                                            \
+  X(OP_NEGATE, op_negate)                                                      \
+  X(OP_NOT, op_not)                                                            \
+  X(OP_EQUAL, op_equal)                                                        \
+  X(OP_NOT_EQUAL, op_not_equal)                                                \
+  X(OP_GREATER, op_greater)                                                    \
+  X(OP_GREATER_EQUAL, op_greater_equal)                                        \
+  X(OP_LESS, op_less)                                                          \
+  X(OP_LESS_EQUAL, op_less_equal)                                              \
+  X(OP_AND, op_and)                                                            \
+  X(OP_OR, op_or)                                                              \
+  X(OP_BIT_AND, op_bit_and)                                                    \
+  X(OP_BIT_OR, op_bit_or)                                                      \
+  X(OP_BIT_XOR, op_bit_xor)                                                    \
+  X(OP_BIT_NOT, op_bit_not)                                                    \
+  X(OP_SHIFT_LEFT, op_shift_left)                                              \
+  X(OP_SHIFT_RIGHT, op_shift_right)                                            \
+  X(OP_STORE_VAR, op_store_var)                                                \
+  X(OP_LOAD_VAR, op_load_var)                                                  \
+  X(OP_STORE_VAR_LONG, op_store_var_long)                                      \
+  X(OP_LOAD_VAR_LONG, op_load_var_long)                                        \
+  X(OP_STORE_VAR_POP, op_store_var_pop)                                        \
+  X(OP_ADD_VAR_CONST, op_add_var_const)                                        \
+  X(OP_CALL_NATIVE, op_call_native)                                            \
+  X(OP_OBJECT_NEW, op_object_new)                                              \
+  X(OP_ARRAY_NEW, op_array_new)                                                \
+  X(OP_FOR_PREP, op_for_prep)                                                  \
+  X(OP_LOAD_FIELD, op_load_field)                                              \
+  X(OP_STORE_FIELD, op_store_field)                                            \
+  X(OP_LOAD_FIELD_LONG, op_load_field_long)                                    \
+  X(OP_STORE_FIELD_LONG, op_store_field_long)                                  \
+  X(OP_OBJECT_GET, op_object_get)                                              \
+  X(OP_OBJECT_SET, op_object_set)                                              \
+  X(OP_CHECK_NULL, op_check_null)                                              \
+  X(OP_ENV, op_env)                                                            \
+  X(OP_INPUT, op_input)                                                        \
+  X(OP_PRINT, op_print)                                                        \
+  X(OP_PRINT_CONST, op_print_const)                                            \
+  X(OP_PRINT_POP, op_print_pop)
+
+// FOR_ITER without its jump, for native code: pushes whether the loop goes
+// on, having moved the loop variable to the next element if so
+bool vm_for_next(VM *vm);
+
 // VM operations
 void vm_init(VM *vm);
 void vm_free(VM *vm);
 bool vm_execute(VM *vm, Chunk *chunk);
 void vm_print_error(VM *vm);
 
+// Set a global before running a chunk that reads it (vm/snapshot.h)
+void vm_define_global(VM *vm, uint16_t slot, Value value);
+const char *vm_dispatch_mode(void);
+
 // Value operations
 Value value_null();
 Value value_bool(bool b);
 Value value_number(double n);
+Value value_int(int64_t n);
 Value value_string(const char *str);
 Value value_array();
 Value value_object();
@@ -111,16 +379,36 @@ bool value_is_truthy(Value v);
 bool value_equals(Value a, Value b);
 
 void value_print(Value v);
-void value_free(Value *v);
+
+// Garbage collector hooks (see gc.h)
+void gc_visit_value(Value *value);
+
+// Call after storing `value` into a field of `owner`
+static inline void gc_write_barrier(GcHeader *owner, Value value) {
+  if ((owner->flags & GC_OLD) && IS_HEAP(value)) {
+    gc_barrier_slow(owner, AS_GC(value));
+  }
+}
 
 // Array operations
 void array_push(RiauArray *arr, Value value);
 Value array_get(RiauArray *arr, size_t index);
 void array_set(RiauArray *arr, size_t index, Value value);
+// The index a numeric key names. False unless the key is a whole number,
+// which rules out NaN and infinities; a negative index, or one too large
+// for size_t, becomes SIZE_MAX, past the end of every array.
+bool array_index(Value key, size_t *index);
 
 // Object operations
 void object_set(RiauObject *obj, const char *key, Value value);
 Value object_get(RiauObject *obj, const char *key);
 bool object_has(RiauObject *obj, const char *key);
+bool object_delete(RiauObject *obj, const char *key);
+
+// Property access through an instruction's inline cache
+Value property_get(RiauObject *obj, const RiauString *key,
+                   PropertyCache *cache);
+void property_set(RiauObject *obj, const RiauString *key, Value value,
+                  PropertyCache *cache);
 
 #endif // RIAU_VM_H
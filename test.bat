@@ -11,12 +11,28 @@ echo Building tests...
 gcc -Wall -Wextra -std=c11 -O2 -Iengine -c engine/lexer/lexer.c -o build/lexer.o
 gcc -Wall -Wextra -std=c11 -O2 -Iengine -c engine/ast/ast.c -o build/ast.o
 gcc -Wall -Wextra -std=c11 -O2 -Iengine -c engine/parser/parser.c -o build/parser.o
+gcc -Wall -Wextra -std=c11 -O2 -Iengine -c engine/optimizer/optimizer.c -o build/optimizer.o
 gcc -Wall -Wextra -std=c11 -O2 -Iengine -c engine/bytecode/bytecode.c -o build/bytecode.o
+gcc -Wall -Wextra -std=c11 -O2 -Iengine -c engine/bytecode/peephole.c -o build/peephole.o
+gcc -Wall -Wextra -std=c11 -O2 -Iengine -c engine/bytecode/compiler.c -o build/compiler.o
 gcc -Wall -Wextra -std=c11 -O2 -Iengine -c engine/vm/vm.c -o build/vm.o
+gcc -Wall -Wextra -std=c11 -O2 -Iengine -c engine/vm/riau_string.c -o build/riau_string.o
+gcc -Wall -Wextra -std=c11 -O2 -Iengine -c engine/vm/key_index.c -o build/key_index.o
+gcc -Wall -Wextra -std=c11 -O2 -Iengine -c engine/vm/shape.c -o build/shape.o
+gcc -Wall -Wextra -std=c11 -O2 -Iengine -c engine/bytecode/regcode.c -o build/regcode.o
+gcc -Wall -Wextra -std=c11 -O2 -Iengine -c engine/vm/reg_vm.c -o build/reg_vm.o
+gcc -Wall -Wextra -std=c11 -O2 -Iengine -c engine/vm/gc.c -o build/gc.o
+gcc -Wall -Wextra -std=c11 -O2 -Iengine -c engine/runtime/arena.c -o build/arena.o
+gcc -Wall -Wextra -std=c11 -O2 -Iengine -c engine/vm/guard.c -o build/guard.o
+gcc -Wall -Wextra -std=c11 -O2 -Iengine -c engine/stdlib/stdlib.c -o build/stdlib.o
+gcc -Wall -Wextra -std=c11 -O2 -Iengine -c engine/vm/jit.c -o build/jit.o
+gcc -Wall -Wextra -std=c11 -O2 -Iengine -c engine/vm/aot.c -o build/aot.o
+gcc -Wall -Wextra -std=c11 -O2 -Iengine -c engine/bytecode/chunk_cache.c -o build/chunk_cache.o
+gcc -Wall -Wextra -std=c11 -O2 -Iengine -c engine/vm/snapshot.c -o build/snapshot.o
 
 REM Build and run lexer tests
 echo.
-echo [1/3] Lexer Tests
+echo [1/5] Lexer Tests
 gcc -Wall -Wextra -std=c11 -O2 -Iengine -o build/test_lexer.exe engine/tests/test_lexer.c build/lexer.o
 if errorlevel 1 goto error
 build\test_lexer.exe
@@ -24,20 +40,36 @@ if errorlevel 1 goto error
 
 REM Build and run parser tests
 echo.
-echo [2/3] Parser Tests
-gcc -Wall -Wextra -std=c11 -O2 -Iengine -o build/test_parser.exe engine/tests/test_parser.c build/lexer.o build/ast.o build/parser.o
+echo [2/5] Parser Tests
+gcc -Wall -Wextra -std=c11 -O2 -Iengine -o build/test_parser.exe engine/tests/test_parser.c build/lexer.o build/ast.o build/parser.o build/arena.o build/optimizer.o -lm
 if errorlevel 1 goto error
 build\test_parser.exe
 if errorlevel 1 goto error
 
 REM Build and run VM tests
 echo.
-echo [3/3] VM Tests
-gcc -Wall -Wextra -std=c11 -O2 -Iengine -o build/test_vm.exe engine/tests/test_vm.c build/bytecode.o build/vm.o -lm
+echo [3/5] VM Tests
+gcc -Wall -Wextra -std=c11 -O2 -Iengine -o build/test_vm.exe engine/tests/test_vm.c build/bytecode.o build/vm.o build/riau_string.o build/key_index.o build/shape.o build/regcode.o build/reg_vm.o build/gc.o build/arena.o build/guard.o build/stdlib.o build/jit.o build/aot.o build/chunk_cache.o build/snapshot.o -lm
 if errorlevel 1 goto error
 build\test_vm.exe
 if errorlevel 1 goto error
 
+REM Build and run peephole optimizer tests
+echo.
+echo [4/5] Peephole Optimizer Tests
+gcc -Wall -Wextra -std=c11 -O2 -Iengine -o build/test_peephole.exe engine/tests/test_peephole.c build/bytecode.o build/peephole.o build/riau_string.o build/gc.o build/vm.o build/key_index.o build/shape.o build/arena.o build/guard.o build/stdlib.o build/jit.o -lm
+if errorlevel 1 goto error
+build\test_peephole.exe
+if errorlevel 1 goto error
+
+REM Build and run compiler tests
+echo.
+echo [5/5] Compiler Tests
+gcc -Wall -Wextra -std=c11 -O2 -Iengine -o build/test_compiler.exe engine/tests/test_compiler.c build/lexer.o build/ast.o build/parser.o build/optimizer.o build/compiler.o build/bytecode.o build/peephole.o build/vm.o build/riau_string.o build/key_index.o build/shape.o build/gc.o build/arena.o build/guard.o build/stdlib.o build/jit.o -lm
+if errorlevel 1 goto error
+build\test_compiler.exe
+if errorlevel 1 goto error
+
 echo.
 echo ========================================
 echo All tests passed!
@@ -3,6 +3,9 @@
 
 set -e
 
+# Extra build options (e.g. RIAU_CFLAGS=-DRIAU_NAN_BOXING) are appended
+CFLAGS="-Wall -Wextra -std=c11 -O2 -Iengine $RIAU_CFLAGS"
+
 echo "========================================"
 echo "Running Riau Test Suite"
 echo "========================================"
@@ -10,30 +13,58 @@ echo ""
 
 # Build tests
 echo "Building tests..."
-gcc -Wall -Wextra -std=c11 -O2 -Iengine -c engine/lexer/lexer.c -o build/lexer.o
-gcc -Wall -Wextra -std=c11 -O2 -Iengine -c engine/ast/ast.c -o build/ast.o
-gcc -Wall -Wextra -std=c11 -O2 -Iengine -c engine/parser/parser.c -o build/parser.o
-gcc -Wall -Wextra -std=c11 -O2 -Iengine -c engine/bytecode/bytecode.c -o build/bytecode.o
-gcc -Wall -Wextra -std=c11 -O2 -Iengine -c engine/vm/vm.c -o build/vm.o
+gcc $CFLAGS -c engine/lexer/lexer.c -o build/lexer.o
+gcc $CFLAGS -c engine/ast/ast.c -o build/ast.o
+gcc $CFLAGS -c engine/parser/parser.c -o build/parser.o
+gcc $CFLAGS -c engine/optimizer/optimizer.c -o build/optimizer.o
+gcc $CFLAGS -c engine/bytecode/bytecode.c -o build/bytecode.o
+gcc $CFLAGS -c engine/bytecode/peephole.c -o build/peephole.o
+gcc $CFLAGS -c engine/bytecode/compiler.c -o build/compiler.o
+gcc $CFLAGS -c engine/vm/vm.c -o build/vm.o
+gcc $CFLAGS -c engine/vm/riau_string.c -o build/riau_string.o
+gcc $CFLAGS -c engine/vm/key_index.c -o build/key_index.o
+gcc $CFLAGS -c engine/vm/shape.c -o build/shape.o
+gcc $CFLAGS -c engine/bytecode/regcode.c -o build/regcode.o
+gcc $CFLAGS -c engine/vm/reg_vm.c -o build/reg_vm.o
+gcc $CFLAGS -c engine/vm/gc.c -o build/gc.o
+gcc $CFLAGS -c engine/runtime/arena.c -o build/arena.o
+gcc $CFLAGS -c engine/vm/guard.c -o build/guard.o
+gcc $CFLAGS -c engine/stdlib/stdlib.c -o build/stdlib.o
+gcc $CFLAGS -c engine/vm/jit.c -o build/jit.o
+gcc $CFLAGS -c engine/vm/aot.c -o build/aot.o
+gcc $CFLAGS -c engine/bytecode/chunk_cache.c -o build/chunk_cache.o
+gcc $CFLAGS -c engine/vm/snapshot.c -o build/snapshot.o
 
 # Build and run lexer tests
 echo ""
-echo "[1/3] Lexer Tests"
-gcc -Wall -Wextra -std=c11 -O2 -Iengine -o build/test_lexer engine/tests/test_lexer.c build/lexer.o
+echo "[1/5] Lexer Tests"
+gcc $CFLAGS -o build/test_lexer engine/tests/test_lexer.c build/lexer.o
 ./build/test_lexer
 
 # Build and run parser tests
 echo ""
-echo "[2/3] Parser Tests"
-gcc -Wall -Wextra -std=c11 -O2 -Iengine -o build/test_parser engine/tests/test_parser.c build/lexer.o build/ast.o build/parser.o
+echo "[2/5] Parser Tests"
+gcc $CFLAGS -o build/test_parser engine/tests/test_parser.c build/lexer.o build/ast.o build/parser.o build/arena.o build/optimizer.o -lm
 ./build/test_parser
 
 # Build and run VM tests
 echo ""
-echo "[3/3] VM Tests"
-gcc -Wall -Wextra -std=c11 -O2 -Iengine -o build/test_vm engine/tests/test_vm.c build/bytecode.o build/vm.o -lm
+echo "[3/5] VM Tests"
+gcc $CFLAGS -o build/test_vm engine/tests/test_vm.c build/bytecode.o build/vm.o build/riau_string.o build/key_index.o build/shape.o build/regcode.o build/reg_vm.o build/gc.o build/arena.o build/guard.o build/stdlib.o build/jit.o build/aot.o build/chunk_cache.o build/snapshot.o -lm
 ./build/test_vm
 
+# Build and run peephole optimizer tests
+echo ""
+echo "[4/5] Peephole Optimizer Tests"
+gcc $CFLAGS -o build/test_peephole engine/tests/test_peephole.c build/bytecode.o build/peephole.o build/riau_string.o build/gc.o build/vm.o build/key_index.o build/shape.o build/arena.o build/guard.o build/stdlib.o build/jit.o -lm
+./build/test_peephole
+
+# Build and run compiler tests
+echo ""
+echo "[5/5] Compiler Tests"
+gcc $CFLAGS -o build/test_compiler engine/tests/test_compiler.c build/lexer.o build/ast.o build/parser.o build/optimizer.o build/compiler.o build/bytecode.o build/peephole.o build/vm.o build/riau_string.o build/key_index.o build/shape.o build/gc.o build/arena.o build/guard.o build/stdlib.o build/jit.o -lm
+./build/test_compiler
+
 echo ""
 echo "========================================"
 echo "All tests passed!"
@@ -0,0 +1,26 @@
+#!/bin/bash
+# Compile a script ahead of time into a native executable: riau --emit-c
+# writes it out as C, which is built against the runtime with -DRIAU_AOT.
+# The executable runs the script without lexing, parsing or compiling it.
+# Needs bin/riau (build.sh). Extra options in RIAU_CFLAGS are passed on.
+# Usage: tools/aot_build.sh script.riau [executable]
+
+set -e
+
+if [ $# -lt 1 ]; then
+  echo "Usage: tools/aot_build.sh script.riau [executable]"
+  exit 64
+fi
+
+script=$1
+name=$(basename "$script" .riau)
+output=${2:-build/$name}
+CFLAGS="-Wall -Wextra -std=c11 -O2 -Iengine -DRIAU_AOT $RIAU_CFLAGS"
+mkdir -p build
+
+./bin/riau --emit-c "$script" >"build/aot_$name.c"
+gcc $CFLAGS -o "$output" "build/aot_$name.c" \
+  engine/bytecode/bytecode.c engine/stdlib/stdlib.c engine/vm/vm.c \
+  engine/vm/aot.c engine/vm/jit.c engine/vm/riau_string.c \
+  engine/vm/key_index.c engine/vm/shape.c engine/vm/gc.c engine/vm/guard.c \
+  engine/runtime/arena.c -lm
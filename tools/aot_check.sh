@@ -0,0 +1,57 @@
+#!/bin/bash
+# Validate ahead-of-time compilation: build every script into a native
+# executable with tools/aot_build.sh and check that it prints the same
+# output, errors and exit status as the interpreter does.
+# Usage: tools/aot_check.sh [file.riau...]
+
+set -e
+
+bash build.sh >/dev/null
+
+if [ $# -eq 0 ]; then
+  set -- examples/*.riau www/*.riau tools/*.riau
+fi
+
+# Program output only: the interpreter frames it with status lines. stdin
+# is closed so scripts reading input see none either way.
+interpret() {
+  local status=0
+  ./bin/riau "$1" </dev/null >build/aot_out 2>build/aot_err || status=$?
+  sed -n '/^--- Execution Output ---$/,/^--- End Output ---$/p' build/aot_out |
+    sed '1d;$d'
+  cat build/aot_err
+  echo "exit $status"
+}
+
+run_native() {
+  local status=0
+  "$1" </dev/null >build/aot_out 2>build/aot_err || status=$?
+  cat build/aot_out build/aot_err
+  echo "exit $status"
+}
+
+failed=0
+checked=0
+for script in "$@"; do
+  # Scripts that do not compile have nothing to compare
+  if ! ./bin/riau --emit-c "$script" >/dev/null 2>&1; then
+    continue
+  fi
+  tools/aot_build.sh "$script" build/aot_program
+  interpreted=$(interpret "$script")
+  native=$(run_native build/aot_program)
+  if [ "$interpreted" != "$native" ]; then
+    echo "MISMATCH: $script"
+    diff <(echo "$interpreted") <(echo "$native") | head -20 || true
+    failed=1
+  fi
+  checked=$((checked + 1))
+done
+
+echo ""
+if [ $failed -eq 0 ]; then
+  echo "AOT check: $checked scripts match the interpreter"
+else
+  echo "AOT check: mismatches found"
+fi
+exit $failed
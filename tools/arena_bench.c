@@ -0,0 +1,99 @@
+// Per-request allocation benchmark: malloc vs arena
+//
+// Runs the front end of one request (parse, semantic analysis, compile)
+// many times over the same script, then tears everything down: node by
+// node with malloc/free, or by releasing the arena in one shot. Reports
+// the average time per request for each mode, see tools/arena_bench.sh.
+#include "../engine/bytecode/compiler.h"
+#include "../engine/lexer/lexer.h"
+#include "../engine/parser/parser.h"
+#include "../engine/runtime/arena.h"
+#include "../engine/semantic/semantic.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define DEFAULT_SCRIPT "www/about.riau"
+#define DEFAULT_RUNS 2000
+
+static char *read_source(const char *path) {
+  FILE *file = fopen(path, "rb");
+  if (!file) {
+    fprintf(stderr, "Could not open file \"%s\"\n", path);
+    exit(74);
+  }
+  fseek(file, 0L, SEEK_END);
+  size_t size = ftell(file);
+  rewind(file);
+  char *source = malloc(size + 1);
+  source[fread(source, 1, size, file)] = '\0';
+  fclose(file);
+  return source;
+}
+
+// One request; returns false if the script does not compile
+static bool request(const char *source) {
+  Lexer lexer;
+  lexer_init(&lexer, source);
+  Parser parser;
+  parser_init(&parser, &lexer);
+  ASTNode *ast = parser_parse(&parser);
+
+  SemanticAnalyzer analyzer;
+  semantic_init(&analyzer);
+  bool ok = !parser_had_error(&parser) && semantic_analyze(&analyzer, ast);
+
+  Chunk chunk;
+  chunk_init(&chunk);
+  Compiler compiler;
+  compiler_init(&compiler, &chunk);
+  ok = ok && compiler_compile(&compiler, ast);
+
+  if (arena_active) {
+    arena_release();
+  } else {
+    chunk_free(&chunk);
+    semantic_free(&analyzer);
+    ast_free(ast);
+  }
+  return ok;
+}
+
+static void report(const char *name, int runs, clock_t start, clock_t end) {
+  double seconds = (double)(end - start) / CLOCKS_PER_SEC;
+  printf("%-7s time: %.3fs  us/request: %8.2f\n", name, seconds,
+         seconds * 1e6 / runs);
+}
+
+int main(int argc, char *argv[]) {
+  const char *path = argc > 1 ? argv[1] : DEFAULT_SCRIPT;
+  int runs = argc > 2 ? atoi(argv[2]) : DEFAULT_RUNS;
+  if (runs <= 0) {
+    runs = DEFAULT_RUNS;
+  }
+
+  char *source = read_source(path);
+  if (!request(source)) {
+    fprintf(stderr, "\"%s\" does not compile\n", path);
+    return 65;
+  }
+
+  clock_t start = clock();
+  for (int run = 0; run < runs; run++) {
+    request(source);
+  }
+  clock_t end = clock();
+  report("malloc", runs, start, end);
+
+  arena_enable();
+  start = clock();
+  for (int run = 0; run < runs; run++) {
+    request(source);
+  }
+  end = clock();
+  report("arena", runs, start, end);
+
+  free(source);
+  return 0;
+}
@@ -0,0 +1,18 @@
+#!/bin/bash
+# Compare per-request front-end cost with malloc and with the arena
+# Usage: tools/arena_bench.sh [script.riau] [runs]
+
+set -e
+
+CFLAGS="-Wall -Wextra -std=c11 -O2 -Iengine $RIAU_CFLAGS"
+mkdir -p build
+
+gcc $CFLAGS -o build/arena_bench tools/arena_bench.c \
+  engine/lexer/lexer.c engine/ast/ast.c engine/parser/parser.c \
+  engine/semantic/semantic.c engine/bytecode/bytecode.c \
+  engine/bytecode/compiler.c engine/bytecode/peephole.c \
+  engine/stdlib/stdlib.c engine/vm/vm.c \
+  engine/vm/jit.c engine/vm/riau_string.c engine/vm/key_index.c \
+  engine/vm/shape.c engine/vm/gc.c engine/vm/guard.c engine/runtime/arena.c -lm
+
+./build/arena_bench "$@"
@@ -0,0 +1,89 @@
+// Call overhead benchmark: recursive fib
+//
+// Compiles a recursive fib and runs it on the stack VM, reporting the time
+// per call. fib(n) makes 2 * fib(n + 1) - 1 calls, each of which does one
+// compare, one jump, and (past the base case) two subtractions and an
+// addition, so the number is dominated by call and return. See
+// tools/call_bench.sh.
+#include "../engine/bytecode/compiler.h"
+#include "../engine/lexer/lexer.h"
+#include "../engine/parser/parser.h"
+#include "../engine/semantic/semantic.h"
+#include "../engine/vm/vm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define DEFAULT_N 30
+#define DEFAULT_RUNS 5
+
+static const char *SOURCE = "fn fib(n) {\n"
+                            "  if n < 2 {\n"
+                            "    return n\n"
+                            "  }\n"
+                            "  return fib(n - 1) + fib(n - 2)\n"
+                            "}\n"
+                            "let result = fib(%d)\n";
+
+static double fib(int n) { return n < 2 ? n : fib(n - 1) + fib(n - 2); }
+
+int main(int argc, char *argv[]) {
+  int n = argc > 1 ? atoi(argv[1]) : DEFAULT_N;
+  int runs = argc > 2 ? atoi(argv[2]) : DEFAULT_RUNS;
+  if (n <= 0 || n > 40) {
+    n = DEFAULT_N;
+  }
+  if (runs <= 0) {
+    runs = DEFAULT_RUNS;
+  }
+
+  char source[256];
+  snprintf(source, sizeof(source), SOURCE, n);
+
+  Lexer lexer;
+  lexer_init(&lexer, source);
+  Parser parser;
+  parser_init(&parser, &lexer);
+  ASTNode *ast = parser_parse(&parser);
+
+  SemanticAnalyzer analyzer;
+  semantic_init(&analyzer);
+  Chunk chunk;
+  chunk_init(&chunk);
+  Compiler compiler;
+  compiler_init(&compiler, &chunk);
+  if (parser_had_error(&parser) || !semantic_analyze(&analyzer, ast) ||
+      !compiler_compile(&compiler, ast)) {
+    fprintf(stderr, "fib does not compile\n");
+    return 65;
+  }
+
+  double calls = 2 * fib(n + 1) - 1;
+  double best = 0;
+  for (int run = 0; run < runs; run++) {
+    VM vm;
+    vm_init(&vm);
+    clock_t start = clock();
+    bool ok = vm_execute(&vm, &chunk);
+    clock_t end = clock();
+    if (!ok || AS_DOUBLE(vm.globals[1]) != fib(n)) {
+      vm_print_error(&vm);
+      return 70;
+    }
+    vm_free(&vm);
+
+    double seconds = (double)(end - start) / CLOCKS_PER_SEC;
+    if (run == 0 || seconds < best) {
+      best = seconds;
+    }
+  }
+
+  printf("fib(%d): %.0f calls  best of %d: %.3fs  ns/call: %.2f\n", n, calls,
+         runs, best, best * 1e9 / calls);
+
+  chunk_free(&chunk);
+  semantic_free(&analyzer);
+  ast_free(ast);
+  gc_free_heap();
+  return 0;
+}
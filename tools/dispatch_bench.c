@@ -0,0 +1,98 @@
+// Dispatch benchmark for the Riau VM
+//
+// Builds a chunk that repeats the inner loop body of tools/benchmark.riau
+// (`result = i + j * k - l` plus a comparison) and runs it many times, then
+// reports the average cost per executed instruction. Build it once per
+// dispatch mode to compare them, see tools/dispatch_bench.sh.
+#include "../engine/bytecode/bytecode.h"
+#include "../engine/vm/vm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define BODY_REPEAT 2000
+#define DEFAULT_RUNS 500
+
+enum { SLOT_I, SLOT_J, SLOT_K, SLOT_L, SLOT_RESULT, SLOT_FLAG };
+
+static void emit(Chunk *chunk, uint8_t byte) { chunk_write(chunk, byte, 1); }
+
+static void emit_op(Chunk *chunk, uint8_t op, uint8_t operand) {
+  emit(chunk, op);
+  emit(chunk, operand);
+}
+
+static size_t build_chunk(Chunk *chunk) {
+  size_t executed = 0;
+
+  // let i = 1, j = 2, k = 3, l = 4, result = 0, flag = false
+  for (int slot = SLOT_I; slot <= SLOT_FLAG; slot++) {
+    size_t constant = chunk_add_constant(chunk, constant_int(slot + 1));
+    emit_op(chunk, OP_PUSH_CONST, (uint8_t)constant);
+    emit_op(chunk, OP_STORE_VAR, (uint8_t)slot);
+    emit(chunk, OP_POP);
+    executed += 3;
+  }
+
+  for (int n = 0; n < BODY_REPEAT; n++) {
+    // result = i + j * k - l
+    emit_op(chunk, OP_LOAD_VAR, SLOT_I);
+    emit_op(chunk, OP_LOAD_VAR, SLOT_J);
+    emit_op(chunk, OP_LOAD_VAR, SLOT_K);
+    emit(chunk, OP_MUL);
+    emit(chunk, OP_ADD);
+    emit_op(chunk, OP_LOAD_VAR, SLOT_L);
+    emit(chunk, OP_SUB);
+    emit_op(chunk, OP_STORE_VAR, SLOT_RESULT);
+    emit(chunk, OP_POP);
+
+    // flag = !(result < l)
+    emit_op(chunk, OP_LOAD_VAR, SLOT_RESULT);
+    emit_op(chunk, OP_LOAD_VAR, SLOT_L);
+    emit(chunk, OP_LESS);
+    emit(chunk, OP_NOT);
+    emit_op(chunk, OP_STORE_VAR, SLOT_FLAG);
+    emit(chunk, OP_POP);
+    executed += 15;
+  }
+
+  emit(chunk, OP_HALT);
+  return executed + 1;
+}
+
+int main(int argc, char *argv[]) {
+  int runs = argc > 1 ? atoi(argv[1]) : DEFAULT_RUNS;
+  if (runs <= 0) {
+    runs = DEFAULT_RUNS;
+  }
+
+  Chunk chunk;
+  chunk_init(&chunk);
+  size_t per_run = build_chunk(&chunk);
+
+  VM vm;
+  clock_t start = clock();
+  for (int run = 0; run < runs; run++) {
+    vm_init(&vm);
+    if (!vm_execute(&vm, &chunk)) {
+      vm_print_error(&vm);
+      return 70;
+    }
+    vm_free(&vm);
+  }
+  clock_t end = clock();
+
+  double seconds = (double)(end - start) / CLOCKS_PER_SEC;
+  double total = (double)per_run * runs;
+#ifdef RIAU_NO_QUICKEN
+  const char *quickening = "off";
+#else
+  const char *quickening = "on";
+#endif
+  printf("dispatch: %-14s quickening: %-3s instructions: %.0f  time: %.3fs  "
+         "ns/instr: %.2f\n",
+         vm_dispatch_mode(), quickening, total, seconds, seconds * 1e9 / total);
+
+  chunk_free(&chunk);
+  return 0;
+}
@@ -0,0 +1,20 @@
+#!/bin/bash
+# Compare the VM's instruction dispatch modes (computed goto vs switch),
+# with and without adaptive quickening
+# Usage: tools/dispatch_bench.sh [runs]
+
+set -e
+
+CFLAGS="-Wall -Wextra -std=c11 -O2 -Iengine $RIAU_CFLAGS"
+mkdir -p build
+
+gcc $CFLAGS -o build/dispatch_bench_goto \
+  tools/dispatch_bench.c engine/bytecode/bytecode.c engine/vm/vm.c engine/vm/jit.c engine/vm/riau_string.c engine/vm/key_index.c engine/vm/shape.c engine/vm/gc.c engine/vm/guard.c engine/runtime/arena.c -lm
+gcc $CFLAGS -DRIAU_NO_COMPUTED_GOTO -o build/dispatch_bench_switch \
+  tools/dispatch_bench.c engine/bytecode/bytecode.c engine/vm/vm.c engine/vm/jit.c engine/vm/riau_string.c engine/vm/key_index.c engine/vm/shape.c engine/vm/gc.c engine/vm/guard.c engine/runtime/arena.c -lm
+gcc $CFLAGS -DRIAU_NO_QUICKEN -o build/dispatch_bench_generic \
+  tools/dispatch_bench.c engine/bytecode/bytecode.c engine/vm/vm.c engine/vm/jit.c engine/vm/riau_string.c engine/vm/key_index.c engine/vm/shape.c engine/vm/gc.c engine/vm/guard.c engine/runtime/arena.c -lm
+
+./build/dispatch_bench_switch "$@"
+./build/dispatch_bench_goto "$@"
+./build/dispatch_bench_generic "$@"
@@ -0,0 +1,54 @@
+#!/bin/bash
+# Validate the JIT: build with -DRIAU_JIT, run the test suite, then run
+# every script on both tiers. A script's output (and exit status) with
+# --no-jit has to match its output with --jit-eager.
+# Usage: tools/jit_check.sh [file.riau...]
+
+set -e
+
+export RIAU_CFLAGS="-DRIAU_JIT $RIAU_CFLAGS"
+CFLAGS="-Wall -Wextra -std=c11 -O2 -Iengine $RIAU_CFLAGS"
+mkdir -p build
+
+gcc $CFLAGS -o build/riau_jit engine/cli/main.c \
+  engine/lexer/lexer.c engine/ast/ast.c engine/parser/parser.c \
+  engine/semantic/semantic.c engine/optimizer/optimizer.c \
+  engine/bytecode/bytecode.c \
+  engine/bytecode/compiler.c engine/bytecode/peephole.c \
+  engine/bytecode/regcode.c \
+  engine/bytecode/reg_compiler.c engine/bytecode/chunk_cache.c \
+  engine/stdlib/stdlib.c engine/vm/vm.c \
+  engine/vm/jit.c engine/vm/aot.c engine/vm/reg_vm.c engine/vm/riau_string.c \
+  engine/vm/snapshot.c \
+  engine/vm/key_index.c engine/vm/shape.c engine/vm/gc.c engine/vm/guard.c \
+  engine/runtime/arena.c -lm
+
+bash test.sh
+
+if [ $# -eq 0 ]; then
+  set -- examples/*.riau www/*.riau tools/*.riau
+fi
+
+# stdin is closed so scripts reading input see none on either tier
+run() {
+  ./build/riau_jit "$@" </dev/null 2>&1 && echo "exit 0" || echo "exit $?"
+}
+
+failed=0
+for script in "$@"; do
+  interpreted=$(run --no-jit "$script")
+  compiled=$(run --jit-eager "$script")
+  if [ "$interpreted" != "$compiled" ]; then
+    echo "MISMATCH: $script"
+    diff <(echo "$interpreted") <(echo "$compiled") | head -20 || true
+    failed=1
+  fi
+done
+
+echo ""
+if [ $failed -eq 0 ]; then
+  echo "JIT check: $# scripts match on both tiers"
+else
+  echo "JIT check: mismatches found"
+fi
+exit $failed
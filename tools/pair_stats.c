@@ -0,0 +1,148 @@
+// Opcode pair statistics for the Riau compiler
+//
+// Compiles each script given on the command line (without
+// superinstructions) and counts how often each opcode follows another in
+// the emitted code. The most frequent pairs and triples are the candidates
+// for superinstructions, see tools/pair_stats.sh.
+#include "../engine/bytecode/bytecode.h"
+#include "../engine/bytecode/compiler.h"
+#include "../engine/lexer/lexer.h"
+#include "../engine/parser/parser.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define TOP_COUNT 15
+
+typedef struct {
+  uint8_t ops[3];
+  long count;
+} Sequence;
+
+static long pairs[256][256];
+static Sequence *triples = NULL;
+static size_t triple_count = 0;
+static size_t triple_capacity = 0;
+static long instruction_total = 0;
+
+static char *read_file(const char *path) {
+  FILE *file = fopen(path, "rb");
+  if (!file) {
+    return NULL;
+  }
+
+  fseek(file, 0L, SEEK_END);
+  size_t size = (size_t)ftell(file);
+  rewind(file);
+
+  char *buffer = malloc(size + 1);
+  size_t read = fread(buffer, 1, size, file);
+  buffer[read] = '\0';
+  fclose(file);
+  return buffer;
+}
+
+static void count_triple(uint8_t a, uint8_t b, uint8_t c) {
+  for (size_t i = 0; i < triple_count; i++) {
+    Sequence *seq = &triples[i];
+    if (seq->ops[0] == a && seq->ops[1] == b && seq->ops[2] == c) {
+      seq->count++;
+      return;
+    }
+  }
+
+  if (triple_capacity < triple_count + 1) {
+    triple_capacity = triple_capacity < 64 ? 64 : triple_capacity * 2;
+    triples = realloc(triples, triple_capacity * sizeof(Sequence));
+  }
+  triples[triple_count++] = (Sequence){{a, b, c}, 1};
+}
+
+static void count_chunk(Chunk *chunk) {
+  int previous[2] = {-1, -1};
+  for (size_t offset = 0; offset < chunk->count;) {
+    uint8_t op = chunk->code[offset];
+    instruction_total++;
+    if (previous[1] >= 0) {
+      pairs[previous[1]][op]++;
+      if (previous[0] >= 0) {
+        count_triple((uint8_t)previous[0], (uint8_t)previous[1], op);
+      }
+    }
+    previous[0] = previous[1];
+    previous[1] = op;
+    offset += opcode_length(op);
+  }
+}
+
+static int compare_sequences(const void *a, const void *b) {
+  long diff = ((const Sequence *)b)->count - ((const Sequence *)a)->count;
+  return diff > 0 ? 1 : diff < 0 ? -1 : 0;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    fprintf(stderr, "Usage: pair_stats <file.riau>...\n");
+    return 64;
+  }
+
+  int scripts = 0;
+  for (int i = 1; i < argc; i++) {
+    char *source = read_file(argv[i]);
+    if (!source) {
+      fprintf(stderr, "Could not open file \"%s\"\n", argv[i]);
+      continue;
+    }
+
+    Lexer lexer;
+    lexer_init(&lexer, source);
+    Parser parser;
+    parser_init(&parser, &lexer);
+    ASTNode *ast = parser_parse(&parser);
+
+    // Scripts with unsupported statements still contribute the code that
+    // compiled
+    if (!parser_had_error(&parser)) {
+      Chunk chunk;
+      chunk_init(&chunk);
+      Compiler compiler;
+      compiler_init(&compiler, &chunk);
+      compiler.superinstructions = false;
+      compiler_compile(&compiler, ast);
+      count_chunk(&chunk);
+      chunk_free(&chunk);
+      scripts++;
+    }
+
+    ast_free(ast);
+    free(source);
+  }
+
+  Sequence *sorted = malloc(256 * 256 * sizeof(Sequence));
+  size_t sorted_count = 0;
+  for (int a = 0; a < 256; a++) {
+    for (int b = 0; b < 256; b++) {
+      if (pairs[a][b] > 0) {
+        sorted[sorted_count++] = (Sequence){{(uint8_t)a, (uint8_t)b, 0},
+                                            pairs[a][b]};
+      }
+    }
+  }
+  qsort(sorted, sorted_count, sizeof(Sequence), compare_sequences);
+  qsort(triples, triple_count, sizeof(Sequence), compare_sequences);
+
+  printf("%d scripts, %ld instructions\n\n", scripts, instruction_total);
+  printf("Top pairs:\n");
+  for (size_t i = 0; i < sorted_count && i < TOP_COUNT; i++) {
+    printf("%6ld  %s %s\n", sorted[i].count, opcode_name(sorted[i].ops[0]),
+           opcode_name(sorted[i].ops[1]));
+  }
+  printf("\nTop triples:\n");
+  for (size_t i = 0; i < triple_count && i < TOP_COUNT; i++) {
+    printf("%6ld  %s %s %s\n", triples[i].count, opcode_name(triples[i].ops[0]),
+           opcode_name(triples[i].ops[1]), opcode_name(triples[i].ops[2]));
+  }
+
+  free(sorted);
+  free(triples);
+  return 0;
+}
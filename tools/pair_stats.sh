@@ -0,0 +1,20 @@
+#!/bin/bash
+# Opcode pair/triple statistics over the example and www scripts
+# Usage: tools/pair_stats.sh [file.riau...]
+
+set -e
+
+CFLAGS="-Wall -Wextra -std=c11 -O2 -Iengine $RIAU_CFLAGS"
+mkdir -p build
+
+gcc $CFLAGS -o build/pair_stats tools/pair_stats.c \
+  engine/lexer/lexer.c engine/ast/ast.c engine/parser/parser.c \
+  engine/bytecode/bytecode.c engine/bytecode/compiler.c \
+  engine/bytecode/peephole.c engine/stdlib/stdlib.c \
+  engine/vm/vm.c engine/vm/jit.c engine/vm/riau_string.c \
+  engine/vm/key_index.c engine/vm/shape.c engine/vm/gc.c engine/vm/guard.c engine/runtime/arena.c -lm
+
+if [ $# -eq 0 ]; then
+  set -- examples/*.riau www/*.riau www/*/*.riau
+fi
+./build/pair_stats "$@"
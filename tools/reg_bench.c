@@ -0,0 +1,126 @@
+// Stack VM vs register VM benchmark
+//
+// Generates a script that repeats the inner loop body of
+// tools/benchmark.riau (`result = i + j * k - l` plus a comparison),
+// compiles it with both backends and runs each one many times. Reports the
+// instructions each backend executes per run and the average wall time,
+// see tools/reg_bench.sh.
+#include "../engine/bytecode/compiler.h"
+#include "../engine/bytecode/reg_compiler.h"
+#include "../engine/lexer/lexer.h"
+#include "../engine/parser/parser.h"
+#include "../engine/vm/reg_vm.h"
+#include "../engine/vm/vm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BODY_REPEAT 2000
+#define DEFAULT_RUNS 500
+
+static const char *prologue = "let i = 1\nlet j = 2\nlet k = 3\nlet l = 4\n"
+                              "let result = 0\nlet flag = false\n";
+static const char *body = "result = i + j * k - l\nflag = !(result < l)\n";
+
+static char *build_source(void) {
+  size_t size = strlen(prologue) + strlen(body) * BODY_REPEAT + 1;
+  char *source = malloc(size);
+  strcpy(source, prologue);
+  char *end = source + strlen(prologue);
+  for (int n = 0; n < BODY_REPEAT; n++) {
+    strcpy(end, body);
+    end += strlen(body);
+  }
+  return source;
+}
+
+// The generated script has no jumps, so every instruction runs once
+static size_t count_stack(Chunk *chunk) {
+  size_t count = 0;
+  for (size_t offset = 0; offset < chunk->count; count++) {
+    offset += opcode_length(chunk->code[offset]);
+  }
+  return count;
+}
+
+static size_t count_registers(RegChunk *chunk) {
+  size_t count = 0;
+  for (size_t offset = 0; offset < chunk->count; count++) {
+    offset += reg_opcode_length(REG_OP(chunk->code[offset]));
+  }
+  return count;
+}
+
+static void report(const char *name, size_t instructions, int runs,
+                   clock_t start, clock_t end) {
+  double seconds = (double)(end - start) / CLOCKS_PER_SEC;
+  printf("%-9s instructions/run: %6zu  time: %.3fs  us/run: %8.2f  "
+         "ns/instr: %.2f\n",
+         name, instructions, seconds, seconds * 1e6 / runs,
+         seconds * 1e9 / ((double)instructions * runs));
+}
+
+int main(int argc, char *argv[]) {
+  int runs = argc > 1 ? atoi(argv[1]) : DEFAULT_RUNS;
+  if (runs <= 0) {
+    runs = DEFAULT_RUNS;
+  }
+
+  char *source = build_source();
+  Lexer lexer;
+  lexer_init(&lexer, source);
+  Parser parser;
+  parser_init(&parser, &lexer);
+  ASTNode *ast = parser_parse(&parser);
+  if (parser_had_error(&parser)) {
+    parser_print_errors(&parser);
+    return 65;
+  }
+
+  Chunk chunk;
+  chunk_init(&chunk);
+  Compiler compiler;
+  compiler_init(&compiler, &chunk);
+  RegChunk reg_chunk;
+  reg_chunk_init(&reg_chunk);
+  RegCompiler reg_compiler;
+  reg_compiler_init(&reg_compiler, &reg_chunk);
+  if (!compiler_compile(&compiler, ast) ||
+      !reg_compiler_compile(&reg_compiler, ast)) {
+    fprintf(stderr, "Compilation failed\n");
+    return 65;
+  }
+
+  clock_t start = clock();
+  for (int run = 0; run < runs; run++) {
+    VM vm;
+    vm_init(&vm);
+    if (!vm_execute(&vm, &chunk)) {
+      vm_print_error(&vm);
+      return 70;
+    }
+    vm_free(&vm);
+  }
+  clock_t end = clock();
+  report("stack", count_stack(&chunk), runs, start, end);
+
+  start = clock();
+  for (int run = 0; run < runs; run++) {
+    RegVM vm;
+    reg_vm_init(&vm);
+    if (!reg_vm_execute(&vm, &reg_chunk)) {
+      reg_vm_print_error(&vm);
+      return 70;
+    }
+    reg_vm_free(&vm);
+  }
+  end = clock();
+  report("register", count_registers(&reg_chunk), runs, start, end);
+
+  reg_chunk_free(&reg_chunk);
+  chunk_free(&chunk);
+  ast_free(ast);
+  free(source);
+  return 0;
+}
@@ -0,0 +1,18 @@
+#!/bin/bash
+# Compare the stack VM with the register VM on the same script
+# Usage: tools/reg_bench.sh [runs]
+
+set -e
+
+CFLAGS="-Wall -Wextra -std=c11 -O2 -Iengine $RIAU_CFLAGS"
+mkdir -p build
+
+gcc $CFLAGS -o build/reg_bench tools/reg_bench.c \
+  engine/lexer/lexer.c engine/ast/ast.c engine/parser/parser.c \
+  engine/bytecode/bytecode.c engine/bytecode/compiler.c \
+  engine/bytecode/peephole.c engine/stdlib/stdlib.c \
+  engine/bytecode/regcode.c engine/bytecode/reg_compiler.c \
+  engine/vm/vm.c engine/vm/jit.c engine/vm/reg_vm.c engine/vm/riau_string.c \
+  engine/vm/key_index.c engine/vm/shape.c engine/vm/gc.c engine/vm/guard.c engine/runtime/arena.c -lm
+
+./build/reg_bench "$@"